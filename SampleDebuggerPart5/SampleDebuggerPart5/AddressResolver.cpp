@@ -0,0 +1,168 @@
+#include "AddressResolver.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Targets this far past the closest symbol are more likely to be in code that has no symbol at all
+const DWORD_PTR dwMaxDisplacement = 0x10000;
+
+const size_t WriteHex(char * const pBuffer, ULONGLONG ullValue)
+{
+    char pDigits[16] = { 0 };
+    size_t ulDigits = 0;
+    do
+    {
+        pDigits[ulDigits++] = "0123456789ABCDEF"[ullValue & 0xF];
+        ullValue >>= 4;
+    } while (ullValue != 0);
+
+    for (size_t i = 0; i < ulDigits; ++i)
+    {
+        pBuffer[i] = pDigits[ulDigits - i - 1];
+    }
+    return ulDigits;
+}
+
+}
+
+AddressResolver::AddressResolver(const Symbols * const pSymbols) : m_pSymbols{ pSymbols }, m_ulSymbolCount{ 0 },
+    m_ullHits{ 0 }, m_ullMisses{ 0 }
+{
+    m_cache.fill(CacheSlot{ 0, dwNoSymbol });
+}
+
+const size_t AddressResolver::Format(const DWORD_PTR dwAddress, char * const pBuffer, const size_t ulBufferSize)
+{
+    const DWORD dwIndex = Lookup(dwAddress);
+    if (dwIndex == dwNoSymbol)
+    {
+        return 0;
+    }
+
+    //Module, '!', name, "+0x" and up to 16 digits
+    const Entry &entry = m_vecEntries[dwIndex];
+    const size_t ulRequired = entry.usModuleLength + 1 + entry.usNameLength + 3 + 16;
+    if (ulRequired > ulBufferSize)
+    {
+        return 0;
+    }
+
+    size_t ulLength = 0;
+    memcpy(&pBuffer[ulLength], entry.pModule, entry.usModuleLength);
+    ulLength += entry.usModuleLength;
+    pBuffer[ulLength++] = '!';
+    memcpy(&pBuffer[ulLength], entry.pName, entry.usNameLength);
+    ulLength += entry.usNameLength;
+    if (dwAddress != entry.dwAddress)
+    {
+        memcpy(&pBuffer[ulLength], "+0x", 3);
+        ulLength += 3;
+        ulLength += WriteHex(&pBuffer[ulLength], (ULONGLONG)(dwAddress - entry.dwAddress));
+    }
+
+    return ulLength;
+}
+
+void AddressResolver::PrintStats() const
+{
+    const unsigned long long ullLookups = m_ullHits + m_ullMisses;
+    fprintf(stderr, "Address resolver: %Iu symbols, %I64u lookups, %.1f%% cache hits.\n",
+        m_vecEntries.size(), ullLookups, (ullLookups != 0) ? (100.0 * m_ullHits) / ullLookups : 0.0);
+}
+
+void AddressResolver::Rebuild()
+{
+    m_vecEntries.clear();
+    m_vecEntries.reserve(m_pSymbols->SymbolList().size());
+    for (auto &symbolInfo : m_pSymbols->SymbolList())
+    {
+        const ModuleSymbolInfo &moduleSymbol = symbolInfo.second;
+        const SymbolInfo &symbol = moduleSymbol.symbolInfo;
+        if (symbol.strName.empty() || moduleSymbol.strName.empty())
+        {
+            continue;
+        }
+
+        //Module paths are stored in full, so only keep the file name without its extension
+        const char * const pPath = moduleSymbol.strName.data();
+        const char *pModule = pPath;
+        const char *pModuleEnd = nullptr;
+        for (const char *pCurrent = pPath; *pCurrent != '\0'; ++pCurrent)
+        {
+            if (*pCurrent == '\\' || *pCurrent == '/')
+            {
+                pModule = pCurrent + 1;
+                pModuleEnd = nullptr;
+            }
+            else if (*pCurrent == '.')
+            {
+                pModuleEnd = pCurrent;
+            }
+        }
+        if (pModuleEnd == nullptr)
+        {
+            pModuleEnd = pModule + strlen(pModule);
+        }
+
+        Entry entry = { 0 };
+        entry.dwAddress = symbol.dwAddress;
+        entry.pModule = pModule;
+        entry.pName = symbol.strName.data();
+        entry.usModuleLength = (unsigned short)std::min<size_t>(pModuleEnd - pModule, 0xFF);
+        entry.usNameLength = (unsigned short)std::min<size_t>(strlen(entry.pName), 0x400);
+        m_vecEntries.push_back(entry);
+    }
+
+    std::sort(m_vecEntries.begin(), m_vecEntries.end(), [](const Entry &left, const Entry &right)
+    {
+        return left.dwAddress < right.dwAddress;
+    });
+
+    m_ulSymbolCount = m_pSymbols->SymbolList().size();
+    m_cache.fill(CacheSlot{ 0, dwNoSymbol });
+}
+
+const DWORD AddressResolver::Lookup(const DWORD_PTR dwAddress)
+{
+    //Symbols are only ever added, so a change in count is enough to notice newly loaded modules
+    if (m_pSymbols->SymbolList().size() != m_ulSymbolCount)
+    {
+        Rebuild();
+    }
+
+    CacheSlot &slot = m_cache[(size_t)(((ULONGLONG)dwAddress * 0x9E3779B97F4A7C15ULL) >> 52) & (ulCacheSlots - 1)];
+    if (slot.dwAddress == dwAddress)
+    {
+        ++m_ullHits;
+        return slot.dwIndex;
+    }
+    ++m_ullMisses;
+
+    auto iter = std::upper_bound(m_vecEntries.begin(), m_vecEntries.end(), dwAddress, [](const DWORD_PTR dwValue, const Entry &entry)
+    {
+        return dwValue < entry.dwAddress;
+    });
+
+    DWORD dwIndex = dwNoSymbol;
+    if (iter != m_vecEntries.begin())
+    {
+        --iter;
+        if (dwAddress - iter->dwAddress < dwMaxDisplacement)
+        {
+            dwIndex = (DWORD)(iter - m_vecEntries.begin());
+        }
+    }
+
+    slot.dwAddress = dwAddress;
+    slot.dwIndex = dwIndex;
+    return dwIndex;
+}
+
+}
\ No newline at end of file
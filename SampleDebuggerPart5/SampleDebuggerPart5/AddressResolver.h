@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Symbols.h"
+
+namespace CodeReversing
+{
+
+//Turns code addresses into "module!symbol+0x1A" text. Symbols are flattened into one sorted table that is rebuilt
+//whenever more modules have been loaded, and recent lookups are kept in a small direct-mapped cache since listings
+//keep branching to the same handful of targets.
+class AddressResolver final
+{
+public:
+    AddressResolver() = delete;
+    AddressResolver(const Symbols * const pSymbols);
+
+    AddressResolver(const AddressResolver &copy) = delete;
+    AddressResolver &operator=(const AddressResolver &copy) = delete;
+
+    ~AddressResolver() = default;
+
+    //Returns the number of characters written, or 0 when no symbol covers the address
+    const size_t Format(const DWORD_PTR dwAddress, char * const pBuffer, const size_t ulBufferSize);
+
+    void PrintStats() const;
+
+private:
+    struct Entry
+    {
+        DWORD_PTR dwAddress;
+        const char *pModule;
+        const char *pName;
+        unsigned short usModuleLength;
+        unsigned short usNameLength;
+    };
+
+    struct CacheSlot
+    {
+        DWORD_PTR dwAddress;
+        DWORD dwIndex;
+    };
+
+    static const size_t ulCacheSlots = 4096;
+    static const DWORD dwNoSymbol = 0xFFFFFFFF;
+
+    void Rebuild();
+    const DWORD Lookup(const DWORD_PTR dwAddress);
+
+    const Symbols *m_pSymbols;
+    size_t m_ulSymbolCount;
+    std::vector<Entry> m_vecEntries;
+    std::array<CacheSlot, ulCacheSlots> m_cache;
+
+    unsigned long long m_ullHits;
+    unsigned long long m_ullMisses;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,489 @@
+#include "ApiTracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const DWORD_PTR ReturnValue(const CONTEXT &ctx)
+{
+#ifdef _M_IX86
+    return ctx.Eax;
+#elif defined _M_AMD64
+    return ctx.Rax;
+#endif
+}
+
+}
+
+ApiTracer::ApiTracer(Debugger *pDebugger, Symbols *pSymbols) : m_pDebugger{ pDebugger }, m_pSymbols{ pSymbols },
+    m_bIsTracing{ false }, m_ulArguments{ 0 }, m_llLastRecord{ 0 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool ApiTracer::Start(const char * const pPattern, const char * const pPath, const size_t ulArguments)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bIsTracing)
+    {
+        fprintf(stderr, "An API trace is already running.\n");
+        return false;
+    }
+    if (ulArguments > ulMaxArguments)
+    {
+        fprintf(stderr, "At most %Iu arguments can be captured.\n", ulMaxArguments);
+        return false;
+    }
+
+    std::vector<ExportedFunction> vecExports;
+    if (!m_pSymbols->FindExports(pPattern, vecExports))
+    {
+        fprintf(stderr, "No code exports match %s.\n", pPattern);
+        return false;
+    }
+
+    m_vecFunctions.clear();
+    m_mapBytes.clear();
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto &exportEntry : vecExports)
+    {
+        //A user breakpoint there stops every caller anyway, and sharing its byte would confuse both
+        if (m_pDebugger->FindBreakpoint(exportEntry.dwAddress) != nullptr)
+        {
+            continue;
+        }
+        m_mapBytes[exportEntry.dwAddress] = { 0, false, m_vecFunctions.size(), 0 };
+        m_vecFunctions.push_back({ exportEntry.dwAddress, exportEntry.strName, 0, 0 });
+        mapBytes[exportEntry.dwAddress] = cBreakpointOpcode;
+    }
+
+    if (!m_writer.Open(pPath))
+    {
+        fprintf(stderr, "Could not open API trace file %s.\n", pPath);
+        return false;
+    }
+
+    Stopwatch clock;
+    std::vector<PatchByte> vecPrevious;
+    if (!m_pDebugger->ProcessPatches()->WriteBatch(mapBytes, &vecPrevious))
+    {
+        fprintf(stderr, "Could not place API breakpoints.\n");
+        (void)m_writer.Close();
+        m_mapBytes.clear();
+        return false;
+    }
+    m_stats.dArmMicroseconds += clock.ElapsedMicroseconds();
+
+    size_t ulArmed = 0;
+    for (auto &previous : vecPrevious)
+    {
+        //An int 3 that was already there belongs to another component and is left to it
+        TracedByte &byte = m_mapBytes[previous.dwAddress];
+        byte.cOriginal = previous.cOriginal;
+        byte.bIsArmed = (previous.cOriginal != cBreakpointOpcode);
+        ulArmed += byte.bIsArmed ? 1 : 0;
+    }
+
+    const char cMagic[] = { 'A', 'P', 'I', '1' };
+    (void)m_writer.Write(cMagic, sizeof(cMagic));
+    (void)m_writer.WriteValue<unsigned char>((unsigned char)sizeof(DWORD_PTR));
+    (void)m_writer.WriteValue<unsigned char>((unsigned char)ulArguments);
+    (void)m_writer.WriteVarint((ULONGLONG)Stopwatch::Frequency());
+    (void)m_writer.WriteVarint(m_vecFunctions.size());
+    for (auto &function : m_vecFunctions)
+    {
+        (void)m_writer.WriteVarint(function.dwAddress);
+        (void)m_writer.WriteVarint(function.strName.size());
+        (void)m_writer.Write(function.strName.data(), function.strName.size());
+    }
+
+    m_ulArguments = ulArguments;
+    m_llLastRecord = Stopwatch::Now();
+    m_bIsTracing = true;
+    fprintf(stderr, "Tracing %Iu exports matching %s, armed in %.2f ms.\n", ulArmed, pPattern,
+        clock.ElapsedMicroseconds() / 1000.0);
+
+    return true;
+}
+
+const bool ApiTracer::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_bIsTracing)
+    {
+        return false;
+    }
+
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto &byte : m_mapBytes)
+    {
+        if (byte.second.bIsArmed)
+        {
+            mapBytes[byte.first] = byte.second.cOriginal;
+        }
+    }
+    const bool bSuccess = mapBytes.empty() || m_pDebugger->ProcessPatches()->WriteBatch(mapBytes);
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not remove API breakpoints.\n");
+    }
+    m_mapBytes.clear();
+
+    //Threads stepping over a byte keep their entry so that the step is still claimed
+    for (auto &thread : m_mapThreads)
+    {
+        thread.second.vecFrames.clear();
+    }
+
+    m_bIsTracing = false;
+    (void)m_writer.Close();
+    fprintf(stderr, "API trace stopped after %I64u calls, %I64u returns, %I64u abandoned frames; %I64u bytes written.\n",
+        m_stats.ullCalls, m_stats.ullReturns, m_stats.ullAbandoned, m_writer.FileBytesWritten());
+
+    return bSuccess;
+}
+
+const bool ApiTracer::IsTracing() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bIsTracing;
+}
+
+const bool ApiTracer::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto byte = m_mapBytes.find(dwAddress);
+    if (!m_bIsTracing || byte == m_mapBytes.end() || !byte->second.bIsArmed)
+    {
+        return false;
+    }
+
+    ThreadState &thread = Thread(dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (!BOOLIFY(GetThreadContext(thread.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        ++m_stats.ullErrors;
+        return false;
+    }
+
+    const LONGLONG llNow = Stopwatch::Now();
+    const size_t ulEntry = byte->second.ulEntry;
+    if (byte->second.ulReturnReferences != 0)
+    {
+        OnReturn(dbgEvent.dwThreadId, thread, dwAddress, ctx, llNow);
+    }
+    if (ulEntry != ulNoEntry)
+    {
+        OnEntry(dbgEvent.dwThreadId, thread, ulEntry, ctx, llNow);
+    }
+
+    //Releasing the last return may already have taken the byte out; otherwise step over it and put it back
+    SetInstructionPointer(ctx, dwAddress);
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    byte = m_mapBytes.find(dwAddress);
+    if (byte != m_mapBytes.end() && IsNeeded(byte->second) && WriteByte(dwAddress, byte->second.cOriginal))
+    {
+        byte->second.bIsArmed = false;
+        thread.dwPendingRearm = dwAddress;
+        ctx.EFlags |= 0x100;
+    }
+    if (!BOOLIFY(SetThreadContext(thread.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        ++m_stats.ullErrors;
+    }
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+
+    return true;
+}
+
+const bool ApiTracer::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto thread = m_mapThreads.find(dbgEvent.dwThreadId);
+    if (thread == m_mapThreads.end() || thread->second.dwPendingRearm == 0)
+    {
+        return false;
+    }
+
+    const DWORD_PTR dwAddress = thread->second.dwPendingRearm;
+    thread->second.dwPendingRearm = 0;
+    auto byte = m_mapBytes.find(dwAddress);
+    if (byte != m_mapBytes.end() && !byte->second.bIsArmed && IsNeeded(byte->second) &&
+        WriteByte(dwAddress, cBreakpointOpcode))
+    {
+        byte->second.bIsArmed = true;
+    }
+
+    return true;
+}
+
+void ApiTracer::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto thread = m_mapThreads.find(dwThreadId);
+    if (thread == m_mapThreads.end())
+    {
+        return;
+    }
+
+    const DWORD_PTR dwPendingRearm = thread->second.dwPendingRearm;
+    auto byte = m_mapBytes.find(dwPendingRearm);
+    if (dwPendingRearm != 0 && byte != m_mapBytes.end() && !byte->second.bIsArmed && IsNeeded(byte->second) &&
+        WriteByte(dwPendingRearm, cBreakpointOpcode))
+    {
+        byte->second.bIsArmed = true;
+    }
+
+    //Calls still open when the thread exits never return
+    const LONGLONG llNow = Stopwatch::Now();
+    for (auto frame = thread->second.vecFrames.rbegin(); frame != thread->second.vecFrames.rend(); ++frame)
+    {
+        if (m_bIsTracing)
+        {
+            WriteRecordHeader(eRecord::eAbandoned, frame->ulApi, dwThreadId, llNow);
+            ++m_stats.ullAbandoned;
+        }
+        ReleaseReturn(frame->dwReturnAddress);
+    }
+    m_mapThreads.erase(thread);
+}
+
+void ApiTracer::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &byte : m_mapBytes)
+    {
+        if (byte.second.bIsArmed && byte.first >= dwAddress && byte.first - dwAddress < ulSize)
+        {
+            pBytes[byte.first - dwAddress] = byte.second.cOriginal;
+        }
+    }
+}
+
+void ApiTracer::PrintTop(const size_t ulMaxEntries) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<const ApiFunction *> vecSorted;
+    vecSorted.reserve(m_vecFunctions.size());
+    for (auto &function : m_vecFunctions)
+    {
+        if (function.ullCalls != 0)
+        {
+            vecSorted.push_back(&function);
+        }
+    }
+    std::sort(vecSorted.begin(), vecSorted.end(), [](const ApiFunction *pLeft, const ApiFunction *pRight)
+    {
+        return pLeft->ullCalls > pRight->ullCalls;
+    });
+
+    fprintf(stderr, "%12s %14s  %s\n", "Calls", "Avg us", "Function");
+    for (size_t i = 0; i < vecSorted.size() && i < ulMaxEntries; ++i)
+    {
+        const ApiFunction * const pFunction = vecSorted[i];
+        fprintf(stderr, "%12I64u %14.2f  %s\n", pFunction->ullCalls,
+            TicksToMicroseconds(pFunction->ullTicks) / (double)pFunction->ullCalls, pFunction->strName.c_str());
+    }
+}
+
+void ApiTracer::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const unsigned long long ullEvents = m_stats.ullCalls + m_stats.ullReturns;
+    fprintf(stderr, "API tracer: %s, %Iu functions, %I64u calls, %I64u returns, %I64u abandoned, %I64u stray returns, "
+        "%I64u errors.\n%.2f ms arming, %.2f us per hit in the handler, %I64u bytes written.\n",
+        m_bIsTracing ? "tracing" : "stopped", m_vecFunctions.size(), m_stats.ullCalls, m_stats.ullReturns,
+        m_stats.ullAbandoned, m_stats.ullStrayReturns, m_stats.ullErrors, m_stats.dArmMicroseconds / 1000.0,
+        m_stats.dHandlerMicroseconds / (double)((ullEvents != 0) ? ullEvents : 1), m_writer.BytesWritten());
+}
+
+ApiTracer::ThreadState &ApiTracer::Thread(const DWORD dwThreadId)
+{
+    auto threadState = m_mapThreads.find(dwThreadId);
+    if (threadState != m_mapThreads.end())
+    {
+        return threadState->second;
+    }
+
+    ThreadState &thread = m_mapThreads[dwThreadId];
+    thread.hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dwThreadId);
+    thread.dwPendingRearm = 0;
+    thread.vecFrames.reserve(64);
+
+    return thread;
+}
+
+void ApiTracer::OnEntry(const DWORD dwThreadId, ThreadState &thread, const size_t ulApi, const CONTEXT &ctx,
+    const LONGLONG llNow)
+{
+    //One read covers the return address and every stack slot that holds a captured argument
+    const DWORD_PTR dwStack = StackPointer(ctx);
+    DWORD_PTR pSlots[1 + 4 + ulMaxArguments] = { 0 };
+    DWORD_PTR pArguments[ulMaxArguments] = { 0 };
+#ifdef _M_IX86
+    const size_t ulSlots = 1 + m_ulArguments;
+#elif defined _M_AMD64
+    const size_t ulSlots = 1 + 4 + ((m_ulArguments > 4) ? m_ulArguments - 4 : 0);
+#endif
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwStack, pSlots, ulSlots * sizeof(DWORD_PTR),
+        &ulBytesRead)))
+    {
+        ++m_stats.ullErrors;
+        return;
+    }
+
+#ifdef _M_IX86
+    for (size_t i = 0; i < m_ulArguments; ++i)
+    {
+        pArguments[i] = pSlots[1 + i];
+    }
+#elif defined _M_AMD64
+    const DWORD_PTR pRegisters[4] = { ctx.Rcx, ctx.Rdx, ctx.R8, ctx.R9 };
+    for (size_t i = 0; i < m_ulArguments; ++i)
+    {
+        //The four home slots above the return address are left for the callee; the fifth argument comes after them
+        pArguments[i] = (i < 4) ? pRegisters[i] : pSlots[1 + i];
+    }
+#endif
+
+    WriteRecordHeader(eRecord::eCall, ulApi, dwThreadId, llNow);
+    for (size_t i = 0; i < m_ulArguments; ++i)
+    {
+        (void)m_writer.WriteVarint(pArguments[i]);
+    }
+    ++m_vecFunctions[ulApi].ullCalls;
+    ++m_stats.ullCalls;
+
+    thread.vecFrames.push_back({ ulApi, pSlots[0], dwStack, llNow });
+    AddReturn(pSlots[0]);
+}
+
+void ApiTracer::OnReturn(const DWORD dwThreadId, ThreadState &thread, const DWORD_PTR dwAddress, const CONTEXT &ctx,
+    const LONGLONG llNow)
+{
+    //Every frame entered below the current stack pointer is finished; the outermost of them is the one returning here
+    const DWORD_PTR dwStack = StackPointer(ctx);
+    auto &vecFrames = thread.vecFrames;
+    size_t ulFirst = vecFrames.size();
+    while (ulFirst > 0 && vecFrames[ulFirst - 1].dwStack < dwStack)
+    {
+        --ulFirst;
+    }
+    if (ulFirst == vecFrames.size())
+    {
+        ++m_stats.ullStrayReturns;
+        return;
+    }
+
+    for (size_t i = vecFrames.size(); i-- > ulFirst;)
+    {
+        const ShadowFrame &frame = vecFrames[i];
+        if (i == ulFirst && frame.dwReturnAddress == dwAddress)
+        {
+            const ULONGLONG ullDuration = (ULONGLONG)(llNow - frame.llEntry);
+            WriteRecordHeader(eRecord::eReturn, frame.ulApi, dwThreadId, llNow);
+            (void)m_writer.WriteVarint(ullDuration);
+            (void)m_writer.WriteVarint(ReturnValue(ctx));
+            m_vecFunctions[frame.ulApi].ullTicks += ullDuration;
+            ++m_stats.ullReturns;
+        }
+        else
+        {
+            WriteRecordHeader(eRecord::eAbandoned, frame.ulApi, dwThreadId, llNow);
+            ++m_stats.ullAbandoned;
+        }
+        ReleaseReturn(frame.dwReturnAddress);
+    }
+    vecFrames.resize(ulFirst);
+}
+
+void ApiTracer::AddReturn(const DWORD_PTR dwAddress)
+{
+    auto byte = m_mapBytes.find(dwAddress);
+    if (byte != m_mapBytes.end())
+    {
+        ++byte->second.ulReturnReferences;
+        return;
+    }
+
+    //A user breakpoint or another component's int 3 already there is left alone and the frame is abandoned later
+    TracedByte returnByte = { cBreakpointOpcode, false, ulNoEntry, 1 };
+    SIZE_T ulBytesRead = 0;
+    if (m_pDebugger->FindBreakpoint(dwAddress) == nullptr &&
+        BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwAddress, &returnByte.cOriginal, sizeof(unsigned char),
+        &ulBytesRead)) && returnByte.cOriginal != cBreakpointOpcode)
+    {
+        returnByte.bIsArmed = WriteByte(dwAddress, cBreakpointOpcode);
+    }
+    m_mapBytes[dwAddress] = returnByte;
+}
+
+void ApiTracer::ReleaseReturn(const DWORD_PTR dwAddress)
+{
+    auto byte = m_mapBytes.find(dwAddress);
+    if (byte == m_mapBytes.end())
+    {
+        return;
+    }
+
+    if (byte->second.ulReturnReferences != 0)
+    {
+        --byte->second.ulReturnReferences;
+    }
+    if (!IsNeeded(byte->second))
+    {
+        if (byte->second.bIsArmed)
+        {
+            (void)WriteByte(dwAddress, byte->second.cOriginal);
+        }
+        m_mapBytes.erase(byte);
+    }
+}
+
+const bool ApiTracer::IsNeeded(const TracedByte &byte) const
+{
+    //Bytes that were already an int 3 are never written, so there is nothing to step over or put back
+    return byte.cOriginal != cBreakpointOpcode && (byte.ulEntry != ulNoEntry || byte.ulReturnReferences != 0);
+}
+
+const bool ApiTracer::WriteByte(const DWORD_PTR dwAddress, const unsigned char cByte) const
+{
+    SIZE_T ulBytesWritten = 0;
+    if (!BOOLIFY(WriteProcessMemory(m_pDebugger->Handle(), (LPVOID)dwAddress, &cByte, sizeof(unsigned char),
+        &ulBytesWritten)))
+    {
+        fprintf(stderr, "Could not write API breakpoint byte at %p. Error = %X\n", dwAddress, GetLastError());
+        return false;
+    }
+    (void)FlushInstructionCache(m_pDebugger->Handle(), (LPCVOID)dwAddress, sizeof(unsigned char));
+
+    return true;
+}
+
+void ApiTracer::WriteRecordHeader(const eRecord type, const size_t ulApi, const DWORD dwThreadId, const LONGLONG llNow)
+{
+    (void)m_writer.WriteValue<unsigned char>((unsigned char)type);
+    (void)m_writer.WriteVarint(ulApi);
+    (void)m_writer.WriteVarint(dwThreadId);
+    (void)m_writer.WriteVarint((ULONGLONG)(llNow - m_llLastRecord));
+    m_llLastRecord = llNow;
+}
+
+}
\ No newline at end of file
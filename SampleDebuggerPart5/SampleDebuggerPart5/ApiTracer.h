@@ -0,0 +1,132 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "BinaryWriter.h"
+#include "SafeHandle.h"
+#include "Symbols.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Traces every call into the exports that match a pattern such as "ws2_32!*". All entries are armed in one batched
+//write. A hit records the first arguments, from registers and then stack slots, pushes a shadow frame and plants a
+//shared int 3 on the return address, whose hit records the return value and duration. The thread is always resumed.
+//The file starts with "API1", the pointer size, the argument count, the counter frequency and the name table
+//[count]([address][name length][name])..., followed by records of [type][api][tid][ticks since the last record]
+//and then the arguments for a call, the duration and return value for a return, or nothing for an abandoned frame.
+class ApiTracer final
+{
+public:
+    enum class eRecord : unsigned char
+    {
+        eCall = 0,
+        eReturn = 1,
+        eAbandoned = 2
+    };
+
+    ApiTracer() = delete;
+    ApiTracer(Debugger *pDebugger, Symbols *pSymbols);
+
+    ApiTracer(const ApiTracer &copy) = delete;
+    ApiTracer &operator=(const ApiTracer &copy) = delete;
+
+    ~ApiTracer() = default;
+
+    const bool Start(const char * const pPattern, const char * const pPath, const size_t ulArguments);
+    const bool Stop();
+    const bool IsTracing() const;
+
+    //Called from the exception handler; false means the event belongs to someone else
+    const bool HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+    void PrintTop(const size_t ulMaxEntries) const;
+    void PrintStats() const;
+
+    static const size_t ulMaxArguments = 8;
+
+private:
+    static const size_t ulNoEntry = (size_t)-1;
+
+    struct ApiFunction
+    {
+        DWORD_PTR dwAddress;
+        std::string strName;
+        ULONGLONG ullCalls;
+        ULONGLONG ullTicks;
+    };
+
+    //One int 3 serves an entry, any number of pending returns, or both when a return lands on a traced entry
+    struct TracedByte
+    {
+        unsigned char cOriginal;
+        bool bIsArmed;
+        size_t ulEntry;
+        size_t ulReturnReferences;
+    };
+
+    struct ShadowFrame
+    {
+        size_t ulApi;
+        DWORD_PTR dwReturnAddress;
+        DWORD_PTR dwStack;
+        LONGLONG llEntry;
+    };
+
+    struct ThreadState
+    {
+        SafeHandle hThread;
+        std::vector<ShadowFrame> vecFrames;
+        DWORD_PTR dwPendingRearm;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullCalls;
+        unsigned long long ullReturns;
+        unsigned long long ullAbandoned;
+        unsigned long long ullStrayReturns;
+        unsigned long long ullErrors;
+        double dArmMicroseconds;
+        double dHandlerMicroseconds;
+    };
+
+    ThreadState &Thread(const DWORD dwThreadId);
+    void OnEntry(const DWORD dwThreadId, ThreadState &thread, const size_t ulApi, const CONTEXT &ctx, const LONGLONG llNow);
+    void OnReturn(const DWORD dwThreadId, ThreadState &thread, const DWORD_PTR dwAddress, const CONTEXT &ctx,
+        const LONGLONG llNow);
+    void AddReturn(const DWORD_PTR dwAddress);
+    void ReleaseReturn(const DWORD_PTR dwAddress);
+    const bool IsNeeded(const TracedByte &byte) const;
+    const bool WriteByte(const DWORD_PTR dwAddress, const unsigned char cByte) const;
+    void WriteRecordHeader(const eRecord type, const size_t ulApi, const DWORD dwThreadId, const LONGLONG llNow);
+
+    Debugger * const m_pDebugger;
+    Symbols * const m_pSymbols;
+
+    //Guards everything below; hits arrive on the debugger thread while the console starts, stops and prints
+    mutable std::mutex m_mutex;
+    bool m_bIsTracing;
+    size_t m_ulArguments;
+    std::vector<ApiFunction> m_vecFunctions;
+    std::unordered_map<DWORD_PTR, TracedByte> m_mapBytes;
+    std::map<DWORD, ThreadState> m_mapThreads;
+
+    BinaryWriter m_writer;
+    LONGLONG m_llLastRecord;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,303 @@
+#pragma comment(lib, "Cabinet.lib")
+
+#include "BinaryWriter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Common.h"
+#include "SafeHandle.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const DWORD dwCompressedMagic = 0x50585742; //"BWXP"
+
+}
+
+BinaryWriter::BinaryWriter(const size_t ulBufferSize /*= 1024 * 1024*/) : m_hFile{ INVALID_HANDLE_VALUE },
+    m_pBuffer{ new unsigned char[ulBufferSize] }, m_ulBufferSize{ ulBufferSize }, m_ulBufferUsed{ 0 },
+    m_ullBytesWritten{ 0 }, m_ullFileBytesWritten{ 0 }, m_bIsOpen{ false }, m_hCompressor{ nullptr }
+{
+}
+
+BinaryWriter::~BinaryWriter()
+{
+    (void)Close();
+}
+
+const bool BinaryWriter::Open(const char * const pPath, const bool bCompress /*= false*/)
+{
+    (void)Close();
+
+    m_hFile = CreateFileA(pPath, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not create file %s. Error = %X\n", pPath, GetLastError());
+        return false;
+    }
+
+    m_ulBufferUsed = 0;
+    m_ullBytesWritten = 0;
+    m_ullFileBytesWritten = 0;
+    m_bIsOpen = true;
+
+    if (bCompress)
+    {
+        if (!BOOLIFY(CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &m_hCompressor)))
+        {
+            fprintf(stderr, "Could not create compressor. Error = %X\n", GetLastError());
+            m_hCompressor = nullptr;
+            (void)Close();
+            return false;
+        }
+        if (!m_pCompressed)
+        {
+            m_pCompressed = std::unique_ptr<unsigned char[]>(new unsigned char[m_ulBufferSize]);
+        }
+        if (!WriteFileBytes(&dwCompressedMagic, sizeof(DWORD)))
+        {
+            (void)Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const bool BinaryWriter::Close()
+{
+    if (!m_bIsOpen)
+    {
+        return true;
+    }
+
+    const bool bSuccess = Flush();
+    if (m_hCompressor != nullptr)
+    {
+        (void)CloseCompressor(m_hCompressor);
+        m_hCompressor = nullptr;
+    }
+    (void)CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_bIsOpen = false;
+
+    return bSuccess;
+}
+
+const bool BinaryWriter::IsOpen() const
+{
+    return m_bIsOpen;
+}
+
+const bool BinaryWriter::Flush()
+{
+    if (m_ulBufferUsed == 0)
+    {
+        return true;
+    }
+
+    if (!WriteBlock(m_pBuffer.get(), m_ulBufferUsed))
+    {
+        return false;
+    }
+
+    m_ulBufferUsed = 0;
+    return true;
+}
+
+const bool BinaryWriter::WriteFileBytes(const void * const pData, const DWORD dwSize)
+{
+    DWORD dwBytesWritten = 0;
+    if (!BOOLIFY(WriteFile(m_hFile, pData, dwSize, &dwBytesWritten, nullptr)) || dwBytesWritten != dwSize)
+    {
+        fprintf(stderr, "Could not write to file. Error = %X\n", GetLastError());
+        return false;
+    }
+
+    m_ullFileBytesWritten += dwSize;
+    return true;
+}
+
+const bool BinaryWriter::WriteBlock(const unsigned char *pData, size_t ulSize)
+{
+    if (m_hCompressor == nullptr)
+    {
+        while (ulSize > 0)
+        {
+            const DWORD dwChunk = (DWORD)((ulSize > 0x40000000) ? 0x40000000 : ulSize);
+            if (!WriteFileBytes(pData, dwChunk))
+            {
+                return false;
+            }
+            pData += dwChunk;
+            ulSize -= dwChunk;
+        }
+        return true;
+    }
+
+    //Compressed blocks never exceed the buffer size so that Expand can work with a fixed buffer
+    while (ulSize > 0)
+    {
+        const size_t ulChunk = (ulSize < m_ulBufferSize) ? ulSize : m_ulBufferSize;
+        SIZE_T ulCompressedSize = 0;
+        const bool bCompressed = BOOLIFY(Compress(m_hCompressor, pData, ulChunk, m_pCompressed.get(), m_ulBufferSize,
+            &ulCompressedSize)) && (ulCompressedSize < ulChunk);
+
+        //Blocks that do not shrink are stored as is and marked with a compressed size of zero
+        const DWORD dwSizes[2] = { (DWORD)ulChunk, bCompressed ? (DWORD)ulCompressedSize : 0 };
+        if (!WriteFileBytes(dwSizes, sizeof(dwSizes)) ||
+            !WriteFileBytes(bCompressed ? m_pCompressed.get() : pData, bCompressed ? (DWORD)ulCompressedSize : (DWORD)ulChunk))
+        {
+            return false;
+        }
+        pData += ulChunk;
+        ulSize -= ulChunk;
+    }
+
+    return true;
+}
+
+const bool BinaryWriter::Write(const void * const pData, const size_t ulSize)
+{
+    if (!m_bIsOpen)
+    {
+        return false;
+    }
+
+    const unsigned char *pBytes = (const unsigned char *)pData;
+    size_t ulRemaining = ulSize;
+    m_ullBytesWritten += ulSize;
+
+    //Writes at least as large as the buffer skip the copy and go straight to the file
+    if (ulRemaining >= m_ulBufferSize)
+    {
+        return Flush() && WriteBlock(pBytes, ulRemaining);
+    }
+
+    while (ulRemaining > 0)
+    {
+        const size_t ulCopy = (ulRemaining < m_ulBufferSize - m_ulBufferUsed) ? ulRemaining : m_ulBufferSize - m_ulBufferUsed;
+        memcpy(&m_pBuffer[m_ulBufferUsed], pBytes, ulCopy);
+        m_ulBufferUsed += ulCopy;
+        pBytes += ulCopy;
+        ulRemaining -= ulCopy;
+        if (m_ulBufferUsed == m_ulBufferSize && !Flush())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const size_t BinaryWriter::EncodeVarint(ULONGLONG ullValue, unsigned char * const pBuffer)
+{
+    size_t ulLength = 0;
+    while (ullValue >= 0x80)
+    {
+        pBuffer[ulLength++] = (unsigned char)(ullValue | 0x80);
+        ullValue >>= 7;
+    }
+    pBuffer[ulLength++] = (unsigned char)ullValue;
+
+    return ulLength;
+}
+
+const bool BinaryWriter::WriteVarint(ULONGLONG ullValue)
+{
+    unsigned char buffer[10] = { 0 };
+    return Write(buffer, EncodeVarint(ullValue, buffer));
+}
+
+const bool BinaryWriter::WriteSignedVarint(const LONGLONG llValue)
+{
+    //Zigzag encoding keeps small negative deltas small
+    return WriteVarint(((ULONGLONG)llValue << 1) ^ (ULONGLONG)(llValue >> 63));
+}
+
+const ULONGLONG BinaryWriter::BytesWritten() const
+{
+    return m_ullBytesWritten;
+}
+
+const ULONGLONG BinaryWriter::FileBytesWritten() const
+{
+    return m_ullFileBytesWritten;
+}
+
+const bool BinaryWriter::Expand(const char * const pInputPath, const char * const pOutputPath)
+{
+    SafeHandle hInput = CreateFileA(pInputPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hInput() == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not open file %s. Error = %X\n", pInputPath, GetLastError());
+        return false;
+    }
+
+    auto ReadExact = [&](void * const pData, const DWORD dwSize)
+    {
+        DWORD dwBytesRead = 0;
+        return BOOLIFY(ReadFile(hInput(), pData, dwSize, &dwBytesRead, nullptr)) && (dwBytesRead == dwSize);
+    };
+
+    DWORD dwMagic = 0;
+    if (!ReadExact(&dwMagic, sizeof(DWORD)) || dwMagic != dwCompressedMagic)
+    {
+        fprintf(stderr, "%s is not a compressed file.\n", pInputPath);
+        return false;
+    }
+
+    DECOMPRESSOR_HANDLE hDecompressor = nullptr;
+    if (!BOOLIFY(CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &hDecompressor)))
+    {
+        fprintf(stderr, "Could not create decompressor. Error = %X\n", GetLastError());
+        return false;
+    }
+
+    BinaryWriter writer;
+    bool bSuccess = writer.Open(pOutputPath);
+    std::vector<unsigned char> vecCompressed;
+    std::vector<unsigned char> vecBlock;
+    DWORD dwSizes[2] = { 0 };
+    while (bSuccess && ReadExact(dwSizes, sizeof(dwSizes)))
+    {
+        vecBlock.resize(dwSizes[0]);
+        if (dwSizes[1] == 0)
+        {
+            bSuccess = ReadExact(vecBlock.data(), dwSizes[0]);
+        }
+        else
+        {
+            SIZE_T ulDecompressedSize = 0;
+            vecCompressed.resize(dwSizes[1]);
+            bSuccess = ReadExact(vecCompressed.data(), dwSizes[1]) &&
+                BOOLIFY(Decompress(hDecompressor, vecCompressed.data(), dwSizes[1], vecBlock.data(), dwSizes[0],
+                &ulDecompressedSize)) && (ulDecompressedSize == dwSizes[0]);
+        }
+
+        if (!bSuccess)
+        {
+            fprintf(stderr, "Could not expand block. Error = %X\n", GetLastError());
+            break;
+        }
+        bSuccess = writer.Write(vecBlock.data(), vecBlock.size());
+    }
+
+    (void)CloseDecompressor(hDecompressor);
+    bSuccess = writer.Close() && bSuccess;
+    if (bSuccess)
+    {
+        fprintf(stderr, "Expanded %s to %I64u bytes.\n", pInputPath, writer.BytesWritten());
+    }
+
+    return bSuccess;
+}
+
+}
\ No newline at end of file
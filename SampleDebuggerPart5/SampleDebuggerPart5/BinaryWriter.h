@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+
+#include <Windows.h>
+#include <compressapi.h>
+
+namespace CodeReversing
+{
+
+//Buffered sequential file writer. Output is handed to WriteFile in large blocks, and integers can be
+//written as LEB128 varints for compact on-disk formats. When opened with compression, every block is
+//run through XPRESS and framed as [uncompressed size][compressed size][data]; Expand undoes it.
+class BinaryWriter final
+{
+public:
+    BinaryWriter(const size_t ulBufferSize = 1024 * 1024);
+
+    BinaryWriter(const BinaryWriter &copy) = delete;
+    BinaryWriter &operator=(const BinaryWriter &copy) = delete;
+
+    ~BinaryWriter();
+
+    const bool Open(const char * const pPath, const bool bCompress = false);
+    const bool Close();
+    const bool Flush();
+    const bool IsOpen() const;
+
+    const bool Write(const void * const pData, const size_t ulSize);
+    const bool WriteVarint(ULONGLONG ullValue);
+    const bool WriteSignedVarint(const LONGLONG llValue);
+
+    template <typename T>
+    const bool WriteValue(const T &value)
+    {
+        return Write(&value, sizeof(T));
+    }
+
+    const ULONGLONG BytesWritten() const;
+    const ULONGLONG FileBytesWritten() const;
+
+    static const size_t EncodeVarint(ULONGLONG ullValue, unsigned char * const pBuffer);
+    static const bool Expand(const char * const pInputPath, const char * const pOutputPath);
+
+private:
+    const bool WriteBlock(const unsigned char *pData, size_t ulSize);
+    const bool WriteFileBytes(const void * const pData, const DWORD dwSize);
+
+    HANDLE m_hFile;
+    std::unique_ptr<unsigned char[]> m_pBuffer;
+    size_t m_ulBufferSize;
+    size_t m_ulBufferUsed;
+    ULONGLONG m_ullBytesWritten;
+    ULONGLONG m_ullFileBytesWritten;
+    bool m_bIsOpen;
+
+    COMPRESSOR_HANDLE m_hCompressor;
+    std::unique_ptr<unsigned char[]> m_pCompressed;
+};
+
+}
\ No newline at end of file
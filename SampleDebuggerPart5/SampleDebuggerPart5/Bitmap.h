@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <Windows.h>
+#include <intrin.h>
+
+namespace CodeReversing
+{
+
+//One bit per address offset. Workers may set bits concurrently as long as they never share a 64-bit word.
+//Rank() answers "how many bits are set below this index" in constant time once BuildRanks() has run.
+class Bitmap final
+{
+public:
+    Bitmap() = default;
+    explicit Bitmap(const size_t ulBits) : m_vecWords((ulBits + 63) / 64, 0)
+    {
+    }
+
+    ~Bitmap() = default;
+
+    const size_t Size() const
+    {
+        return m_vecWords.size() * 64;
+    }
+
+    const bool Test(const DWORD dwIndex) const
+    {
+        return ((m_vecWords[dwIndex / 64] >> (dwIndex % 64)) & 1) != 0;
+    }
+
+    void Set(const DWORD dwIndex)
+    {
+        m_vecWords[dwIndex / 64] |= (1ULL << (dwIndex % 64));
+    }
+
+    void Clear(const DWORD dwIndex)
+    {
+        m_vecWords[dwIndex / 64] &= ~(1ULL << (dwIndex % 64));
+    }
+
+    //Returns dwLimit when there is no set bit in [dwIndex, dwLimit)
+    const DWORD NextSet(DWORD dwIndex, const DWORD dwLimit) const
+    {
+        while (dwIndex < dwLimit)
+        {
+            const ULONGLONG ullWord = m_vecWords[dwIndex / 64] & (~0ULL << (dwIndex % 64));
+            if (ullWord != 0)
+            {
+                return std::min(dwLimit, (DWORD)((dwIndex & ~63UL) + LowestSetBit(ullWord)));
+            }
+            dwIndex = (dwIndex & ~63UL) + 64;
+        }
+        return dwLimit;
+    }
+
+    const size_t Count() const
+    {
+        size_t ulCount = 0;
+        for (auto &ullWord : m_vecWords)
+        {
+            ulCount += CountBits(ullWord);
+        }
+        return ulCount;
+    }
+
+    void BuildRanks()
+    {
+        m_vecRanks.resize(m_vecWords.size());
+        DWORD dwRank = 0;
+        for (size_t i = 0; i < m_vecWords.size(); ++i)
+        {
+            m_vecRanks[i] = dwRank;
+            dwRank += (DWORD)CountBits(m_vecWords[i]);
+        }
+    }
+
+    const DWORD Rank(const DWORD dwIndex) const
+    {
+        if (dwIndex >= Size())
+        {
+            return m_vecRanks.empty() ? 0 : m_vecRanks.back() + (DWORD)CountBits(m_vecWords.back());
+        }
+        const ULONGLONG ullBelow = m_vecWords[dwIndex / 64] & ((1ULL << (dwIndex % 64)) - 1);
+        return m_vecRanks[dwIndex / 64] + (DWORD)CountBits(ullBelow);
+    }
+
+    //Raw words for writing the bitmap out; bit i is bit (i % 64) of word (i / 64)
+    const ULONGLONG * const Words() const
+    {
+        return m_vecWords.data();
+    }
+
+    const size_t WordCount() const
+    {
+        return m_vecWords.size();
+    }
+
+    const size_t MemoryUsage() const
+    {
+        return m_vecWords.capacity() * sizeof(ULONGLONG) + m_vecRanks.capacity() * sizeof(DWORD);
+    }
+
+private:
+    static const unsigned int LowestSetBit(const ULONGLONG ullBits)
+    {
+        unsigned long ulIndex = 0;
+        if ((DWORD)ullBits != 0)
+        {
+            (void)_BitScanForward(&ulIndex, (unsigned long)ullBits);
+            return (unsigned int)ulIndex;
+        }
+        (void)_BitScanForward(&ulIndex, (unsigned long)(ullBits >> 32));
+        return (unsigned int)ulIndex + 32;
+    }
+
+    static const size_t CountBits(ULONGLONG ullBits)
+    {
+        ullBits = ullBits - ((ullBits >> 1) & 0x5555555555555555ULL);
+        ullBits = (ullBits & 0x3333333333333333ULL) + ((ullBits >> 2) & 0x3333333333333333ULL);
+        ullBits = (ullBits + (ullBits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (size_t)((ullBits * 0x0101010101010101ULL) >> 56);
+    }
+
+    std::vector<ULONGLONG> m_vecWords;
+    std::vector<DWORD> m_vecRanks;
+};
+
+}
\ No newline at end of file
@@ -8,6 +8,9 @@ namespace CodeReversing
 class Breakpoint
 {
 public:
+    //Groups of breakpoints are toggled by the debugger with one batched write instead of one write each
+    friend class Debugger;
+
     enum class eType
     {
         eHardware = 1,
@@ -0,0 +1,512 @@
+#include "BreakpointCondition.h"
+
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Common.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+struct RegisterName
+{
+    const char *pName;
+    size_t ulOffset;
+    unsigned char cSize;
+    DWORD dwContextFlags;
+};
+
+#ifdef _M_IX86
+const RegisterName registerNames[] =
+{
+    { "eax", offsetof(CONTEXT, Eax), 4, CONTEXT_INTEGER }, { "ebx", offsetof(CONTEXT, Ebx), 4, CONTEXT_INTEGER },
+    { "ecx", offsetof(CONTEXT, Ecx), 4, CONTEXT_INTEGER }, { "edx", offsetof(CONTEXT, Edx), 4, CONTEXT_INTEGER },
+    { "esi", offsetof(CONTEXT, Esi), 4, CONTEXT_INTEGER }, { "edi", offsetof(CONTEXT, Edi), 4, CONTEXT_INTEGER },
+    { "ebp", offsetof(CONTEXT, Ebp), 4, CONTEXT_CONTROL }, { "esp", offsetof(CONTEXT, Esp), 4, CONTEXT_CONTROL },
+    { "eip", offsetof(CONTEXT, Eip), 4, CONTEXT_CONTROL }, { "eflags", offsetof(CONTEXT, EFlags), 4, CONTEXT_CONTROL }
+};
+#elif defined _M_AMD64
+//The 32-bit names read the low half of the full register
+const RegisterName registerNames[] =
+{
+    { "rax", offsetof(CONTEXT, Rax), 8, CONTEXT_INTEGER }, { "rbx", offsetof(CONTEXT, Rbx), 8, CONTEXT_INTEGER },
+    { "rcx", offsetof(CONTEXT, Rcx), 8, CONTEXT_INTEGER }, { "rdx", offsetof(CONTEXT, Rdx), 8, CONTEXT_INTEGER },
+    { "rsi", offsetof(CONTEXT, Rsi), 8, CONTEXT_INTEGER }, { "rdi", offsetof(CONTEXT, Rdi), 8, CONTEXT_INTEGER },
+    { "rbp", offsetof(CONTEXT, Rbp), 8, CONTEXT_INTEGER }, { "rsp", offsetof(CONTEXT, Rsp), 8, CONTEXT_CONTROL },
+    { "r8", offsetof(CONTEXT, R8), 8, CONTEXT_INTEGER }, { "r9", offsetof(CONTEXT, R9), 8, CONTEXT_INTEGER },
+    { "r10", offsetof(CONTEXT, R10), 8, CONTEXT_INTEGER }, { "r11", offsetof(CONTEXT, R11), 8, CONTEXT_INTEGER },
+    { "r12", offsetof(CONTEXT, R12), 8, CONTEXT_INTEGER }, { "r13", offsetof(CONTEXT, R13), 8, CONTEXT_INTEGER },
+    { "r14", offsetof(CONTEXT, R14), 8, CONTEXT_INTEGER }, { "r15", offsetof(CONTEXT, R15), 8, CONTEXT_INTEGER },
+    { "rip", offsetof(CONTEXT, Rip), 8, CONTEXT_CONTROL }, { "eflags", offsetof(CONTEXT, EFlags), 4, CONTEXT_CONTROL },
+    { "eax", offsetof(CONTEXT, Rax), 4, CONTEXT_INTEGER }, { "ebx", offsetof(CONTEXT, Rbx), 4, CONTEXT_INTEGER },
+    { "ecx", offsetof(CONTEXT, Rcx), 4, CONTEXT_INTEGER }, { "edx", offsetof(CONTEXT, Rdx), 4, CONTEXT_INTEGER },
+    { "esi", offsetof(CONTEXT, Rsi), 4, CONTEXT_INTEGER }, { "edi", offsetof(CONTEXT, Rdi), 4, CONTEXT_INTEGER }
+};
+#else
+#error "Unsupported architecture"
+#endif
+
+struct MemorySize
+{
+    const char *pName;
+    unsigned char cSize;
+};
+
+const MemorySize memorySizes[] =
+{
+    { "byte", 1 }, { "word", 2 }, { "dword", 4 }, { "qword", 8 }
+};
+
+const char * const pMnemonics[] =
+{
+    "ldi", "ldr", "ldhits", "ldm", "neg", "not", "lnot", "test", "add", "sub", "mul", "div", "mod", "and", "or", "xor",
+    "shl", "shr", "eq", "ne", "lt", "le", "gt", "ge", "jz", "jnz"
+};
+
+}
+
+//Recursive descent over C operator precedence. Every subexpression leaves its value in the lowest free register,
+//so registers are handed out and given back like a stack.
+class ConditionCompiler
+{
+public:
+    typedef BreakpointCondition::eOpcode eOpcode;
+
+    ConditionCompiler(BreakpointCondition &condition) : m_condition{ condition },
+        m_pStart{ condition.m_strExpression.c_str() }, m_pCurrent{ condition.m_strExpression.c_str() }, m_ulNextRegister{ 0 }
+    {
+    }
+
+    const bool Compile()
+    {
+        unsigned char cResult = 0;
+        if (!ParseBinary(1, cResult))
+        {
+            return false;
+        }
+        SkipSpaces();
+        if (*m_pCurrent != '\0')
+        {
+            return Fail("unexpected text after the expression");
+        }
+
+        return true;
+    }
+
+private:
+    struct BinaryOperator
+    {
+        const char *pToken;
+        int iPrecedence;
+        eOpcode opcode;
+    };
+
+    //Two-character tokens come first so that "<<" is not read as "<"
+    static const BinaryOperator *FindOperator(const char * const pText)
+    {
+        static const BinaryOperator binaryOperators[] =
+        {
+            { "||", 1, eOpcode::eJumpIfNotZero }, { "&&", 2, eOpcode::eJumpIfZero }, { "==", 6, eOpcode::eEqual },
+            { "!=", 6, eOpcode::eNotEqual }, { "<<", 8, eOpcode::eShiftLeft }, { ">>", 8, eOpcode::eShiftRight },
+            { "<=", 7, eOpcode::eLessEqual }, { ">=", 7, eOpcode::eGreaterEqual }, { "|", 3, eOpcode::eOr },
+            { "^", 4, eOpcode::eXor }, { "&", 5, eOpcode::eAnd }, { "<", 7, eOpcode::eLess }, { ">", 7, eOpcode::eGreater },
+            { "+", 9, eOpcode::eAdd }, { "-", 9, eOpcode::eSubtract }, { "*", 10, eOpcode::eMultiply },
+            { "/", 10, eOpcode::eDivide }, { "%", 10, eOpcode::eModulo }
+        };
+
+        for (auto &binaryOperator : binaryOperators)
+        {
+            if (strncmp(pText, binaryOperator.pToken, strlen(binaryOperator.pToken)) == 0)
+            {
+                return &binaryOperator;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const bool ParseBinary(const int iMinPrecedence, unsigned char &cResult)
+    {
+        if (!ParseUnary(cResult))
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            SkipSpaces();
+            const BinaryOperator * const pOperator = FindOperator(m_pCurrent);
+            if (pOperator == nullptr || pOperator->iPrecedence < iMinPrecedence)
+            {
+                return true;
+            }
+            m_pCurrent += strlen(pOperator->pToken);
+
+            unsigned char cRight = 0;
+            if (pOperator->opcode == eOpcode::eJumpIfZero || pOperator->opcode == eOpcode::eJumpIfNotZero)
+            {
+                //Both paths leave 0 or 1 behind; the jump skips the right side once the left decides the result
+                Emit(eOpcode::eTest, cResult, cResult, 0, 0);
+                const size_t ulJump = m_condition.m_vecCode.size();
+                Emit(pOperator->opcode, 0, cResult, 0, 0);
+                if (!ParseBinary(pOperator->iPrecedence + 1, cRight))
+                {
+                    return false;
+                }
+                Emit(eOpcode::eTest, cResult, cRight, 0, 0);
+                m_condition.m_vecCode[ulJump].ullOperand = m_condition.m_vecCode.size();
+            }
+            else
+            {
+                if (!ParseBinary(pOperator->iPrecedence + 1, cRight))
+                {
+                    return false;
+                }
+                Emit(pOperator->opcode, cResult, cResult, cRight, 0);
+            }
+            m_ulNextRegister = cResult + 1;
+        }
+    }
+
+    const bool ParseUnary(unsigned char &cResult)
+    {
+        SkipSpaces();
+        const char cOperator = *m_pCurrent;
+        if (cOperator == '-' || cOperator == '~' || cOperator == '!')
+        {
+            ++m_pCurrent;
+            if (!ParseUnary(cResult))
+            {
+                return false;
+            }
+            const eOpcode opcode = (cOperator == '-') ? eOpcode::eNegate :
+                (cOperator == '~') ? eOpcode::eComplement : eOpcode::eLogicalNot;
+            Emit(opcode, cResult, cResult, 0, 0);
+            return true;
+        }
+
+        return ParsePrimary(cResult);
+    }
+
+    const bool ParsePrimary(unsigned char &cResult)
+    {
+        SkipSpaces();
+        if (*m_pCurrent == '(')
+        {
+            ++m_pCurrent;
+            if (!ParseBinary(1, cResult))
+            {
+                return false;
+            }
+            return Expect(')');
+        }
+        if (*m_pCurrent == '[')
+        {
+            return ParseMemory(sizeof(DWORD_PTR), cResult);
+        }
+        if (isdigit((unsigned char)*m_pCurrent))
+        {
+            const int iBase = (m_pCurrent[0] == '0' && (m_pCurrent[1] == 'x' || m_pCurrent[1] == 'X')) ? 16 : 10;
+            char *pEnd = nullptr;
+            const DWORD64 ullValue = strtoull(m_pCurrent, &pEnd, iBase);
+            m_pCurrent = pEnd;
+            if (!Allocate(cResult))
+            {
+                return false;
+            }
+            Emit(eOpcode::eLoadImmediate, cResult, 0, 0, ullValue);
+            return true;
+        }
+
+        const char * const pName = m_pCurrent;
+        while (isalnum((unsigned char)*m_pCurrent) || *m_pCurrent == '_')
+        {
+            ++m_pCurrent;
+        }
+        const size_t ulLength = m_pCurrent - pName;
+        if (ulLength == 0)
+        {
+            return Fail("expected a value");
+        }
+
+        if (IsName(pName, ulLength, "hits"))
+        {
+            if (!Allocate(cResult))
+            {
+                return false;
+            }
+            Emit(eOpcode::eLoadHits, cResult, 0, 0, 0);
+            return true;
+        }
+        for (auto &memorySize : memorySizes)
+        {
+            if (IsName(pName, ulLength, memorySize.pName))
+            {
+                SkipSpaces();
+                return ParseMemory(memorySize.cSize, cResult);
+            }
+        }
+        for (auto &registerName : registerNames)
+        {
+            if (IsName(pName, ulLength, registerName.pName))
+            {
+                if (!Allocate(cResult))
+                {
+                    return false;
+                }
+                Emit(eOpcode::eLoadRegister, cResult, 0, registerName.cSize, registerName.ulOffset);
+                m_condition.m_dwContextFlags |= registerName.dwContextFlags;
+                return true;
+            }
+        }
+
+        m_pCurrent = pName;
+        return Fail("unknown register or name");
+    }
+
+    const bool ParseMemory(const unsigned char cSize, unsigned char &cResult)
+    {
+        if (!Expect('['))
+        {
+            return false;
+        }
+        if (!ParseBinary(1, cResult) || !Expect(']'))
+        {
+            return false;
+        }
+        Emit(eOpcode::eLoadMemory, cResult, cResult, 0, cSize);
+        return true;
+    }
+
+    const bool Allocate(unsigned char &cRegister)
+    {
+        if (m_ulNextRegister >= BreakpointCondition::ulMaxRegisters)
+        {
+            return Fail("expression needs too many registers");
+        }
+        cRegister = (unsigned char)m_ulNextRegister++;
+        return true;
+    }
+
+    void Emit(const eOpcode opcode, const unsigned char cDestination, const unsigned char cLeft, const unsigned char cRight,
+        const DWORD64 ullOperand)
+    {
+        m_condition.m_vecCode.push_back({ opcode, cDestination, cLeft, cRight, ullOperand });
+    }
+
+    const bool Expect(const char cToken)
+    {
+        SkipSpaces();
+        if (*m_pCurrent != cToken)
+        {
+            char strReason[32] = { 0 };
+            sprintf_s(strReason, sizeof(strReason), "expected '%c'", cToken);
+            return Fail(strReason);
+        }
+        ++m_pCurrent;
+        return true;
+    }
+
+    void SkipSpaces()
+    {
+        while (isspace((unsigned char)*m_pCurrent))
+        {
+            ++m_pCurrent;
+        }
+    }
+
+    static const bool IsName(const char * const pText, const size_t ulLength, const char * const pName)
+    {
+        return strlen(pName) == ulLength && _strnicmp(pText, pName, ulLength) == 0;
+    }
+
+    const bool Fail(const char * const pReason)
+    {
+        fprintf(stderr, "Condition error at column %Iu: %s.\n", (size_t)(m_pCurrent - m_pStart) + 1, pReason);
+        return false;
+    }
+
+    BreakpointCondition &m_condition;
+    const char * const m_pStart;
+    const char *m_pCurrent;
+    size_t m_ulNextRegister;
+};
+
+BreakpointCondition::BreakpointCondition(const char * const pExpression) : m_strExpression{ pExpression },
+    m_dwContextFlags{ 0 }
+{
+}
+
+std::unique_ptr<BreakpointCondition> BreakpointCondition::Compile(const char * const pExpression)
+{
+    std::unique_ptr<BreakpointCondition> pCondition(new BreakpointCondition(pExpression));
+    ConditionCompiler compiler(*pCondition);
+    if (!compiler.Compile())
+    {
+        return nullptr;
+    }
+
+    return pCondition;
+}
+
+const DWORD BreakpointCondition::ContextFlags() const
+{
+    return m_dwContextFlags;
+}
+
+const std::string &BreakpointCondition::Expression() const
+{
+    return m_strExpression;
+}
+
+const bool BreakpointCondition::Evaluate(const HANDLE hProcess, const CONTEXT &ctx, const ULONGLONG ullHits, bool &bResult) const
+{
+    DWORD64 ullValue = 0;
+    if (!EvaluateValue(hProcess, ctx, ullHits, ullValue))
+    {
+        return false;
+    }
+
+    bResult = (ullValue != 0);
+    return true;
+}
+
+const bool BreakpointCondition::EvaluateValue(const HANDLE hProcess, const CONTEXT &ctx, const ULONGLONG ullHits,
+    DWORD64 &ullValue) const
+{
+    DWORD64 registers[ulMaxRegisters] = { 0 };
+    const size_t ulCodeSize = m_vecCode.size();
+    for (size_t i = 0; i < ulCodeSize;)
+    {
+        const Instruction &instruction = m_vecCode[i++];
+        const DWORD64 ullLeft = registers[instruction.cLeft];
+        const DWORD64 ullRight = registers[instruction.cRight];
+        DWORD64 &ullDestination = registers[instruction.cDestination];
+        switch (instruction.opcode)
+        {
+        case eOpcode::eLoadImmediate:
+            ullDestination = instruction.ullOperand;
+            break;
+        case eOpcode::eLoadRegister:
+        {
+            DWORD64 ullValue = 0;
+            memcpy(&ullValue, (const unsigned char *)&ctx + instruction.ullOperand, instruction.cRight);
+            ullDestination = ullValue;
+            break;
+        }
+        case eOpcode::eLoadHits:
+            ullDestination = ullHits;
+            break;
+        case eOpcode::eLoadMemory:
+        {
+            DWORD64 ullValue = 0;
+            SIZE_T ulBytesRead = 0;
+            if (!BOOLIFY(ReadProcessMemory(hProcess, (LPCVOID)(DWORD_PTR)ullLeft, &ullValue, (SIZE_T)instruction.ullOperand,
+                &ulBytesRead)))
+            {
+                fprintf(stderr, "Condition could not read memory at %p. Error = %X\n", (DWORD_PTR)ullLeft, GetLastError());
+                return false;
+            }
+            ullDestination = ullValue;
+            break;
+        }
+        case eOpcode::eNegate:
+            ullDestination = 0 - ullLeft;
+            break;
+        case eOpcode::eComplement:
+            ullDestination = ~ullLeft;
+            break;
+        case eOpcode::eLogicalNot:
+            ullDestination = (ullLeft == 0) ? 1 : 0;
+            break;
+        case eOpcode::eTest:
+            ullDestination = (ullLeft != 0) ? 1 : 0;
+            break;
+        case eOpcode::eAdd:
+            ullDestination = ullLeft + ullRight;
+            break;
+        case eOpcode::eSubtract:
+            ullDestination = ullLeft - ullRight;
+            break;
+        case eOpcode::eMultiply:
+            ullDestination = ullLeft * ullRight;
+            break;
+        case eOpcode::eDivide:
+        case eOpcode::eModulo:
+            if (ullRight == 0)
+            {
+                fprintf(stderr, "Condition divided by zero.\n");
+                return false;
+            }
+            ullDestination = (instruction.opcode == eOpcode::eDivide) ? ullLeft / ullRight : ullLeft % ullRight;
+            break;
+        case eOpcode::eAnd:
+            ullDestination = ullLeft & ullRight;
+            break;
+        case eOpcode::eOr:
+            ullDestination = ullLeft | ullRight;
+            break;
+        case eOpcode::eXor:
+            ullDestination = ullLeft ^ ullRight;
+            break;
+        case eOpcode::eShiftLeft:
+            ullDestination = (ullRight >= 64) ? 0 : ullLeft << ullRight;
+            break;
+        case eOpcode::eShiftRight:
+            ullDestination = (ullRight >= 64) ? 0 : ullLeft >> ullRight;
+            break;
+        case eOpcode::eEqual:
+            ullDestination = (ullLeft == ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eNotEqual:
+            ullDestination = (ullLeft != ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eLess:
+            ullDestination = (ullLeft < ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eLessEqual:
+            ullDestination = (ullLeft <= ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eGreater:
+            ullDestination = (ullLeft > ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eGreaterEqual:
+            ullDestination = (ullLeft >= ullRight) ? 1 : 0;
+            break;
+        case eOpcode::eJumpIfZero:
+            if (ullLeft == 0)
+            {
+                i = (size_t)instruction.ullOperand;
+            }
+            break;
+        case eOpcode::eJumpIfNotZero:
+            if (ullLeft != 0)
+            {
+                i = (size_t)instruction.ullOperand;
+            }
+            break;
+        }
+    }
+
+    ullValue = registers[0];
+    return true;
+}
+
+void BreakpointCondition::PrintBytecode() const
+{
+    fprintf(stderr, "%s\n", m_strExpression.c_str());
+    for (size_t i = 0; i < m_vecCode.size(); ++i)
+    {
+        const Instruction &instruction = m_vecCode[i];
+        fprintf(stderr, "  %3Iu: %-6s r%u, r%u, r%u, %I64X\n", i, pMnemonics[(size_t)instruction.opcode],
+            instruction.cDestination, instruction.cLeft, instruction.cRight, instruction.ullOperand);
+    }
+}
+
+}
\ No newline at end of file
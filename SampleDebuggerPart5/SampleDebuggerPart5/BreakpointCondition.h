@@ -0,0 +1,91 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+//A breakpoint condition such as "rcx == 0x10 && [rsp+8] > 5", parsed once and compiled to a small register-machine
+//bytecode. Values are unsigned and pointer-width memory reads are written [expr], with byte/word/dword/qword in
+//front for other sizes. "hits" is the number of times the breakpoint has been reached, this one included.
+//&& and || short-circuit, so a memory read on the right is only made when the left side allows it.
+class BreakpointCondition final
+{
+public:
+    BreakpointCondition() = delete;
+    BreakpointCondition(const BreakpointCondition &copy) = delete;
+    BreakpointCondition &operator=(const BreakpointCondition &copy) = delete;
+
+    ~BreakpointCondition() = default;
+
+    //Returns nullptr and prints where parsing stopped when the expression is malformed
+    static std::unique_ptr<BreakpointCondition> Compile(const char * const pExpression);
+
+    //The thread context only has to hold what these flags ask for
+    const DWORD ContextFlags() const;
+    const std::string &Expression() const;
+
+    //Returns false when a memory read fails or a division by zero is hit; the result is only valid on success
+    const bool Evaluate(const HANDLE hProcess, const CONTEXT &ctx, const ULONGLONG ullHits, bool &bResult) const;
+    const bool EvaluateValue(const HANDLE hProcess, const CONTEXT &ctx, const ULONGLONG ullHits, DWORD64 &ullValue) const;
+
+    void PrintBytecode() const;
+
+    static const size_t ulMaxRegisters = 16;
+
+private:
+    enum class eOpcode : unsigned char
+    {
+        eLoadImmediate,
+        eLoadRegister,
+        eLoadHits,
+        eLoadMemory,
+        eNegate,
+        eComplement,
+        eLogicalNot,
+        eTest,
+        eAdd,
+        eSubtract,
+        eMultiply,
+        eDivide,
+        eModulo,
+        eAnd,
+        eOr,
+        eXor,
+        eShiftLeft,
+        eShiftRight,
+        eEqual,
+        eNotEqual,
+        eLess,
+        eLessEqual,
+        eGreater,
+        eGreaterEqual,
+        eJumpIfZero,
+        eJumpIfNotZero
+    };
+
+    //ullOperand is the immediate, the CONTEXT offset, the memory read size or the jump target depending on the opcode.
+    //Registers with a context offset also carry their width in cRight.
+    struct Instruction
+    {
+        eOpcode opcode;
+        unsigned char cDestination;
+        unsigned char cLeft;
+        unsigned char cRight;
+        DWORD64 ullOperand;
+    };
+
+    friend class ConditionCompiler;
+
+    BreakpointCondition(const char * const pExpression);
+
+    std::string m_strExpression;
+    std::vector<Instruction> m_vecCode;
+    DWORD m_dwContextFlags;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "BreakpointGroups.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include "Debugger.h"
+#include "Stopwatch.h"
+#include "Symbols.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const std::string ToLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](const char c) { return (char)tolower((unsigned char)c); });
+    return str;
+}
+
+}
+
+BreakpointGroups::BreakpointGroups(Debugger *pDebugger) : m_pDebugger{ pDebugger }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool BreakpointGroups::Add(const char * const pGroup, const std::vector<DWORD_PTR> &vecAddresses)
+{
+    Stopwatch clock;
+    Group &group = m_mapGroups.insert(std::make_pair(std::string(pGroup), Group{ std::set<DWORD_PTR>(), true })).first->second;
+    group.setAddresses.insert(vecAddresses.begin(), vecAddresses.end());
+    const bool bSuccess = m_pDebugger->AddBreakpoints(vecAddresses, group.bIsEnabled);
+    Record(vecAddresses.size(), clock.ElapsedMicroseconds());
+
+    return bSuccess;
+}
+
+const bool BreakpointGroups::Enable(const char * const pGroup)
+{
+    return SetEnabled(pGroup, true);
+}
+
+const bool BreakpointGroups::Disable(const char * const pGroup)
+{
+    return SetEnabled(pGroup, false);
+}
+
+const bool BreakpointGroups::Remove(const char * const pGroup)
+{
+    auto group = m_mapGroups.find(pGroup);
+    if (group == m_mapGroups.end())
+    {
+        fprintf(stderr, "No breakpoint group %s.\n", pGroup);
+        return false;
+    }
+
+    Stopwatch clock;
+    std::vector<DWORD_PTR> vecAddresses;
+    vecAddresses.reserve(group->second.setAddresses.size());
+    for (auto dwAddress : group->second.setAddresses)
+    {
+        const bool bIsShared = std::any_of(m_mapGroups.begin(), m_mapGroups.end(),
+            [&](const std::pair<const std::string, Group> &other)
+        {
+            return &other.second != &group->second && other.second.setAddresses.count(dwAddress) != 0;
+        });
+        if (!bIsShared)
+        {
+            vecAddresses.push_back(dwAddress);
+        }
+    }
+    const bool bSuccess = m_pDebugger->RemoveBreakpoints(vecAddresses);
+    m_mapGroups.erase(group);
+    Record(vecAddresses.size(), clock.ElapsedMicroseconds());
+    fprintf(stderr, "Removed group %s and %Iu of its breakpoints.\n", pGroup, vecAddresses.size());
+
+    return bSuccess;
+}
+
+const bool BreakpointGroups::SaveSession(const char * const pPath) const
+{
+    FILE *pFile = fopen(pPath, "w");
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", pPath);
+        return false;
+    }
+
+    //Addresses are sorted, so neighbours mostly fall in the region that was queried last
+    MEMORY_BASIC_INFORMATION region = { 0 };
+    for (auto &group : m_mapGroups)
+    {
+        fprintf(pFile, "group %s %s\n", group.first.c_str(), group.second.bIsEnabled ? "enabled" : "disabled");
+        for (auto dwAddress : group.second.setAddresses)
+        {
+            DWORD_PTR dwOffset = 0;
+            const std::string strModule = ModuleOffset(dwAddress, region, dwOffset);
+            if (!strModule.empty())
+            {
+                fprintf(pFile, "%s+%p\n", strModule.c_str(), dwOffset);
+            }
+            else
+            {
+                fprintf(pFile, "%p\n", dwAddress);
+            }
+        }
+    }
+    const bool bSuccess = (ferror(pFile) == 0);
+    fclose(pFile);
+
+    fprintf(stderr, "Saved %Iu breakpoint groups to %s.\n", m_mapGroups.size(), pPath);
+    return bSuccess;
+}
+
+const bool BreakpointGroups::LoadSession(const char * const pPath)
+{
+    FILE *pFile = fopen(pPath, "r");
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", pPath);
+        return false;
+    }
+
+    const std::map<std::string, DWORD_PTR> mapModules = LoadedModules();
+    bool bSuccess = true;
+    size_t ulGroups = 0;
+    size_t ulSkipped = 0;
+    std::string strGroup;
+    bool bIsEnabled = false;
+    std::vector<DWORD_PTR> vecAddresses;
+
+    //Each group goes to the debugger as one batch once all of its lines are read
+    auto AddGroup = [&]()
+    {
+        if (strGroup.empty())
+        {
+            return;
+        }
+        Stopwatch clock;
+        Group &group = m_mapGroups[strGroup];
+        group.bIsEnabled = bIsEnabled;
+        group.setAddresses.insert(vecAddresses.begin(), vecAddresses.end());
+        bSuccess = m_pDebugger->AddBreakpoints(vecAddresses, bIsEnabled) && bSuccess;
+        Record(vecAddresses.size(), clock.ElapsedMicroseconds());
+        ++ulGroups;
+    };
+
+    char strLine[512] = { 0 };
+    while (fgets(strLine, sizeof(strLine), pFile) != nullptr)
+    {
+        char strName[128] = { 0 };
+        char strState[16] = { 0 };
+        if (sscanf(strLine, "group %127s %15s", strName, strState) == 2)
+        {
+            AddGroup();
+            strGroup = strName;
+            bIsEnabled = (_stricmp(strState, "enabled") == 0);
+            vecAddresses.clear();
+            continue;
+        }
+
+        DWORD_PTR dwAddress = 0;
+        char * const pPlus = strchr(strLine, '+');
+        if (pPlus != nullptr)
+        {
+            //Modules that are not loaded yet are skipped rather than guessed at
+            *pPlus = '\0';
+            auto module = mapModules.find(ToLower(strLine));
+            if (module == mapModules.end() || sscanf(pPlus + 1, "%p", &dwAddress) != 1)
+            {
+                ++ulSkipped;
+                continue;
+            }
+            dwAddress += module->second;
+        }
+        else if (sscanf(strLine, "%p", &dwAddress) != 1)
+        {
+            continue;
+        }
+        if (!strGroup.empty())
+        {
+            vecAddresses.push_back(dwAddress);
+        }
+    }
+    AddGroup();
+    fclose(pFile);
+
+    fprintf(stderr, "Loaded %Iu breakpoint groups from %s, %Iu addresses skipped in modules that are not loaded.\n",
+        ulGroups, pPath, ulSkipped);
+    return bSuccess;
+}
+
+void BreakpointGroups::PrintGroups() const
+{
+    for (auto &group : m_mapGroups)
+    {
+        fprintf(stderr, "%s: %Iu breakpoints, %s.\n", group.first.c_str(), group.second.setAddresses.size(),
+            group.second.bIsEnabled ? "enabled" : "disabled");
+    }
+}
+
+void BreakpointGroups::PrintStats() const
+{
+    const double dOperations = (m_stats.ullOperations != 0) ? (double)m_stats.ullOperations : 1.0;
+    fprintf(stderr, "Breakpoint groups: %Iu groups, %I64u operations over %I64u breakpoints, %.2f ms per operation on "
+        "average, %.2f ms at most.\n", m_mapGroups.size(), m_stats.ullOperations, m_stats.ullBreakpoints,
+        m_stats.dOperationMicroseconds / dOperations / 1000.0, m_stats.dMaxOperationMicroseconds / 1000.0);
+}
+
+const bool BreakpointGroups::SetEnabled(const char * const pGroup, const bool bEnable)
+{
+    auto group = m_mapGroups.find(pGroup);
+    if (group == m_mapGroups.end())
+    {
+        fprintf(stderr, "No breakpoint group %s.\n", pGroup);
+        return false;
+    }
+
+    Stopwatch clock;
+    const std::vector<DWORD_PTR> vecAddresses(group->second.setAddresses.begin(), group->second.setAddresses.end());
+    const bool bSuccess = m_pDebugger->EnableBreakpoints(vecAddresses, bEnable);
+    if (bSuccess)
+    {
+        group->second.bIsEnabled = bEnable;
+    }
+    const double dMicroseconds = clock.ElapsedMicroseconds();
+    Record(vecAddresses.size(), dMicroseconds);
+    fprintf(stderr, "%s %Iu breakpoints in group %s in %.2f ms.\n", bEnable ? "Enabled" : "Disabled", vecAddresses.size(),
+        pGroup, dMicroseconds / 1000.0);
+
+    return bSuccess;
+}
+
+void BreakpointGroups::Record(const size_t ulBreakpoints, const double dMicroseconds)
+{
+    ++m_stats.ullOperations;
+    m_stats.ullBreakpoints += ulBreakpoints;
+    m_stats.dOperationMicroseconds += dMicroseconds;
+    m_stats.dMaxOperationMicroseconds = (std::max)(m_stats.dMaxOperationMicroseconds, dMicroseconds);
+}
+
+const std::string BreakpointGroups::ModuleOffset(const DWORD_PTR dwAddress, MEMORY_BASIC_INFORMATION &region,
+    DWORD_PTR &dwOffset) const
+{
+    if (dwAddress < (DWORD_PTR)region.BaseAddress || dwAddress - (DWORD_PTR)region.BaseAddress >= region.RegionSize)
+    {
+        if (VirtualQueryEx(m_pDebugger->Handle(), (LPCVOID)dwAddress, &region, sizeof(MEMORY_BASIC_INFORMATION)) == 0)
+        {
+            memset(&region, 0, sizeof(MEMORY_BASIC_INFORMATION));
+            return std::string();
+        }
+    }
+    if (region.Type != MEM_IMAGE)
+    {
+        return std::string();
+    }
+
+    const DWORD_PTR dwModuleBase = (DWORD_PTR)region.AllocationBase;
+    auto &symbols = m_pDebugger->ProcessSymbols()->SymbolList();
+    auto module = symbols.find(dwModuleBase);
+    if (module == symbols.end())
+    {
+        return std::string();
+    }
+    dwOffset = dwAddress - dwModuleBase;
+
+    return ToLower(Symbols::ModuleStem(module->second.strName.data()));
+}
+
+const std::map<std::string, DWORD_PTR> BreakpointGroups::LoadedModules() const
+{
+    std::map<std::string, DWORD_PTR> mapModules;
+    auto &symbols = m_pDebugger->ProcessSymbols()->SymbolList();
+    for (auto module = symbols.begin(); module != symbols.end(); module = symbols.upper_bound(module->first))
+    {
+        mapModules[ToLower(Symbols::ModuleStem(module->second.strName.data()))] = module->first;
+    }
+
+    return mapModules;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Named groups of breakpoints that are added, enabled, disabled and removed together. Every operation hands the whole
+//group to the debugger as one page-batched write, so toggling thousands of breakpoints costs one protection change
+//and one write per touched page. A breakpoint may belong to several groups; removing a group keeps the breakpoints
+//another group still names. Sessions are saved as text with module-relative addresses so they survive relocation:
+//"group <name> enabled|disabled" followed by one "<module>+<offset>" or absolute address per line.
+class BreakpointGroups final
+{
+public:
+    BreakpointGroups() = delete;
+    BreakpointGroups(Debugger *pDebugger);
+
+    BreakpointGroups(const BreakpointGroups &copy) = delete;
+    BreakpointGroups &operator=(const BreakpointGroups &copy) = delete;
+
+    ~BreakpointGroups() = default;
+
+    //Creates the group if needed; new breakpoints take the group's state
+    const bool Add(const char * const pGroup, const std::vector<DWORD_PTR> &vecAddresses);
+    const bool Enable(const char * const pGroup);
+    const bool Disable(const char * const pGroup);
+    const bool Remove(const char * const pGroup);
+
+    const bool SaveSession(const char * const pPath) const;
+    const bool LoadSession(const char * const pPath);
+
+    void PrintGroups() const;
+    void PrintStats() const;
+
+private:
+    struct Group
+    {
+        std::set<DWORD_PTR> setAddresses;
+        bool bIsEnabled;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullOperations;
+        unsigned long long ullBreakpoints;
+        double dOperationMicroseconds;
+        double dMaxOperationMicroseconds;
+    };
+
+    const bool SetEnabled(const char * const pGroup, const bool bEnable);
+    void Record(const size_t ulBreakpoints, const double dMicroseconds);
+
+    const std::string ModuleOffset(const DWORD_PTR dwAddress, MEMORY_BASIC_INFORMATION &region, DWORD_PTR &dwOffset) const;
+    const std::map<std::string, DWORD_PTR> LoadedModules() const;
+
+    Debugger * const m_pDebugger;
+    std::map<std::string, Group> m_mapGroups;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,1050 @@
+#include "CfiUnwinder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#endif
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//DWARF call frame instructions. The first three carry their operand in the low six bits.
+const uint8_t cCfaAdvanceLocation = 0x40;
+const uint8_t cCfaOffset = 0x80;
+const uint8_t cCfaRestore = 0xC0;
+const uint8_t cCfaNop = 0x00;
+const uint8_t cCfaSetLocation = 0x01;
+const uint8_t cCfaAdvanceLocation1 = 0x02;
+const uint8_t cCfaAdvanceLocation2 = 0x03;
+const uint8_t cCfaAdvanceLocation4 = 0x04;
+const uint8_t cCfaOffsetExtended = 0x05;
+const uint8_t cCfaRestoreExtended = 0x06;
+const uint8_t cCfaUndefined = 0x07;
+const uint8_t cCfaSameValue = 0x08;
+const uint8_t cCfaRegister = 0x09;
+const uint8_t cCfaRememberState = 0x0A;
+const uint8_t cCfaRestoreState = 0x0B;
+const uint8_t cCfaDefineCfa = 0x0C;
+const uint8_t cCfaDefineCfaRegister = 0x0D;
+const uint8_t cCfaDefineCfaOffset = 0x0E;
+const uint8_t cCfaDefineCfaExpression = 0x0F;
+const uint8_t cCfaExpression = 0x10;
+const uint8_t cCfaOffsetExtendedSigned = 0x11;
+const uint8_t cCfaDefineCfaSigned = 0x12;
+const uint8_t cCfaDefineCfaOffsetSigned = 0x13;
+const uint8_t cCfaValueOffset = 0x14;
+const uint8_t cCfaValueOffsetSigned = 0x15;
+const uint8_t cCfaValueExpression = 0x16;
+const uint8_t cCfaGnuArgumentsSize = 0x2E;
+const uint8_t cCfaGnuNegativeOffsetExtended = 0x2F;
+
+//Pointer encodings used in .eh_frame and .eh_frame_hdr
+const uint8_t cEncodingOmit = 0xFF;
+const uint8_t cEncodingAbsolute = 0x00;
+const uint8_t cEncodingUleb128 = 0x01;
+const uint8_t cEncodingUdata2 = 0x02;
+const uint8_t cEncodingUdata4 = 0x03;
+const uint8_t cEncodingUdata8 = 0x04;
+const uint8_t cEncodingSleb128 = 0x09;
+const uint8_t cEncodingSdata2 = 0x0A;
+const uint8_t cEncodingSdata4 = 0x0B;
+const uint8_t cEncodingSdata8 = 0x0C;
+const uint8_t cEncodingPcRelative = 0x10;
+const uint8_t cEncodingDataRelative = 0x30;
+
+const uint32_t uiProgramLoad = 1;
+const uint32_t uiProgramEhFrameHeader = 0x6474E550;
+const uint32_t uiSectionNoBits = 8;
+
+const uint32_t uiNoCfaRegister = 0xFFFFFFFF;
+const size_t ulMaxRememberedStates = 16;
+
+#if defined(__linux__) && defined(__x86_64__)
+const size_t ulMaxStackSize = 1024 * 1024;
+#endif
+
+//Bounds checked cursor over a byte range. Reads past the end return zero and clear bIsValid.
+struct Reader
+{
+    const uint8_t *pData;
+    size_t ulPosition;
+    size_t ulEnd;
+    bool bIsValid;
+
+    const bool Has(const size_t ulSize)
+    {
+        if (!bIsValid || ulPosition > ulEnd || ulEnd - ulPosition < ulSize)
+        {
+            bIsValid = false;
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    const T Read()
+    {
+        T value = 0;
+        if (Has(sizeof(T)))
+        {
+            memcpy(&value, &pData[ulPosition], sizeof(T));
+            ulPosition += sizeof(T);
+        }
+        return value;
+    }
+
+    const uint64_t ReadUleb128()
+    {
+        uint64_t ullValue = 0;
+        uint32_t uiShift = 0;
+        while (Has(1))
+        {
+            const uint8_t cByte = pData[ulPosition++];
+            if (uiShift < 64)
+            {
+                ullValue |= (uint64_t)(cByte & 0x7F) << uiShift;
+            }
+            uiShift += 7;
+            if ((cByte & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        return ullValue;
+    }
+
+    const int64_t ReadSleb128()
+    {
+        int64_t llValue = 0;
+        uint32_t uiShift = 0;
+        uint8_t cByte = 0;
+        while (Has(1))
+        {
+            cByte = pData[ulPosition++];
+            if (uiShift < 64)
+            {
+                llValue |= (int64_t)(cByte & 0x7F) << uiShift;
+            }
+            uiShift += 7;
+            if ((cByte & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        if (uiShift < 64 && (cByte & 0x40) != 0)
+        {
+            llValue |= -((int64_t)1 << uiShift);
+        }
+        return llValue;
+    }
+
+    //ullAddress is the linked address of pData, used for PC relative pointers
+    const bool ReadEncoded(const uint8_t cEncoding, const uint64_t ullAddress, const uint64_t ullDataAddress, uint64_t &ullValue)
+    {
+        const uint64_t ullField = ullAddress + ulPosition;
+        if (cEncoding == cEncodingOmit)
+        {
+            ullValue = 0;
+            return true;
+        }
+
+        switch (cEncoding & 0x0F)
+        {
+        case cEncodingAbsolute:
+        case cEncodingUdata8:
+        case cEncodingSdata8:
+            ullValue = Read<uint64_t>();
+            break;
+        case cEncodingUleb128:
+            ullValue = ReadUleb128();
+            break;
+        case cEncodingUdata2:
+            ullValue = Read<uint16_t>();
+            break;
+        case cEncodingUdata4:
+            ullValue = Read<uint32_t>();
+            break;
+        case cEncodingSleb128:
+            ullValue = (uint64_t)ReadSleb128();
+            break;
+        case cEncodingSdata2:
+            ullValue = (uint64_t)(int64_t)Read<int16_t>();
+            break;
+        case cEncodingSdata4:
+            ullValue = (uint64_t)(int64_t)Read<int32_t>();
+            break;
+        default:
+            return false;
+        }
+
+        switch (cEncoding & 0x70)
+        {
+        case 0:
+            break;
+        case cEncodingPcRelative:
+            ullValue += ullField;
+            break;
+        case cEncodingDataRelative:
+            ullValue += ullDataAddress;
+            break;
+        default:
+            return false;
+        }
+
+        //Indirect pointers would need a read of the target's memory, which .eh_frame does not use for code ranges
+        return bIsValid && (cEncoding & 0x80) == 0;
+    }
+};
+
+template <typename T>
+const T ReadAt(const uint8_t * const pData, const size_t ulSize, const uint64_t ullOffset)
+{
+    T value = 0;
+    if (ullOffset <= ulSize && ulSize - ullOffset >= sizeof(T))
+    {
+        memcpy(&value, &pData[ullOffset], sizeof(T));
+    }
+    return value;
+}
+
+const uint64_t ElapsedMicroseconds(const std::chrono::steady_clock::time_point &start)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+CfiUnwinder::CfiUnwinder() : m_vecRowCache(ulRowCacheSlots)
+#if defined(__linux__) && defined(__x86_64__)
+    , m_iProcessId{ 0 }, m_vecStack(ulMaxStackSize)
+#endif
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool CfiUnwinder::AddModule(const uint64_t ullLoadAddress, const uint8_t * const pElf, const size_t ulSize)
+{
+    //ELF64, little endian, x64
+    if (ulSize < 0x40 || memcmp(pElf, "\x7F" "ELF", 4) != 0 || pElf[4] != 2 || pElf[5] != 1 ||
+        ReadAt<uint16_t>(pElf, ulSize, 0x12) != 0x3E)
+    {
+        return false;
+    }
+
+    const uint64_t ullProgramHeaders = ReadAt<uint64_t>(pElf, ulSize, 0x20);
+    const uint16_t usProgramHeaderSize = ReadAt<uint16_t>(pElf, ulSize, 0x36);
+    const uint16_t usProgramHeaderCount = ReadAt<uint16_t>(pElf, ulSize, 0x38);
+
+    //The segment that maps the start of the file gives the bias, and the loaded range covers every segment
+    bool bHasBias = false;
+    uint64_t ullBias = 0;
+    uint64_t ullEnd = 0;
+    uint64_t ullHeaderOffset = 0;
+    uint64_t ullHeaderAddress = 0;
+    for (uint16_t i = 0; i < usProgramHeaderCount; ++i)
+    {
+        const uint64_t ullHeader = ullProgramHeaders + (uint64_t)i * usProgramHeaderSize;
+        const uint32_t uiType = ReadAt<uint32_t>(pElf, ulSize, ullHeader);
+        const uint64_t ullOffset = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x08);
+        const uint64_t ullAddress = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x10);
+        const uint64_t ullMemorySize = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x28);
+        if (uiType == uiProgramLoad)
+        {
+            if (!bHasBias && ullOffset == 0)
+            {
+                ullBias = ullLoadAddress - ullAddress;
+                bHasBias = true;
+            }
+            ullEnd = std::max(ullEnd, ullAddress + ullMemorySize);
+        }
+        else if (uiType == uiProgramEhFrameHeader)
+        {
+            ullHeaderOffset = ullOffset;
+            ullHeaderAddress = ullAddress;
+        }
+    }
+    if (!bHasBias)
+    {
+        return false;
+    }
+
+    //Find .eh_frame through the section table, or through .eh_frame_hdr when sections have been stripped
+    uint64_t ullFrameOffset = 0;
+    uint64_t ullFrameSize = 0;
+    uint64_t ullFrameAddress = 0;
+    const uint64_t ullSectionHeaders = ReadAt<uint64_t>(pElf, ulSize, 0x28);
+    const uint16_t usSectionHeaderSize = ReadAt<uint16_t>(pElf, ulSize, 0x3A);
+    const uint16_t usSectionHeaderCount = ReadAt<uint16_t>(pElf, ulSize, 0x3C);
+    const uint16_t usStringSection = ReadAt<uint16_t>(pElf, ulSize, 0x3E);
+    if (ullSectionHeaders != 0 && usStringSection < usSectionHeaderCount)
+    {
+        const uint64_t ullStrings = ReadAt<uint64_t>(pElf, ulSize,
+            ullSectionHeaders + (uint64_t)usStringSection * usSectionHeaderSize + 0x18);
+        for (uint16_t i = 0; i < usSectionHeaderCount; ++i)
+        {
+            const uint64_t ullHeader = ullSectionHeaders + (uint64_t)i * usSectionHeaderSize;
+            const uint64_t ullName = ullStrings + ReadAt<uint32_t>(pElf, ulSize, ullHeader);
+            if (ullName < ulSize && ulSize - ullName > 9 && memcmp(&pElf[ullName], ".eh_frame", 10) == 0 &&
+                ReadAt<uint32_t>(pElf, ulSize, ullHeader + 0x04) != uiSectionNoBits)
+            {
+                ullFrameAddress = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x10);
+                ullFrameOffset = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x18);
+                ullFrameSize = ReadAt<uint64_t>(pElf, ulSize, ullHeader + 0x20);
+                break;
+            }
+        }
+    }
+
+    if (ullFrameSize == 0 && ullHeaderOffset != 0 && ullHeaderOffset + 8 <= ulSize)
+    {
+        //Without a size the entries are walked up to their zero terminator, bounded by the end of the file. Both
+        //sections live in the same segment, so the header's address to offset delta applies to .eh_frame too.
+        const uint64_t ullDelta = ullHeaderAddress - ullHeaderOffset;
+        Reader reader = { pElf, (size_t)ullHeaderOffset + 4, ulSize, true };
+        const uint8_t cEncoding = pElf[ullHeaderOffset + 1];
+        uint64_t ullPointer = 0;
+        if (pElf[ullHeaderOffset] == 1 && reader.ReadEncoded(cEncoding, ullDelta, 0, ullPointer) &&
+            ullPointer - ullDelta < ulSize)
+        {
+            ullFrameAddress = ullPointer;
+            ullFrameOffset = ullPointer - ullDelta;
+            ullFrameSize = ulSize - ullFrameOffset;
+        }
+    }
+
+    if (ullFrameSize == 0 || ullFrameOffset > ulSize || ulSize - ullFrameOffset < ullFrameSize)
+    {
+        return false;
+    }
+
+    ModuleEntry module;
+    module.ullBias = ullBias;
+    module.ullEnd = ullBias + ullEnd;
+    module.vecFrameData.assign(&pElf[ullFrameOffset], &pElf[ullFrameOffset] + ullFrameSize);
+    if (!ParseFrameData(module, ullFrameAddress))
+    {
+        return false;
+    }
+
+    //Rows for an address range that now belongs to a different module would be wrong
+    m_mapModules[ullLoadAddress] = std::move(module);
+    std::fill(m_vecRowCache.begin(), m_vecRowCache.end(), UnwindRow{ 0 });
+    return true;
+}
+
+const bool CfiUnwinder::AddModuleFile(const uint64_t ullLoadAddress, const char * const pPath)
+{
+    FILE *pFile = fopen(pPath, "rb");
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", pPath);
+        return false;
+    }
+
+    std::vector<uint8_t> vecFile;
+    if (fseek(pFile, 0, SEEK_END) == 0)
+    {
+        const long lSize = ftell(pFile);
+        if (lSize > 0 && fseek(pFile, 0, SEEK_SET) == 0)
+        {
+            vecFile.resize((size_t)lSize);
+            vecFile.resize(fread(vecFile.data(), 1, vecFile.size(), pFile));
+        }
+    }
+    fclose(pFile);
+
+    return !vecFile.empty() && AddModule(ullLoadAddress, vecFile.data(), vecFile.size());
+}
+
+void CfiUnwinder::RemoveModule(const uint64_t ullLoadAddress)
+{
+    if (m_mapModules.erase(ullLoadAddress) != 0)
+    {
+        std::fill(m_vecRowCache.begin(), m_vecRowCache.end(), UnwindRow{ 0 });
+    }
+}
+
+const size_t CfiUnwinder::Capture(const uint64_t * const pRegisters, const uint8_t * const pStack, const size_t ulStackSize,
+    const uint64_t ullStackAddress, CfiFrame * const pFrames, const size_t ulMaxFrames, const eMode mode)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    auto ReadStack = [&](const uint64_t ullAddress, uint64_t &ullValue)
+    {
+        if (ullAddress < ullStackAddress || ullAddress - ullStackAddress > ulStackSize ||
+            ulStackSize - (ullAddress - ullStackAddress) < sizeof(uint64_t))
+        {
+            return false;
+        }
+        memcpy(&ullValue, &pStack[ullAddress - ullStackAddress], sizeof(uint64_t));
+        return true;
+    };
+
+    //Only callee-saved registers survive past the first frame, so track which values are still known
+    uint64_t pCurrent[ulRegisterCount] = { 0 };
+    memcpy(pCurrent, pRegisters, sizeof(pCurrent));
+    uint32_t uiValid = (1u << ulRegisterCount) - 1;
+
+    size_t ulFrames = 0;
+    bool bIsExactPc = true;
+    while (ulFrames < ulMaxFrames && pCurrent[ulRegisterReturn] != 0)
+    {
+        pFrames[ulFrames].ullInstruction = pCurrent[ulRegisterReturn];
+        pFrames[ulFrames].ullStack = pCurrent[ulRegisterRsp];
+        ++ulFrames;
+
+        //Return addresses can be just past a call at the very end of a function, so look those up by the call itself
+        const uint64_t ullPc = pCurrent[ulRegisterReturn] - (bIsExactPc ? 0 : 1);
+        const UnwindRow * const pRow = (mode == eMode::eCfi) ? FindRow(ullPc) : nullptr;
+
+        uint64_t pNext[ulRegisterCount] = { 0 };
+        uint32_t uiNextValid = 0;
+        if (pRow != nullptr && pRow->bIsValid && pRow->uiCfaRegister < ulRegisterCount &&
+            (uiValid & (1u << pRow->uiCfaRegister)) != 0)
+        {
+            const uint64_t ullCfa = pCurrent[pRow->uiCfaRegister] + (int64_t)pRow->iCfaOffset;
+            for (size_t i = 0; i < ulRegisterCount; ++i)
+            {
+                const RegisterRule &rule = pRow->rules[i];
+                switch (rule.rule)
+                {
+                case eRule::eSameValue:
+                    pNext[i] = pCurrent[i];
+                    uiNextValid |= uiValid & (1u << i);
+                    break;
+                case eRule::eOffset:
+                    if (ReadStack(ullCfa + (int64_t)rule.iValue, pNext[i]))
+                    {
+                        uiNextValid |= 1u << i;
+                    }
+                    break;
+                case eRule::eValueOffset:
+                    pNext[i] = ullCfa + (int64_t)rule.iValue;
+                    uiNextValid |= 1u << i;
+                    break;
+                case eRule::eRegister:
+                    pNext[i] = pCurrent[rule.iValue];
+                    uiNextValid |= (uiValid & (1u << rule.iValue)) != 0 ? (1u << i) : 0;
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            //An undefined return address marks the outermost frame
+            if ((uiNextValid & (1u << ulRegisterReturn)) == 0)
+            {
+                break;
+            }
+            if (pRow->rules[ulRegisterRsp].rule == eRule::eSameValue)
+            {
+                pNext[ulRegisterRsp] = ullCfa;
+                uiNextValid |= 1u << ulRegisterRsp;
+            }
+            bIsExactPc = pRow->bIsSignalFrame;
+            ++m_stats.ullCfiFrames;
+        }
+        else
+        {
+            const uint64_t ullFrame = pCurrent[ulRegisterRbp];
+            if ((uiValid & (1u << ulRegisterRbp)) == 0 || ullFrame < pCurrent[ulRegisterRsp] ||
+                !ReadStack(ullFrame, pNext[ulRegisterRbp]) || !ReadStack(ullFrame + 8, pNext[ulRegisterReturn]))
+            {
+                break;
+            }
+            pNext[ulRegisterRsp] = ullFrame + 16;
+            uiNextValid = (1u << ulRegisterRbp) | (1u << ulRegisterRsp) | (1u << ulRegisterReturn);
+            bIsExactPc = false;
+            ++m_stats.ullFramePointerFrames;
+        }
+
+        //Every frame sits above the one it called, so anything else is a corrupt stack or a bad rule
+        if ((uiNextValid & (1u << ulRegisterRsp)) == 0 || pNext[ulRegisterRsp] <= pCurrent[ulRegisterRsp])
+        {
+            break;
+        }
+        memcpy(pCurrent, pNext, sizeof(pCurrent));
+        uiValid = uiNextValid;
+    }
+
+    ++m_stats.ullCaptures;
+    m_stats.ullFrames += ulFrames;
+    m_stats.dMicroseconds += (double)ElapsedMicroseconds(start);
+
+    return ulFrames;
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+const bool CfiUnwinder::LoadProcessModules(const int iProcessId)
+{
+    m_iProcessId = iProcessId;
+
+    char strPath[64] = { 0 };
+    snprintf(strPath, sizeof(strPath), "/proc/%i/maps", iProcessId);
+    FILE *pMaps = fopen(strPath, "r");
+    if (pMaps == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", strPath);
+        return false;
+    }
+
+    //Each image is loaded at the mapping that covers the start of its file
+    char strLine[4096] = { 0 };
+    while (fgets(strLine, sizeof(strLine), pMaps) != nullptr)
+    {
+        unsigned long long ullBegin = 0;
+        unsigned long long ullEnd = 0;
+        unsigned long long ullOffset = 0;
+        char strPermissions[8] = { 0 };
+        int iPathStart = 0;
+        if (sscanf(strLine, "%llx-%llx %7s %llx %*s %*s %n", &ullBegin, &ullEnd, strPermissions, &ullOffset, &iPathStart) < 4 ||
+            strPermissions[0] != 'r' || ullOffset != 0 || m_mapModules.find(ullBegin) != m_mapModules.end())
+        {
+            continue;
+        }
+
+        char * const pName = &strLine[iPathStart];
+        pName[strcspn(pName, "\n")] = '\0';
+        if (pName[0] == '/')
+        {
+            (void)AddModuleFile(ullBegin, pName);
+        }
+        else if (strcmp(pName, "[vdso]") == 0)
+        {
+            std::vector<uint8_t> vecImage((size_t)(ullEnd - ullBegin));
+            iovec local = { vecImage.data(), vecImage.size() };
+            iovec remote = { (void *)ullBegin, vecImage.size() };
+            if (process_vm_readv(iProcessId, &local, 1, &remote, 1, 0) == (ssize_t)vecImage.size())
+            {
+                (void)AddModule(ullBegin, vecImage.data(), vecImage.size());
+            }
+        }
+    }
+    fclose(pMaps);
+
+    return ReadMappings(iProcessId);
+}
+
+const bool CfiUnwinder::ReadMappings(const int iProcessId)
+{
+    char strPath[64] = { 0 };
+    snprintf(strPath, sizeof(strPath), "/proc/%i/maps", iProcessId);
+    FILE *pMaps = fopen(strPath, "r");
+    if (pMaps == nullptr)
+    {
+        return false;
+    }
+
+    m_vecMappings.clear();
+    char strLine[4096] = { 0 };
+    while (fgets(strLine, sizeof(strLine), pMaps) != nullptr)
+    {
+        unsigned long long ullBegin = 0;
+        unsigned long long ullEnd = 0;
+        char strPermissions[8] = { 0 };
+        if (sscanf(strLine, "%llx-%llx %7s", &ullBegin, &ullEnd, strPermissions) == 3 && strPermissions[0] == 'r')
+        {
+            m_vecMappings.push_back(Mapping{ ullBegin, ullEnd });
+        }
+    }
+    fclose(pMaps);
+
+    return true;
+}
+
+const size_t CfiUnwinder::CaptureThread(const int iThreadId, CfiFrame * const pFrames, const size_t ulMaxFrames, const eMode mode)
+{
+    user_regs_struct regs = { 0 };
+    if (ptrace(PTRACE_GETREGS, iThreadId, nullptr, &regs) == -1)
+    {
+        fprintf(stderr, "Could not get registers of thread %i.\n", iThreadId);
+        return 0;
+    }
+
+    const uint64_t pRegisters[ulRegisterCount] = { regs.rax, regs.rdx, regs.rcx, regs.rbx, regs.rsi, regs.rdi,
+        regs.rbp, regs.rsp, regs.r8, regs.r9, regs.r10, regs.r11, regs.r12, regs.r13, regs.r14, regs.r15, regs.rip };
+
+    //Read from the stack pointer to the end of its mapping in one go; the mappings are only refreshed on a miss
+    auto FindMapping = [&]()
+    {
+        return std::find_if(m_vecMappings.begin(), m_vecMappings.end(), [&](const Mapping &mapping)
+        {
+            return regs.rsp >= mapping.ullBegin && regs.rsp < mapping.ullEnd;
+        });
+    };
+    auto iter = FindMapping();
+    if (iter == m_vecMappings.end() && ReadMappings(m_iProcessId))
+    {
+        iter = FindMapping();
+    }
+    if (iter == m_vecMappings.end())
+    {
+        return 0;
+    }
+
+    const size_t ulSize = (size_t)std::min<uint64_t>(iter->ullEnd - regs.rsp, m_vecStack.size());
+    iovec local = { m_vecStack.data(), ulSize };
+    iovec remote = { (void *)regs.rsp, ulSize };
+    const ssize_t lBytesRead = process_vm_readv(m_iProcessId, &local, 1, &remote, 1, 0);
+    if (lBytesRead <= 0)
+    {
+        fprintf(stderr, "Could not read stack of thread %i.\n", iThreadId);
+        return 0;
+    }
+    m_stats.ullStackBytes += (uint64_t)lBytesRead;
+
+    return Capture(pRegisters, m_vecStack.data(), (size_t)lBytesRead, regs.rsp, pFrames, ulMaxFrames, mode);
+}
+
+void CfiUnwinder::Benchmark(const int iThreadId, const size_t ulIterations)
+{
+    std::vector<CfiFrame> vecFrames(4096);
+    for (const eMode mode : { eMode::eFramePointer, eMode::eCfi })
+    {
+        size_t ulFrames = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ulIterations; ++i)
+        {
+            ulFrames += CaptureThread(iThreadId, vecFrames.data(), vecFrames.size(), mode);
+        }
+        const double dSeconds = (double)ElapsedMicroseconds(start) / 1000000.0;
+        fprintf(stderr, "%s: %zu stacks of %.1f frames in %.3f seconds, %.0f stacks per second.\n",
+            (mode == eMode::eCfi) ? "CFI" : "Frame pointer", ulIterations,
+            (ulIterations != 0) ? (double)ulFrames / ulIterations : 0.0, dSeconds, (dSeconds > 0.0) ? ulIterations / dSeconds : 0.0);
+    }
+}
+#endif
+
+void CfiUnwinder::PrintStats() const
+{
+    size_t ulFrameEntries = 0;
+    for (auto &module : m_mapModules)
+    {
+        ulFrameEntries += module.second.vecFrameEntries.size();
+    }
+
+    const unsigned long long ullCaptures = m_stats.ullCaptures;
+    const unsigned long long ullLookups = m_stats.ullRowHits + m_stats.ullRowMisses;
+    fprintf(stderr, "CFI unwinder: %zu modules, %zu FDEs. %llu captures, %.2f us and %.1f frames per capture "
+        "(%llu CFI, %llu frame pointer), %.1f%% row cache hits, %llu stack bytes read.\n", m_mapModules.size(),
+        ulFrameEntries, ullCaptures, (ullCaptures != 0) ? m_stats.dMicroseconds / ullCaptures : 0.0,
+        (ullCaptures != 0) ? (double)m_stats.ullFrames / ullCaptures : 0.0, m_stats.ullCfiFrames,
+        m_stats.ullFramePointerFrames, (ullLookups != 0) ? (100.0 * m_stats.ullRowHits) / ullLookups : 0.0,
+        m_stats.ullStackBytes);
+}
+
+const CfiUnwinder::UnwindRow * const CfiUnwinder::FindRow(const uint64_t ullPc)
+{
+    UnwindRow &slot = m_vecRowCache[(size_t)((ullPc * 0x9E3779B97F4A7C15ULL) >> 52) & (ulRowCacheSlots - 1)];
+    if (slot.ullPc == ullPc)
+    {
+        ++m_stats.ullRowHits;
+        return &slot;
+    }
+    ++m_stats.ullRowMisses;
+
+    //Rows that have no CFI are cached as well so the frame pointer fallback does not search again
+    slot.ullPc = ullPc;
+    slot.bIsValid = false;
+
+    auto moduleIter = m_mapModules.upper_bound(ullPc);
+    if (moduleIter == m_mapModules.begin())
+    {
+        return &slot;
+    }
+    --moduleIter;
+    const ModuleEntry &module = moduleIter->second;
+    if (ullPc >= module.ullEnd)
+    {
+        return &slot;
+    }
+
+    const uint64_t ullLinkedPc = ullPc - module.ullBias;
+    auto frameIter = std::upper_bound(module.vecFrameEntries.begin(), module.vecFrameEntries.end(), ullLinkedPc,
+        [](const uint64_t ullValue, const FrameEntry &frame)
+    {
+        return ullValue < frame.ullBegin;
+    });
+    if (frameIter == module.vecFrameEntries.begin())
+    {
+        return &slot;
+    }
+    --frameIter;
+    if (ullLinkedPc < frameIter->ullEnd)
+    {
+        slot.bIsValid = ComputeRow(module, *frameIter, ullLinkedPc, slot);
+    }
+
+    return &slot;
+}
+
+const bool CfiUnwinder::ComputeRow(const ModuleEntry &module, const FrameEntry &frame, const uint64_t ullPc, UnwindRow &row) const
+{
+    const CommonEntry &common = module.vecCommonEntries[frame.uiCommonEntry];
+    if (common.uiReturnRegister != ulRegisterReturn)
+    {
+        return false;
+    }
+
+    //Registers the CIE says nothing about are assumed to be preserved, which is what compilers rely on
+    row.uiCfaRegister = uiNoCfaRegister;
+    row.iCfaOffset = 0;
+    row.bIsSignalFrame = common.bIsSignalFrame;
+    for (auto &rule : row.rules)
+    {
+        rule = RegisterRule{ eRule::eSameValue, 0 };
+    }
+
+    uint64_t ullLocation = frame.ullBegin;
+    if (!ExecuteInstructions(module, common, common.uiInstructions, common.uiInstructionsEnd, ullPc, ullLocation, row, row))
+    {
+        return false;
+    }
+
+    const UnwindRow initialRow = row;
+    return ExecuteInstructions(module, common, frame.uiInstructions, frame.uiInstructionsEnd, ullPc, ullLocation,
+        initialRow, row) && row.uiCfaRegister != uiNoCfaRegister;
+}
+
+const bool CfiUnwinder::ExecuteInstructions(const ModuleEntry &module, const CommonEntry &common, const uint32_t uiBegin,
+    const uint32_t uiEnd, const uint64_t ullPc, uint64_t &ullLocation, const UnwindRow &initialRow, UnwindRow &row) const
+{
+    Reader reader = { module.vecFrameData.data(), uiBegin, uiEnd, true };
+
+    UnwindRow pStates[ulMaxRememberedStates];
+    size_t ulStates = 0;
+
+    auto SetRule = [&](const uint64_t ullRegister, const eRule rule, const int64_t llValue)
+    {
+        if (ullRegister < ulRegisterCount)
+        {
+            row.rules[ullRegister] = RegisterRule{ rule, (int32_t)llValue };
+        }
+    };
+    auto Advance = [&](const uint64_t ullDelta)
+    {
+        ullLocation += ullDelta * common.ullCodeAlignment;
+        return ullLocation <= ullPc;
+    };
+
+    while (reader.bIsValid && reader.ulPosition < reader.ulEnd)
+    {
+        const uint8_t cInstruction = reader.Read<uint8_t>();
+        const uint8_t cOperand = cInstruction & 0x3F;
+        uint64_t ullRegister = 0;
+        uint64_t ullValue = 0;
+
+        switch (cInstruction & 0xC0)
+        {
+        case cCfaAdvanceLocation:
+            if (!Advance(cOperand))
+            {
+                return true;
+            }
+            continue;
+        case cCfaOffset:
+            SetRule(cOperand, eRule::eOffset, (int64_t)reader.ReadUleb128() * common.llDataAlignment);
+            continue;
+        case cCfaRestore:
+            SetRule(cOperand, initialRow.rules[std::min<size_t>(cOperand, ulRegisterCount - 1)].rule,
+                initialRow.rules[std::min<size_t>(cOperand, ulRegisterCount - 1)].iValue);
+            continue;
+        default:
+            break;
+        }
+
+        switch (cInstruction)
+        {
+        case cCfaNop:
+            break;
+        case cCfaSetLocation:
+            if (!reader.ReadEncoded(common.uiPointerEncoding, 0, 0, ullValue))
+            {
+                return false;
+            }
+            ullLocation = ullValue;
+            if (ullLocation > ullPc)
+            {
+                return true;
+            }
+            break;
+        case cCfaAdvanceLocation1:
+            if (!Advance(reader.Read<uint8_t>()))
+            {
+                return true;
+            }
+            break;
+        case cCfaAdvanceLocation2:
+            if (!Advance(reader.Read<uint16_t>()))
+            {
+                return true;
+            }
+            break;
+        case cCfaAdvanceLocation4:
+            if (!Advance(reader.Read<uint32_t>()))
+            {
+                return true;
+            }
+            break;
+        case cCfaOffsetExtended:
+            ullRegister = reader.ReadUleb128();
+            SetRule(ullRegister, eRule::eOffset, (int64_t)reader.ReadUleb128() * common.llDataAlignment);
+            break;
+        case cCfaOffsetExtendedSigned:
+            ullRegister = reader.ReadUleb128();
+            SetRule(ullRegister, eRule::eOffset, reader.ReadSleb128() * common.llDataAlignment);
+            break;
+        case cCfaGnuNegativeOffsetExtended:
+            ullRegister = reader.ReadUleb128();
+            SetRule(ullRegister, eRule::eOffset, -(int64_t)reader.ReadUleb128() * common.llDataAlignment);
+            break;
+        case cCfaValueOffset:
+            ullRegister = reader.ReadUleb128();
+            SetRule(ullRegister, eRule::eValueOffset, (int64_t)reader.ReadUleb128() * common.llDataAlignment);
+            break;
+        case cCfaValueOffsetSigned:
+            ullRegister = reader.ReadUleb128();
+            SetRule(ullRegister, eRule::eValueOffset, reader.ReadSleb128() * common.llDataAlignment);
+            break;
+        case cCfaRestoreExtended:
+            ullRegister = reader.ReadUleb128();
+            if (ullRegister < ulRegisterCount)
+            {
+                row.rules[ullRegister] = initialRow.rules[ullRegister];
+            }
+            break;
+        case cCfaUndefined:
+            SetRule(reader.ReadUleb128(), eRule::eUndefined, 0);
+            break;
+        case cCfaSameValue:
+            SetRule(reader.ReadUleb128(), eRule::eSameValue, 0);
+            break;
+        case cCfaRegister:
+            ullRegister = reader.ReadUleb128();
+            ullValue = reader.ReadUleb128();
+            SetRule(ullRegister, (ullValue < ulRegisterCount) ? eRule::eRegister : eRule::eUnsupported, (int64_t)ullValue);
+            break;
+        case cCfaRememberState:
+            if (ulStates == ulMaxRememberedStates)
+            {
+                return false;
+            }
+            pStates[ulStates++] = row;
+            break;
+        case cCfaRestoreState:
+            if (ulStates == 0)
+            {
+                return false;
+            }
+            row = pStates[--ulStates];
+            break;
+        case cCfaDefineCfa:
+            row.uiCfaRegister = (uint32_t)reader.ReadUleb128();
+            row.iCfaOffset = (int32_t)reader.ReadUleb128();
+            break;
+        case cCfaDefineCfaSigned:
+            row.uiCfaRegister = (uint32_t)reader.ReadUleb128();
+            row.iCfaOffset = (int32_t)(reader.ReadSleb128() * common.llDataAlignment);
+            break;
+        case cCfaDefineCfaRegister:
+            row.uiCfaRegister = (uint32_t)reader.ReadUleb128();
+            break;
+        case cCfaDefineCfaOffset:
+            row.iCfaOffset = (int32_t)reader.ReadUleb128();
+            break;
+        case cCfaDefineCfaOffsetSigned:
+            row.iCfaOffset = (int32_t)(reader.ReadSleb128() * common.llDataAlignment);
+            break;
+        case cCfaDefineCfaExpression:
+            //DWARF expressions (PLT stubs, realigned stacks) are left to the frame pointer fallback
+            row.uiCfaRegister = uiNoCfaRegister;
+            reader.ulPosition += (size_t)reader.ReadUleb128();
+            break;
+        case cCfaExpression:
+        case cCfaValueExpression:
+            SetRule(reader.ReadUleb128(), eRule::eUnsupported, 0);
+            reader.ulPosition += (size_t)reader.ReadUleb128();
+            break;
+        case cCfaGnuArgumentsSize:
+            (void)reader.ReadUleb128();
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return reader.bIsValid;
+}
+
+const bool CfiUnwinder::ParseCommonEntry(const uint8_t * const pData, const size_t ulSize, const size_t ulOffset,
+    CommonEntry &common)
+{
+    Reader reader = { pData, ulOffset, ulSize, true };
+    uint64_t ullLength = reader.Read<uint32_t>();
+    if (ullLength == 0xFFFFFFFF)
+    {
+        ullLength = reader.Read<uint64_t>();
+    }
+    if (!reader.Has((size_t)ullLength))
+    {
+        return false;
+    }
+    reader.ulEnd = reader.ulPosition + (size_t)ullLength;
+    if (reader.Read<uint32_t>() != 0)
+    {
+        return false;
+    }
+
+    const uint8_t cVersion = reader.Read<uint8_t>();
+    const char * const pAugmentation = (const char *)&pData[reader.ulPosition];
+    while (reader.Has(1) && pData[reader.ulPosition] != '\0')
+    {
+        ++reader.ulPosition;
+    }
+    ++reader.ulPosition;
+    if (strncmp(pAugmentation, "eh", 2) == 0)
+    {
+        (void)reader.Read<uint64_t>();
+    }
+    if (cVersion >= 4)
+    {
+        (void)reader.Read<uint16_t>();
+    }
+
+    memset(&common, 0, sizeof(CommonEntry));
+    common.ullCodeAlignment = reader.ReadUleb128();
+    common.llDataAlignment = reader.ReadSleb128();
+    common.uiReturnRegister = (cVersion == 1) ? reader.Read<uint8_t>() : (uint32_t)reader.ReadUleb128();
+    common.uiPointerEncoding = cEncodingAbsolute;
+
+    if (pAugmentation[0] == 'z')
+    {
+        common.bHasAugmentationData = true;
+        const uint64_t ullAugmentationSize = reader.ReadUleb128();
+        if (!reader.Has((size_t)ullAugmentationSize))
+        {
+            return false;
+        }
+        const size_t ulAugmentationEnd = reader.ulPosition + (size_t)ullAugmentationSize;
+        for (const char *pCurrent = &pAugmentation[1]; *pCurrent != '\0'; ++pCurrent)
+        {
+            uint64_t ullIgnored = 0;
+            if (*pCurrent == 'R')
+            {
+                common.uiPointerEncoding = reader.Read<uint8_t>();
+            }
+            else if (*pCurrent == 'L')
+            {
+                (void)reader.Read<uint8_t>();
+            }
+            else if (*pCurrent == 'P')
+            {
+                //Only the size matters here, so the personality routine's address is never resolved
+                const uint8_t cEncoding = reader.Read<uint8_t>() & 0x0F;
+                (void)reader.ReadEncoded(cEncoding, 0, 0, ullIgnored);
+            }
+            else if (*pCurrent == 'S')
+            {
+                common.bIsSignalFrame = true;
+            }
+            else if (*pCurrent != 'B')
+            {
+                break;
+            }
+        }
+        reader.ulPosition = ulAugmentationEnd;
+    }
+
+    common.uiInstructions = (uint32_t)reader.ulPosition;
+    common.uiInstructionsEnd = (uint32_t)reader.ulEnd;
+    return reader.bIsValid && common.uiInstructions <= common.uiInstructionsEnd;
+}
+
+const bool CfiUnwinder::ParseFrameData(ModuleEntry &module, const uint64_t ullAddress) const
+{
+    const uint8_t * const pData = module.vecFrameData.data();
+    const size_t ulSize = module.vecFrameData.size();
+
+    //CIEs are shared by many FDEs, so each one is parsed once and found again by its offset
+    std::map<size_t, uint32_t> mapCommonEntries;
+
+    size_t ulOffset = 0;
+    while (ulOffset + sizeof(uint32_t) <= ulSize)
+    {
+        Reader reader = { pData, ulOffset, ulSize, true };
+        uint64_t ullLength = reader.Read<uint32_t>();
+        if (ullLength == 0)
+        {
+            break;
+        }
+        if (ullLength == 0xFFFFFFFF)
+        {
+            ullLength = reader.Read<uint64_t>();
+        }
+        if (!reader.Has((size_t)ullLength))
+        {
+            break;
+        }
+        const size_t ulNext = reader.ulPosition + (size_t)ullLength;
+        reader.ulEnd = ulNext;
+
+        const size_t ulIdentifier = reader.ulPosition;
+        const uint32_t uiCommonPointer = reader.Read<uint32_t>();
+        if (uiCommonPointer != 0 && uiCommonPointer <= ulIdentifier)
+        {
+            const size_t ulCommonOffset = ulIdentifier - uiCommonPointer;
+            auto iter = mapCommonEntries.find(ulCommonOffset);
+            if (iter == mapCommonEntries.end())
+            {
+                CommonEntry common = { 0 };
+                if (!ParseCommonEntry(pData, ulSize, ulCommonOffset, common))
+                {
+                    ulOffset = ulNext;
+                    continue;
+                }
+                module.vecCommonEntries.push_back(common);
+                iter = mapCommonEntries.insert(std::make_pair(ulCommonOffset, (uint32_t)(module.vecCommonEntries.size() - 1))).first;
+            }
+
+            const CommonEntry &common = module.vecCommonEntries[iter->second];
+            FrameEntry frame = { 0 };
+            uint64_t ullRange = 0;
+            if (reader.ReadEncoded(common.uiPointerEncoding, ullAddress, 0, frame.ullBegin) &&
+                reader.ReadEncoded(common.uiPointerEncoding & 0x0F, 0, 0, ullRange) && ullRange != 0)
+            {
+                if (common.bHasAugmentationData)
+                {
+                    reader.ulPosition += (size_t)reader.ReadUleb128();
+                }
+                frame.ullEnd = frame.ullBegin + ullRange;
+                frame.uiInstructions = (uint32_t)reader.ulPosition;
+                frame.uiInstructionsEnd = (uint32_t)ulNext;
+                frame.uiCommonEntry = iter->second;
+                if (reader.bIsValid && frame.uiInstructions <= frame.uiInstructionsEnd)
+                {
+                    module.vecFrameEntries.push_back(frame);
+                }
+            }
+        }
+
+        ulOffset = ulNext;
+    }
+
+    std::sort(module.vecFrameEntries.begin(), module.vecFrameEntries.end(), [](const FrameEntry &left, const FrameEntry &right)
+    {
+        return left.ullBegin < right.ullBegin;
+    });
+
+    return !module.vecFrameEntries.empty();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace CodeReversing
+{
+
+struct CfiFrame
+{
+    uint64_t ullInstruction;
+    uint64_t ullStack;
+};
+
+//Stack capture for x64 ELF targets. Each module's .eh_frame is parsed once into a sorted FDE index and the CFA and
+//register rules computed for a PC are kept in a direct-mapped cache, so repeated samples of the same code skip the
+//CFI interpreter. Frames without CFI fall back to the RBP chain, which is also available on its own as a fast path.
+//The unwinder itself only works on a copy of the stack and does not depend on any OS; the Linux front end reads that
+//copy with a single process_vm_readv.
+class CfiUnwinder final
+{
+public:
+    enum class eMode
+    {
+        eFramePointer,
+        eCfi
+    };
+
+    //DWARF x64 register numbering: rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp, r8-r15, then the return address column
+    static const size_t ulRegisterCount = 17;
+    static const size_t ulRegisterRbp = 6;
+    static const size_t ulRegisterRsp = 7;
+    static const size_t ulRegisterReturn = 16;
+
+    CfiUnwinder();
+
+    CfiUnwinder(const CfiUnwinder &copy) = delete;
+    CfiUnwinder &operator=(const CfiUnwinder &copy) = delete;
+
+    ~CfiUnwinder() = default;
+
+    //ullLoadAddress is where the start of the file is mapped. pRegisters for Capture is in DWARF order with the
+    //instruction pointer in the return address column.
+    const bool AddModule(const uint64_t ullLoadAddress, const uint8_t * const pElf, const size_t ulSize);
+    const bool AddModuleFile(const uint64_t ullLoadAddress, const char * const pPath);
+    void RemoveModule(const uint64_t ullLoadAddress);
+
+    const size_t Capture(const uint64_t * const pRegisters, const uint8_t * const pStack, const size_t ulStackSize,
+        const uint64_t ullStackAddress, CfiFrame * const pFrames, const size_t ulMaxFrames, const eMode mode);
+
+#if defined(__linux__) && defined(__x86_64__)
+    //Loads every mapped ELF image of the process, including the vDSO
+    const bool LoadProcessModules(const int iProcessId);
+
+    //The thread has to be in a ptrace stop
+    const size_t CaptureThread(const int iThreadId, CfiFrame * const pFrames, const size_t ulMaxFrames, const eMode mode);
+    void Benchmark(const int iThreadId, const size_t ulIterations);
+#endif
+
+    void PrintStats() const;
+
+private:
+    enum class eRule : uint8_t
+    {
+        eUndefined,
+        eSameValue,
+        eOffset,
+        eValueOffset,
+        eRegister,
+        eUnsupported
+    };
+
+    struct RegisterRule
+    {
+        eRule rule;
+        int32_t iValue;
+    };
+
+    struct UnwindRow
+    {
+        uint64_t ullPc;
+        uint32_t uiCfaRegister;
+        int32_t iCfaOffset;
+        bool bIsValid;
+        bool bIsSignalFrame;
+        RegisterRule rules[ulRegisterCount];
+    };
+
+    struct CommonEntry
+    {
+        uint32_t uiInstructions;
+        uint32_t uiInstructionsEnd;
+        uint64_t ullCodeAlignment;
+        int64_t llDataAlignment;
+        uint32_t uiReturnRegister;
+        uint8_t uiPointerEncoding;
+        bool bHasAugmentationData;
+        bool bIsSignalFrame;
+    };
+
+    struct FrameEntry
+    {
+        uint64_t ullBegin;
+        uint64_t ullEnd;
+        uint32_t uiInstructions;
+        uint32_t uiInstructionsEnd;
+        uint32_t uiCommonEntry;
+    };
+
+    //Keyed by load address; FDE addresses are kept as linked and the bias is applied on lookup
+    struct ModuleEntry
+    {
+        uint64_t ullBias;
+        uint64_t ullEnd;
+        std::vector<uint8_t> vecFrameData;
+        std::vector<CommonEntry> vecCommonEntries;
+        std::vector<FrameEntry> vecFrameEntries;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullCaptures;
+        unsigned long long ullFrames;
+        unsigned long long ullCfiFrames;
+        unsigned long long ullFramePointerFrames;
+        unsigned long long ullRowHits;
+        unsigned long long ullRowMisses;
+        unsigned long long ullStackBytes;
+        double dMicroseconds;
+    };
+
+    static const size_t ulRowCacheSlots = 4096;
+
+    const UnwindRow * const FindRow(const uint64_t ullPc);
+    const bool ComputeRow(const ModuleEntry &module, const FrameEntry &frame, const uint64_t ullPc, UnwindRow &row) const;
+    const bool ExecuteInstructions(const ModuleEntry &module, const CommonEntry &common, const uint32_t uiBegin,
+        const uint32_t uiEnd, const uint64_t ullPc, uint64_t &ullLocation, const UnwindRow &initialRow, UnwindRow &row) const;
+    const bool ParseFrameData(ModuleEntry &module, const uint64_t ullAddress) const;
+
+    static const bool ParseCommonEntry(const uint8_t * const pData, const size_t ulSize, const size_t ulOffset,
+        CommonEntry &common);
+
+    std::map<uint64_t, ModuleEntry> m_mapModules;
+    std::vector<UnwindRow> m_vecRowCache;
+
+#if defined(__linux__) && defined(__x86_64__)
+    struct Mapping
+    {
+        uint64_t ullBegin;
+        uint64_t ullEnd;
+    };
+
+    const bool ReadMappings(const int iProcessId);
+
+    int m_iProcessId;
+    std::vector<Mapping> m_vecMappings;
+    std::vector<uint8_t> m_vecStack;
+#endif
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "Common.h"
+
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+const DWORD_PTR InstructionPointer(const CONTEXT &ctx)
+{
+#ifdef _M_IX86
+    return ctx.Eip;
+#elif defined _M_AMD64
+    return ctx.Rip;
+#else
+#error "Unsupported architecture"
+#endif
+}
+
+void SetInstructionPointer(CONTEXT &ctx, const DWORD_PTR dwAddress)
+{
+#ifdef _M_IX86
+    ctx.Eip = dwAddress;
+#elif defined _M_AMD64
+    ctx.Rip = dwAddress;
+#else
+#error "Unsupported architecture"
+#endif
+}
+
+const DWORD_PTR StackPointer(const CONTEXT &ctx)
+{
+#ifdef _M_IX86
+    return ctx.Esp;
+#elif defined _M_AMD64
+    return ctx.Rsp;
+#else
+#error "Unsupported architecture"
+#endif
+}
+
+void SetStackPointer(CONTEXT &ctx, const DWORD_PTR dwAddress)
+{
+#ifdef _M_IX86
+    ctx.Esp = dwAddress;
+#elif defined _M_AMD64
+    ctx.Rsp = dwAddress;
+#else
+#error "Unsupported architecture"
+#endif
+}
+
+const double TicksToSeconds(const LONGLONG llTicks)
+{
+    return (double)llTicks / (double)Stopwatch::Frequency();
+}
+
+const double TicksToMicroseconds(const LONGLONG llTicks)
+{
+    return TicksToSeconds(llTicks) * 1000000.0;
+}
+
+const bool IsWritable(const DWORD dwProtect)
+{
+    const DWORD dwWritable = PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    return BOOLIFY(dwProtect & dwWritable);
+}
+
+}
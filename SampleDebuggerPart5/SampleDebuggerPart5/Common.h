@@ -1,3 +1,25 @@
 #pragma once
 
-#define BOOLIFY(x) !!(x)
\ No newline at end of file
+#include <Windows.h>
+
+#define BOOLIFY(x) !!(x)
+
+namespace CodeReversing
+{
+
+//The int 3 written over the first byte of an instruction for a software breakpoint
+const unsigned char cBreakpointOpcode = 0xCC;
+
+//Registers the breakpoint and stepping components move, without an #ifdef at every use
+const DWORD_PTR InstructionPointer(const CONTEXT &ctx);
+void SetInstructionPointer(CONTEXT &ctx, const DWORD_PTR dwAddress);
+const DWORD_PTR StackPointer(const CONTEXT &ctx);
+void SetStackPointer(CONTEXT &ctx, const DWORD_PTR dwAddress);
+
+//Performance counter ticks as returned by Stopwatch::Now
+const double TicksToSeconds(const LONGLONG llTicks);
+const double TicksToMicroseconds(const LONGLONG llTicks);
+
+const bool IsWritable(const DWORD dwProtect);
+
+}
@@ -0,0 +1,384 @@
+#include "ConditionalBreakpoints.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+#ifdef _M_IX86
+const LengthDecoder::eMode decoderMode = LengthDecoder::eMode::e32Bit;
+#elif defined _M_AMD64
+const LengthDecoder::eMode decoderMode = LengthDecoder::eMode::e64Bit;
+#else
+#error "Unsupported architecture"
+#endif
+
+//One allocation granularity, the smallest VirtualAllocEx hands out anyway
+const size_t ulSlotPageSize = 0x10000;
+
+//Half the reach of a rel32, leaving the rest for RIP-relative operands that point some way from the breakpoint
+const DWORD_PTR dwMaxSlotDistance = 0x40000000;
+
+const bool IsNear(const DWORD_PTR dwFirst, const DWORD_PTR dwSecond)
+{
+#ifdef _M_AMD64
+    return ((dwFirst > dwSecond) ? dwFirst - dwSecond : dwSecond - dwFirst) < dwMaxSlotDistance;
+#else
+    return true;
+#endif
+}
+
+const DWORD_PTR AllocateNear(const HANDLE hProcess, const DWORD_PTR dwAddress)
+{
+#ifdef _M_AMD64
+    //Walk down from the code a region at a time and take the top of the first free one
+    DWORD_PTR dwTry = dwAddress & ~(ulSlotPageSize - 1);
+    while (dwTry > ulSlotPageSize && IsNear(dwTry, dwAddress))
+    {
+        MEMORY_BASIC_INFORMATION memoryInfo = { 0 };
+        if (VirtualQueryEx(hProcess, (LPCVOID)dwTry, &memoryInfo, sizeof(memoryInfo)) == 0)
+        {
+            break;
+        }
+        const DWORD_PTR dwRegion = (DWORD_PTR)memoryInfo.BaseAddress;
+        if (memoryInfo.State == MEM_FREE && memoryInfo.RegionSize >= ulSlotPageSize)
+        {
+            const DWORD_PTR dwBase = (dwRegion + memoryInfo.RegionSize - ulSlotPageSize) & ~(ulSlotPageSize - 1);
+            LPVOID pPage = (dwBase >= dwRegion) ? VirtualAllocEx(hProcess, (LPVOID)dwBase, ulSlotPageSize,
+                MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE) : nullptr;
+            if (pPage != nullptr)
+            {
+                return (DWORD_PTR)pPage;
+            }
+        }
+        dwTry = (dwRegion & ~(ulSlotPageSize - 1)) - ulSlotPageSize;
+    }
+    return 0;
+#else
+    return (DWORD_PTR)VirtualAllocEx(hProcess, nullptr, ulSlotPageSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#endif
+}
+
+}
+
+ConditionalBreakpoints::ConditionalBreakpoints(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwSlotPage{ 0 },
+    m_ulSlotsUsed{ 0 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool ConditionalBreakpoints::SetCondition(const DWORD_PTR dwAddress, const char * const pExpression)
+{
+    std::unique_ptr<BreakpointCondition> pCondition = BreakpointCondition::Compile(pExpression);
+    if (pCondition == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ConditionState &state = m_mapConditions[dwAddress];
+    state.pCondition = std::move(pCondition);
+    return true;
+}
+
+const bool ConditionalBreakpoints::SetIgnoreCount(const DWORD_PTR dwAddress, const ULONGLONG ullIgnoreCount)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mapConditions[dwAddress].ullIgnoreCount = ullIgnoreCount;
+    return true;
+}
+
+const bool ConditionalBreakpoints::Clear(const DWORD_PTR dwAddress)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_mapConditions.erase(dwAddress) != 0;
+}
+
+const bool ConditionalBreakpoints::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto condition = m_mapConditions.find(dwAddress);
+    if (condition == m_mapConditions.end())
+    {
+        return false;
+    }
+    Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(dwAddress);
+    if (pBreakpoint == nullptr || !pBreakpoint->IsEnabled())
+    {
+        return false;
+    }
+
+    ConditionState &state = condition->second;
+    ++state.ullHits;
+    ++m_stats.ullHits;
+
+    //Only the registers the condition reads are fetched, along with the control set needed to resume
+    Stopwatch contextClock;
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | ((state.pCondition != nullptr) ? state.pCondition->ContextFlags() : 0);
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        ++m_stats.ullErrors;
+        return false;
+    }
+    m_stats.dContextMicroseconds += contextClock.ElapsedMicroseconds();
+
+    bool bIsMet = true;
+    if (state.pCondition != nullptr && !state.pCondition->Evaluate(m_pDebugger->Handle(), ctx, state.ullHits, bIsMet))
+    {
+        //A condition that cannot be decided stops the thread rather than silently skipping it
+        fprintf(stderr, "Could not evaluate condition at %p, stopping.\n", dwAddress);
+        ++m_stats.ullErrors;
+        return false;
+    }
+    if (bIsMet && state.ullIgnoreCount == 0)
+    {
+        fprintf(stderr, "Condition at %p met on hit %I64u.\n", dwAddress, state.ullHits);
+        ++m_stats.ullStops;
+        m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+        return false;
+    }
+    if (bIsMet)
+    {
+        --state.ullIgnoreCount;
+    }
+
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    const bool bIsInPlace = ResumeInPlace(dwAddress, state, ctx);
+    if (!bIsInPlace)
+    {
+        SetInstructionPointer(ctx, dwAddress);
+        ctx.EFlags |= 0x100;
+        if (!pBreakpoint->Disable())
+        {
+            fprintf(stderr, "Could not remove breakpoint at %p.\n", dwAddress);
+            ++m_stats.ullErrors;
+            return false;
+        }
+    }
+    if (!BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not resume thread %X past %p. Error = %X\n", dbgEvent.dwThreadId, dwAddress, GetLastError());
+        if (!bIsInPlace)
+        {
+            (void)pBreakpoint->Enable();
+        }
+        ++m_stats.ullErrors;
+        return false;
+    }
+    if (bIsInPlace)
+    {
+        ++((state.trampoline.Kind() == Trampoline::eKind::eDisplaced) ? m_stats.ullDisplaced : m_stats.ullEmulated);
+    }
+    else
+    {
+        m_mapRearms[dbgEvent.dwThreadId] = dwAddress;
+        ++m_stats.ullStepped;
+    }
+
+    const LONGLONG llNow = Stopwatch::Now();
+    if (state.ullResumed++ == 0)
+    {
+        state.llFirstResume = llNow;
+    }
+    state.llLastResume = llNow;
+    ++m_stats.ullResumed;
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+
+    return true;
+}
+
+const bool ConditionalBreakpoints::ResumeInPlace(const DWORD_PTR dwAddress, ConditionState &state, CONTEXT &ctx)
+{
+    //Read on every hit so that an instruction patched since the last one never runs from a stale copy. The second read
+    //covers an instruction that ends just short of an unreadable page.
+    const HANDLE hProcess = m_pDebugger->Handle();
+    unsigned char pCode[LengthDecoder::ulMaxInstructionLength] = { 0 };
+    const size_t ulToPageEnd = 0x1000 - (dwAddress & 0xFFF);
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(hProcess, (LPCVOID)dwAddress, pCode, sizeof(pCode), &ulBytesRead)) &&
+        !BOOLIFY(ReadProcessMemory(hProcess, (LPCVOID)dwAddress, pCode, std::min(sizeof(pCode), ulToPageEnd), &ulBytesRead)))
+    {
+        return false;
+    }
+    m_pDebugger->RestoreOriginalBytes(dwAddress, pCode, ulBytesRead);
+
+    Trampoline &trampoline = state.trampoline;
+    if (!trampoline.Matches(dwAddress, pCode, ulBytesRead))
+    {
+        (void)trampoline.Plan(dwAddress, pCode, ulBytesRead, decoderMode);
+        state.dwSlot = 0;
+        state.bIsSlotFailed = false;
+    }
+
+    switch (trampoline.Kind())
+    {
+    case Trampoline::eKind::eDisplaced:
+        if (state.dwSlot == 0 && !state.bIsSlotFailed)
+        {
+            //A slot that cannot be built is not retried until the instruction changes
+            state.bIsSlotFailed = true;
+            const DWORD_PTR dwSlot = AllocateSlot(dwAddress);
+            unsigned char pSlot[Trampoline::ulSlotSize] = { 0 };
+            if (dwSlot == 0 || !trampoline.Relocate(dwSlot, pSlot) ||
+                !BOOLIFY(WriteProcessMemory(hProcess, (LPVOID)dwSlot, pSlot, sizeof(pSlot), nullptr)))
+            {
+                return false;
+            }
+            (void)FlushInstructionCache(hProcess, (LPCVOID)dwSlot, sizeof(pSlot));
+            state.dwSlot = dwSlot;
+            state.bIsSlotFailed = false;
+        }
+        if (state.dwSlot == 0)
+        {
+            return false;
+        }
+        SetInstructionPointer(ctx, state.dwSlot);
+        return true;
+
+    case Trampoline::eKind::eCall:
+    {
+        const DWORD_PTR dwReturn = (DWORD_PTR)trampoline.ReturnAddress();
+        const DWORD_PTR dwStack = StackPointer(ctx) - sizeof(DWORD_PTR);
+        if (!BOOLIFY(WriteProcessMemory(hProcess, (LPVOID)dwStack, &dwReturn, sizeof(DWORD_PTR), nullptr)))
+        {
+            return false;
+        }
+        SetStackPointer(ctx, dwStack);
+        SetInstructionPointer(ctx, (DWORD_PTR)trampoline.Continuation(ctx.EFlags));
+        return true;
+    }
+
+    case Trampoline::eKind::eJump:
+    case Trampoline::eKind::eConditional:
+        SetInstructionPointer(ctx, (DWORD_PTR)trampoline.Continuation(ctx.EFlags));
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+const DWORD_PTR ConditionalBreakpoints::AllocateSlot(const DWORD_PTR dwAddress)
+{
+    //On x64 a page only serves code within reach of it, so that relocated RIP-relative operands still fit
+    if (m_dwSlotPage != 0 && m_ulSlotsUsed < ulSlotPageSize / Trampoline::ulSlotSize && IsNear(m_dwSlotPage, dwAddress))
+    {
+        return m_dwSlotPage + (m_ulSlotsUsed++ * Trampoline::ulSlotSize);
+    }
+
+    const DWORD_PTR dwPage = AllocateNear(m_pDebugger->Handle(), dwAddress);
+    if (dwPage == 0)
+    {
+        fprintf(stderr, "Could not allocate trampolines near %p. Error = %X\n", dwAddress, GetLastError());
+        return 0;
+    }
+    m_dwSlotPage = dwPage;
+    m_ulSlotsUsed = 1;
+    return dwPage;
+}
+
+const bool ConditionalBreakpoints::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dbgEvent.dwThreadId);
+    if (rearm == m_mapRearms.end())
+    {
+        return false;
+    }
+
+    //The breakpoint may have been removed from the console while the thread was stepping
+    Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(rearm->second);
+    if (pBreakpoint != nullptr && !pBreakpoint->IsEnabled())
+    {
+        (void)pBreakpoint->Enable();
+    }
+    m_mapRearms.erase(rearm);
+
+    return true;
+}
+
+void ConditionalBreakpoints::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dwThreadId);
+    if (rearm != m_mapRearms.end())
+    {
+        Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(rearm->second);
+        if (pBreakpoint != nullptr && !pBreakpoint->IsEnabled())
+        {
+            (void)pBreakpoint->Enable();
+        }
+        m_mapRearms.erase(rearm);
+    }
+}
+
+const bool ConditionalBreakpoints::Benchmark(const DWORD_PTR dwAddress, const CONTEXT &ctx, const size_t ulIterations) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto condition = m_mapConditions.find(dwAddress);
+    if (condition == m_mapConditions.end() || condition->second.pCondition == nullptr)
+    {
+        fprintf(stderr, "No condition at %p.\n", dwAddress);
+        return false;
+    }
+
+    const BreakpointCondition * const pCondition = condition->second.pCondition.get();
+    size_t ulMet = 0;
+    Stopwatch clock;
+    for (size_t i = 0; i < ulIterations; ++i)
+    {
+        bool bIsMet = false;
+        if (!pCondition->Evaluate(m_pDebugger->Handle(), ctx, condition->second.ullHits + 1, bIsMet))
+        {
+            return false;
+        }
+        ulMet += bIsMet ? 1 : 0;
+    }
+    const double dSeconds = clock.ElapsedMicroseconds() / 1000000.0;
+
+    fprintf(stderr, "%Iu evaluations of \"%s\" in %.2f ms, %.0f per second, %Iu met.\n", ulIterations,
+        pCondition->Expression().c_str(), dSeconds * 1000.0, (dSeconds > 0.0) ? (double)ulIterations / dSeconds : 0.0, ulMet);
+    pCondition->PrintBytecode();
+
+    return true;
+}
+
+void ConditionalBreakpoints::PrintConditions() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &condition : m_mapConditions)
+    {
+        const ConditionState &state = condition.second;
+        const double dSeconds = TicksToSeconds(state.llLastResume - state.llFirstResume);
+        fprintf(stderr, "%p: \"%s\", %I64u hits, %I64u resumed (%.0f per second), %I64u left to ignore.\n", condition.first,
+            (state.pCondition != nullptr) ? state.pCondition->Expression().c_str() : "", state.ullHits, state.ullResumed,
+            (dSeconds > 0.0) ? (double)(state.ullResumed - 1) / dSeconds : 0.0, state.ullIgnoreCount);
+    }
+}
+
+void ConditionalBreakpoints::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dHits = (m_stats.ullHits != 0) ? (double)m_stats.ullHits : 1.0;
+    fprintf(stderr, "Conditional breakpoints: %I64u hits, %I64u resumed (%I64u displaced, %I64u emulated, %I64u stepped), "
+        "%I64u stopped, %I64u errors. %.2f us per hit in the handler, %.2f us of it fetching context.\n", m_stats.ullHits,
+        m_stats.ullResumed, m_stats.ullDisplaced, m_stats.ullEmulated, m_stats.ullStepped, m_stats.ullStops,
+        m_stats.ullErrors, m_stats.dHandlerMicroseconds / dHits, m_stats.dContextMicroseconds / dHits);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <Windows.h>
+
+#include "BreakpointCondition.h"
+#include "Trampoline.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Conditions, ignore counts and hit counts for user breakpoints, decided in the exception handler. A hit that does not
+//stop leaves the int 3 in place and resumes the thread past it in the same debug event: the original instruction runs
+//from a trampoline slot in the target, or a relative jump, call or jcc is emulated in the context. Instructions that
+//cannot be moved or emulated (indirect branches, returns, loop/jecxz, out-of-reach RIP-relative operands) fall back to
+//disabling the breakpoint, stepping with the trap flag and putting the int 3 back on the step, which costs a second
+//debug event and lets other threads run past the breakpoint meanwhile. A fault in a displaced instruction reports
+//the slot's address rather than the breakpoint's. Conditions are keyed by address and stay in place when the
+//breakpoint is removed and set again.
+class ConditionalBreakpoints final
+{
+public:
+    ConditionalBreakpoints() = delete;
+    ConditionalBreakpoints(Debugger *pDebugger);
+
+    ConditionalBreakpoints(const ConditionalBreakpoints &copy) = delete;
+    ConditionalBreakpoints &operator=(const ConditionalBreakpoints &copy) = delete;
+
+    ~ConditionalBreakpoints() = default;
+
+    const bool SetCondition(const DWORD_PTR dwAddress, const char * const pExpression);
+    const bool SetIgnoreCount(const DWORD_PTR dwAddress, const ULONGLONG ullIgnoreCount);
+    const bool Clear(const DWORD_PTR dwAddress);
+
+    //True when the hit was resumed and the thread should not stop
+    const bool HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+
+    //Evaluation cost alone, against a context the caller already has
+    const bool Benchmark(const DWORD_PTR dwAddress, const CONTEXT &ctx, const size_t ulIterations) const;
+
+    void PrintConditions() const;
+    void PrintStats() const;
+
+private:
+    struct ConditionState
+    {
+        std::unique_ptr<BreakpointCondition> pCondition;
+        ULONGLONG ullHits;
+        ULONGLONG ullIgnoreCount;
+        ULONGLONG ullResumed;
+        LONGLONG llFirstResume;
+        LONGLONG llLastResume;
+        Trampoline trampoline;
+        DWORD_PTR dwSlot;
+        bool bIsSlotFailed;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullHits;
+        unsigned long long ullResumed;
+        unsigned long long ullDisplaced;
+        unsigned long long ullEmulated;
+        unsigned long long ullStepped;
+        unsigned long long ullStops;
+        unsigned long long ullErrors;
+        double dContextMicroseconds;
+        double dHandlerMicroseconds;
+    };
+
+    //Points the context past the instruction under the breakpoint without lifting it; false when it has to be stepped
+    const bool ResumeInPlace(const DWORD_PTR dwAddress, ConditionState &state, CONTEXT &ctx);
+    const DWORD_PTR AllocateSlot(const DWORD_PTR dwAddress);
+
+    Debugger * const m_pDebugger;
+
+    //Guards everything below; conditions are edited from the console while hits arrive on the debugger thread
+    mutable std::mutex m_mutex;
+    std::map<DWORD_PTR, ConditionState> m_mapConditions;
+
+    //Threads stepping over a breakpoint whose hit was resumed
+    std::map<DWORD, DWORD_PTR> m_mapRearms;
+
+    //Trampoline slots are carved from pages allocated in the target and never handed out twice, since a thread
+    //resumed into one may still be inside it when its condition is cleared or its instruction patched
+    DWORD_PTR m_dwSlotPage;
+    size_t m_ulSlotsUsed;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
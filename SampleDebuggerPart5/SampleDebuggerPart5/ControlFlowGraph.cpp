@@ -0,0 +1,740 @@
+#include "ControlFlowGraph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_set>
+
+#include "Common.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const DWORD dwTypeShift = 29;
+const DWORD dwIndexMask = (1UL << dwTypeShift) - 1;
+const unsigned char cIndirectFlag = 0x80;
+const DWORD dwMaxRegionSize = 0xFFFFF000;
+
+inline const DWORD PackEntry(const DWORD dwIndex, const eEdgeType type)
+{
+    return ((DWORD)type << dwTypeShift) | dwIndex;
+}
+
+inline const DWORD EntryIndex(const DWORD dwEntry)
+{
+    return dwEntry & dwIndexMask;
+}
+
+inline const eEdgeType EntryType(const DWORD dwEntry)
+{
+    return (eEdgeType)(dwEntry >> dwTypeShift);
+}
+
+inline const unsigned char PackFlags(const eBranchType terminator, const bool bIsIndirect)
+{
+    return (unsigned char)terminator | (bIsIndirect ? cIndirectFlag : 0);
+}
+
+//Turns per-list counts into offsets; the extra slot at the end receives the total
+void CountsToOffsets(std::vector<DWORD> &vecOffsets)
+{
+    DWORD dwTotal = 0;
+    for (auto &dwOffset : vecOffsets)
+    {
+        const DWORD dwCount = dwOffset;
+        dwOffset = dwTotal;
+        dwTotal += dwCount;
+    }
+}
+
+//Sorts every list and drops repeated entries, compacting the array in place
+void CompactLists(std::vector<DWORD> &vecOffsets, std::vector<DWORD> &vecEntries)
+{
+    DWORD dwWrite = 0;
+    for (size_t i = 0; i + 1 < vecOffsets.size(); ++i)
+    {
+        auto begin = vecEntries.begin() + vecOffsets[i];
+        auto end = vecEntries.begin() + vecOffsets[i + 1];
+        std::sort(begin, end);
+        end = std::unique(begin, end);
+
+        vecOffsets[i] = dwWrite;
+        for (auto iter = begin; iter != end; ++iter)
+        {
+            vecEntries[dwWrite++] = *iter;
+        }
+    }
+    vecOffsets.back() = dwWrite;
+    vecEntries.resize(dwWrite);
+    vecEntries.shrink_to_fit();
+}
+
+}
+
+ControlFlowGraph::ControlFlowGraph(const HANDLE hProcess, Disassembler * const pDisassembler)
+    : m_hProcess{ hProcess }, m_pDisassembler{ pDisassembler }
+{
+}
+
+void ControlFlowGraph::AddModule(const ModuleIndex &index)
+{
+    Stopwatch stopwatch;
+
+    //A fresh analysis supersedes anything discovered in the module before
+    Graph &graph = m_mapGraphs[index.dwModuleBase];
+    graph = Graph();
+    graph.dwBase = index.dwModuleBase;
+    graph.dwSize = index.dwImageSize;
+
+    std::vector<BasicBlock> vecBlocks(index.vecBlocks);
+    std::vector<ControlEdge> vecEdges(index.vecEdges);
+    std::vector<DWORD> vecFunctions(index.vecFunctions);
+    Build(graph, vecBlocks, vecEdges, vecFunctions);
+
+    fprintf(stderr, "Control flow graph for %p built in %.3f s: %Iu blocks, %Iu edges, %Iu functions, %Iu KB.\n",
+        (void *)graph.dwBase, stopwatch.ElapsedSeconds(), graph.vecBlocks.size(), graph.vecSuccessors.size(),
+        graph.vecFunctions.size(), MemoryUsage(graph) / 1024);
+}
+
+void ControlFlowGraph::RemoveModule(const DWORD_PTR dwModuleBase)
+{
+    (void)m_mapGraphs.erase(dwModuleBase);
+}
+
+const size_t ControlFlowGraph::Discover(const DWORD_PTR dwAddress, const size_t ulMaxInstructions /*= 4096*/)
+{
+    Graph *pGraph = FindGraph(dwAddress);
+    if (pGraph == nullptr)
+    {
+        pGraph = CreateRegionGraph(dwAddress);
+        if (pGraph == nullptr)
+        {
+            return 0;
+        }
+    }
+    Graph &graph = *pGraph;
+    Commit(graph);
+
+    std::unordered_set<DWORD> setStarts;
+    auto IsKnownStart = [&](const DWORD dwRva)
+    {
+        return (dwRva < graph.starts.Size() && graph.starts.Test(dwRva)) || setStarts.count(dwRva) != 0;
+    };
+    auto IsInside = [&](const DWORD_PTR dwTarget)
+    {
+        return dwTarget >= graph.dwBase && dwTarget - graph.dwBase < graph.dwSize;
+    };
+
+    //Recursive descent through Disassembler::Decode, so breakpoints and patches are seen the way the caches see them
+    size_t ulDecoded = 0;
+    std::vector<DWORD> vecWork(1, (DWORD)(dwAddress - graph.dwBase));
+    while (!vecWork.empty() && ulDecoded < ulMaxInstructions)
+    {
+        const DWORD dwBlockStart = vecWork.back();
+        vecWork.pop_back();
+        if (IsKnownStart(dwBlockStart))
+        {
+            continue;
+        }
+        (void)setStarts.insert(dwBlockStart);
+
+        DWORD dwCurrent = dwBlockStart;
+        while (ulDecoded < ulMaxInstructions)
+        {
+            DecodedInstruction instruction = { 0 };
+            if (!m_pDisassembler->Decode(graph.dwBase + dwCurrent, instruction))
+            {
+                if (dwCurrent != dwBlockStart)
+                {
+                    BasicBlock block = { dwBlockStart, dwCurrent, eBranchType::eNone, false };
+                    graph.vecPendingBlocks.push_back(block);
+                }
+                break;
+            }
+            ++ulDecoded;
+
+            const DWORD dwNext = dwCurrent + instruction.cLength;
+            const bool bHasTarget = !instruction.bIsIndirect && IsInside(instruction.dwTarget);
+            const DWORD dwTarget = bHasTarget ? (DWORD)(instruction.dwTarget - graph.dwBase) : 0;
+            bool bEndsBlock = false;
+            switch (instruction.branchType)
+            {
+            case eBranchType::eCall:
+                if (bHasTarget)
+                {
+                    ControlEdge edge = { dwCurrent, dwTarget, eEdgeType::eCall };
+                    graph.vecPendingEdges.push_back(edge);
+                    graph.vecPendingFunctions.push_back(dwTarget);
+                    vecWork.push_back(dwTarget);
+                }
+                break;
+            case eBranchType::eJump:
+                if (bHasTarget)
+                {
+                    ControlEdge edge = { dwCurrent, dwTarget, eEdgeType::eJump };
+                    graph.vecPendingEdges.push_back(edge);
+                    vecWork.push_back(dwTarget);
+                }
+                bEndsBlock = true;
+                break;
+            case eBranchType::eConditional:
+                if (bHasTarget)
+                {
+                    ControlEdge edge = { dwCurrent, dwTarget, eEdgeType::eConditional };
+                    graph.vecPendingEdges.push_back(edge);
+                    vecWork.push_back(dwTarget);
+                }
+                {
+                    ControlEdge fallthrough = { dwCurrent, dwNext, eEdgeType::eFallthrough };
+                    graph.vecPendingEdges.push_back(fallthrough);
+                    vecWork.push_back(dwNext);
+                }
+                bEndsBlock = true;
+                break;
+            case eBranchType::eReturn:
+                bEndsBlock = true;
+                break;
+            default:
+                break;
+            }
+
+            if (bEndsBlock)
+            {
+                BasicBlock block = { dwBlockStart, dwNext, instruction.branchType, instruction.bIsIndirect };
+                graph.vecPendingBlocks.push_back(block);
+                break;
+            }
+            if (dwNext >= graph.dwSize || IsKnownStart(dwNext))
+            {
+                BasicBlock block = { dwBlockStart, dwNext, instruction.branchType, instruction.bIsIndirect };
+                graph.vecPendingBlocks.push_back(block);
+                if (dwNext < graph.dwSize)
+                {
+                    ControlEdge fallthrough = { dwCurrent, dwNext, eEdgeType::eFallthrough };
+                    graph.vecPendingEdges.push_back(fallthrough);
+                }
+                break;
+            }
+            dwCurrent = dwNext;
+        }
+    }
+
+    return ulDecoded;
+}
+
+const bool ControlFlowGraph::FindBlock(const DWORD_PTR dwAddress, FlowBlock &block)
+{
+    Graph * const pGraph = CommittedGraph(dwAddress);
+    DWORD dwIndex = 0;
+    if (pGraph == nullptr || !FindBlockIndex(*pGraph, (DWORD)(dwAddress - pGraph->dwBase), dwIndex))
+    {
+        return false;
+    }
+
+    block = MakeBlock(*pGraph, dwIndex);
+    return true;
+}
+
+const bool ControlFlowGraph::Successors(const DWORD_PTR dwAddress, std::vector<FlowEdge> &vecEdges)
+{
+    vecEdges.clear();
+    Graph * const pGraph = CommittedGraph(dwAddress);
+    DWORD dwIndex = 0;
+    if (pGraph == nullptr || !FindBlockIndex(*pGraph, (DWORD)(dwAddress - pGraph->dwBase), dwIndex))
+    {
+        return false;
+    }
+
+    const Graph &graph = *pGraph;
+    for (DWORD i = graph.vecSuccessorOffsets[dwIndex]; i < graph.vecSuccessorOffsets[dwIndex + 1]; ++i)
+    {
+        const DWORD dwEntry = graph.vecSuccessors[i];
+        FlowEdge edge = { graph.dwBase + graph.vecBlocks[dwIndex].dwStart,
+            graph.dwBase + graph.vecBlocks[EntryIndex(dwEntry)].dwStart, EntryType(dwEntry) };
+        vecEdges.push_back(edge);
+    }
+    return true;
+}
+
+const bool ControlFlowGraph::Predecessors(const DWORD_PTR dwAddress, std::vector<FlowEdge> &vecEdges)
+{
+    vecEdges.clear();
+    Graph * const pGraph = CommittedGraph(dwAddress);
+    DWORD dwIndex = 0;
+    if (pGraph == nullptr || !FindBlockIndex(*pGraph, (DWORD)(dwAddress - pGraph->dwBase), dwIndex))
+    {
+        return false;
+    }
+
+    const Graph &graph = *pGraph;
+    for (DWORD i = graph.vecPredecessorOffsets[dwIndex]; i < graph.vecPredecessorOffsets[dwIndex + 1]; ++i)
+    {
+        const DWORD dwEntry = graph.vecPredecessors[i];
+        FlowEdge edge = { graph.dwBase + graph.vecBlocks[EntryIndex(dwEntry)].dwStart,
+            graph.dwBase + graph.vecBlocks[dwIndex].dwStart, EntryType(dwEntry) };
+        vecEdges.push_back(edge);
+    }
+    return true;
+}
+
+const size_t ControlFlowGraph::ReachingBlocks(const DWORD_PTR dwAddress, std::vector<DWORD_PTR> &vecBlocks, const bool bFollowCalls,
+    const size_t ulMaxBlocks /*= 4096*/)
+{
+    vecBlocks.clear();
+    Graph * const pGraph = CommittedGraph(dwAddress);
+    DWORD dwIndex = 0;
+    if (pGraph == nullptr || !FindBlockIndex(*pGraph, (DWORD)(dwAddress - pGraph->dwBase), dwIndex))
+    {
+        return 0;
+    }
+
+    //Breadth-first walk backwards over predecessors; the visited set stays proportional to the answer
+    const Graph &graph = *pGraph;
+    std::unordered_set<DWORD> setVisited;
+    std::vector<DWORD> vecQueue(1, dwIndex);
+    (void)setVisited.insert(dwIndex);
+    for (size_t ulHead = 0; ulHead < vecQueue.size() && vecBlocks.size() < ulMaxBlocks; ++ulHead)
+    {
+        const DWORD dwCurrent = vecQueue[ulHead];
+        vecBlocks.push_back(graph.dwBase + graph.vecBlocks[dwCurrent].dwStart);
+        for (DWORD i = graph.vecPredecessorOffsets[dwCurrent]; i < graph.vecPredecessorOffsets[dwCurrent + 1]; ++i)
+        {
+            const DWORD dwEntry = graph.vecPredecessors[i];
+            if ((bFollowCalls || EntryType(dwEntry) != eEdgeType::eCall) && setVisited.insert(EntryIndex(dwEntry)).second)
+            {
+                vecQueue.push_back(EntryIndex(dwEntry));
+            }
+        }
+    }
+
+    return vecBlocks.size();
+}
+
+const bool ControlFlowGraph::FindFunction(const DWORD_PTR dwAddress, DWORD_PTR &dwFunction)
+{
+    Graph * const pGraph = CommittedGraph(dwAddress);
+    size_t ulIndex = 0;
+    if (pGraph == nullptr || !FunctionIndex(*pGraph, (DWORD)(dwAddress - pGraph->dwBase), ulIndex))
+    {
+        return false;
+    }
+
+    dwFunction = pGraph->dwBase + pGraph->vecFunctions[ulIndex];
+    return true;
+}
+
+const bool ControlFlowGraph::FunctionBlocks(const DWORD_PTR dwFunction, std::vector<FlowBlock> &vecBlocks)
+{
+    vecBlocks.clear();
+    Graph * const pGraph = CommittedGraph(dwFunction);
+    size_t ulIndex = 0;
+    if (pGraph == nullptr || !FunctionIndex(*pGraph, (DWORD)(dwFunction - pGraph->dwBase), ulIndex))
+    {
+        return false;
+    }
+
+    for (DWORD i = pGraph->vecFunctionBlocks[ulIndex]; i < pGraph->vecFunctionBlocks[ulIndex + 1]; ++i)
+    {
+        vecBlocks.push_back(MakeBlock(*pGraph, i));
+    }
+    return true;
+}
+
+const bool ControlFlowGraph::Callers(const DWORD_PTR dwFunction, std::vector<DWORD_PTR> &vecCallSites)
+{
+    vecCallSites.clear();
+    Graph * const pGraph = CommittedGraph(dwFunction);
+    size_t ulIndex = 0;
+    if (pGraph == nullptr || !FunctionIndex(*pGraph, (DWORD)(dwFunction - pGraph->dwBase), ulIndex) ||
+        pGraph->vecFunctions[ulIndex] != (DWORD)(dwFunction - pGraph->dwBase))
+    {
+        return false;
+    }
+
+    for (DWORD i = pGraph->vecCallerOffsets[ulIndex]; i < pGraph->vecCallerOffsets[ulIndex + 1]; ++i)
+    {
+        vecCallSites.push_back(pGraph->dwBase + pGraph->vecCallSites[i]);
+    }
+    return true;
+}
+
+const bool ControlFlowGraph::Callees(const DWORD_PTR dwFunction, std::vector<DWORD_PTR> &vecFunctions)
+{
+    vecFunctions.clear();
+    Graph * const pGraph = CommittedGraph(dwFunction);
+    size_t ulIndex = 0;
+    if (pGraph == nullptr || !FunctionIndex(*pGraph, (DWORD)(dwFunction - pGraph->dwBase), ulIndex))
+    {
+        return false;
+    }
+
+    const Graph &graph = *pGraph;
+    for (DWORD dwBlock = graph.vecFunctionBlocks[ulIndex]; dwBlock < graph.vecFunctionBlocks[ulIndex + 1]; ++dwBlock)
+    {
+        for (DWORD i = graph.vecSuccessorOffsets[dwBlock]; i < graph.vecSuccessorOffsets[dwBlock + 1]; ++i)
+        {
+            if (EntryType(graph.vecSuccessors[i]) == eEdgeType::eCall)
+            {
+                vecFunctions.push_back(graph.dwBase + graph.vecBlocks[EntryIndex(graph.vecSuccessors[i])].dwStart);
+            }
+        }
+    }
+    std::sort(vecFunctions.begin(), vecFunctions.end());
+    vecFunctions.erase(std::unique(vecFunctions.begin(), vecFunctions.end()), vecFunctions.end());
+    return true;
+}
+
+void ControlFlowGraph::PrintStats() const
+{
+    for (auto &entry : m_mapGraphs)
+    {
+        const Graph &graph = entry.second;
+        fprintf(stderr, "%p-%p: %Iu blocks, %Iu edges, %Iu functions, %Iu call sites, %Iu pending blocks, %Iu KB.\n",
+            (void *)graph.dwBase, (void *)(graph.dwBase + graph.dwSize), graph.vecBlocks.size(), graph.vecSuccessors.size(),
+            graph.vecFunctions.size(), graph.vecCallSites.size(), graph.vecPendingBlocks.size(), MemoryUsage(graph) / 1024);
+    }
+}
+
+ControlFlowGraph::Graph * const ControlFlowGraph::FindGraph(const DWORD_PTR dwAddress)
+{
+    auto iter = m_mapGraphs.upper_bound(dwAddress);
+    if (iter == m_mapGraphs.begin())
+    {
+        return nullptr;
+    }
+    --iter;
+    return (dwAddress - iter->second.dwBase < iter->second.dwSize) ? &iter->second : nullptr;
+}
+
+ControlFlowGraph::Graph * const ControlFlowGraph::CreateRegionGraph(const DWORD_PTR dwAddress)
+{
+    //Code outside any analyzed module (generated code, unpacked stubs) gets a graph spanning its allocation
+    MEMORY_BASIC_INFORMATION memoryInfo = { 0 };
+    if (VirtualQueryEx(m_hProcess, (LPCVOID)dwAddress, &memoryInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0 ||
+        memoryInfo.State != MEM_COMMIT)
+    {
+        fprintf(stderr, "No committed memory at %p. Error = %X\n", (void *)dwAddress, GetLastError());
+        return nullptr;
+    }
+
+    const DWORD_PTR dwBase = (DWORD_PTR)memoryInfo.AllocationBase;
+    DWORD_PTR dwEnd = dwBase;
+    MEMORY_BASIC_INFORMATION regionInfo = { 0 };
+    while (dwEnd - dwBase < dwMaxRegionSize &&
+        VirtualQueryEx(m_hProcess, (LPCVOID)dwEnd, &regionInfo, sizeof(MEMORY_BASIC_INFORMATION)) != 0 &&
+        regionInfo.AllocationBase == memoryInfo.AllocationBase)
+    {
+        dwEnd = (DWORD_PTR)regionInfo.BaseAddress + regionInfo.RegionSize;
+    }
+
+    Graph &graph = m_mapGraphs[dwBase];
+    graph.dwBase = dwBase;
+    graph.dwSize = (DWORD)std::min((DWORD_PTR)dwMaxRegionSize, dwEnd - dwBase);
+    return (dwAddress - dwBase < graph.dwSize) ? &graph : nullptr;
+}
+
+ControlFlowGraph::Graph * const ControlFlowGraph::CommittedGraph(const DWORD_PTR dwAddress)
+{
+    Graph * const pGraph = FindGraph(dwAddress);
+    if (pGraph != nullptr)
+    {
+        Commit(*pGraph);
+    }
+    return pGraph;
+}
+
+const bool ControlFlowGraph::FindBlockIndex(const Graph &graph, const DWORD dwRva, DWORD &dwIndex) const
+{
+    if (dwRva >= graph.starts.Size())
+    {
+        return false;
+    }
+
+    const DWORD dwRank = graph.starts.Rank(dwRva + 1);
+    if (dwRank == 0 || dwRva >= graph.vecBlocks[dwRank - 1].dwEnd)
+    {
+        return false;
+    }
+
+    dwIndex = dwRank - 1;
+    return true;
+}
+
+const FlowBlock ControlFlowGraph::MakeBlock(const Graph &graph, const DWORD dwIndex) const
+{
+    const unsigned char cFlags = graph.vecBlockFlags[dwIndex];
+    FlowBlock block = { graph.dwBase + graph.vecBlocks[dwIndex].dwStart, graph.dwBase + graph.vecBlocks[dwIndex].dwEnd,
+        (eBranchType)(cFlags & ~cIndirectFlag), BOOLIFY(cFlags & cIndirectFlag) };
+    return block;
+}
+
+const bool ControlFlowGraph::FunctionIndex(const Graph &graph, const DWORD dwRva, size_t &ulIndex) const
+{
+    auto iter = std::upper_bound(graph.vecFunctions.begin(), graph.vecFunctions.end(), dwRva);
+    if (iter == graph.vecFunctions.begin())
+    {
+        return false;
+    }
+
+    ulIndex = (size_t)(iter - graph.vecFunctions.begin()) - 1;
+    return true;
+}
+
+void ControlFlowGraph::Build(Graph &graph, std::vector<BasicBlock> &vecBlocks, std::vector<ControlEdge> &vecEdges,
+    std::vector<DWORD> &vecFunctions)
+{
+    const DWORD dwSize = graph.dwSize;
+
+    //Every block start, branch target and function start splits whatever block it falls into
+    Bitmap leaders(dwSize);
+    for (auto &block : vecBlocks)
+    {
+        if (block.dwStart < dwSize)
+        {
+            leaders.Set(block.dwStart);
+        }
+    }
+    for (auto &edge : vecEdges)
+    {
+        if (edge.dwTo < dwSize)
+        {
+            leaders.Set(edge.dwTo);
+        }
+        if (edge.type == eEdgeType::eCall && edge.dwTo < dwSize)
+        {
+            vecFunctions.push_back(edge.dwTo);
+        }
+    }
+    for (auto &dwFunction : vecFunctions)
+    {
+        if (dwFunction < dwSize)
+        {
+            leaders.Set(dwFunction);
+        }
+    }
+
+    auto IsBefore = [](const BasicBlock &first, const BasicBlock &second)
+    {
+        return (first.dwStart != second.dwStart) ? (first.dwStart < second.dwStart) : (first.dwEnd < second.dwEnd);
+    };
+    if (!std::is_sorted(vecBlocks.begin(), vecBlocks.end(), IsBefore))
+    {
+        std::sort(vecBlocks.begin(), vecBlocks.end(), IsBefore);
+    }
+
+    //Pieces that were cut out of a longer block fall through into the next piece
+    graph.vecBlocks.clear();
+    graph.vecBlockFlags.clear();
+    graph.vecBlocks.reserve(vecBlocks.size());
+    graph.vecBlockFlags.reserve(vecBlocks.size());
+    for (auto &block : vecBlocks)
+    {
+        if (block.dwStart >= block.dwEnd || block.dwEnd > dwSize)
+        {
+            continue;
+        }
+
+        DWORD dwPieceStart = block.dwStart;
+        while (dwPieceStart < block.dwEnd)
+        {
+            const DWORD dwPieceEnd = leaders.NextSet(dwPieceStart + 1, block.dwEnd);
+            const bool bIsLast = (dwPieceEnd == block.dwEnd);
+            if (graph.vecBlocks.empty() || dwPieceStart >= graph.vecBlocks.back().dwEnd)
+            {
+                BlockRange range = { dwPieceStart, dwPieceEnd };
+                graph.vecBlocks.push_back(range);
+                graph.vecBlockFlags.push_back(bIsLast ? PackFlags(block.terminator, block.bIsIndirect) : 0);
+            }
+            if (!bIsLast)
+            {
+                ControlEdge fallthrough = { dwPieceEnd - 1, dwPieceEnd, eEdgeType::eFallthrough };
+                vecEdges.push_back(fallthrough);
+            }
+            dwPieceStart = dwPieceEnd;
+        }
+    }
+    std::vector<BasicBlock>().swap(vecBlocks);
+    graph.vecBlocks.shrink_to_fit();
+    graph.vecBlockFlags.shrink_to_fit();
+
+    graph.starts = Bitmap(dwSize);
+    for (auto &range : graph.vecBlocks)
+    {
+        graph.starts.Set(range.dwStart);
+    }
+    graph.starts.BuildRanks();
+
+    //Two passes over the edges: count per block, then place. No sorting is needed.
+    const size_t ulBlockCount = graph.vecBlocks.size();
+    graph.vecSuccessorOffsets.assign(ulBlockCount + 1, 0);
+    graph.vecPredecessorOffsets.assign(ulBlockCount + 1, 0);
+    auto MapEdge = [&](const ControlEdge &edge, DWORD &dwFrom, DWORD &dwTo)
+    {
+        if (edge.dwTo >= dwSize || !graph.starts.Test(edge.dwTo) || edge.dwFrom >= dwSize)
+        {
+            return false;
+        }
+        const DWORD dwRank = graph.starts.Rank(edge.dwFrom + 1);
+        if (dwRank == 0 || edge.dwFrom >= graph.vecBlocks[dwRank - 1].dwEnd)
+        {
+            return false;
+        }
+        dwFrom = dwRank - 1;
+        dwTo = graph.starts.Rank(edge.dwTo);
+        return true;
+    };
+
+    DWORD dwFrom = 0;
+    DWORD dwTo = 0;
+    graph.vecUnresolvedEdges.clear();
+    for (auto &edge : vecEdges)
+    {
+        if (MapEdge(edge, dwFrom, dwTo))
+        {
+            ++graph.vecSuccessorOffsets[dwFrom];
+            ++graph.vecPredecessorOffsets[dwTo];
+        }
+        else if (edge.type != eEdgeType::eCall && edge.dwTo < dwSize && edge.dwFrom < dwSize)
+        {
+            graph.vecUnresolvedEdges.push_back(edge);
+        }
+    }
+    graph.vecUnresolvedEdges.shrink_to_fit();
+    CountsToOffsets(graph.vecSuccessorOffsets);
+    CountsToOffsets(graph.vecPredecessorOffsets);
+
+    graph.vecSuccessors.assign(graph.vecSuccessorOffsets.back(), 0);
+    graph.vecPredecessors.assign(graph.vecPredecessorOffsets.back(), 0);
+    {
+        std::vector<DWORD> vecSuccessorCursor(graph.vecSuccessorOffsets.begin(), graph.vecSuccessorOffsets.end() - 1);
+        std::vector<DWORD> vecPredecessorCursor(graph.vecPredecessorOffsets.begin(), graph.vecPredecessorOffsets.end() - 1);
+        for (auto &edge : vecEdges)
+        {
+            if (MapEdge(edge, dwFrom, dwTo))
+            {
+                graph.vecSuccessors[vecSuccessorCursor[dwFrom]++] = PackEntry(dwTo, edge.type);
+                graph.vecPredecessors[vecPredecessorCursor[dwTo]++] = PackEntry(dwFrom, edge.type);
+            }
+        }
+    }
+    CompactLists(graph.vecSuccessorOffsets, graph.vecSuccessors);
+    CompactLists(graph.vecPredecessorOffsets, graph.vecPredecessors);
+
+    //Functions own the blocks from their start up to the next function
+    std::sort(vecFunctions.begin(), vecFunctions.end());
+    vecFunctions.erase(std::unique(vecFunctions.begin(), vecFunctions.end()), vecFunctions.end());
+    vecFunctions.erase(std::lower_bound(vecFunctions.begin(), vecFunctions.end(), dwSize), vecFunctions.end());
+    graph.vecFunctions.swap(vecFunctions);
+    graph.vecFunctions.shrink_to_fit();
+    graph.vecFunctionBlocks.resize(graph.vecFunctions.size() + 1);
+    for (size_t i = 0; i < graph.vecFunctions.size(); ++i)
+    {
+        graph.vecFunctionBlocks[i] = graph.starts.Rank(graph.vecFunctions[i]);
+    }
+    graph.vecFunctionBlocks.back() = (DWORD)ulBlockCount;
+
+    auto CalleeIndex = [&](const ControlEdge &edge, size_t &ulIndex)
+    {
+        if (edge.type != eEdgeType::eCall)
+        {
+            return false;
+        }
+        auto iter = std::lower_bound(graph.vecFunctions.begin(), graph.vecFunctions.end(), edge.dwTo);
+        ulIndex = (size_t)(iter - graph.vecFunctions.begin());
+        return iter != graph.vecFunctions.end() && *iter == edge.dwTo;
+    };
+
+    size_t ulCallee = 0;
+    graph.vecCallerOffsets.assign(graph.vecFunctions.size() + 1, 0);
+    for (auto &edge : vecEdges)
+    {
+        if (CalleeIndex(edge, ulCallee))
+        {
+            ++graph.vecCallerOffsets[ulCallee];
+        }
+    }
+    CountsToOffsets(graph.vecCallerOffsets);
+    graph.vecCallSites.assign(graph.vecCallerOffsets.back(), 0);
+    {
+        std::vector<DWORD> vecCursor(graph.vecCallerOffsets.begin(), graph.vecCallerOffsets.end() - 1);
+        for (auto &edge : vecEdges)
+        {
+            if (CalleeIndex(edge, ulCallee))
+            {
+                graph.vecCallSites[vecCursor[ulCallee]++] = edge.dwFrom;
+            }
+        }
+    }
+    CompactLists(graph.vecCallerOffsets, graph.vecCallSites);
+    std::vector<ControlEdge>().swap(vecEdges);
+
+    std::vector<BasicBlock>().swap(graph.vecPendingBlocks);
+    std::vector<ControlEdge>().swap(graph.vecPendingEdges);
+    std::vector<DWORD>().swap(graph.vecPendingFunctions);
+}
+
+void ControlFlowGraph::Commit(Graph &graph)
+{
+    if (graph.vecPendingBlocks.empty() && graph.vecPendingEdges.empty() && graph.vecPendingFunctions.empty())
+    {
+        return;
+    }
+
+    //Expand the committed graph back into blocks and edges and rebuild it with the new code merged in. Branches
+    //leave a block from its last instruction, so any byte of the last piece stands in for the source.
+    std::vector<BasicBlock> vecBlocks;
+    vecBlocks.reserve(graph.vecBlocks.size() + graph.vecPendingBlocks.size());
+    for (size_t i = 0; i < graph.vecBlocks.size(); ++i)
+    {
+        const unsigned char cFlags = graph.vecBlockFlags[i];
+        BasicBlock block = { graph.vecBlocks[i].dwStart, graph.vecBlocks[i].dwEnd, (eBranchType)(cFlags & ~cIndirectFlag),
+            BOOLIFY(cFlags & cIndirectFlag) };
+        vecBlocks.push_back(block);
+    }
+    vecBlocks.insert(vecBlocks.end(), graph.vecPendingBlocks.begin(), graph.vecPendingBlocks.end());
+
+    std::vector<ControlEdge> vecEdges;
+    vecEdges.reserve(graph.vecSuccessors.size() + graph.vecCallSites.size() + graph.vecUnresolvedEdges.size() +
+        graph.vecPendingEdges.size());
+    for (size_t i = 0; i < graph.vecBlocks.size(); ++i)
+    {
+        for (DWORD j = graph.vecSuccessorOffsets[i]; j < graph.vecSuccessorOffsets[i + 1]; ++j)
+        {
+            const DWORD dwEntry = graph.vecSuccessors[j];
+            if (EntryType(dwEntry) != eEdgeType::eCall)
+            {
+                ControlEdge edge = { graph.vecBlocks[i].dwEnd - 1, graph.vecBlocks[EntryIndex(dwEntry)].dwStart, EntryType(dwEntry) };
+                vecEdges.push_back(edge);
+            }
+        }
+    }
+    for (size_t i = 0; i < graph.vecFunctions.size(); ++i)
+    {
+        for (DWORD j = graph.vecCallerOffsets[i]; j < graph.vecCallerOffsets[i + 1]; ++j)
+        {
+            ControlEdge edge = { graph.vecCallSites[j], graph.vecFunctions[i], eEdgeType::eCall };
+            vecEdges.push_back(edge);
+        }
+    }
+    vecEdges.insert(vecEdges.end(), graph.vecUnresolvedEdges.begin(), graph.vecUnresolvedEdges.end());
+    vecEdges.insert(vecEdges.end(), graph.vecPendingEdges.begin(), graph.vecPendingEdges.end());
+
+    std::vector<DWORD> vecFunctions(graph.vecFunctions);
+    vecFunctions.insert(vecFunctions.end(), graph.vecPendingFunctions.begin(), graph.vecPendingFunctions.end());
+
+    Build(graph, vecBlocks, vecEdges, vecFunctions);
+}
+
+const size_t ControlFlowGraph::MemoryUsage(const Graph &graph)
+{
+    return graph.starts.MemoryUsage() + graph.vecBlocks.capacity() * sizeof(BlockRange) + graph.vecBlockFlags.capacity() +
+        (graph.vecSuccessorOffsets.capacity() + graph.vecSuccessors.capacity() + graph.vecPredecessorOffsets.capacity() +
+        graph.vecPredecessors.capacity() + graph.vecFunctions.capacity() + graph.vecFunctionBlocks.capacity() +
+        graph.vecCallerOffsets.capacity() + graph.vecCallSites.capacity()) * sizeof(DWORD) +
+        graph.vecUnresolvedEdges.capacity() * sizeof(ControlEdge);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Bitmap.h"
+#include "Disassembler.h"
+#include "ModuleAnalyzer.h"
+
+namespace CodeReversing
+{
+
+struct FlowBlock
+{
+    DWORD_PTR dwStart;
+    DWORD_PTR dwEnd;
+    eBranchType terminator;
+    bool bIsIndirect;
+};
+
+struct FlowEdge
+{
+    DWORD_PTR dwFrom;
+    DWORD_PTR dwTo;
+    eEdgeType type;
+};
+
+//Per-module control flow graphs. Blocks live in a sorted array indexed through a start bitmap, successors and
+//predecessors are kept in CSR form, functions own the block range from their start to the next function, and call
+//sites are grouped by callee. New code is collected in a small pending set and merged in before the next query.
+class ControlFlowGraph final
+{
+public:
+    ControlFlowGraph() = delete;
+    ControlFlowGraph(const HANDLE hProcess, Disassembler * const pDisassembler);
+
+    ControlFlowGraph(const ControlFlowGraph &copy) = delete;
+    ControlFlowGraph &operator=(const ControlFlowGraph &copy) = delete;
+
+    ~ControlFlowGraph() = default;
+
+    void AddModule(const ModuleIndex &index);
+    void RemoveModule(const DWORD_PTR dwModuleBase);
+    const size_t Discover(const DWORD_PTR dwAddress, const size_t ulMaxInstructions = 4096);
+
+    const bool FindBlock(const DWORD_PTR dwAddress, FlowBlock &block);
+    const bool Successors(const DWORD_PTR dwAddress, std::vector<FlowEdge> &vecEdges);
+    const bool Predecessors(const DWORD_PTR dwAddress, std::vector<FlowEdge> &vecEdges);
+    const size_t ReachingBlocks(const DWORD_PTR dwAddress, std::vector<DWORD_PTR> &vecBlocks, const bool bFollowCalls,
+        const size_t ulMaxBlocks = 4096);
+
+    const bool FindFunction(const DWORD_PTR dwAddress, DWORD_PTR &dwFunction);
+    const bool FunctionBlocks(const DWORD_PTR dwFunction, std::vector<FlowBlock> &vecBlocks);
+    const bool Callers(const DWORD_PTR dwFunction, std::vector<DWORD_PTR> &vecCallSites);
+    const bool Callees(const DWORD_PTR dwFunction, std::vector<DWORD_PTR> &vecFunctions);
+
+    void PrintStats() const;
+
+private:
+    struct BlockRange
+    {
+        DWORD dwStart;
+        DWORD dwEnd;
+    };
+
+    struct Graph
+    {
+        DWORD_PTR dwBase;
+        DWORD dwSize;
+
+        Bitmap starts;
+        std::vector<BlockRange> vecBlocks;
+        std::vector<unsigned char> vecBlockFlags;
+
+        //Each entry is the other block's index with the edge type in the top bits
+        std::vector<DWORD> vecSuccessorOffsets;
+        std::vector<DWORD> vecSuccessors;
+        std::vector<DWORD> vecPredecessorOffsets;
+        std::vector<DWORD> vecPredecessors;
+
+        std::vector<DWORD> vecFunctions;
+        std::vector<DWORD> vecFunctionBlocks;
+        std::vector<DWORD> vecCallerOffsets;
+        std::vector<DWORD> vecCallSites;
+
+        //Branches into code that has not been discovered yet are kept until a block shows up for them
+        std::vector<ControlEdge> vecUnresolvedEdges;
+        std::vector<BasicBlock> vecPendingBlocks;
+        std::vector<ControlEdge> vecPendingEdges;
+        std::vector<DWORD> vecPendingFunctions;
+    };
+
+    Graph * const FindGraph(const DWORD_PTR dwAddress);
+    Graph * const CreateRegionGraph(const DWORD_PTR dwAddress);
+    Graph * const CommittedGraph(const DWORD_PTR dwAddress);
+    const bool FindBlockIndex(const Graph &graph, const DWORD dwRva, DWORD &dwIndex) const;
+    const FlowBlock MakeBlock(const Graph &graph, const DWORD dwIndex) const;
+    const bool FunctionIndex(const Graph &graph, const DWORD dwRva, size_t &ulIndex) const;
+
+    static void Build(Graph &graph, std::vector<BasicBlock> &vecBlocks, std::vector<ControlEdge> &vecEdges,
+        std::vector<DWORD> &vecFunctions);
+    static void Commit(Graph &graph);
+    static const size_t MemoryUsage(const Graph &graph);
+
+    HANDLE m_hProcess;
+    Disassembler *m_pDisassembler;
+    std::map<DWORD_PTR, Graph> m_mapGraphs;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,359 @@
+#include "CoverageTracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <TlHelp32.h>
+
+#include "BinaryWriter.h"
+#include "Common.h"
+#include "Debugger.h"
+#include "SafeHandle.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const DWORD dwBitmapMagic = 0x31564F43; //"COV1"
+
+}
+
+CoverageTracer::CoverageTracer(Debugger *pDebugger) : m_pDebugger{ pDebugger }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool CoverageTracer::AddModule(const DWORD_PTR dwModuleBase, const eGranularity granularity)
+{
+    ModuleIndex index;
+    if (!m_pDebugger->AnalyzeModule(dwModuleBase, index))
+    {
+        fprintf(stderr, "Could not analyze module at %p.\n", dwModuleBase);
+        return false;
+    }
+
+    ModuleCoverage module;
+    module.dwModuleBase = dwModuleBase;
+    module.dwImageSize = index.dwImageSize;
+    module.granularity = granularity;
+    module.bIsLoaded = true;
+    module.strName = ModuleName(dwModuleBase);
+    module.ulArmed = 0;
+    module.ulHits = 0;
+
+    //Only blocks reached by recursive descent are armed, in either mode. The linear sweep also runs through the jump
+    //tables and literals that compilers leave in .text, and an int 3 written into those corrupts the target.
+    module.vecPoints.reserve((granularity == eGranularity::eFunctions) ? index.vecFunctions.size() : index.ulReachableBlocks);
+    for (auto &block : index.vecBlocks)
+    {
+        if (block.bIsReachable && (granularity == eGranularity::eBlocks ||
+            std::binary_search(index.vecFunctions.begin(), index.vecFunctions.end(), block.dwStart)))
+        {
+            module.vecPoints.push_back(block.dwStart);
+        }
+    }
+    if (module.vecPoints.empty())
+    {
+        fprintf(stderr, "No code in module at %p is reachable from its entry point, exports or unwind data.\n", dwModuleBase);
+        return false;
+    }
+    std::sort(module.vecPoints.begin(), module.vecPoints.end());
+    module.vecPoints.erase(std::unique(module.vecPoints.begin(), module.vecPoints.end()), module.vecPoints.end());
+
+    //User breakpoints keep their bytes; the patch manager would otherwise fold our int 3 into them
+    module.vecPoints.erase(std::remove_if(module.vecPoints.begin(), module.vecPoints.end(), [&](const DWORD dwRva)
+    {
+        return m_pDebugger->FindBreakpoint(dwModuleBase + dwRva) != nullptr;
+    }), module.vecPoints.end());
+
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto &dwRva : module.vecPoints)
+    {
+        mapBytes.emplace_hint(mapBytes.end(), dwModuleBase + dwRva, cBreakpointOpcode);
+    }
+
+    //Held across the write so that a point hit before it is recorded is not mistaken for someone else's
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto existing = m_mapModules.find(dwModuleBase);
+    if (existing != m_mapModules.end() && existing->second.bIsLoaded)
+    {
+        fprintf(stderr, "Module at %p is already being traced.\n", dwModuleBase);
+        return false;
+    }
+
+    Stopwatch clock;
+    std::vector<PatchByte> vecPrevious;
+    if (!m_pDebugger->ProcessPatches()->WriteBatch(mapBytes, &vecPrevious) || vecPrevious.size() != module.vecPoints.size())
+    {
+        fprintf(stderr, "Could not place coverage breakpoints in module at %p.\n", dwModuleBase);
+        return false;
+    }
+    m_stats.dArmMicroseconds += clock.ElapsedMicroseconds();
+
+    module.vecOriginalBytes.resize(module.vecPoints.size());
+    module.armed = Bitmap(module.vecPoints.size());
+    module.hits = Bitmap(module.vecPoints.size());
+    for (size_t i = 0; i < vecPrevious.size(); ++i)
+    {
+        module.vecOriginalBytes[i] = vecPrevious[i].cOriginal;
+
+        //An int 3 that was already there belongs to another component and is left to it
+        if (vecPrevious[i].cOriginal != cBreakpointOpcode)
+        {
+            module.armed.Set((DWORD)i);
+            ++module.ulArmed;
+        }
+    }
+
+    fprintf(stderr, "Placed %Iu coverage breakpoints in %s in %.2f ms.\n", module.ulArmed, module.strName.c_str(),
+        clock.ElapsedMicroseconds() / 1000.0);
+    m_mapModules[dwModuleBase] = std::move(module);
+
+    return true;
+}
+
+void CoverageTracer::RemoveModule(const DWORD_PTR dwModuleBase)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto module = m_mapModules.find(dwModuleBase);
+    if (module == m_mapModules.end())
+    {
+        return;
+    }
+
+    //The code is gone along with the breakpoints, but what was hit before the unload is still reported
+    module->second.bIsLoaded = false;
+    module->second.armed = Bitmap(module->second.vecPoints.size());
+    module->second.ulArmed = 0;
+}
+
+const bool CoverageTracer::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool bSuccess = true;
+    for (auto &module : m_mapModules)
+    {
+        bSuccess &= Disarm(module.second);
+    }
+
+    return bSuccess;
+}
+
+const bool CoverageTracer::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ModuleCoverage * const pModule = FindModule(dwAddress);
+    DWORD dwIndex = 0;
+    if (pModule == nullptr || !FindPoint(*pModule, (DWORD)(dwAddress - pModule->dwModuleBase), dwIndex))
+    {
+        return false;
+    }
+    if (!pModule->armed.Test(dwIndex))
+    {
+        //Another thread raced to the same point before it was removed; its int 3 is already gone
+        ++m_stats.ullStrayHits;
+    }
+    else
+    {
+        //Through the patch manager so the write is ordered with its batches and survives read-only code pages
+        if (!m_pDebugger->ProcessPatches()->SwapByte(dwAddress, pModule->vecOriginalBytes[dwIndex]))
+        {
+            fprintf(stderr, "Could not remove coverage breakpoint at %p. Error = %X\n", dwAddress, GetLastError());
+            return false;
+        }
+        pModule->armed.Clear(dwIndex);
+        pModule->hits.Set(dwIndex);
+        --pModule->ulArmed;
+        ++pModule->ulHits;
+        ++m_stats.ullHits;
+    }
+
+    //The int 3 is gone, so backing up over it is all the thread needs to run the original instruction
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        SetInstructionPointer(ctx, dwAddress);
+        (void)SetThreadContext(hThread(), &ctx);
+    }
+    else
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+    }
+
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+    return true;
+}
+
+void CoverageTracer::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &module : m_mapModules)
+    {
+        const ModuleCoverage &coverage = module.second;
+        if (coverage.ulArmed == 0 || dwAddress >= coverage.dwModuleBase + coverage.dwImageSize ||
+            dwAddress + ulSize <= coverage.dwModuleBase)
+        {
+            continue;
+        }
+
+        const DWORD dwFirst = (dwAddress > coverage.dwModuleBase) ? (DWORD)(dwAddress - coverage.dwModuleBase) : 0;
+        auto point = std::lower_bound(coverage.vecPoints.begin(), coverage.vecPoints.end(), dwFirst);
+        for (; point != coverage.vecPoints.end() && coverage.dwModuleBase + *point < dwAddress + ulSize; ++point)
+        {
+            const DWORD dwIndex = (DWORD)(point - coverage.vecPoints.begin());
+            if (coverage.armed.Test(dwIndex))
+            {
+                pBytes[coverage.dwModuleBase + *point - dwAddress] = coverage.vecOriginalBytes[dwIndex];
+            }
+        }
+    }
+}
+
+const bool CoverageTracer::ExportBitmap(const char * const pPath) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    BinaryWriter writer;
+    if (!writer.Open(pPath))
+    {
+        return false;
+    }
+
+    bool bSuccess = writer.WriteValue(dwBitmapMagic) && writer.WriteVarint(m_mapModules.size());
+    for (auto moduleIter = m_mapModules.cbegin(); bSuccess && moduleIter != m_mapModules.cend(); ++moduleIter)
+    {
+        const ModuleCoverage &module = moduleIter->second;
+        bSuccess = writer.WriteVarint(module.dwModuleBase) && writer.WriteVarint(module.dwImageSize) &&
+            writer.WriteVarint((ULONGLONG)module.granularity) && writer.WriteVarint(module.strName.size()) &&
+            writer.Write(module.strName.data(), module.strName.size()) && writer.WriteVarint(module.vecPoints.size());
+
+        DWORD dwPrevious = 0;
+        for (auto point = module.vecPoints.cbegin(); bSuccess && point != module.vecPoints.cend(); ++point)
+        {
+            bSuccess = writer.WriteVarint(*point - dwPrevious);
+            dwPrevious = *point;
+        }
+
+        //Only the bytes that hold bits are written, so the reader needs the point count to size the bitmap
+        const size_t ulBitmapBytes = (module.vecPoints.size() + 7) / 8;
+        bSuccess = bSuccess && writer.Write(module.hits.Words(), ulBitmapBytes);
+    }
+
+    if (!writer.Close() || !bSuccess)
+    {
+        fprintf(stderr, "Could not write coverage to %s.\n", pPath);
+        return false;
+    }
+
+    fprintf(stderr, "Wrote coverage of %Iu modules to %s (%I64u bytes).\n", m_mapModules.size(), pPath,
+        writer.FileBytesWritten());
+    return true;
+}
+
+void CoverageTracer::PrintSummary() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t ulPoints = 0;
+    size_t ulHits = 0;
+    for (auto &module : m_mapModules)
+    {
+        const ModuleCoverage &coverage = module.second;
+        const size_t ulCount = coverage.vecPoints.size();
+        fprintf(stderr, "%p %-32s %s: %Iu / %Iu hit (%.1f%%), %Iu still armed%s\n", coverage.dwModuleBase,
+            coverage.strName.c_str(), coverage.granularity == eGranularity::eFunctions ? "functions" : "blocks",
+            coverage.ulHits, ulCount, ulCount == 0 ? 0.0 : 100.0 * (double)coverage.ulHits / (double)ulCount,
+            coverage.ulArmed, coverage.bIsLoaded ? "" : " (unloaded)");
+        ulPoints += ulCount;
+        ulHits += coverage.ulHits;
+    }
+
+    fprintf(stderr, "Coverage: %Iu / %Iu points hit, %I64u stray hits. Arming took %.2f ms, disarming %.2f ms, "
+        "%.2f us per hit in handler.\n", ulHits, ulPoints, m_stats.ullStrayHits, m_stats.dArmMicroseconds / 1000.0,
+        m_stats.dDisarmMicroseconds / 1000.0,
+        m_stats.ullHits == 0 ? 0.0 : m_stats.dHandlerMicroseconds / (double)m_stats.ullHits);
+}
+
+CoverageTracer::ModuleCoverage * const CoverageTracer::FindModule(const DWORD_PTR dwAddress)
+{
+    auto module = m_mapModules.upper_bound(dwAddress);
+    if (module == m_mapModules.begin())
+    {
+        return nullptr;
+    }
+    --module;
+
+    ModuleCoverage &coverage = module->second;
+    return (coverage.bIsLoaded && dwAddress - coverage.dwModuleBase < coverage.dwImageSize) ? &coverage : nullptr;
+}
+
+const bool CoverageTracer::FindPoint(const ModuleCoverage &module, const DWORD dwRva, DWORD &dwIndex) const
+{
+    auto point = std::lower_bound(module.vecPoints.begin(), module.vecPoints.end(), dwRva);
+    if (point == module.vecPoints.end() || *point != dwRva)
+    {
+        return false;
+    }
+
+    dwIndex = (DWORD)(point - module.vecPoints.begin());
+    return true;
+}
+
+const std::string CoverageTracer::ModuleName(const DWORD_PTR dwModuleBase) const
+{
+    SafeHandle hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, GetProcessId(m_pDebugger->Handle()));
+    if (hSnapshot() != INVALID_HANDLE_VALUE)
+    {
+        MODULEENTRY32 moduleEntry = { 0 };
+        moduleEntry.dwSize = sizeof(MODULEENTRY32);
+        for (BOOL bHasEntry = Module32First(hSnapshot(), &moduleEntry); bHasEntry; bHasEntry = Module32Next(hSnapshot(), &moduleEntry))
+        {
+            if ((DWORD_PTR)moduleEntry.modBaseAddr == dwModuleBase)
+            {
+                return moduleEntry.szModule;
+            }
+        }
+    }
+
+    char strName[32] = { 0 };
+    sprintf_s(strName, sizeof(strName), "module_%p", (void *)dwModuleBase);
+    return strName;
+}
+
+const bool CoverageTracer::Disarm(ModuleCoverage &module)
+{
+    if (module.ulArmed == 0)
+    {
+        return true;
+    }
+
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    const DWORD dwCount = (DWORD)module.vecPoints.size();
+    for (DWORD i = module.armed.NextSet(0, dwCount); i < dwCount; i = module.armed.NextSet(i + 1, dwCount))
+    {
+        mapBytes.emplace_hint(mapBytes.end(), module.dwModuleBase + module.vecPoints[i], module.vecOriginalBytes[i]);
+    }
+
+    Stopwatch clock;
+    if (!m_pDebugger->ProcessPatches()->WriteBatch(mapBytes))
+    {
+        fprintf(stderr, "Could not remove coverage breakpoints from %s.\n", module.strName.c_str());
+        return false;
+    }
+    m_stats.dDisarmMicroseconds += clock.ElapsedMicroseconds();
+
+    module.armed = Bitmap(module.vecPoints.size());
+    module.ulArmed = 0;
+    return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Bitmap.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Code coverage of unmodified binaries. Every function entry or basic block head of a module gets an int3 that is
+//removed the first time it is hit, so each point costs exactly one debug event and the thread resumes without a
+//single-step. Breakpoints are written and removed in per-page batches through the patch manager. Points are limited
+//to what recursive descent reaches from the entry point, exports and .pdata; block heads that only the linear sweep
+//found may be data inside .text, so they are never patched.
+class CoverageTracer final
+{
+public:
+    enum class eGranularity
+    {
+        eFunctions = 0,
+        eBlocks = 1
+    };
+
+    CoverageTracer() = delete;
+    CoverageTracer(Debugger *pDebugger);
+
+    CoverageTracer(const CoverageTracer &copy) = delete;
+    CoverageTracer &operator=(const CoverageTracer &copy) = delete;
+
+    ~CoverageTracer() = default;
+
+    const bool AddModule(const DWORD_PTR dwModuleBase, const eGranularity granularity);
+    void RemoveModule(const DWORD_PTR dwModuleBase);
+
+    //Takes out every breakpoint that has not been hit yet; results are kept
+    const bool Stop();
+
+    //Called from the exception handler; false means the event belongs to someone else
+    const bool HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+
+    //Per module: base, image size, granularity, name, delta-encoded point RVAs and the hit bitmap
+    const bool ExportBitmap(const char * const pPath) const;
+    void PrintSummary() const;
+
+private:
+    struct ModuleCoverage
+    {
+        DWORD_PTR dwModuleBase;
+        DWORD dwImageSize;
+        eGranularity granularity;
+        bool bIsLoaded;
+        std::string strName;
+        std::vector<DWORD> vecPoints;
+        std::vector<unsigned char> vecOriginalBytes;
+        Bitmap armed;
+        Bitmap hits;
+        size_t ulArmed;
+        size_t ulHits;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullHits;
+        unsigned long long ullStrayHits;
+        double dArmMicroseconds;
+        double dDisarmMicroseconds;
+        double dHandlerMicroseconds;
+    };
+
+    ModuleCoverage * const FindModule(const DWORD_PTR dwAddress);
+    const bool FindPoint(const ModuleCoverage &module, const DWORD dwRva, DWORD &dwIndex) const;
+    const std::string ModuleName(const DWORD_PTR dwModuleBase) const;
+    const bool Disarm(ModuleCoverage &module);
+
+    Debugger * const m_pDebugger;
+
+    //Guards everything below; hits come in on the debugger thread while the console reads the results
+    mutable std::mutex m_mutex;
+    std::map<DWORD_PTR, ModuleCoverage> m_mapModules;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -24,6 +24,10 @@ void DebugEventHandler::Initialize()
             "TLS base: %p\n"
             "Start address: %p\n",
             info.hThread, info.lpThreadLocalBase, info.lpStartAddress);
+        if (m_pDebugger->m_pWatchpoints != nullptr)
+        {
+            m_pDebugger->m_pWatchpoints->AddThread(dbgEvent.dwThreadId);
+        }
         SetContinueStatus(DBG_CONTINUE);
     });
 
@@ -51,8 +55,40 @@ void DebugEventHandler::Initialize()
         m_pDebugger->m_pSymbols = std::unique_ptr<Symbols>(new Symbols(m_pDebugger->m_hProcess(),
             m_pDebugger->m_hFile()));
         m_pDebugger->m_pSymbols->EnumerateModuleSymbols(strName, (DWORD64)info.lpBaseOfImage);
-        m_pDebugger->m_pStepPoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(info.hProcess, 0));
+        m_pDebugger->m_pPatchManager = std::unique_ptr<PatchManager>(new PatchManager(m_pDebugger));
+        m_pDebugger->m_pStepPoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(info.hProcess, 0,
+            m_pDebugger->m_pPatchManager.get()));
         m_pDebugger->m_pDisassembler = std::unique_ptr<Disassembler>(new Disassembler(info.hProcess));
+        Debugger * const pDebugger = m_pDebugger;
+        m_pDebugger->m_pDisassembler->SetByteFilter([pDebugger](const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize)
+        {
+            pDebugger->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+        });
+        m_pDebugger->m_pAddressResolver = std::unique_ptr<AddressResolver>(new AddressResolver(m_pDebugger->m_pSymbols.get()));
+        AddressResolver * const pResolver = m_pDebugger->m_pAddressResolver.get();
+        m_pDebugger->m_pDisassembler->SetTargetFormatter([pResolver](const DWORD_PTR dwAddress, char * const pBuffer, const size_t ulBufferSize)
+        {
+            return pResolver->Format(dwAddress, pBuffer, ulBufferSize);
+        });
+        m_pDebugger->m_pMemoryScanner = std::unique_ptr<MemoryScanner>(new MemoryScanner(info.hProcess));
+        m_pDebugger->m_pValueScanner = std::unique_ptr<ValueScanner>(new ValueScanner(m_pDebugger));
+        m_pDebugger->m_pMemorySnapshot = std::unique_ptr<MemorySnapshot>(new MemorySnapshot(m_pDebugger));
+        m_pDebugger->m_pControlFlowGraph = std::unique_ptr<ControlFlowGraph>(new ControlFlowGraph(info.hProcess,
+            m_pDebugger->m_pDisassembler.get()));
+        m_pDebugger->m_pStackUnwinder = std::unique_ptr<StackUnwinder>(new StackUnwinder(info.hProcess));
+        m_pDebugger->m_pSamplingProfiler = std::unique_ptr<SamplingProfiler>(new SamplingProfiler(m_pDebugger));
+        m_pDebugger->m_pFunctionProfiler = std::unique_ptr<FunctionProfiler>(new FunctionProfiler(m_pDebugger));
+        m_pDebugger->m_pCoverageTracer = std::unique_ptr<CoverageTracer>(new CoverageTracer(m_pDebugger));
+        m_pDebugger->m_pInstructionTracer = std::unique_ptr<InstructionTracer>(new InstructionTracer(m_pDebugger));
+        m_pDebugger->m_pRangeStepper = std::unique_ptr<RangeStepper>(new RangeStepper(m_pDebugger, m_pDebugger->m_pSymbols.get()));
+        m_pDebugger->m_pTemporaryBreakpoints = std::unique_ptr<TemporaryBreakpoints>(new TemporaryBreakpoints(m_pDebugger));
+        m_pDebugger->m_pConditionalBreakpoints = std::unique_ptr<ConditionalBreakpoints>(new ConditionalBreakpoints(m_pDebugger));
+        m_pDebugger->m_pLogpoints = std::unique_ptr<Logpoints>(new Logpoints(m_pDebugger));
+        m_pDebugger->m_pApiTracer = std::unique_ptr<ApiTracer>(new ApiTracer(m_pDebugger, m_pDebugger->m_pSymbols.get()));
+        m_pDebugger->m_pPendingBreakpoints = std::unique_ptr<PendingBreakpoints>(new PendingBreakpoints(m_pDebugger,
+            m_pDebugger->m_pSymbols.get()));
+        m_pDebugger->m_pBreakpointGroups = std::unique_ptr<BreakpointGroups>(new BreakpointGroups(m_pDebugger));
+        m_pDebugger->m_pWatchpoints = std::unique_ptr<Watchpoints>(new Watchpoints(m_pDebugger));
 
         SetContinueStatus(DBG_CONTINUE);
     });
@@ -62,6 +98,38 @@ void DebugEventHandler::Initialize()
         fprintf(stderr, "EXIT_THREAD_DEBUG_EVENT received.\n"
             "Thread %X exited with code %X.\n",
             dbgEvent.dwThreadId, dbgEvent.u.ExitThread.dwExitCode);
+        if (m_pDebugger->m_pFunctionProfiler != nullptr)
+        {
+            m_pDebugger->m_pFunctionProfiler->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pInstructionTracer != nullptr)
+        {
+            m_pDebugger->m_pInstructionTracer->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pRangeStepper != nullptr)
+        {
+            m_pDebugger->m_pRangeStepper->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pTemporaryBreakpoints != nullptr)
+        {
+            m_pDebugger->m_pTemporaryBreakpoints->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pConditionalBreakpoints != nullptr)
+        {
+            m_pDebugger->m_pConditionalBreakpoints->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pLogpoints != nullptr)
+        {
+            m_pDebugger->m_pLogpoints->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pApiTracer != nullptr)
+        {
+            m_pDebugger->m_pApiTracer->RemoveThread(dbgEvent.dwThreadId);
+        }
+        if (m_pDebugger->m_pWatchpoints != nullptr)
+        {
+            m_pDebugger->m_pWatchpoints->RemoveThread(dbgEvent.dwThreadId);
+        }
         SetContinueStatus(DBG_CONTINUE);
     });
 
@@ -87,6 +155,7 @@ void DebugEventHandler::Initialize()
         (void)GetFinalPathNameByHandleA(info.hFile, strName, sizeof(strName), FILE_NAME_NORMALIZED);
         fprintf(stderr, "Name: %s\n", strName);
         m_pDebugger->m_pSymbols->EnumerateModuleSymbols(strName, (DWORD64)info.lpBaseOfDll);
+        (void)m_pDebugger->m_pPendingBreakpoints->ResolveModule((DWORD_PTR)info.lpBaseOfDll, strName);
 
         m_dwContinueStatus = DBG_CONTINUE;
     });
@@ -95,6 +164,11 @@ void DebugEventHandler::Initialize()
     {
         fprintf(stderr, "UNLOAD_DLL_DEBUG_EVENT received.\n"
             "Dll at %p has unloaded.\n", dbgEvent.u.UnloadDll.lpBaseOfDll);
+        m_pDebugger->m_pControlFlowGraph->RemoveModule((DWORD_PTR)dbgEvent.u.UnloadDll.lpBaseOfDll);
+        m_pDebugger->m_pStackUnwinder->RemoveModule((DWORD_PTR)dbgEvent.u.UnloadDll.lpBaseOfDll);
+        m_pDebugger->m_pSamplingProfiler->RemoveModule((DWORD_PTR)dbgEvent.u.UnloadDll.lpBaseOfDll);
+        m_pDebugger->m_pCoverageTracer->RemoveModule((DWORD_PTR)dbgEvent.u.UnloadDll.lpBaseOfDll);
+        m_pDebugger->m_pLogpoints->RemoveModule((DWORD_PTR)dbgEvent.u.UnloadDll.lpBaseOfDll);
         SetContinueStatus(DBG_CONTINUE);
     });
 
@@ -14,6 +14,10 @@ void DebugExceptionHandler::Initialize()
 {
     Register(DebugExceptions::eAccessViolation, [&](const DEBUG_EVENT &dbgEvent)
     {
+        if (HandleWatchFault(dbgEvent))
+        {
+            return;
+        }
         fprintf(stderr, "Received access violation\n");
         SetContinueStatus(DBG_EXCEPTION_NOT_HANDLED);
     });
@@ -28,6 +32,31 @@ void DebugExceptionHandler::Initialize()
     {
         auto &exceptionRecord = dbgEvent.u.Exception.ExceptionRecord;
         const DWORD_PTR dwExceptionAddress = (DWORD_PTR)exceptionRecord.ExceptionAddress;
+        const RangeStepper::eResult rangeResult = (m_pDebugger->m_pRangeStepper != nullptr) ?
+            m_pDebugger->m_pRangeStepper->HandleBreakpoint(dbgEvent) : RangeStepper::eResult::eNotOwned;
+        const TemporaryBreakpoints::eResult temporaryResult =
+            (rangeResult == RangeStepper::eResult::eNotOwned && m_pDebugger->m_pTemporaryBreakpoints != nullptr) ?
+            m_pDebugger->m_pTemporaryBreakpoints->HandleBreakpoint(dbgEvent) : TemporaryBreakpoints::eResult::eNotOwned;
+        if (rangeResult == RangeStepper::eResult::eFinished || temporaryResult == TemporaryBreakpoints::eResult::eFinished)
+        {
+            fprintf(stderr, "Press c to continue, s to step into, o to step over.\n");
+            m_pDebugger->m_dwExecutingThreadId = dbgEvent.dwThreadId;
+            CONTEXT ctx = m_pDebugger->GetExecutingContext();
+            if (m_pDebugger->SetExecutingContext(ctx))
+            {
+                (void)m_pDebugger->WaitForContinue();
+            }
+        }
+        if (rangeResult != RangeStepper::eResult::eNotOwned || temporaryResult != TemporaryBreakpoints::eResult::eNotOwned ||
+            (m_pDebugger->m_pCoverageTracer != nullptr && m_pDebugger->m_pCoverageTracer->HandleBreakpoint(dbgEvent)) ||
+            (m_pDebugger->m_pFunctionProfiler != nullptr && m_pDebugger->m_pFunctionProfiler->HandleBreakpoint(dbgEvent)) ||
+            (m_pDebugger->m_pApiTracer != nullptr && m_pDebugger->m_pApiTracer->HandleBreakpoint(dbgEvent)) ||
+            (m_pDebugger->m_pLogpoints != nullptr && m_pDebugger->m_pLogpoints->HandleBreakpoint(dbgEvent)) ||
+            (m_pDebugger->m_pConditionalBreakpoints != nullptr && m_pDebugger->m_pConditionalBreakpoints->HandleBreakpoint(dbgEvent)))
+        {
+            SetContinueStatus(DBG_CONTINUE);
+            return;
+        }
         fprintf(stderr, "Received breakpoint at address %p.\n", dwExceptionAddress);  
 
         Breakpoint *pBreakpoint = m_pDebugger->FindBreakpoint(dwExceptionAddress);
@@ -66,8 +95,40 @@ void DebugExceptionHandler::Initialize()
     {
         auto &exceptionRecord = dbgEvent.u.Exception.ExceptionRecord;
         const DWORD_PTR dwExceptionAddress = (DWORD_PTR)exceptionRecord.ExceptionAddress;
+        const bool bIsProfilerStep = (m_pDebugger->m_pFunctionProfiler != nullptr &&
+            m_pDebugger->m_pFunctionProfiler->HandleSingleStep(dbgEvent));
+        const bool bIsTemporaryStep = (m_pDebugger->m_pTemporaryBreakpoints != nullptr &&
+            m_pDebugger->m_pTemporaryBreakpoints->HandleSingleStep(dbgEvent));
+        const bool bIsConditionStep = (m_pDebugger->m_pConditionalBreakpoints != nullptr &&
+            m_pDebugger->m_pConditionalBreakpoints->HandleSingleStep(dbgEvent)) ||
+            (m_pDebugger->m_pLogpoints != nullptr && m_pDebugger->m_pLogpoints->HandleSingleStep(dbgEvent));
+        const bool bIsApiStep = (m_pDebugger->m_pApiTracer != nullptr && m_pDebugger->m_pApiTracer->HandleSingleStep(dbgEvent));
+        bool bIsTraceFinished = false;
+        const bool bIsTraceStep = (m_pDebugger->m_pInstructionTracer != nullptr &&
+            m_pDebugger->m_pInstructionTracer->HandleSingleStep(dbgEvent, bIsTraceFinished));
+        const RangeStepper::eResult rangeResult = (m_pDebugger->m_pRangeStepper != nullptr) ?
+            m_pDebugger->m_pRangeStepper->HandleSingleStep(dbgEvent) : RangeStepper::eResult::eNotOwned;
+        const bool bIsRangeStep = (rangeResult != RangeStepper::eResult::eNotOwned);
+        const Watchpoints::eResult watchResult = (m_pDebugger->m_pWatchpoints != nullptr) ?
+            m_pDebugger->m_pWatchpoints->HandleSingleStep(dbgEvent) : Watchpoints::eResult::eNotOwned;
+        const bool bIsWatchStep = (watchResult != Watchpoints::eResult::eNotOwned);
+        const bool bIsFinished = bIsTraceFinished || (rangeResult == RangeStepper::eResult::eFinished) ||
+            (watchResult == Watchpoints::eResult::eStop);
+        if ((bIsProfilerStep || bIsTemporaryStep || bIsConditionStep || bIsApiStep || bIsTraceStep || bIsRangeStep ||
+            bIsWatchStep) && !m_pDebugger->m_bIsStepping && !bIsFinished)
+        {
+            //The first traced or range step is also the one that was meant to put the last breakpoint back
+            Breakpoint * const pLastBreakpoint = m_pDebugger->m_pLastBreakpoint;
+            if ((bIsTraceStep || bIsRangeStep) && pLastBreakpoint != nullptr && pLastBreakpoint != m_pDebugger->m_pStepPoint.get() &&
+                !pLastBreakpoint->IsEnabled())
+            {
+                (void)pLastBreakpoint->Enable();
+            }
+            SetContinueStatus(DBG_CONTINUE);
+            return;
+        }
         fprintf(stderr, "Received step at address %p\n", dwExceptionAddress);
-        if (m_pDebugger->m_bIsStepping)
+        if (m_pDebugger->m_bIsStepping || bIsFinished)
         {
             fprintf(stderr, "Press c to continue, s to step into, o to step over.\n");
             m_pDebugger->m_dwExecutingThreadId = dbgEvent.dwThreadId;
@@ -77,7 +138,8 @@ void DebugExceptionHandler::Initialize()
                 (void)m_pDebugger->WaitForContinue();
             }
         }
-        if (m_pDebugger->m_pLastBreakpoint != m_pDebugger->m_pStepPoint.get() && !m_pDebugger->m_pLastBreakpoint->IsEnabled())
+        if (m_pDebugger->m_pLastBreakpoint != nullptr && m_pDebugger->m_pLastBreakpoint != m_pDebugger->m_pStepPoint.get() &&
+            !m_pDebugger->m_pLastBreakpoint->IsEnabled())
         {
             (void)m_pDebugger->m_pLastBreakpoint->Enable();
         }
@@ -183,6 +245,10 @@ void DebugExceptionHandler::Initialize()
 
     Register(DebugExceptions::eGuardPage, [&](const DEBUG_EVENT &dbgEvent)
     {
+        if (HandleWatchFault(dbgEvent))
+        {
+            return;
+        }
         fprintf(stderr, "Received guard page\n");
         SetContinueStatus(DBG_EXCEPTION_NOT_HANDLED);
     });
@@ -194,6 +260,31 @@ void DebugExceptionHandler::Initialize()
     });
 }
 
+const bool DebugExceptionHandler::HandleWatchFault(const DEBUG_EVENT &dbgEvent)
+{
+    const Watchpoints::eResult result = (m_pDebugger->m_pWatchpoints != nullptr) ?
+        m_pDebugger->m_pWatchpoints->HandleFault(dbgEvent) : Watchpoints::eResult::eNotOwned;
+    if (result == Watchpoints::eResult::eNotOwned)
+    {
+        return false;
+    }
+
+    //The faulting instruction has not run yet; it is stepped once the user continues and the page is protected again
+    if (result == Watchpoints::eResult::eStop)
+    {
+        fprintf(stderr, "Press c to continue, s to step into, o to step over.\n");
+        m_pDebugger->m_dwExecutingThreadId = dbgEvent.dwThreadId;
+        CONTEXT ctx = m_pDebugger->GetExecutingContext();
+        if (m_pDebugger->SetExecutingContext(ctx))
+        {
+            (void)m_pDebugger->WaitForContinue();
+        }
+    }
+    SetContinueStatus(DBG_CONTINUE);
+
+    return true;
+}
+
 const DWORD DebugExceptionHandler::ContinueStatus() const
 {
     return m_dwContinueStatus;
@@ -49,6 +49,9 @@ private:
     void Initialize();
     void SetContinueStatus(const DWORD dwContinueStatus);
 
+    //Guard page and access violation faults raised by watchpoints; false when the fault is the target's own
+    const bool HandleWatchFault(const DEBUG_EVENT &dbgEvent);
+
     Debugger * const m_pDebugger;
     DWORD m_dwContinueStatus;
 };
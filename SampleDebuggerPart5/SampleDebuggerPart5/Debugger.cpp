@@ -4,9 +4,11 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <iterator>
 #include <DbgHelp.h>
 
 #include "Common.h"
+#include "DumpWriter.h"
 
 namespace CodeReversing
 {
@@ -96,10 +98,12 @@ const bool Debugger::AddBreakpoint(const DWORD_PTR dwAddress)
     bool bSuccess = false;
     DWORD dwOldProtect = ChangeMemoryPermissions(dwAddress, sizeof(DWORD_PTR), PAGE_EXECUTE_READWRITE);
 
-    std::unique_ptr<InterruptBreakpoint> pNewBreakpoint(new InterruptBreakpoint(m_hProcess(), dwAddress));
-    if (pNewBreakpoint->EnableBreakpoint())
+    std::unique_ptr<InterruptBreakpoint> pNewBreakpoint(new InterruptBreakpoint(m_hProcess(), dwAddress,
+        m_pPatchManager.get()));
+    if (m_mapBreakpoints.find(dwAddress) == m_mapBreakpoints.end() && pNewBreakpoint->Enable())
     {
         m_lstBreakpoints.emplace_back(std::move(pNewBreakpoint));
+        m_mapBreakpoints[dwAddress] = std::prev(m_lstBreakpoints.end());
         bSuccess = true;
     }
 
@@ -113,14 +117,16 @@ const bool Debugger::RemoveBreakpoint(const DWORD_PTR dwAddress)
     bool bSuccess = false;
     DWORD dwOldProtect = ChangeMemoryPermissions(dwAddress, sizeof(DWORD_PTR), PAGE_EXECUTE_READWRITE);
 
-    auto breakpoint = std::find_if(m_lstBreakpoints.begin(), m_lstBreakpoints.end(), [=](const std::unique_ptr<Breakpoint> &breakpoint)
+    auto breakpoint = m_mapBreakpoints.find(dwAddress);
+    if (breakpoint != m_mapBreakpoints.end())
     {
-        return breakpoint->Address() == dwAddress;
-    });
-    if (breakpoint != m_lstBreakpoints.end())
-    {
-        (void)(*breakpoint)->Disable();
-        m_lstBreakpoints.remove(*breakpoint);
+        (void)(*breakpoint->second)->Disable();
+        if (m_pLastBreakpoint == breakpoint->second->get())
+        {
+            m_pLastBreakpoint = nullptr;
+        }
+        m_lstBreakpoints.erase(breakpoint->second);
+        m_mapBreakpoints.erase(breakpoint);
         bSuccess = true;
     }
 
@@ -131,13 +137,10 @@ const bool Debugger::RemoveBreakpoint(const DWORD_PTR dwAddress)
 
 Breakpoint * Debugger::FindBreakpoint(const DWORD_PTR dwAddress)
 {
-    auto breakpoint = std::find_if(m_lstBreakpoints.begin(), m_lstBreakpoints.end(), [=](const std::unique_ptr<Breakpoint> &breakpoint)
+    auto breakpoint = m_mapBreakpoints.find(dwAddress);
+    if (breakpoint != m_mapBreakpoints.end())
     {
-        return breakpoint->Address() == dwAddress;
-    });
-    if (breakpoint != m_lstBreakpoints.end())
-    {
-        return breakpoint->get();
+        return breakpoint->second->get();
     }
     if (m_pStepPoint->Address() == dwAddress)
     {
@@ -169,6 +172,111 @@ const bool Debugger::RemoveBreakpoint(const char * const pSymbolName)
     return false;
 }
 
+const bool Debugger::AddBreakpoints(const std::vector<DWORD_PTR> &vecAddresses, const bool bEnable)
+{
+    for (auto dwAddress : vecAddresses)
+    {
+        if (m_mapBreakpoints.find(dwAddress) == m_mapBreakpoints.end())
+        {
+            m_lstBreakpoints.emplace_back(new InterruptBreakpoint(m_hProcess(), dwAddress, m_pPatchManager.get()));
+            m_mapBreakpoints[dwAddress] = std::prev(m_lstBreakpoints.end());
+        }
+    }
+
+    return !bEnable || EnableBreakpoints(vecAddresses, true);
+}
+
+const bool Debugger::EnableBreakpoints(const std::vector<DWORD_PTR> &vecAddresses, const bool bEnable)
+{
+    bool bSuccess = true;
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    std::vector<Breakpoint *> vecToggled;
+    for (auto dwAddress : vecAddresses)
+    {
+        auto breakpoint = m_mapBreakpoints.find(dwAddress);
+        if (breakpoint == m_mapBreakpoints.end() || (*breakpoint->second)->IsEnabled() == bEnable ||
+            mapBytes.find(dwAddress) != mapBytes.end())
+        {
+            continue;
+        }
+
+        //A breakpoint the current thread is stepping off is put back by the step itself
+        Breakpoint * const pBreakpoint = breakpoint->second->get();
+        if (bEnable && pBreakpoint == m_pLastBreakpoint)
+        {
+            continue;
+        }
+        if (pBreakpoint->Type() != Breakpoint::eType::eInterrupt)
+        {
+            bSuccess = (bEnable ? pBreakpoint->Enable() : pBreakpoint->Disable()) && bSuccess;
+            continue;
+        }
+        mapBytes[dwAddress] = bEnable ? 0xCC : static_cast<InterruptBreakpoint *>(pBreakpoint)->OriginalByte();
+        vecToggled.push_back(pBreakpoint);
+    }
+    if (mapBytes.empty())
+    {
+        return bSuccess;
+    }
+
+    //The patch manager writes bytes under an enabled int 3 into the breakpoint, so these are marked disabled first
+    if (!bEnable)
+    {
+        for (auto pBreakpoint : vecToggled)
+        {
+            pBreakpoint->m_eState = Breakpoint::eState::eDisabled;
+        }
+    }
+
+    std::vector<PatchByte> vecPrevious;
+    if (!m_pPatchManager->WriteBatch(mapBytes, &vecPrevious))
+    {
+        for (auto pBreakpoint : vecToggled)
+        {
+            pBreakpoint->m_eState = bEnable ? Breakpoint::eState::eDisabled : Breakpoint::eState::eEnabled;
+        }
+        return false;
+    }
+
+    for (auto &previous : vecPrevious)
+    {
+        InterruptBreakpoint * const pBreakpoint = static_cast<InterruptBreakpoint *>(m_mapBreakpoints[previous.dwAddress]->get());
+        if (bEnable)
+        {
+            pBreakpoint->SetOriginalByte(previous.cOriginal);
+            pBreakpoint->m_eState = Breakpoint::eState::eEnabled;
+        }
+        else if (pBreakpoint == m_pLastBreakpoint)
+        {
+            //Otherwise the next step would put it straight back
+            m_pLastBreakpoint = nullptr;
+        }
+    }
+
+    return bSuccess;
+}
+
+const bool Debugger::RemoveBreakpoints(const std::vector<DWORD_PTR> &vecAddresses)
+{
+    const bool bSuccess = EnableBreakpoints(vecAddresses, false);
+    for (auto dwAddress : vecAddresses)
+    {
+        auto breakpoint = m_mapBreakpoints.find(dwAddress);
+        if (breakpoint == m_mapBreakpoints.end() || (*breakpoint->second)->IsEnabled())
+        {
+            continue;
+        }
+        if (m_pLastBreakpoint == breakpoint->second->get())
+        {
+            m_pLastBreakpoint = nullptr;
+        }
+        m_lstBreakpoints.erase(breakpoint->second);
+        m_mapBreakpoints.erase(breakpoint);
+    }
+
+    return bSuccess;
+}
+
 const bool Debugger::StepInto()
 {
     CONTEXT ctx = GetExecutingContext();
@@ -212,6 +320,45 @@ const bool Debugger::StepOver()
     return false;
 }
 
+const bool Debugger::StepRange(const DWORD_PTR dwStart, const DWORD_PTR dwEnd)
+{
+    return m_pRangeStepper->StartRange(m_dwExecutingThreadId, dwStart, dwEnd) && Continue(false);
+}
+
+const bool Debugger::StepLine()
+{
+    return m_pRangeStepper->StartLine(m_dwExecutingThreadId) && Continue(false);
+}
+
+const bool Debugger::StepOut()
+{
+    //Frame 1 is the caller; its return lands once the stack pointer is back above the current one
+    const CONTEXT ctx = GetExecutingContext();
+    StackFrame pFrames[2] = { 0 };
+    if (m_pStackUnwinder->Capture(ctx, pFrames, 2) < 2)
+    {
+        fprintf(stderr, "Could not find the return address of the current function.\n");
+        return false;
+    }
+
+    const DWORD_PTR dwStack = StackPointer(ctx);
+    const std::vector<DWORD_PTR> vecReturn{ pFrames[1].dwInstruction };
+    unsigned int uiId = 0;
+    return m_pTemporaryBreakpoints->Add(m_dwExecutingThreadId, dwStack, vecReturn, uiId) && Continue(false);
+}
+
+const bool Debugger::RunTo(const DWORD_PTR dwAddress)
+{
+    unsigned int uiId = 0;
+    return m_pTemporaryBreakpoints->Add(m_dwExecutingThreadId, 0, std::vector<DWORD_PTR>{ dwAddress }, uiId) && Continue(false);
+}
+
+const bool Debugger::RunToAny(const std::vector<DWORD_PTR> &vecAddresses)
+{
+    unsigned int uiId = 0;
+    return m_pTemporaryBreakpoints->Add(0, 0, vecAddresses, uiId) && Continue(false);
+}
+
 const bool Debugger::Continue()
 {
     return Continue(false);
@@ -363,11 +510,54 @@ void Debugger::PrintContext()
         return bSuccess;
     }
 
+void Debugger::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const
+{
+    auto Restore = [&](const InterruptBreakpoint * const pBreakpoint)
+    {
+        if (pBreakpoint->IsEnabled() && pBreakpoint->Address() >= dwAddress && pBreakpoint->Address() - dwAddress < ulSize)
+        {
+            pBytes[pBreakpoint->Address() - dwAddress] = pBreakpoint->OriginalByte();
+        }
+    };
+
+    for (auto breakpoint = m_mapBreakpoints.lower_bound(dwAddress);
+        breakpoint != m_mapBreakpoints.end() && breakpoint->first - dwAddress < ulSize; ++breakpoint)
+    {
+        if ((*breakpoint->second)->Type() == Breakpoint::eType::eInterrupt)
+        {
+            Restore((const InterruptBreakpoint *)breakpoint->second->get());
+        }
+    }
+    if (m_pStepPoint != nullptr)
+    {
+        Restore(m_pStepPoint.get());
+    }
+    if (m_pFunctionProfiler != nullptr)
+    {
+        m_pFunctionProfiler->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+    }
+    if (m_pCoverageTracer != nullptr)
+    {
+        m_pCoverageTracer->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+    }
+    if (m_pRangeStepper != nullptr)
+    {
+        m_pRangeStepper->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+    }
+    if (m_pTemporaryBreakpoints != nullptr)
+    {
+        m_pTemporaryBreakpoints->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+    }
+    if (m_pApiTracer != nullptr)
+    {
+        m_pApiTracer->RestoreOriginalBytes(dwAddress, pBytes, ulSize);
+    }
+}
+
 const bool Debugger::ChangeByteAt(const DWORD_PTR dwAddress, const unsigned char cNewByte)
 {
-    SIZE_T ulBytesWritten = 0;
-    const bool bSuccess = BOOLIFY(WriteProcessMemory(m_hProcess(), (LPVOID)dwAddress, &cNewByte, sizeof(unsigned char), &ulBytesWritten));
-    if (bSuccess && ulBytesWritten == sizeof(unsigned char))
+    const bool bSuccess = m_pPatchManager->WriteBytes(dwAddress, &cNewByte, sizeof(unsigned char));
+    if (bSuccess)
     {
         return true;
     }
@@ -411,4 +601,133 @@ const Symbols * const Debugger::ProcessSymbols() const
     return m_pSymbols.get();
 }
 
+Disassembler * const Debugger::ProcessDisassembler() const
+{
+    return m_pDisassembler.get();
+}
+
+AddressResolver * const Debugger::ProcessResolver() const
+{
+    return m_pAddressResolver.get();
+}
+
+PatchManager * const Debugger::ProcessPatches() const
+{
+    return m_pPatchManager.get();
+}
+
+MemoryScanner * const Debugger::ProcessScanner() const
+{
+    return m_pMemoryScanner.get();
+}
+
+ValueScanner * const Debugger::ProcessValueScanner() const
+{
+    return m_pValueScanner.get();
+}
+
+MemorySnapshot * const Debugger::ProcessSnapshot() const
+{
+    return m_pMemorySnapshot.get();
+}
+
+ControlFlowGraph * const Debugger::ProcessFlowGraph() const
+{
+    return m_pControlFlowGraph.get();
+}
+
+StackUnwinder * const Debugger::ProcessUnwinder() const
+{
+    return m_pStackUnwinder.get();
+}
+
+SamplingProfiler * const Debugger::ProcessProfiler() const
+{
+    return m_pSamplingProfiler.get();
+}
+
+FunctionProfiler * const Debugger::ProcessFunctionProfiler() const
+{
+    return m_pFunctionProfiler.get();
+}
+
+CoverageTracer * const Debugger::ProcessCoverage() const
+{
+    return m_pCoverageTracer.get();
+}
+
+InstructionTracer * const Debugger::ProcessTracer() const
+{
+    return m_pInstructionTracer.get();
+}
+
+RangeStepper * const Debugger::ProcessStepper() const
+{
+    return m_pRangeStepper.get();
+}
+
+TemporaryBreakpoints * const Debugger::ProcessTemporaries() const
+{
+    return m_pTemporaryBreakpoints.get();
+}
+
+ConditionalBreakpoints * const Debugger::ProcessConditions() const
+{
+    return m_pConditionalBreakpoints.get();
+}
+
+Logpoints * const Debugger::ProcessLogpoints() const
+{
+    return m_pLogpoints.get();
+}
+
+ApiTracer * const Debugger::ProcessApiTracer() const
+{
+    return m_pApiTracer.get();
+}
+
+PendingBreakpoints * const Debugger::ProcessPendingBreakpoints() const
+{
+    return m_pPendingBreakpoints.get();
+}
+
+BreakpointGroups * const Debugger::ProcessBreakpointGroups() const
+{
+    return m_pBreakpointGroups.get();
+}
+
+Watchpoints * const Debugger::ProcessWatchpoints() const
+{
+    return m_pWatchpoints.get();
+}
+
+const bool Debugger::WriteDump(const char * const pPath, const bool bCompress /*= false*/, const bool bIncludeImagePages /*= false*/)
+{
+    DumpWriter dumpWriter(this);
+    return dumpWriter.Write(pPath, bCompress, bIncludeImagePages);
+}
+
+const bool Debugger::AnalyzeModule(const DWORD_PTR dwModuleBase, ModuleIndex &index) const
+{
+    ModuleAnalyzer moduleAnalyzer(Handle());
+    if (!moduleAnalyzer.Analyze(dwModuleBase, index))
+    {
+        return false;
+    }
+
+    m_pControlFlowGraph->AddModule(index);
+    return true;
+}
+
+const size_t Debugger::CaptureStack(StackFrame * const pFrames, const size_t ulMaxFrames)
+{
+    const CONTEXT ctx = GetExecutingContext();
+    return m_pStackUnwinder->Capture(ctx, pFrames, ulMaxFrames);
+}
+
+const bool Debugger::TraceExecutingThread(const char * const pPath, const TraceOptions &options)
+{
+    return m_pInstructionTracer->Start(m_dwExecutingThreadId, pPath, options);
+}
+
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <map>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include <Windows.h>
 
@@ -15,6 +16,26 @@
 #include "SafeHandle.h"
 #include "Symbols.h"
 #include "Disassembler.h"
+#include "AddressResolver.h"
+#include "PatchManager.h"
+#include "MemoryScanner.h"
+#include "ValueScanner.h"
+#include "MemorySnapshot.h"
+#include "ModuleAnalyzer.h"
+#include "ControlFlowGraph.h"
+#include "StackUnwinder.h"
+#include "SamplingProfiler.h"
+#include "FunctionProfiler.h"
+#include "CoverageTracer.h"
+#include "InstructionTracer.h"
+#include "RangeStepper.h"
+#include "TemporaryBreakpoints.h"
+#include "ConditionalBreakpoints.h"
+#include "Logpoints.h"
+#include "ApiTracer.h"
+#include "PendingBreakpoints.h"
+#include "BreakpointGroups.h"
+#include "Watchpoints.h"
 
 namespace CodeReversing
 {
@@ -37,6 +58,11 @@ public:
     const bool Stop();
     const bool StepInto();
     const bool StepOver();
+    const bool StepRange(const DWORD_PTR dwStart, const DWORD_PTR dwEnd);
+    const bool StepLine();
+    const bool StepOut();
+    const bool RunTo(const DWORD_PTR dwAddress);
+    const bool RunToAny(const std::vector<DWORD_PTR> &vecAddresses);
     const bool Continue();
 
     void PrintCallStack();
@@ -58,8 +84,40 @@ public:
     const bool AddBreakpoint(const char * const pSymbolName);
     const bool RemoveBreakpoint(const char * const pSymbolName);
 
+    //Page-batched versions for breakpoint groups; addresses without a breakpoint, or already in the state, are skipped
+    const bool AddBreakpoints(const std::vector<DWORD_PTR> &vecAddresses, const bool bEnable);
+    const bool EnableBreakpoints(const std::vector<DWORD_PTR> &vecAddresses, const bool bEnable);
+    const bool RemoveBreakpoints(const std::vector<DWORD_PTR> &vecAddresses);
+
+    const bool WriteDump(const char * const pPath, const bool bCompress = false, const bool bIncludeImagePages = false);
+    const bool AnalyzeModule(const DWORD_PTR dwModuleBase, ModuleIndex &index) const;
+    const size_t CaptureStack(StackFrame * const pFrames, const size_t ulMaxFrames);
+    const bool TraceExecutingThread(const char * const pPath, const TraceOptions &options);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+
     const HANDLE Handle() const;
     const Symbols * const ProcessSymbols() const;
+    Disassembler * const ProcessDisassembler() const;
+    AddressResolver * const ProcessResolver() const;
+    PatchManager * const ProcessPatches() const;
+    MemoryScanner * const ProcessScanner() const;
+    ValueScanner * const ProcessValueScanner() const;
+    MemorySnapshot * const ProcessSnapshot() const;
+    ControlFlowGraph * const ProcessFlowGraph() const;
+    StackUnwinder * const ProcessUnwinder() const;
+    SamplingProfiler * const ProcessProfiler() const;
+    FunctionProfiler * const ProcessFunctionProfiler() const;
+    CoverageTracer * const ProcessCoverage() const;
+    InstructionTracer * const ProcessTracer() const;
+    RangeStepper * const ProcessStepper() const;
+    TemporaryBreakpoints * const ProcessTemporaries() const;
+    ConditionalBreakpoints * const ProcessConditions() const;
+    Logpoints * const ProcessLogpoints() const;
+    ApiTracer * const ProcessApiTracer() const;
+    PendingBreakpoints * const ProcessPendingBreakpoints() const;
+    BreakpointGroups * const ProcessBreakpointGroups() const;
+    Watchpoints * const ProcessWatchpoints() const;
 
 private:
     volatile bool m_bIsActive;
@@ -88,8 +146,29 @@ private:
 
     std::unique_ptr<InterruptBreakpoint> m_pStepPoint;
     std::unique_ptr<Disassembler> m_pDisassembler;
+    std::unique_ptr<AddressResolver> m_pAddressResolver;
+    std::unique_ptr<PatchManager> m_pPatchManager;
+    std::unique_ptr<MemoryScanner> m_pMemoryScanner;
+    std::unique_ptr<ValueScanner> m_pValueScanner;
+    std::unique_ptr<MemorySnapshot> m_pMemorySnapshot;
+    std::unique_ptr<ControlFlowGraph> m_pControlFlowGraph;
+    std::unique_ptr<StackUnwinder> m_pStackUnwinder;
+    std::unique_ptr<SamplingProfiler> m_pSamplingProfiler;
+    std::unique_ptr<FunctionProfiler> m_pFunctionProfiler;
+    std::unique_ptr<CoverageTracer> m_pCoverageTracer;
+    std::unique_ptr<InstructionTracer> m_pInstructionTracer;
+    std::unique_ptr<RangeStepper> m_pRangeStepper;
+    std::unique_ptr<TemporaryBreakpoints> m_pTemporaryBreakpoints;
+    std::unique_ptr<ConditionalBreakpoints> m_pConditionalBreakpoints;
+    std::unique_ptr<Logpoints> m_pLogpoints;
+    std::unique_ptr<ApiTracer> m_pApiTracer;
+    std::unique_ptr<PendingBreakpoints> m_pPendingBreakpoints;
+    std::unique_ptr<BreakpointGroups> m_pBreakpointGroups;
+    std::unique_ptr<Watchpoints> m_pWatchpoints;
 
     std::list<std::unique_ptr<Breakpoint>> m_lstBreakpoints;
+    //Ordered so that restoring the bytes under a window only visits the breakpoints inside it
+    std::map<DWORD_PTR, std::list<std::unique_ptr<Breakpoint>>::iterator> m_mapBreakpoints;
 
 };
 
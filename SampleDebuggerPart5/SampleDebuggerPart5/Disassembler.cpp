@@ -2,18 +2,50 @@
 
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <memory>
 
 #include "Common.h"
+#include "Stopwatch.h"
 
 namespace CodeReversing
 {
 
+namespace
+{
+
+const size_t ulMaxInstructionLength = LengthDecoder::ulMaxInstructionLength;
+const size_t ulMaxCachedInstructions = 64 * 1024;
+
+//Fixed width, uppercase hex without going through the printf machinery
+const size_t WriteHex(char * const pBuffer, ULONGLONG ullValue, const size_t ulDigits)
+{
+    for (size_t i = ulDigits; i > 0; --i)
+    {
+        pBuffer[i - 1] = "0123456789ABCDEF"[ullValue & 0xF];
+        ullValue >>= 4;
+    }
+    return ulDigits;
+}
+
+#ifdef _M_IX86
+const LengthDecoder::eMode decoderMode = LengthDecoder::eMode::e32Bit;
+#elif defined _M_AMD64
+const LengthDecoder::eMode decoderMode = LengthDecoder::eMode::e64Bit;
+#else
+#error "Unsupported architecture"
+#endif
+
+}
+
 HMODULE Disassembler::m_hDll = nullptr;
 pDisasm Disassembler::m_pDisasm = nullptr;
 
-Disassembler::Disassembler(HANDLE hProcess) : m_hProcess{ hProcess }
+Disassembler::Disassembler(HANDLE hProcess) : m_hProcess{ hProcess }, m_dwStartAddress{ 0 }, m_ulBytesValid{ 0 },
+    m_ullGeneration{ 0 }
 {
     memset(&m_disassembler, 0, sizeof(DISASM));
+    memset(&m_stats, 0, sizeof(CacheStats));
 #ifdef _M_IX86
     m_disassembler.Archi = 0;
     if (m_hDll == nullptr)
@@ -43,96 +75,431 @@ Disassembler::~Disassembler()
 
 const bool Disassembler::BytesAtAddress(DWORD_PTR dwAddress, size_t ulInstructionsToDisassemble /*= 15*/)
 {
-    if (IsInitialized())
-    {
-        SetDisassembler(dwAddress);
-        bool bFailed = false;
-        while (!bFailed && ulInstructionsToDisassemble-- > 0)
-        {
-            int iDisasmLength = m_pDisasm(&m_disassembler);
-            if (iDisasmLength != UNKNOWN_OPCODE)
-            {
-                fprintf(stderr, "0x%p - %s\n", dwAddress, m_disassembler.CompleteInstr);
-                m_disassembler.EIP += iDisasmLength;
-                dwAddress += iDisasmLength;
-            }
-            else
-            {
-                fprintf(stderr, "Error: Reached unknown opcode in disassembly.\n");
-                bFailed = true;
-            }
-        }
-    }
-    else
+    if (!IsInitialized())
     {
         fprintf(stderr, "Could not show disassembly at address. Disassembler Dll was not loaded properly.\n");
         return false;
     }
 
+    //Lines are collected into one buffer so the console only gets a write per batch
+    std::array<char, 16 * 1024> listing;
+    while (ulInstructionsToDisassemble > 0)
+    {
+        const size_t ulLines = List(dwAddress, ulInstructionsToDisassemble, listing.data(), listing.size(), dwAddress);
+        if (ulLines == 0)
+        {
+            return false;
+        }
+        (void)fputs(listing.data(), stderr);
+        ulInstructionsToDisassemble -= ulLines;
+    }
+
     return true;
 }
 
 DWORD_PTR Disassembler::GetNextInstruction(const DWORD_PTR dwAddress, bool &bIsUnconditionalBranch)
 {
     DWORD_PTR dwNextAddress = 0;
-    if (IsInitialized())
+    DecodedInstruction instruction = { 0 };
+    if (Decode(dwAddress, instruction))
     {
-        SetDisassembler(dwAddress);
-        int iDisasmLength = m_pDisasm(&m_disassembler);
-        if (iDisasmLength != UNKNOWN_OPCODE)
+        if (instruction.branchType == eBranchType::eReturn || instruction.branchType == eBranchType::eJump)
         {
-            if (m_disassembler.Instruction.BranchType == RetType || m_disassembler.Instruction.BranchType == JmpType)
-            {
-                bIsUnconditionalBranch = true;
-            }
-            else
-            {
-                dwNextAddress = (dwAddress + iDisasmLength);
-            }
+            bIsUnconditionalBranch = true;
         }
         else
         {
-            fprintf(stderr, "Could not get next instruction. Unknown opcode at %p.\n");
+            dwNextAddress = (dwAddress + instruction.cLength);
         }
     }
     else
     {
-        fprintf(stderr, "Could not get next instruction. Disassembler Dll was not loaded propertly.\n");
+        fprintf(stderr, "Could not get next instruction at %p.\n", dwAddress);
     }
 
     return dwNextAddress;
 }
 
-void Disassembler::SetDisassembler(const DWORD_PTR dwAddress)
+const size_t Disassembler::List(const DWORD_PTR dwAddress, const size_t ulInstructions, char * const pBuffer,
+    const size_t ulBufferSize, DWORD_PTR &dwNextAddress)
+{
+    dwNextAddress = dwAddress;
+    if (!IsInitialized() || ulBufferSize == 0)
+    {
+        return 0;
+    }
+
+    //Lines are formatted in place, so stop once a worst case line plus its newline and terminator no longer fits
+    size_t ulLines = 0;
+    size_t ulWritten = 0;
+    while (ulLines < ulInstructions && ulBufferSize - ulWritten >= ulMaxLineLength + 2)
+    {
+        size_t ulLineLength = 0;
+        size_t ulInstructionLength = 0;
+        if (!FormatLine(dwNextAddress, &pBuffer[ulWritten], ulLineLength, ulInstructionLength))
+        {
+            break;
+        }
+        ulWritten += ulLineLength;
+        pBuffer[ulWritten++] = '\n';
+        dwNextAddress += ulInstructionLength;
+        ++ulLines;
+    }
+    pBuffer[ulWritten] = '\0';
+
+    return ulLines;
+}
+
+const size_t Disassembler::List(const DWORD_PTR dwAddress, const size_t ulInstructions, const ListingSink &sink)
+{
+    if (!IsInitialized())
+    {
+        return 0;
+    }
+
+    char pLine[ulMaxLineLength] = { 0 };
+    DWORD_PTR dwCurrent = dwAddress;
+    size_t ulLines = 0;
+    while (ulLines < ulInstructions)
+    {
+        size_t ulLineLength = 0;
+        size_t ulInstructionLength = 0;
+        if (!FormatLine(dwCurrent, pLine, ulLineLength, ulInstructionLength))
+        {
+            break;
+        }
+        ++ulLines;
+        if (!sink(dwCurrent, pLine, ulLineLength))
+        {
+            break;
+        }
+        dwCurrent += ulInstructionLength;
+    }
+
+    return ulLines;
+}
+
+void Disassembler::SetTargetFormatter(const TargetFormatter &formatter)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_targetFormatter = formatter;
+}
+
+const bool Disassembler::BenchmarkListing(const DWORD_PTR dwAddress, const size_t ulInstructions)
 {
-    bool bIsCached = ((dwAddress - m_dwStartAddress) < m_bytes.size());
-    bIsCached &= (dwAddress < m_dwStartAddress);
-    if (!bIsCached)
+    if (!IsInitialized())
     {
-        (void)TransferBytes(dwAddress);
-        m_disassembler.EIP = (UIntPtr)m_bytes.data();
-        m_dwStartAddress = dwAddress;
+        fprintf(stderr, "Could not benchmark listing. Disassembler Dll was not loaded properly.\n");
+        return false;
+    }
+
+    const size_t ulBufferSize = 64 * 1024;
+    std::unique_ptr<char[]> pBuffer(new char[ulBufferSize]);
+
+    Stopwatch stopwatch;
+    DWORD_PTR dwNextAddress = dwAddress;
+    size_t ulLines = 0;
+    size_t ulCharacters = 0;
+    while (ulLines < ulInstructions)
+    {
+        const size_t ulBatch = List(dwNextAddress, ulInstructions - ulLines, pBuffer.get(), ulBufferSize, dwNextAddress);
+        if (ulBatch == 0)
+        {
+            break;
+        }
+        ulLines += ulBatch;
+        ulCharacters += strlen(pBuffer.get());
+    }
+    double dSeconds = stopwatch.ElapsedSeconds();
+    double dLinesPerSecond = (dSeconds > 0.0) ? ulLines / dSeconds : 0.0;
+    fprintf(stderr, "Buffer listing: %Iu lines, %Iu KB of text, %.0f lines/s (%.0f lines per 60 Hz frame).\n",
+        ulLines, ulCharacters / 1024, dLinesPerSecond, dLinesPerSecond / 60.0);
+
+    stopwatch.Start();
+    ulCharacters = 0;
+    ulLines = List(dwAddress, ulInstructions, [&ulCharacters](const DWORD_PTR dwLineAddress, const char * const pLine, const size_t ulLength)
+    {
+        ulCharacters += ulLength;
+        return true;
+    });
+    dSeconds = stopwatch.ElapsedSeconds();
+    dLinesPerSecond = (dSeconds > 0.0) ? ulLines / dSeconds : 0.0;
+    fprintf(stderr, "Sink listing: %Iu lines, %Iu KB of text, %.0f lines/s (%.0f lines per 60 Hz frame).\n",
+        ulLines, ulCharacters / 1024, dLinesPerSecond, dLinesPerSecond / 60.0);
+
+    return ulLines != 0;
+}
+
+const bool Disassembler::Decode(const DWORD_PTR dwAddress, DecodedInstruction &instruction)
+{
+    Stopwatch stopwatch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto cached = m_mapInstructions.find(dwAddress);
+    if (cached != m_mapInstructions.end())
+    {
+        instruction = cached->second;
+        ++m_stats.ullHits;
+        m_stats.dHitMicroseconds += stopwatch.ElapsedMicroseconds();
+        return true;
+    }
+
+    //Only lengths and branches are needed here, so BeaEngine is left for printing
+    if (!SetDisassembler(dwAddress, lock))
+    {
+        return false;
+    }
+    const size_t ulOffset = (size_t)(dwAddress - m_dwStartAddress);
+    LengthDecoder::Result result = { 0 };
+    if (!LengthDecoder::Decode((const uint8_t *)&m_bytes[ulOffset], m_ulBytesValid - ulOffset, decoderMode, result))
+    {
+        fprintf(stderr, "Could not decode instruction. Unknown opcode at %p.\n", dwAddress);
+        return false;
+    }
+
+    //Nothing is evicted selectively; once the cache is full it simply starts over
+    if (m_mapInstructions.size() >= ulMaxCachedInstructions)
+    {
+        m_mapInstructions.clear();
+    }
+    instruction.dwAddress = dwAddress;
+    instruction.cLength = result.uiLength;
+    instruction.branchType = result.branchType;
+    instruction.bIsIndirect = result.bIsIndirect;
+    instruction.dwTarget = (DWORD_PTR)LengthDecoder::BranchTarget(dwAddress, result);
+    m_mapInstructions[dwAddress] = instruction;
+
+    ++m_stats.ullMisses;
+    m_stats.dMissMicroseconds += stopwatch.ElapsedMicroseconds();
+
+    return true;
+}
+
+void Disassembler::Invalidate(const DWORD_PTR dwAddress, const size_t ulSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //An instruction starting up to 14 bytes before the write can still overlap it
+    const DWORD_PTR dwFirst = (dwAddress > ulMaxInstructionLength - 1) ? dwAddress - (ulMaxInstructionLength - 1) : 0;
+    const DWORD_PTR dwEnd = dwAddress + ulSize;
+    if (dwEnd - dwFirst > m_mapInstructions.size())
+    {
+        for (auto iter = m_mapInstructions.begin(); iter != m_mapInstructions.end();)
+        {
+            iter = (iter->first >= dwFirst && iter->first < dwEnd) ? m_mapInstructions.erase(iter) : ++iter;
+        }
     }
     else
     {
-        m_disassembler.EIP = (UIntPtr)&m_bytes.data()[dwAddress - m_dwStartAddress];
+        for (DWORD_PTR dwInstruction = dwFirst; dwInstruction < dwEnd; ++dwInstruction)
+        {
+            (void)m_mapInstructions.erase(dwInstruction);
+        }
+    }
+
+    if (dwAddress < m_dwStartAddress + m_ulBytesValid && dwEnd > m_dwStartAddress)
+    {
+        m_ulBytesValid = 0;
     }
+    ++m_ullGeneration;
+    ++m_stats.ullInvalidations;
+}
+
+void Disassembler::SetByteFilter(const std::function<void(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize)> &filter)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byteFilter = filter;
+    m_mapInstructions.clear();
+    m_ulBytesValid = 0;
+    ++m_ullGeneration;
 }
 
-const bool Disassembler::TransferBytes(const DWORD_PTR dwAddress)
+void Disassembler::PrintCacheStats() const
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fprintf(stderr, "Instruction cache: %Iu entries, %I64u hits (%.2f us avg), %I64u misses (%.2f us avg), %I64u invalidations.\n",
+        m_mapInstructions.size(), m_stats.ullHits, (m_stats.ullHits != 0) ? m_stats.dHitMicroseconds / m_stats.ullHits : 0.0,
+        m_stats.ullMisses, (m_stats.ullMisses != 0) ? m_stats.dMissMicroseconds / m_stats.ullMisses : 0.0,
+        m_stats.ullInvalidations);
+}
+
+const bool Disassembler::Benchmark(const DWORD_PTR dwAddress, const size_t ulSize)
+{
+    std::unique_ptr<unsigned char[]> pCode(new unsigned char[ulSize + ulMaxInstructionLength]);
+    memset(pCode.get(), 0, ulSize + ulMaxInstructionLength);
     SIZE_T ulBytesRead = 0;
-    bool bSuccess = BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, m_bytes.data(), m_bytes.size(), &ulBytesRead));
-    if (bSuccess && ulBytesRead == m_bytes.size())
+    if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, pCode.get(), ulSize, &ulBytesRead)) || ulBytesRead != ulSize)
     {
+        fprintf(stderr, "Could not read from %p. Error = %X\n", dwAddress, GetLastError());
+        return false;
+    }
+
+    //Linear sweep, stepping over a single byte whenever something does not decode
+    auto Sweep = [&](const std::function<const size_t(const size_t ulOffset)> &decode)
+    {
+        Stopwatch stopwatch;
+        size_t ulInstructions = 0;
+        for (size_t ulOffset = 0; ulOffset < ulSize; ++ulInstructions)
+        {
+            const size_t ulLength = decode(ulOffset);
+            ulOffset += (ulLength != 0) ? ulLength : 1;
+        }
+        const double dSeconds = stopwatch.ElapsedSeconds();
+        return std::make_pair(ulInstructions, (dSeconds > 0.0) ? ulInstructions / dSeconds : 0.0);
+    };
+
+    auto lengthDecoder = Sweep([&](const size_t ulOffset)
+    {
+        LengthDecoder::Result result;
+        return LengthDecoder::Decode(&pCode[ulOffset], ulSize + ulMaxInstructionLength - ulOffset, decoderMode, result) ?
+            (size_t)result.uiLength : 0;
+    });
+    fprintf(stderr, "Length decoder: %Iu instructions, %.0f instructions/s.\n", lengthDecoder.first, lengthDecoder.second);
+
+    if (IsInitialized())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto beaEngine = Sweep([&](const size_t ulOffset)
+        {
+            m_disassembler.EIP = (UIntPtr)&pCode[ulOffset];
+            m_disassembler.VirtualAddr = (UInt64)(dwAddress + ulOffset);
+            m_disassembler.SecurityBlock = (UInt32)(ulSize + ulMaxInstructionLength - ulOffset);
+            const int iLength = m_pDisasm(&m_disassembler);
+            return (iLength > 0) ? (size_t)iLength : 0;
+        });
+        fprintf(stderr, "BeaEngine: %Iu instructions, %.0f instructions/s.\n", beaEngine.first, beaEngine.second);
+
+        //The benchmark pointed BeaEngine at its own buffer
+        m_ulBytesValid = 0;
+    }
+
+    return true;
+}
+
+const bool Disassembler::FormatLine(const DWORD_PTR dwAddress, char * const pLine, size_t &ulLineLength,
+    size_t &ulInstructionLength)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!SetDisassembler(dwAddress, lock))
+    {
+        return false;
+    }
+
+    ulLineLength = WriteHex(pLine, (ULONGLONG)dwAddress, sizeof(DWORD_PTR) * 2);
+    pLine[ulLineLength++] = ' ';
+    pLine[ulLineLength++] = ' ';
+
+    const int iLength = m_pDisasm(&m_disassembler);
+    if (iLength == UNKNOWN_OPCODE || iLength == OUT_OF_BLOCK)
+    {
+        //Show the byte as data and keep going, a listing should not end at the first bad opcode
+        const unsigned char cByte = *(const unsigned char *)m_disassembler.EIP;
+        memcpy(&pLine[ulLineLength], "db ", 3);
+        ulLineLength += 3;
+        ulLineLength += WriteHex(&pLine[ulLineLength], cByte, 2);
+        pLine[ulLineLength++] = 'h';
+        ulInstructionLength = 1;
         return true;
     }
+
+    const size_t ulTextLength = strnlen(m_disassembler.CompleteInstr, INSTRUCT_LENGTH);
+    memcpy(&pLine[ulLineLength], m_disassembler.CompleteInstr, ulTextLength);
+    ulLineLength += ulTextLength;
+    ulInstructionLength = (size_t)iLength;
+
+    const INSTRTYPE &instruction = m_disassembler.Instruction;
+    const bool bHasTarget = instruction.BranchType != 0 && instruction.BranchType != RetType && instruction.AddrValue != 0;
+    const DWORD_PTR dwTarget = (DWORD_PTR)instruction.AddrValue;
+    lock.unlock();
+
+    if (m_targetFormatter && bHasTarget)
+    {
+        const size_t ulLabelLength = m_targetFormatter(dwTarget, &pLine[ulLineLength + 4],
+            ulMaxLineLength - ulLineLength - 4);
+        if (ulLabelLength != 0)
+        {
+            memcpy(&pLine[ulLineLength], "  ; ", 4);
+            ulLineLength += 4 + ulLabelLength;
+        }
+    }
+
+    return true;
+}
+
+const bool Disassembler::SetDisassembler(const DWORD_PTR dwAddress, std::unique_lock<std::mutex> &lock)
+{
+    //Reuse the buffered bytes as long as a full instruction fits, or the buffer already runs up to unreadable memory
+    const bool bIsCached = (m_ulBytesValid != 0) && (dwAddress >= m_dwStartAddress) &&
+        (dwAddress - m_dwStartAddress < m_ulBytesValid) &&
+        ((dwAddress - m_dwStartAddress + ulMaxInstructionLength <= m_ulBytesValid) || (m_ulBytesValid < m_bytes.size()));
+    if (!bIsCached && !TransferBytes(dwAddress, lock))
+    {
+        return false;
+    }
+
+    const size_t ulOffset = (size_t)(dwAddress - m_dwStartAddress);
+    m_disassembler.EIP = (UIntPtr)&m_bytes.data()[ulOffset];
+    m_disassembler.VirtualAddr = (UInt64)dwAddress;
+    m_disassembler.SecurityBlock = (UInt32)(m_ulBytesValid - ulOffset);
+
+    return true;
+}
+
+const bool Disassembler::TransferBytes(const DWORD_PTR dwAddress, std::unique_lock<std::mutex> &lock)
+{
+    //The window is filled on a copy with the lock released, and read again if anything was invalidated meanwhile
+    ByteWindow bytes;
+    size_t ulBytesValid = 0;
+    unsigned long long ullGeneration = 0;
+    do
+    {
+        ullGeneration = m_ullGeneration;
+        lock.unlock();
+        const bool bSuccess = ReadWindow(dwAddress, bytes, ulBytesValid);
+        lock.lock();
+        if (!bSuccess)
+        {
+            m_ulBytesValid = 0;
+            return false;
+        }
+    } while (ullGeneration != m_ullGeneration);
+
+    m_dwStartAddress = dwAddress;
+    m_ulBytesValid = ulBytesValid;
+    memcpy(m_bytes.data(), bytes.data(), ulBytesValid);
+
+    return true;
+}
+
+const bool Disassembler::ReadWindow(const DWORD_PTR dwAddress, ByteWindow &bytes, size_t &ulBytesValid) const
+{
+    ulBytesValid = 0;
+
+    SIZE_T ulBytesRead = 0;
+    bool bSuccess = BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, bytes.data(), bytes.size(), &ulBytesRead));
+    if (bSuccess && ulBytesRead == bytes.size())
+    {
+        ulBytesValid = bytes.size();
+    }
     else
     {
-        fprintf(stderr, "Could not read from %p. Error = %X\n", dwAddress, GetLastError());
+        //The window ran into unreadable memory, so settle for what is left of the first page
+        const size_t ulToPageEnd = 0x1000 - (size_t)(dwAddress & 0xFFF);
+        bSuccess = BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, bytes.data(), ulToPageEnd, &ulBytesRead));
+        if (!bSuccess || ulBytesRead != ulToPageEnd)
+        {
+            fprintf(stderr, "Could not read from %p. Error = %X\n", dwAddress, GetLastError());
+            return false;
+        }
+        ulBytesValid = ulToPageEnd;
     }
 
-    return false;
+    //Let the owner put back bytes that it has replaced, such as breakpoint opcodes
+    if (m_byteFilter)
+    {
+        m_byteFilter(dwAddress, (unsigned char *)bytes.data(), ulBytesValid);
+    }
+
+    return true;
 }
 
 const bool Disassembler::IsInitialized()
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "BeaEngine.h"
+#include "LengthDecoder.h"
 
 #include <array>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 
 #include <Windows.h>
 
@@ -10,8 +14,23 @@ namespace CodeReversing
 {
 typedef int(__stdcall *pDisasm)(LPDISASM pDisAsm);
 
+//Writes a label for a branch target and returns its length, or 0 to leave the target unannotated
+typedef std::function<const size_t(const DWORD_PTR dwAddress, char * const pBuffer, const size_t ulBufferSize)> TargetFormatter;
+
+//Receives one listing line at a time, without a trailing newline. Returning false ends the listing.
+typedef std::function<const bool(const DWORD_PTR dwAddress, const char * const pLine, const size_t ulLength)> ListingSink;
+
+struct DecodedInstruction
+{
+    DWORD_PTR dwAddress;
+    unsigned char cLength;
+    eBranchType branchType;
+    bool bIsIndirect;
+    DWORD_PTR dwTarget;
+};
+
 class Disassembler final
-{ 
+{
 public:
     Disassembler() = delete;
 
@@ -25,20 +44,62 @@ public:
     const bool BytesAtAddress(DWORD_PTR dwAddress, size_t ulInstructionsToDisassemble = 15);
     DWORD_PTR GetNextInstruction(const DWORD_PTR dwAddress, bool &bIsUnconditionalBranch);
 
+    const size_t List(const DWORD_PTR dwAddress, const size_t ulInstructions, char * const pBuffer, const size_t ulBufferSize,
+        DWORD_PTR &dwNextAddress);
+    const size_t List(const DWORD_PTR dwAddress, const size_t ulInstructions, const ListingSink &sink);
+    void SetTargetFormatter(const TargetFormatter &formatter);
+    const bool BenchmarkListing(const DWORD_PTR dwAddress, const size_t ulInstructions);
+
+    const bool Decode(const DWORD_PTR dwAddress, DecodedInstruction &instruction);
+    void Invalidate(const DWORD_PTR dwAddress, const size_t ulSize);
+    void SetByteFilter(const std::function<void(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize)> &filter);
+    void PrintCacheStats() const;
+    const bool Benchmark(const DWORD_PTR dwAddress, const size_t ulSize);
+
 private:
+    struct CacheStats
+    {
+        unsigned long long ullHits;
+        unsigned long long ullMisses;
+        unsigned long long ullInvalidations;
+        double dHitMicroseconds;
+        double dMissMicroseconds;
+    };
+
     static HMODULE m_hDll;
     static pDisasm m_pDisasm;
 
+    static const size_t ulMaxLineLength = 512;
+
     static const bool IsInitialized();
 
-    void SetDisassembler(const DWORD_PTR dwAddress);
-    const bool TransferBytes(const DWORD_PTR dwAddress);
+    typedef std::array<char, 4096> ByteWindow;
+
+    const bool FormatLine(const DWORD_PTR dwAddress, char * const pLine, size_t &ulLineLength, size_t &ulInstructionLength);
+
+    //Both are called with m_mutex held through lock and may release it while target memory is read
+    const bool SetDisassembler(const DWORD_PTR dwAddress, std::unique_lock<std::mutex> &lock);
+    const bool TransferBytes(const DWORD_PTR dwAddress, std::unique_lock<std::mutex> &lock);
+    const bool ReadWindow(const DWORD_PTR dwAddress, ByteWindow &bytes, size_t &ulBytesValid) const;
 
     HANDLE m_hProcess;
+
+    //Guards everything below; the debugger thread decodes while stepping and the console lists and benchmarks. It is
+    //never held while the byte filter or target formatter run, since both call back into the debugger.
+    mutable std::mutex m_mutex;
     DISASM m_disassembler;
 
     DWORD_PTR m_dwStartAddress;
-    std::array<char, 4096> m_bytes;
+    size_t m_ulBytesValid;
+    ByteWindow m_bytes;
+    unsigned long long m_ullGeneration;
+
+    std::unordered_map<DWORD_PTR, DecodedInstruction> m_mapInstructions;
+    CacheStats m_stats;
+
+    //Set once when the process is created, before anything decodes
+    std::function<void(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize)> m_byteFilter;
+    TargetFormatter m_targetFormatter;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "DumpWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+
+#include <TlHelp32.h>
+#include <ProcessSnapshot.h>
+
+#include "BinaryWriter.h"
+#include "Common.h"
+#include "Debugger.h"
+#include "MemoryScanner.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulReadSize = 4 * 1024 * 1024;
+const ULONG32 ulStreamCount = 4;
+
+typedef DWORD(WINAPI *pPssCaptureSnapshot)(HANDLE hProcess, DWORD dwCaptureFlags, DWORD dwThreadContextFlags, HPSS *pSnapshot);
+typedef DWORD(WINAPI *pPssQuerySnapshot)(HPSS hSnapshot, DWORD dwInformationClass, void *pBuffer, DWORD dwBufferLength);
+typedef DWORD(WINAPI *pPssFreeSnapshot)(HANDLE hProcess, HPSS hSnapshot);
+typedef LONG(WINAPI *pRtlGetVersion)(OSVERSIONINFOEXW *pVersionInfo);
+
+//Image pages that were never written to are identical to the file on disk
+const bool IsReconstructible(const MemoryRegion &region)
+{
+    const DWORD dwProtect = region.dwProtect & 0xFF;
+    return (region.dwType == MEM_IMAGE) && (dwProtect == PAGE_READONLY || dwProtect == PAGE_EXECUTE ||
+        dwProtect == PAGE_EXECUTE_READ || dwProtect == PAGE_WRITECOPY || dwProtect == PAGE_EXECUTE_WRITECOPY);
+}
+
+//Copy-on-write clone of the target's address space. Only available from Windows 8.1 on, so everything is
+//resolved at runtime and callers fall back to reading the live process.
+class ProcessClone final
+{
+public:
+    ProcessClone(const HANDLE hProcess) : m_hSnapshot{ nullptr }, m_hClone{ nullptr }, m_pFreeSnapshot{ nullptr }
+    {
+        HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
+        pPssCaptureSnapshot pCaptureSnapshot = (pPssCaptureSnapshot)GetProcAddress(hKernel32, "PssCaptureSnapshot");
+        pPssQuerySnapshot pQuerySnapshot = (pPssQuerySnapshot)GetProcAddress(hKernel32, "PssQuerySnapshot");
+        m_pFreeSnapshot = (pPssFreeSnapshot)GetProcAddress(hKernel32, "PssFreeSnapshot");
+        if (pCaptureSnapshot == nullptr || pQuerySnapshot == nullptr || m_pFreeSnapshot == nullptr)
+        {
+            return;
+        }
+
+        DWORD dwResult = pCaptureSnapshot(hProcess, PSS_CAPTURE_VA_CLONE, 0, &m_hSnapshot);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            fprintf(stderr, "Could not clone process address space. Error = %X\n", dwResult);
+            m_hSnapshot = nullptr;
+            return;
+        }
+
+        PSS_VA_CLONE_INFORMATION cloneInfo = { 0 };
+        dwResult = pQuerySnapshot(m_hSnapshot, PSS_QUERY_VA_CLONE_INFORMATION, &cloneInfo, sizeof(PSS_VA_CLONE_INFORMATION));
+        if (dwResult != ERROR_SUCCESS)
+        {
+            fprintf(stderr, "Could not query cloned address space. Error = %X\n", dwResult);
+            return;
+        }
+        m_hClone = cloneInfo.VaCloneHandle;
+    }
+
+    ProcessClone(const ProcessClone &copy) = delete;
+    ProcessClone &operator=(const ProcessClone &copy) = delete;
+
+    ~ProcessClone()
+    {
+        if (m_hSnapshot != nullptr)
+        {
+            (void)m_pFreeSnapshot(GetCurrentProcess(), m_hSnapshot);
+        }
+    }
+
+    const HANDLE Handle() const
+    {
+        return m_hClone;
+    }
+
+private:
+    HPSS m_hSnapshot;
+    HANDLE m_hClone;
+    pPssFreeSnapshot m_pFreeSnapshot;
+};
+
+}
+
+DumpWriter::DumpWriter(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwPageSize{ 0x1000 }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+}
+
+DumpWriter::ThreadState::ThreadState() : dwThreadId{ 0 }, dwSuspendCount{ 0 }, iPriority{ 0 }
+{
+    memset(&context, 0, sizeof(CONTEXT));
+}
+
+DumpWriter::ThreadState::ThreadState(ThreadState &&other) : dwThreadId{ other.dwThreadId }, hThread(std::move(other.hThread)),
+    dwSuspendCount{ other.dwSuspendCount }, iPriority{ other.iPriority }
+{
+    memcpy(&context, &other.context, sizeof(CONTEXT));
+}
+
+DumpWriter::ThreadState &DumpWriter::ThreadState::operator=(ThreadState &&other)
+{
+    if (this != &other)
+    {
+        dwThreadId = other.dwThreadId;
+        hThread = std::move(other.hThread);
+        dwSuspendCount = other.dwSuspendCount;
+        iPriority = other.iPriority;
+        memcpy(&context, &other.context, sizeof(CONTEXT));
+    }
+    return *this;
+}
+
+const bool DumpWriter::SuspendThreads(std::vector<ThreadState> &vecThreads) const
+{
+    const DWORD dwProcessId = GetProcessId(m_pDebugger->Handle());
+    SafeHandle hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot() == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not enumerate threads. Error = %X\n", GetLastError());
+        return false;
+    }
+
+    THREADENTRY32 threadEntry = { 0 };
+    threadEntry.dwSize = sizeof(THREADENTRY32);
+    for (BOOL bHasEntry = Thread32First(hSnapshot(), &threadEntry); bHasEntry; bHasEntry = Thread32Next(hSnapshot(), &threadEntry))
+    {
+        if (threadEntry.th32OwnerProcessID != dwProcessId)
+        {
+            continue;
+        }
+
+        ThreadState thread;
+        thread.dwThreadId = threadEntry.th32ThreadID;
+        thread.hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE,
+            threadEntry.th32ThreadID);
+        if (thread.hThread() == nullptr)
+        {
+            //Threads that exit between the snapshot and here are simply left out
+            continue;
+        }
+
+        thread.dwSuspendCount = SuspendThread(thread.hThread());
+        if (thread.dwSuspendCount == (DWORD)-1)
+        {
+            fprintf(stderr, "Could not suspend thread %X. Error = %X\n", thread.dwThreadId, GetLastError());
+            continue;
+        }
+
+        thread.iPriority = GetThreadPriority(thread.hThread());
+        memset(&thread.context, 0, sizeof(CONTEXT));
+        thread.context.ContextFlags = CONTEXT_ALL;
+        if (!BOOLIFY(GetThreadContext(thread.hThread(), &thread.context)))
+        {
+            fprintf(stderr, "Could not get context of thread %X. Error = %X\n", thread.dwThreadId, GetLastError());
+        }
+        vecThreads.emplace_back(std::move(thread));
+    }
+
+    return true;
+}
+
+void DumpWriter::ResumeThreads(std::vector<ThreadState> &vecThreads) const
+{
+    for (auto &thread : vecThreads)
+    {
+        (void)ResumeThread(thread.hThread());
+    }
+}
+
+const std::vector<DumpWriter::ModuleState> DumpWriter::CollectModules() const
+{
+    std::vector<ModuleState> vecModules;
+
+    const DWORD dwProcessId = GetProcessId(m_pDebugger->Handle());
+    SafeHandle hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, dwProcessId);
+    if (hSnapshot() == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not enumerate modules. Error = %X\n", GetLastError());
+        return vecModules;
+    }
+
+    MODULEENTRY32W moduleEntry = { 0 };
+    moduleEntry.dwSize = sizeof(MODULEENTRY32W);
+    for (BOOL bHasEntry = Module32FirstW(hSnapshot(), &moduleEntry); bHasEntry; bHasEntry = Module32NextW(hSnapshot(), &moduleEntry))
+    {
+        ModuleState module = { (DWORD_PTR)moduleEntry.modBaseAddr, moduleEntry.modBaseSize, 0, 0, moduleEntry.szExePath };
+
+        //The timestamp and checksum let debuggers find the matching image and symbols
+        IMAGE_DOS_HEADER dosHeader = { 0 };
+        IMAGE_NT_HEADERS ntHeaders = { 0 };
+        SIZE_T ulBytesRead = 0;
+        if (BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)module.dwBaseAddress, &dosHeader,
+                sizeof(IMAGE_DOS_HEADER), &ulBytesRead)) && dosHeader.e_magic == IMAGE_DOS_SIGNATURE &&
+            BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)(module.dwBaseAddress + dosHeader.e_lfanew), &ntHeaders,
+                sizeof(IMAGE_NT_HEADERS), &ulBytesRead)) && ntHeaders.Signature == IMAGE_NT_SIGNATURE)
+        {
+            //CheckSum sits at the same offset in the 32-bit and 64-bit optional headers
+            module.dwTimeDateStamp = ntHeaders.FileHeader.TimeDateStamp;
+            module.dwCheckSum = ntHeaders.OptionalHeader.CheckSum;
+        }
+        vecModules.emplace_back(std::move(module));
+    }
+
+    return vecModules;
+}
+
+const std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> DumpWriter::CollectRanges(const HANDLE hSource, const bool bIncludeImagePages) const
+{
+    std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> vecRanges;
+    for (auto &region : MemoryScanner::EnumerateRegions(hSource))
+    {
+        if (!bIncludeImagePages && IsReconstructible(region))
+        {
+            continue;
+        }
+
+        if (!vecRanges.empty() && vecRanges.back().StartOfMemoryRange + vecRanges.back().DataSize == region.dwBaseAddress)
+        {
+            vecRanges.back().DataSize += region.ulSize;
+            continue;
+        }
+
+        MINIDUMP_MEMORY_DESCRIPTOR64 range = { region.dwBaseAddress, region.ulSize };
+        vecRanges.push_back(range);
+    }
+
+    return vecRanges;
+}
+
+const bool DumpWriter::WriteString(BinaryWriter &writer, const std::wstring &str) const
+{
+    const ULONG32 ulLength = (ULONG32)(str.length() * sizeof(WCHAR));
+    const WCHAR wcTerminator = L'\0';
+    return writer.WriteValue(ulLength) && writer.Write(str.c_str(), ulLength) && writer.WriteValue(wcTerminator);
+}
+
+const bool DumpWriter::WriteMemory(BinaryWriter &writer, const HANDLE hSource,
+    const std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> &vecRanges) const
+{
+    std::unique_ptr<unsigned char[]> pBuffer(new unsigned char[ulReadSize]);
+    size_t ulUnreadablePages = 0;
+    for (auto &range : vecRanges)
+    {
+        for (ULONG64 ullOffset = 0; ullOffset < range.DataSize; ullOffset += ulReadSize)
+        {
+            const DWORD_PTR dwAddress = (DWORD_PTR)(range.StartOfMemoryRange + ullOffset);
+            const size_t ulSize = (size_t)std::min((ULONG64)ulReadSize, range.DataSize - ullOffset);
+            SIZE_T ulBytesRead = 0;
+            if (!(BOOLIFY(ReadProcessMemory(hSource, (LPCVOID)dwAddress, pBuffer.get(), ulSize, &ulBytesRead)) &&
+                ulBytesRead == ulSize))
+            {
+                //The layout is fixed by the memory list already written, so pages that went away are zero filled
+                for (size_t ulPage = 0; ulPage < ulSize; ulPage += m_dwPageSize)
+                {
+                    if (!(BOOLIFY(ReadProcessMemory(hSource, (LPCVOID)(dwAddress + ulPage), &pBuffer[ulPage], m_dwPageSize,
+                        &ulBytesRead)) && ulBytesRead == m_dwPageSize))
+                    {
+                        memset(&pBuffer[ulPage], 0, m_dwPageSize);
+                        ++ulUnreadablePages;
+                    }
+                }
+            }
+
+            if (!writer.Write(pBuffer.get(), ulSize))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (ulUnreadablePages != 0)
+    {
+        fprintf(stderr, "%Iu pages could not be read and were zero filled.\n", ulUnreadablePages);
+    }
+
+    return true;
+}
+
+const bool DumpWriter::Write(const char * const pPath, const bool bCompress /*= false*/, const bool bIncludeImagePages /*= false*/)
+{
+    BinaryWriter writer;
+    if (!writer.Open(pPath, bCompress))
+    {
+        return false;
+    }
+
+    Stopwatch totalTime;
+    Stopwatch pauseTime;
+    std::vector<ThreadState> vecThreads;
+    if (!SuspendThreads(vecThreads))
+    {
+        return false;
+    }
+
+    const std::vector<ModuleState> vecModules = CollectModules();
+
+    //With a clone the process only has to stay suspended for as long as the capture takes
+    ProcessClone clone(m_pDebugger->Handle());
+    const HANDLE hSource = (clone.Handle() != nullptr) ? clone.Handle() : m_pDebugger->Handle();
+    double dPauseSeconds = 0.0;
+    if (clone.Handle() != nullptr)
+    {
+        ResumeThreads(vecThreads);
+        dPauseSeconds = pauseTime.ElapsedSeconds();
+    }
+
+    const std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> vecRanges = CollectRanges(hSource, bIncludeImagePages);
+
+    //Every stream is laid out up front so that the file can be written front to back in one pass, with
+    //the memory list last since its raw data runs to the end of the file
+    ULONG64 ullOffset = sizeof(MINIDUMP_HEADER) + ulStreamCount * sizeof(MINIDUMP_DIRECTORY);
+    const RVA rvaSystemInfo = (RVA)ullOffset;
+    ullOffset += sizeof(MINIDUMP_SYSTEM_INFO);
+    const RVA rvaServicePack = (RVA)ullOffset;
+    ullOffset += sizeof(ULONG32) + sizeof(WCHAR);
+    const RVA rvaThreadList = (RVA)ullOffset;
+    ullOffset += sizeof(ULONG32) + vecThreads.size() * sizeof(MINIDUMP_THREAD);
+    const RVA rvaContexts = (RVA)ullOffset;
+    ullOffset += vecThreads.size() * sizeof(CONTEXT);
+    const RVA rvaModuleList = (RVA)ullOffset;
+    ullOffset += sizeof(ULONG32) + vecModules.size() * sizeof(MINIDUMP_MODULE);
+    const RVA rvaModuleNames = (RVA)ullOffset;
+    for (auto &module : vecModules)
+    {
+        ullOffset += sizeof(ULONG32) + (module.strPath.length() + 1) * sizeof(WCHAR);
+    }
+    const RVA rvaMemoryList = (RVA)ullOffset;
+    ullOffset += 2 * sizeof(ULONG64) + vecRanges.size() * sizeof(MINIDUMP_MEMORY_DESCRIPTOR64);
+    const RVA64 rvaMemoryData = ullOffset;
+
+    MINIDUMP_HEADER header = { 0 };
+    header.Signature = MINIDUMP_SIGNATURE;
+    header.Version = MINIDUMP_VERSION;
+    header.NumberOfStreams = ulStreamCount;
+    header.StreamDirectoryRva = sizeof(MINIDUMP_HEADER);
+    header.TimeDateStamp = (ULONG32)time(nullptr);
+    header.Flags = bIncludeImagePages ? MiniDumpWithFullMemory : MiniDumpNormal;
+
+    MINIDUMP_DIRECTORY directory[ulStreamCount] = { 0 };
+    directory[0].StreamType = SystemInfoStream;
+    directory[0].Location.DataSize = sizeof(MINIDUMP_SYSTEM_INFO);
+    directory[0].Location.Rva = rvaSystemInfo;
+    directory[1].StreamType = ThreadListStream;
+    directory[1].Location.DataSize = rvaContexts - rvaThreadList;
+    directory[1].Location.Rva = rvaThreadList;
+    directory[2].StreamType = ModuleListStream;
+    directory[2].Location.DataSize = rvaModuleNames - rvaModuleList;
+    directory[2].Location.Rva = rvaModuleList;
+    directory[3].StreamType = Memory64ListStream;
+    directory[3].Location.DataSize = (ULONG32)(rvaMemoryData - rvaMemoryList);
+    directory[3].Location.Rva = rvaMemoryList;
+
+    SYSTEM_INFO sysInfo = { 0 };
+    GetNativeSystemInfo(&sysInfo);
+    OSVERSIONINFOEXW versionInfo = { 0 };
+    versionInfo.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEXW);
+    pRtlGetVersion pGetVersion = (pRtlGetVersion)GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "RtlGetVersion");
+    if (pGetVersion != nullptr)
+    {
+        (void)pGetVersion(&versionInfo);
+    }
+
+    MINIDUMP_SYSTEM_INFO systemInfo = { 0 };
+    systemInfo.ProcessorArchitecture = sysInfo.wProcessorArchitecture;
+    systemInfo.ProcessorLevel = sysInfo.wProcessorLevel;
+    systemInfo.ProcessorRevision = sysInfo.wProcessorRevision;
+    systemInfo.NumberOfProcessors = (UCHAR)std::min(sysInfo.dwNumberOfProcessors, (DWORD)0xFF);
+    systemInfo.ProductType = versionInfo.wProductType;
+    systemInfo.MajorVersion = versionInfo.dwMajorVersion;
+    systemInfo.MinorVersion = versionInfo.dwMinorVersion;
+    systemInfo.BuildNumber = versionInfo.dwBuildNumber;
+    systemInfo.PlatformId = versionInfo.dwPlatformId;
+    systemInfo.CSDVersionRva = rvaServicePack;
+    systemInfo.SuiteMask = versionInfo.wSuiteMask;
+
+    bool bSuccess = writer.WriteValue(header) && writer.Write(directory, sizeof(directory)) &&
+        writer.WriteValue(systemInfo) && WriteString(writer, L"");
+
+    const ULONG32 ulThreadCount = (ULONG32)vecThreads.size();
+    bSuccess = bSuccess && writer.WriteValue(ulThreadCount);
+    for (size_t i = 0; bSuccess && i < vecThreads.size(); ++i)
+    {
+        MINIDUMP_THREAD thread = { 0 };
+        thread.ThreadId = vecThreads[i].dwThreadId;
+        thread.SuspendCount = vecThreads[i].dwSuspendCount;
+        thread.Priority = (ULONG32)vecThreads[i].iPriority;
+#ifdef _M_IX86
+        thread.Stack.StartOfMemoryRange = vecThreads[i].context.Esp;
+#elif defined _M_AMD64
+        thread.Stack.StartOfMemoryRange = vecThreads[i].context.Rsp;
+#endif
+        thread.ThreadContext.DataSize = sizeof(CONTEXT);
+        thread.ThreadContext.Rva = (RVA)(rvaContexts + i * sizeof(CONTEXT));
+        bSuccess = writer.WriteValue(thread);
+    }
+    for (size_t i = 0; bSuccess && i < vecThreads.size(); ++i)
+    {
+        bSuccess = writer.WriteValue(vecThreads[i].context);
+    }
+
+    const ULONG32 ulModuleCount = (ULONG32)vecModules.size();
+    bSuccess = bSuccess && writer.WriteValue(ulModuleCount);
+    RVA rvaName = rvaModuleNames;
+    for (size_t i = 0; bSuccess && i < vecModules.size(); ++i)
+    {
+        MINIDUMP_MODULE module = { 0 };
+        module.BaseOfImage = vecModules[i].dwBaseAddress;
+        module.SizeOfImage = vecModules[i].dwSize;
+        module.CheckSum = vecModules[i].dwCheckSum;
+        module.TimeDateStamp = vecModules[i].dwTimeDateStamp;
+        module.ModuleNameRva = rvaName;
+        rvaName += (RVA)(sizeof(ULONG32) + (vecModules[i].strPath.length() + 1) * sizeof(WCHAR));
+        bSuccess = writer.WriteValue(module);
+    }
+    for (size_t i = 0; bSuccess && i < vecModules.size(); ++i)
+    {
+        bSuccess = WriteString(writer, vecModules[i].strPath);
+    }
+
+    const ULONG64 ullRangeCount = vecRanges.size();
+    bSuccess = bSuccess && writer.WriteValue(ullRangeCount) && writer.WriteValue(rvaMemoryData) &&
+        (vecRanges.empty() || writer.Write(vecRanges.data(), vecRanges.size() * sizeof(MINIDUMP_MEMORY_DESCRIPTOR64)));
+
+    bSuccess = bSuccess && WriteMemory(writer, hSource, vecRanges);
+
+    if (clone.Handle() == nullptr)
+    {
+        ResumeThreads(vecThreads);
+        dPauseSeconds = pauseTime.ElapsedSeconds();
+    }
+
+    bSuccess = writer.Close() && bSuccess;
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not write dump to %s.\n", pPath);
+        return false;
+    }
+
+    const double dTotalSeconds = totalTime.ElapsedSeconds();
+    fprintf(stderr, "Wrote %Iu threads, %Iu modules, %Iu memory ranges to %s.\n", vecThreads.size(), vecModules.size(),
+        vecRanges.size(), pPath);
+    fprintf(stderr, "Process paused for %.3f s (%s). %I64u MB in %.3f s (%.1f MB/s), %I64u MB on disk.\n", dPauseSeconds,
+        (clone.Handle() != nullptr) ? "cloned" : "suspended", writer.BytesWritten() / (1024 * 1024), dTotalSeconds,
+        (dTotalSeconds > 0.0) ? (writer.BytesWritten() / (1024.0 * 1024.0)) / dTotalSeconds : 0.0,
+        writer.FileBytesWritten() / (1024 * 1024));
+
+    return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+#include <DbgHelp.h>
+
+#include "SafeHandle.h"
+
+namespace CodeReversing
+{
+
+class BinaryWriter;
+class Debugger;
+
+//Writes a minidump of the debuggee without going through MiniDumpWriteDump. Threads are suspended once, and
+//a copy-on-write clone of the address space is taken where the OS supports it so that the process can resume
+//before any memory hits the disk.
+class DumpWriter final
+{
+public:
+    DumpWriter() = delete;
+    DumpWriter(Debugger *pDebugger);
+
+    DumpWriter(const DumpWriter &copy) = delete;
+    DumpWriter &operator=(const DumpWriter &copy) = delete;
+
+    ~DumpWriter() = default;
+
+    const bool Write(const char * const pPath, const bool bCompress = false, const bool bIncludeImagePages = false);
+
+private:
+    //Moved by hand since the v120 toolset does not generate move operations, and the handle cannot be copied
+    struct ThreadState
+    {
+        ThreadState();
+        ThreadState(ThreadState &&other);
+        ThreadState &operator=(ThreadState &&other);
+
+        ThreadState(const ThreadState &copy) = delete;
+        ThreadState &operator=(const ThreadState &copy) = delete;
+
+        DWORD dwThreadId;
+        SafeHandle hThread;
+        DWORD dwSuspendCount;
+        int iPriority;
+        CONTEXT context;
+    };
+
+    struct ModuleState
+    {
+        DWORD_PTR dwBaseAddress;
+        DWORD dwSize;
+        DWORD dwCheckSum;
+        DWORD dwTimeDateStamp;
+        std::wstring strPath;
+    };
+
+    const bool SuspendThreads(std::vector<ThreadState> &vecThreads) const;
+    void ResumeThreads(std::vector<ThreadState> &vecThreads) const;
+    const std::vector<ModuleState> CollectModules() const;
+    const std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> CollectRanges(const HANDLE hSource, const bool bIncludeImagePages) const;
+
+    const bool WriteString(BinaryWriter &writer, const std::wstring &str) const;
+    const bool WriteMemory(BinaryWriter &writer, const HANDLE hSource,
+        const std::vector<MINIDUMP_MEMORY_DESCRIPTOR64> &vecRanges) const;
+
+    Debugger * const m_pDebugger;
+    DWORD m_dwPageSize;
+};
+
+}
\ No newline at end of file
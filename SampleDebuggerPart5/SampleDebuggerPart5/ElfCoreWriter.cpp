@@ -0,0 +1,498 @@
+#include "ElfCoreWriter.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <dirent.h>
+#include <elf.h>
+#include <signal.h>
+#include <sys/procfs.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulReadSize = 4 * 1024 * 1024;
+
+static_assert(sizeof(elf_gregset_t) == sizeof(user_regs_struct), "prstatus registers are laid out as user_regs_struct");
+
+const double ElapsedSeconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+const uint64_t AlignUp(const uint64_t ullValue, const uint64_t ullAlignment)
+{
+    return (ullValue + ullAlignment - 1) & ~(ullAlignment - 1);
+}
+
+const std::vector<uint8_t> ReadProcFile(const int iProcessId, const char * const pName)
+{
+    char strPath[64] = { 0 };
+    snprintf(strPath, sizeof(strPath), "/proc/%i/%s", iProcessId, pName);
+    std::vector<uint8_t> vecData;
+    FILE *pFile = fopen(strPath, "rb");
+    if (pFile == nullptr)
+    {
+        return vecData;
+    }
+
+    //Proc files report no size, so they are read until they run dry
+    uint8_t buffer[4096];
+    size_t ulRead = 0;
+    while ((ulRead = fread(buffer, 1, sizeof(buffer), pFile)) != 0)
+    {
+        vecData.insert(vecData.end(), buffer, buffer + ulRead);
+    }
+    fclose(pFile);
+
+    return vecData;
+}
+
+void AddNote(std::vector<uint8_t> &vecNotes, const uint32_t uiType, const void * const pDesc, const size_t ulSize)
+{
+    static const char strName[] = "CORE";
+    Elf64_Nhdr header = { 0 };
+    header.n_namesz = sizeof(strName);
+    header.n_descsz = (Elf64_Word)ulSize;
+    header.n_type = uiType;
+
+    const uint8_t * const pHeader = (const uint8_t *)&header;
+    vecNotes.insert(vecNotes.end(), pHeader, pHeader + sizeof(Elf64_Nhdr));
+    vecNotes.insert(vecNotes.end(), strName, strName + sizeof(strName));
+    vecNotes.resize(AlignUp(vecNotes.size(), 4), 0);
+    vecNotes.insert(vecNotes.end(), (const uint8_t *)pDesc, (const uint8_t *)pDesc + ulSize);
+    vecNotes.resize(AlignUp(vecNotes.size(), 4), 0);
+}
+
+}
+
+ElfCoreWriter::ElfCoreWriter(const int iProcessId) : m_iProcessId{ iProcessId }, m_ullPageSize{ 0x1000 }
+{
+    const long lPageSize = sysconf(_SC_PAGESIZE);
+    if (lPageSize > 0)
+    {
+        m_ullPageSize = (uint64_t)lPageSize;
+    }
+}
+
+const bool ElfCoreWriter::StopThreads(std::vector<ThreadState> &vecThreads) const
+{
+    char strPath[64] = { 0 };
+    snprintf(strPath, sizeof(strPath), "/proc/%i/task", m_iProcessId);
+
+    //Threads started while the others are being stopped show up on the next pass
+    bool bFoundNew = true;
+    while (bFoundNew)
+    {
+        bFoundNew = false;
+        DIR *pTasks = opendir(strPath);
+        if (pTasks == nullptr)
+        {
+            fprintf(stderr, "Could not enumerate threads of process %i.\n", m_iProcessId);
+            return false;
+        }
+
+        for (dirent *pEntry = readdir(pTasks); pEntry != nullptr; pEntry = readdir(pTasks))
+        {
+            const int iThreadId = atoi(pEntry->d_name);
+            if (iThreadId <= 0 || std::any_of(vecThreads.begin(), vecThreads.end(),
+                [=](const ThreadState &thread) { return thread.iThreadId == iThreadId; }))
+            {
+                continue;
+            }
+
+            ThreadState thread;
+            memset(&thread, 0, sizeof(ThreadState));
+            thread.iThreadId = iThreadId;
+            bFoundNew = true;
+            if (ptrace(PTRACE_SEIZE, iThreadId, nullptr, nullptr) == -1)
+            {
+                //Threads that exit between the listing and here are simply left out
+                if (iThreadId == m_iProcessId)
+                {
+                    fprintf(stderr, "Could not attach to process %i. Is it already being traced?\n", m_iProcessId);
+                    closedir(pTasks);
+                    return false;
+                }
+                vecThreads.push_back(thread);
+                continue;
+            }
+            thread.bIsAttached = true;
+
+            int iStatus = 0;
+            if (ptrace(PTRACE_INTERRUPT, iThreadId, nullptr, nullptr) == -1 || waitpid(iThreadId, &iStatus, __WALL) == -1 ||
+                !WIFSTOPPED(iStatus))
+            {
+                fprintf(stderr, "Could not stop thread %i.\n", iThreadId);
+            }
+            else
+            {
+                //A signal that was on its way in is handed back on detach instead of being swallowed
+                if ((iStatus >> 16) != PTRACE_EVENT_STOP)
+                {
+                    thread.iPendingSignal = WSTOPSIG(iStatus);
+                }
+                (void)ptrace(PTRACE_GETREGS, iThreadId, nullptr, &thread.regs);
+                (void)ptrace(PTRACE_GETFPREGS, iThreadId, nullptr, &thread.fpregs);
+            }
+            vecThreads.push_back(thread);
+        }
+        closedir(pTasks);
+    }
+
+    vecThreads.erase(std::remove_if(vecThreads.begin(), vecThreads.end(),
+        [](const ThreadState &thread) { return !thread.bIsAttached; }), vecThreads.end());
+
+    //Debuggers treat the first NT_PRSTATUS as the current thread
+    std::stable_partition(vecThreads.begin(), vecThreads.end(),
+        [&](const ThreadState &thread) { return thread.iThreadId == m_iProcessId; });
+
+    return !vecThreads.empty();
+}
+
+void ElfCoreWriter::ResumeThreads(std::vector<ThreadState> &vecThreads) const
+{
+    for (auto &thread : vecThreads)
+    {
+        (void)ptrace(PTRACE_DETACH, thread.iThreadId, nullptr, (void *)(intptr_t)thread.iPendingSignal);
+    }
+}
+
+const std::vector<ElfCoreWriter::Mapping> ElfCoreWriter::CollectMappings(const bool bIncludeFilePages) const
+{
+    std::vector<Mapping> vecMappings;
+
+    char strPath[64] = { 0 };
+    //smaps rather than maps, for the VmFlags line that follows each mapping
+    snprintf(strPath, sizeof(strPath), "/proc/%i/smaps", m_iProcessId);
+    FILE *pMaps = fopen(strPath, "r");
+    if (pMaps == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", strPath);
+        return vecMappings;
+    }
+
+    char strLine[4096] = { 0 };
+    while (fgets(strLine, sizeof(strLine), pMaps) != nullptr)
+    {
+        unsigned long long ullBegin = 0;
+        unsigned long long ullEnd = 0;
+        unsigned long long ullOffset = 0;
+        char strPermissions[8] = { 0 };
+        int iPathStart = 0;
+        if (sscanf(strLine, "%llx-%llx %7s %llx %*s %*s %n", &ullBegin, &ullEnd, strPermissions, &ullOffset, &iPathStart) < 4)
+        {
+            //Memory marked with MADV_DONTDUMP stays out of the core, as the kernel does. Sanitizer shadow is mapped
+            //that way and would otherwise run to terabytes.
+            if (strncmp(strLine, "VmFlags:", 8) == 0 && !vecMappings.empty() && strstr(strLine, " dd") != nullptr)
+            {
+                vecMappings.back().ullDumpSize = 0;
+            }
+            continue;
+        }
+        char * const pName = &strLine[iPathStart];
+        pName[strcspn(pName, "\n")] = '\0';
+
+        //The vsyscall page is the same in every process and cannot be read through process_vm_readv
+        if (strcmp(pName, "[vsyscall]") == 0)
+        {
+            continue;
+        }
+
+        Mapping mapping;
+        mapping.ullBegin = ullBegin;
+        mapping.ullEnd = ullEnd;
+        mapping.ullFileOffset = ullOffset;
+        mapping.uiFlags = ((strPermissions[0] == 'r') ? PF_R : 0) | ((strPermissions[1] == 'w') ? PF_W : 0) |
+            ((strPermissions[2] == 'x') ? PF_X : 0);
+        //[vvar] and its per-clock siblings are kernel data pages that refuse remote reads
+        mapping.bIsReadable = (strPermissions[0] == 'r') && strncmp(pName, "[vvar", 5) != 0;
+        mapping.strPath = pName;
+        mapping.bIsReconstructible = (pName[0] == '/') && (strPermissions[1] != 'w') &&
+            mapping.strPath.find(" (deleted)") == std::string::npos;
+        mapping.ullFileOffsetInCore = 0;
+
+        mapping.ullDumpSize = 0;
+        if (mapping.bIsReadable)
+        {
+            if (!mapping.bIsReconstructible || bIncludeFilePages)
+            {
+                mapping.ullDumpSize = ullEnd - ullBegin;
+            }
+            else if (ullOffset == 0)
+            {
+                mapping.ullDumpSize = std::min<uint64_t>(m_ullPageSize, ullEnd - ullBegin);
+            }
+        }
+        vecMappings.emplace_back(std::move(mapping));
+    }
+    fclose(pMaps);
+
+    return vecMappings;
+}
+
+const std::vector<uint8_t> ElfCoreWriter::BuildNotes(const std::vector<ThreadState> &vecThreads,
+    const std::vector<Mapping> &vecMappings) const
+{
+    std::vector<uint8_t> vecNotes;
+
+    //Process ids and state come from /proc/<pid>/stat; the command name is in parentheses and may contain anything
+    int iParentId = 0;
+    int iGroupId = 0;
+    int iSessionId = 0;
+    char cState = 'R';
+    std::string strCommand;
+    std::vector<uint8_t> vecStat = ReadProcFile(m_iProcessId, "stat");
+    vecStat.push_back('\0');
+    const char * const pStat = (const char *)vecStat.data();
+    const char * const pOpen = strchr(pStat, '(');
+    const char * const pClose = strrchr(pStat, ')');
+    if (pOpen != nullptr && pClose != nullptr && pClose > pOpen)
+    {
+        strCommand.assign(pOpen + 1, pClose);
+        (void)sscanf(pClose + 1, " %c %i %i %i", &cState, &iParentId, &iGroupId, &iSessionId);
+    }
+
+    elf_prpsinfo processInfo;
+    memset(&processInfo, 0, sizeof(elf_prpsinfo));
+    const char *pStates = "RSDTZW";
+    const char * const pStateIndex = strchr(pStates, cState);
+    processInfo.pr_state = (pStateIndex != nullptr) ? (char)(pStateIndex - pStates) : 0;
+    processInfo.pr_sname = cState;
+    processInfo.pr_zomb = (cState == 'Z');
+    processInfo.pr_pid = m_iProcessId;
+    processInfo.pr_ppid = iParentId;
+    processInfo.pr_pgrp = iGroupId;
+    processInfo.pr_sid = iSessionId;
+    char strProcPath[64] = { 0 };
+    snprintf(strProcPath, sizeof(strProcPath), "/proc/%i", m_iProcessId);
+    struct stat procInfo;
+    if (stat(strProcPath, &procInfo) == 0)
+    {
+        processInfo.pr_uid = procInfo.st_uid;
+        processInfo.pr_gid = procInfo.st_gid;
+    }
+    strncpy(processInfo.pr_fname, strCommand.c_str(), sizeof(processInfo.pr_fname) - 1);
+    std::vector<uint8_t> vecArguments = ReadProcFile(m_iProcessId, "cmdline");
+    vecArguments.resize(std::min(vecArguments.size(), sizeof(processInfo.pr_psargs) - 1));
+    std::replace(vecArguments.begin(), vecArguments.end(), (uint8_t)'\0', (uint8_t)' ');
+    memcpy(processInfo.pr_psargs, vecArguments.data(), vecArguments.size());
+
+    //NT_FILE: count and page size, one start/end/page offset triple per file mapping, then the names in the same order
+    std::vector<uint64_t> vecFileRanges;
+    std::vector<char> vecFileNames;
+    for (auto &mapping : vecMappings)
+    {
+        if (!mapping.strPath.empty() && mapping.strPath[0] == '/')
+        {
+            vecFileRanges.push_back(mapping.ullBegin);
+            vecFileRanges.push_back(mapping.ullEnd);
+            vecFileRanges.push_back(mapping.ullFileOffset / m_ullPageSize);
+            vecFileNames.insert(vecFileNames.end(), mapping.strPath.c_str(), mapping.strPath.c_str() + mapping.strPath.length() + 1);
+        }
+    }
+    std::vector<uint8_t> vecFiles(2 * sizeof(uint64_t) + vecFileRanges.size() * sizeof(uint64_t) + vecFileNames.size());
+    const uint64_t ullHeader[2] = { vecFileRanges.size() / 3, m_ullPageSize };
+    memcpy(vecFiles.data(), ullHeader, sizeof(ullHeader));
+    if (!vecFileRanges.empty())
+    {
+        memcpy(&vecFiles[sizeof(ullHeader)], vecFileRanges.data(), vecFileRanges.size() * sizeof(uint64_t));
+        memcpy(&vecFiles[sizeof(ullHeader) + vecFileRanges.size() * sizeof(uint64_t)], vecFileNames.data(), vecFileNames.size());
+    }
+
+    const std::vector<uint8_t> vecAuxiliary = ReadProcFile(m_iProcessId, "auxv");
+
+    //Same order as the kernel: each thread's status and FPU state, with the process notes after the first status
+    for (size_t i = 0; i < vecThreads.size(); ++i)
+    {
+        elf_prstatus status;
+        memset(&status, 0, sizeof(elf_prstatus));
+        status.pr_info.si_signo = vecThreads[i].iPendingSignal;
+        status.pr_cursig = (short)vecThreads[i].iPendingSignal;
+        status.pr_pid = vecThreads[i].iThreadId;
+        status.pr_ppid = iParentId;
+        status.pr_pgrp = iGroupId;
+        status.pr_sid = iSessionId;
+        memcpy(&status.pr_reg, &vecThreads[i].regs, sizeof(user_regs_struct));
+        status.pr_fpvalid = 1;
+        AddNote(vecNotes, NT_PRSTATUS, &status, sizeof(elf_prstatus));
+
+        if (i == 0)
+        {
+            AddNote(vecNotes, NT_PRPSINFO, &processInfo, sizeof(elf_prpsinfo));
+            if (!vecAuxiliary.empty())
+            {
+                AddNote(vecNotes, NT_AUXV, vecAuxiliary.data(), vecAuxiliary.size());
+            }
+            AddNote(vecNotes, NT_FILE, vecFiles.data(), vecFiles.size());
+        }
+        AddNote(vecNotes, NT_FPREGSET, &vecThreads[i].fpregs, sizeof(user_fpregs_struct));
+    }
+
+    return vecNotes;
+}
+
+const bool ElfCoreWriter::WriteMemory(FILE * const pFile, const std::vector<Mapping> &vecMappings, uint64_t &ullOffset) const
+{
+    std::unique_ptr<uint8_t[]> pBuffer(new uint8_t[ulReadSize]);
+    size_t ulUnreadablePages = 0;
+    for (auto &mapping : vecMappings)
+    {
+        for (uint64_t ullChunk = 0; ullChunk < mapping.ullDumpSize; ullChunk += ulReadSize)
+        {
+            const uint64_t ullAddress = mapping.ullBegin + ullChunk;
+            const size_t ulSize = (size_t)std::min<uint64_t>(ulReadSize, mapping.ullDumpSize - ullChunk);
+            iovec local = { pBuffer.get(), ulSize };
+            iovec remote = { (void *)ullAddress, ulSize };
+            if (process_vm_readv(m_iProcessId, &local, 1, &remote, 1, 0) != (ssize_t)ulSize)
+            {
+                //The layout is fixed by the program headers already written, so pages that cannot be read are zero filled
+                for (size_t ulPage = 0; ulPage < ulSize; ulPage += m_ullPageSize)
+                {
+                    iovec localPage = { &pBuffer[ulPage], (size_t)m_ullPageSize };
+                    iovec remotePage = { (void *)(ullAddress + ulPage), (size_t)m_ullPageSize };
+                    if (process_vm_readv(m_iProcessId, &localPage, 1, &remotePage, 1, 0) != (ssize_t)m_ullPageSize)
+                    {
+                        memset(&pBuffer[ulPage], 0, (size_t)m_ullPageSize);
+                        ++ulUnreadablePages;
+                    }
+                }
+            }
+
+            if (fwrite(pBuffer.get(), 1, ulSize, pFile) != ulSize)
+            {
+                return false;
+            }
+            ullOffset += ulSize;
+        }
+    }
+
+    if (ulUnreadablePages != 0)
+    {
+        fprintf(stderr, "%zu pages could not be read and were zero filled.\n", ulUnreadablePages);
+    }
+
+    return true;
+}
+
+const bool ElfCoreWriter::Write(const char * const pPath, const bool bIncludeFilePages /*= false*/)
+{
+    FILE *pFile = fopen(pPath, "wb");
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", pPath);
+        return false;
+    }
+    (void)setvbuf(pFile, nullptr, _IOFBF, 1024 * 1024);
+
+    const auto totalTime = std::chrono::steady_clock::now();
+    std::vector<ThreadState> vecThreads;
+    if (!StopThreads(vecThreads))
+    {
+        ResumeThreads(vecThreads);
+        fclose(pFile);
+        return false;
+    }
+
+    std::vector<Mapping> vecMappings = CollectMappings(bIncludeFilePages);
+    const std::vector<uint8_t> vecNotes = BuildNotes(vecThreads, vecMappings);
+    const size_t ulHeaders = 1 + vecMappings.size();
+    if (ulHeaders >= PN_XNUM)
+    {
+        fprintf(stderr, "%zu mappings do not fit in the program header table.\n", vecMappings.size());
+        ResumeThreads(vecThreads);
+        fclose(pFile);
+        return false;
+    }
+
+    //Everything is laid out up front so the file is written front to back, with the memory page aligned at the end
+    const uint64_t ullNotesOffset = sizeof(Elf64_Ehdr) + ulHeaders * sizeof(Elf64_Phdr);
+    uint64_t ullDataOffset = AlignUp(ullNotesOffset + vecNotes.size(), m_ullPageSize);
+    size_t ulLeftToFiles = 0;
+    for (auto &mapping : vecMappings)
+    {
+        mapping.ullFileOffsetInCore = ullDataOffset;
+        ullDataOffset += mapping.ullDumpSize;
+        ulLeftToFiles += (mapping.bIsReadable && mapping.ullDumpSize < mapping.ullEnd - mapping.ullBegin) ? 1 : 0;
+    }
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(Elf64_Ehdr));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    header.e_type = ET_CORE;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = (Elf64_Half)ulHeaders;
+
+    std::vector<Elf64_Phdr> vecHeaders(ulHeaders);
+    memset(vecHeaders.data(), 0, vecHeaders.size() * sizeof(Elf64_Phdr));
+    vecHeaders[0].p_type = PT_NOTE;
+    vecHeaders[0].p_offset = ullNotesOffset;
+    vecHeaders[0].p_filesz = vecNotes.size();
+    vecHeaders[0].p_align = 4;
+    for (size_t i = 0; i < vecMappings.size(); ++i)
+    {
+        Elf64_Phdr &load = vecHeaders[i + 1];
+        load.p_type = PT_LOAD;
+        load.p_flags = vecMappings[i].uiFlags;
+        load.p_offset = vecMappings[i].ullFileOffsetInCore;
+        load.p_vaddr = vecMappings[i].ullBegin;
+        load.p_filesz = vecMappings[i].ullDumpSize;
+        load.p_memsz = vecMappings[i].ullEnd - vecMappings[i].ullBegin;
+        load.p_align = m_ullPageSize;
+    }
+
+    const std::vector<uint8_t> vecPadding((size_t)(AlignUp(ullNotesOffset + vecNotes.size(), m_ullPageSize) -
+        (ullNotesOffset + vecNotes.size())), 0);
+    bool bSuccess = fwrite(&header, sizeof(Elf64_Ehdr), 1, pFile) == 1 &&
+        fwrite(vecHeaders.data(), sizeof(Elf64_Phdr), vecHeaders.size(), pFile) == vecHeaders.size() &&
+        fwrite(vecNotes.data(), 1, vecNotes.size(), pFile) == vecNotes.size() &&
+        (vecPadding.empty() || fwrite(vecPadding.data(), 1, vecPadding.size(), pFile) == vecPadding.size());
+
+    uint64_t ullMemoryBytes = 0;
+    bSuccess = bSuccess && WriteMemory(pFile, vecMappings, ullMemoryBytes);
+
+    //ptrace has no copy-on-write clone to read from, so the process stays stopped until the last page is read
+    ResumeThreads(vecThreads);
+    const double dPauseSeconds = ElapsedSeconds(totalTime);
+
+    bSuccess = (fclose(pFile) == 0) && bSuccess;
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not write core to %s.\n", pPath);
+        return false;
+    }
+
+    const double dTotalSeconds = ElapsedSeconds(totalTime);
+    fprintf(stderr, "Wrote %zu threads, %zu mappings (%zu left to their files) to %s.\n", vecThreads.size(),
+        vecMappings.size(), ulLeftToFiles, pPath);
+    fprintf(stderr, "Process paused for %.3f s (stopped). %llu MB in %.3f s (%.1f MB/s).\n", dPauseSeconds,
+        (unsigned long long)(ullDataOffset / (1024 * 1024)), dTotalSeconds,
+        (dTotalSeconds > 0.0) ? (ullDataOffset / (1024.0 * 1024.0)) / dTotalSeconds : 0.0);
+
+    return true;
+}
+
+}
+
+#endif
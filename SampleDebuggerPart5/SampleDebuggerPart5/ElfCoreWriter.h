@@ -0,0 +1,70 @@
+#pragma once
+
+#if defined(__linux__) && defined(__x86_64__)
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/user.h>
+
+namespace CodeReversing
+{
+
+//The Linux counterpart of DumpWriter. Every thread is stopped once with ptrace, the notes and program headers are laid
+//out up front, and memory is streamed behind them in large process_vm_readv chunks, so the file is written front to
+//back in one pass. Read-only file mappings are left out, like image pages in a minidump, since the NT_FILE note names
+//the files they can be rebuilt from; only the first page of each file is kept so debuggers can identify it.
+class ElfCoreWriter final
+{
+public:
+    ElfCoreWriter() = delete;
+    ElfCoreWriter(const int iProcessId);
+
+    ElfCoreWriter(const ElfCoreWriter &copy) = delete;
+    ElfCoreWriter &operator=(const ElfCoreWriter &copy) = delete;
+
+    ~ElfCoreWriter() = default;
+
+    //The process must not already be traced; the writer attaches for the duration of the dump and detaches after
+    const bool Write(const char * const pPath, const bool bIncludeFilePages = false);
+
+private:
+    struct ThreadState
+    {
+        int iThreadId;
+        bool bIsAttached;
+        int iPendingSignal;
+        user_regs_struct regs;
+        user_fpregs_struct fpregs;
+    };
+
+    struct Mapping
+    {
+        uint64_t ullBegin;
+        uint64_t ullEnd;
+        uint64_t ullFileOffset;
+        uint32_t uiFlags;
+        bool bIsReadable;
+        bool bIsReconstructible;
+        std::string strPath;
+        uint64_t ullDumpSize;
+        uint64_t ullFileOffsetInCore;
+    };
+
+    const bool StopThreads(std::vector<ThreadState> &vecThreads) const;
+    void ResumeThreads(std::vector<ThreadState> &vecThreads) const;
+    const std::vector<Mapping> CollectMappings(const bool bIncludeFilePages) const;
+
+    const std::vector<uint8_t> BuildNotes(const std::vector<ThreadState> &vecThreads,
+        const std::vector<Mapping> &vecMappings) const;
+    const bool WriteMemory(FILE * const pFile, const std::vector<Mapping> &vecMappings, uint64_t &ullOffset) const;
+
+    const int m_iProcessId;
+    uint64_t m_ullPageSize;
+};
+
+}
+
+#endif
@@ -0,0 +1,565 @@
+#include "FunctionProfiler.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Enough for the longest emulated instruction, mov [rsp+disp8], reg
+const size_t ulPlanBytes = 5;
+
+void CloseThreadHandle(SafeHandle &hThread)
+{
+    if (hThread() != INVALID_HANDLE_VALUE)
+    {
+        (void)CloseHandle(hThread());
+        hThread = INVALID_HANDLE_VALUE;
+    }
+}
+
+const double Microseconds(const ULONGLONG ullTicks)
+{
+    return (double)ullTicks * 1000000.0 / (double)Stopwatch::Frequency();
+}
+
+}
+
+FunctionProfiler::FunctionProfiler(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_ulFunctionCount{ 0 },
+    m_ulThreadCount{ 0 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool FunctionProfiler::AddFunction(const DWORD_PTR dwAddress)
+{
+    //Read before taking the lock since RestoreOriginalBytes comes back here for our own breakpoints
+    unsigned char pCode[ulPlanBytes] = { 0 };
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwAddress, pCode, sizeof(pCode), &ulBytesRead)) ||
+        ulBytesRead == 0)
+    {
+        fprintf(stderr, "Could not read function at %p. Error = %X\n", dwAddress, GetLastError());
+        return false;
+    }
+    memset(pCode + ulBytesRead, 0, sizeof(pCode) - ulBytesRead);
+    m_pDebugger->RestoreOriginalBytes(dwAddress, pCode, ulBytesRead);
+
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    if (m_mapEntries.find(dwAddress) != m_mapEntries.end() || m_mapReturns.find(dwAddress) != m_mapReturns.end() ||
+        m_pDebugger->FindBreakpoint(dwAddress) != nullptr)
+    {
+        fprintf(stderr, "Address %p already has a breakpoint.\n", dwAddress);
+        return false;
+    }
+
+    //A function that was removed and added again keeps its slot and its counters
+    const size_t ulCount = m_ulFunctionCount.load(std::memory_order_relaxed);
+    size_t ulIndex = 0;
+    while (ulIndex < ulCount && m_functions[ulIndex].dwAddress != dwAddress)
+    {
+        ++ulIndex;
+    }
+    if (ulIndex == ulMaxFunctions)
+    {
+        fprintf(stderr, "Cannot profile more than %Iu functions.\n", ulMaxFunctions);
+        return false;
+    }
+
+    FunctionEntry &function = m_functions[ulIndex];
+    function.dwAddress = dwAddress;
+    PlanEmulation(pCode, function);
+    function.pBreakpoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(m_pDebugger->Handle(), dwAddress,
+        m_pDebugger->ProcessPatches()));
+    if (!function.pBreakpoint->Enable())
+    {
+        fprintf(stderr, "Could not set breakpoint at %p.\n", dwAddress);
+        function.pBreakpoint.reset();
+        return false;
+    }
+
+    m_mapEntries[dwAddress] = ulIndex;
+    if (ulIndex == ulCount)
+    {
+        m_ulFunctionCount.store(ulCount + 1, std::memory_order_release);
+    }
+
+    return true;
+}
+
+const bool FunctionProfiler::RemoveFunction(const DWORD_PTR dwAddress)
+{
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    auto entry = m_mapEntries.find(dwAddress);
+    if (entry == m_mapEntries.end())
+    {
+        return false;
+    }
+
+    FunctionEntry &function = m_functions[entry->second];
+    (void)function.pBreakpoint->Disable();
+    function.pBreakpoint.reset();
+    m_mapEntries.erase(entry);
+
+    //Calls still in flight may return here and were sharing the entry breakpoint
+    auto returnPoint = m_mapReturns.find(dwAddress);
+    if (returnPoint != m_mapReturns.end() && returnPoint->second.pBreakpoint == nullptr)
+    {
+        returnPoint->second.pBreakpoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(m_pDebugger->Handle(), dwAddress,
+            m_pDebugger->ProcessPatches()));
+        (void)returnPoint->second.pBreakpoint->Enable();
+    }
+
+    return true;
+}
+
+const bool FunctionProfiler::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    const LONGLONG llNow = Stopwatch::Now();
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    const FunctionEntry *pFunction = nullptr;
+    size_t ulFunction = 0;
+    bool bIsReturn = false;
+    {
+        std::lock_guard<std::mutex> lock(m_breakpointMutex);
+        auto entry = m_mapEntries.find(dwAddress);
+        if (entry != m_mapEntries.end())
+        {
+            ulFunction = entry->second;
+            pFunction = &m_functions[ulFunction];
+        }
+        bIsReturn = (m_mapReturns.find(dwAddress) != m_mapReturns.end());
+    }
+    if (pFunction == nullptr && !bIsReturn)
+    {
+        return false;
+    }
+
+    ThreadState &thread = Thread(dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (!BOOLIFY(GetThreadContext(thread.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        return true;
+    }
+
+    SetInstructionPointer(ctx, dwAddress);
+    const DWORD_PTR dwStack = StackPointer(ctx);
+
+    if (bIsReturn)
+    {
+        ++m_stats.ullReturns;
+        OnReturn(thread, dwAddress, dwStack, llNow);
+    }
+
+    bool bNeedsStep = false;
+    if (pFunction != nullptr)
+    {
+        ++m_stats.ullEntries;
+        DWORD_PTR dwReturnAddress = 0;
+        SIZE_T ulBytesRead = 0;
+        (void)ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwStack, &dwReturnAddress, sizeof(DWORD_PTR), &ulBytesRead);
+        if (ulBytesRead != sizeof(DWORD_PTR) || !AddReturn(dwReturnAddress))
+        {
+            //Nowhere to catch the return; the call is still counted once something above it returns
+            dwReturnAddress = 0;
+        }
+        thread.vecFrames.push_back({ ulFunction, dwReturnAddress, dwStack, llNow, 0 });
+
+        if (Emulate(*pFunction, ctx))
+        {
+            ++m_stats.ullEmulated;
+        }
+        else
+        {
+            bNeedsStep = true;
+        }
+    }
+    else
+    {
+        //The last frame returning here may just have released the breakpoint
+        std::lock_guard<std::mutex> lock(m_breakpointMutex);
+        bNeedsStep = (BreakpointAt(dwAddress) != nullptr);
+    }
+
+    if (bNeedsStep)
+    {
+        std::lock_guard<std::mutex> lock(m_breakpointMutex);
+        InterruptBreakpoint * const pBreakpoint = BreakpointAt(dwAddress);
+        if (pBreakpoint != nullptr && pBreakpoint->Disable())
+        {
+            thread.dwPendingRearm = dwAddress;
+            ctx.EFlags |= 0x100;
+            ++m_stats.ullSteps;
+        }
+    }
+
+    if (!BOOLIFY(SetThreadContext(thread.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+    }
+
+    m_stats.ullHandlerTicks += (ULONGLONG)(Stopwatch::Now() - llNow);
+    return true;
+}
+
+const bool FunctionProfiler::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    auto threadState = m_mapThreads.find(dbgEvent.dwThreadId);
+    if (threadState == m_mapThreads.end() || threadState->second.dwPendingRearm == 0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    InterruptBreakpoint * const pBreakpoint = BreakpointAt(threadState->second.dwPendingRearm);
+    if (pBreakpoint != nullptr && !pBreakpoint->IsEnabled())
+    {
+        (void)pBreakpoint->Enable();
+    }
+    threadState->second.dwPendingRearm = 0;
+
+    return true;
+}
+
+void FunctionProfiler::RemoveThread(const DWORD dwThreadId)
+{
+    auto threadState = m_mapThreads.find(dwThreadId);
+    if (threadState == m_mapThreads.end())
+    {
+        return;
+    }
+
+    for (auto &frame : threadState->second.vecFrames)
+    {
+        if (frame.dwReturnAddress != 0)
+        {
+            ReleaseReturn(frame.dwReturnAddress);
+        }
+    }
+    m_stats.ullAbandoned += threadState->second.vecFrames.size();
+    CloseThreadHandle(threadState->second.hThread);
+    m_mapThreads.erase(threadState);
+}
+
+void FunctionProfiler::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const
+{
+    auto Restore = [&](const InterruptBreakpoint * const pBreakpoint)
+    {
+        if (pBreakpoint != nullptr && pBreakpoint->IsEnabled() && pBreakpoint->Address() >= dwAddress &&
+            pBreakpoint->Address() - dwAddress < ulSize)
+        {
+            pBytes[pBreakpoint->Address() - dwAddress] = pBreakpoint->OriginalByte();
+        }
+    };
+
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    for (auto &entry : m_mapEntries)
+    {
+        Restore(m_functions[entry.second].pBreakpoint.get());
+    }
+    for (auto &returnPoint : m_mapReturns)
+    {
+        Restore(returnPoint.second.pBreakpoint.get());
+    }
+}
+
+void FunctionProfiler::PrintStats(const bool bPerThread) const
+{
+    const size_t ulFunctions = m_ulFunctionCount.load(std::memory_order_acquire);
+    const size_t ulThreads = m_ulThreadCount.load(std::memory_order_acquire);
+    const ULONGLONG ullEvents = m_stats.ullEntries + m_stats.ullReturns;
+
+    fprintf(stderr, "Function profiler: %I64u entries (%I64u emulated, %I64u stepped), %I64u returns, "
+        "%I64u abandoned frames, %.2f us in handler per event.\n",
+        m_stats.ullEntries.load(), m_stats.ullEmulated.load(), m_stats.ullSteps.load(), m_stats.ullReturns.load(),
+        m_stats.ullAbandoned.load(), ullEvents == 0 ? 0.0 : Microseconds(m_stats.ullHandlerTicks) / (double)ullEvents);
+
+    for (size_t i = 0; i < ulFunctions; ++i)
+    {
+        ULONGLONG ullCalls = 0;
+        ULONGLONG ullInclusive = 0;
+        ULONGLONG ullExclusive = 0;
+        ULONGLONG ullMaxInclusive = 0;
+        for (size_t j = 0; j < ulThreads; ++j)
+        {
+            const Counters &counters = m_threadTables[j]->counters[i];
+            ullCalls += counters.ullCalls.load(std::memory_order_relaxed);
+            ullInclusive += counters.ullInclusive.load(std::memory_order_relaxed);
+            ullExclusive += counters.ullExclusive.load(std::memory_order_relaxed);
+            const ULONGLONG ullMax = counters.ullMaxInclusive.load(std::memory_order_relaxed);
+            ullMaxInclusive = (ullMax > ullMaxInclusive) ? ullMax : ullMaxInclusive;
+        }
+
+        char strName[512] = { 0 };
+        const size_t ulLength = m_pDebugger->ProcessResolver()->Format(m_functions[i].dwAddress, strName, sizeof(strName) - 1);
+        strName[ulLength] = '\0';
+        fprintf(stderr, "%p %s\n"
+            "    calls %I64u, inclusive %.3f ms (avg %.2f us, max %.2f us), exclusive %.3f ms (avg %.2f us)\n",
+            m_functions[i].dwAddress, strName, ullCalls, Microseconds(ullInclusive) / 1000.0,
+            ullCalls == 0 ? 0.0 : Microseconds(ullInclusive) / (double)ullCalls, Microseconds(ullMaxInclusive),
+            Microseconds(ullExclusive) / 1000.0, ullCalls == 0 ? 0.0 : Microseconds(ullExclusive) / (double)ullCalls);
+
+        if (!bPerThread)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < ulThreads; ++j)
+        {
+            const Counters &counters = m_threadTables[j]->counters[i];
+            const ULONGLONG ullThreadCalls = counters.ullCalls.load(std::memory_order_relaxed);
+            if (ullThreadCalls != 0)
+            {
+                fprintf(stderr, "    thread %X: calls %I64u, inclusive %.3f ms, exclusive %.3f ms\n",
+                    m_threadTables[j]->dwThreadId, ullThreadCalls,
+                    Microseconds(counters.ullInclusive.load(std::memory_order_relaxed)) / 1000.0,
+                    Microseconds(counters.ullExclusive.load(std::memory_order_relaxed)) / 1000.0);
+            }
+        }
+    }
+}
+
+FunctionProfiler::ThreadState &FunctionProfiler::Thread(const DWORD dwThreadId)
+{
+    auto threadState = m_mapThreads.find(dwThreadId);
+    if (threadState != m_mapThreads.end())
+    {
+        return threadState->second;
+    }
+
+    ThreadState &thread = m_mapThreads[dwThreadId];
+    thread.hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dwThreadId);
+    thread.dwPendingRearm = 0;
+    thread.pTable = nullptr;
+    thread.vecFrames.reserve(64);
+
+    //Threads past the limit are still tracked so their breakpoints resume, but their calls are not counted
+    const size_t ulIndex = m_ulThreadCount.load(std::memory_order_relaxed);
+    if (ulIndex < ulMaxThreads)
+    {
+        m_threadTables[ulIndex] = std::unique_ptr<ThreadTable>(new ThreadTable());
+        m_threadTables[ulIndex]->dwThreadId = dwThreadId;
+        thread.pTable = m_threadTables[ulIndex].get();
+        m_ulThreadCount.store(ulIndex + 1, std::memory_order_release);
+    }
+
+    return thread;
+}
+
+void FunctionProfiler::PlanEmulation(const unsigned char * const pCode, FunctionEntry &function)
+{
+    function.emulation = eEmulation::eNone;
+    function.cLength = 0;
+    function.cRegister = 0;
+    function.cDisplacement = 0;
+
+    if (pCode[0] == 0x90)
+    {
+        function.emulation = eEmulation::eSkip;
+        function.cLength = 1;
+    }
+    else if (pCode[0] == 0x8B && pCode[1] == 0xFF)
+    {
+        //mov edi, edi hot-patch pad
+        function.emulation = eEmulation::eSkip;
+        function.cLength = 2;
+    }
+#ifdef _M_AMD64
+    else if (pCode[0] >= 0x50 && pCode[0] <= 0x57)
+    {
+        function.emulation = eEmulation::ePush;
+        function.cLength = 1;
+        function.cRegister = pCode[0] - 0x50;
+    }
+    else if (pCode[0] == 0x41 && pCode[1] >= 0x50 && pCode[1] <= 0x57)
+    {
+        function.emulation = eEmulation::ePush;
+        function.cLength = 2;
+        function.cRegister = pCode[1] - 0x50 + 8;
+    }
+    else if ((pCode[0] == 0x48 || pCode[0] == 0x4C) && pCode[1] == 0x89 && (pCode[2] & 0xC7) == 0x44 && pCode[3] == 0x24)
+    {
+        //mov [rsp+disp8], reg, which is how register arguments are homed
+        function.emulation = eEmulation::eStoreToStack;
+        function.cLength = 5;
+        function.cRegister = ((pCode[0] & 0x04) << 1) | ((pCode[2] >> 3) & 0x07);
+        function.cDisplacement = (char)pCode[4];
+    }
+    else if ((pCode[0] == 0x48 || pCode[0] == 0x4C) && pCode[1] == 0x8B && (pCode[2] & 0xC7) == 0xC4)
+    {
+        //mov reg, rsp
+        function.emulation = eEmulation::eCopyStackPointer;
+        function.cLength = 3;
+        function.cRegister = ((pCode[0] & 0x04) << 1) | ((pCode[2] >> 3) & 0x07);
+    }
+#endif
+}
+
+const bool FunctionProfiler::Emulate(const FunctionEntry &function, CONTEXT &ctx) const
+{
+    if (function.emulation == eEmulation::eNone)
+    {
+        return false;
+    }
+
+#ifdef _M_IX86
+    if (function.emulation != eEmulation::eSkip)
+    {
+        return false;
+    }
+    ctx.Eip += function.cLength;
+#elif defined _M_AMD64
+    //Rax through R15 are laid out in encoding order
+    DWORD64 * const pRegisters = &ctx.Rax;
+    const DWORD64 dwValue = pRegisters[function.cRegister];
+    SIZE_T ulBytesWritten = 0;
+    switch (function.emulation)
+    {
+    case eEmulation::ePush:
+        if (!BOOLIFY(WriteProcessMemory(m_pDebugger->Handle(), (LPVOID)(ctx.Rsp - sizeof(DWORD64)), &dwValue,
+            sizeof(DWORD64), &ulBytesWritten)))
+        {
+            return false;
+        }
+        ctx.Rsp -= sizeof(DWORD64);
+        break;
+    case eEmulation::eStoreToStack:
+        if (!BOOLIFY(WriteProcessMemory(m_pDebugger->Handle(), (LPVOID)(ctx.Rsp + function.cDisplacement), &dwValue,
+            sizeof(DWORD64), &ulBytesWritten)))
+        {
+            return false;
+        }
+        break;
+    case eEmulation::eCopyStackPointer:
+        pRegisters[function.cRegister] = ctx.Rsp;
+        break;
+    default:
+        break;
+    }
+    ctx.Rip += function.cLength;
+#endif
+
+    return true;
+}
+
+void FunctionProfiler::OnReturn(ThreadState &thread, const DWORD_PTR dwAddress, const DWORD_PTR dwStack, const LONGLONG llNow)
+{
+    //Everything entered below the current stack pointer is gone. The outermost such frame returning to this address
+    //completed normally; anything above it was unwound past by an exception or longjmp.
+    while (!thread.vecFrames.empty() && thread.vecFrames.back().dwStack < dwStack)
+    {
+        const ShadowFrame frame = thread.vecFrames.back();
+        thread.vecFrames.pop_back();
+        if (frame.dwReturnAddress != 0)
+        {
+            ReleaseReturn(frame.dwReturnAddress);
+        }
+
+        const bool bIsOutermost = thread.vecFrames.empty() || thread.vecFrames.back().dwStack >= dwStack;
+        if (!bIsOutermost || frame.dwReturnAddress != dwAddress)
+        {
+            ++m_stats.ullAbandoned;
+            continue;
+        }
+
+        const LONGLONG llInclusive = llNow - frame.llEntry;
+        const LONGLONG llExclusive = (llInclusive > frame.llChildren) ? llInclusive - frame.llChildren : 0;
+        if (!thread.vecFrames.empty())
+        {
+            thread.vecFrames.back().llChildren += llInclusive;
+        }
+        if (thread.pTable == nullptr)
+        {
+            continue;
+        }
+
+        //Only this thread writes the counters, so plain stores are enough for readers to see whole values
+        Counters &counters = thread.pTable->counters[frame.ulFunction];
+        counters.ullCalls.store(counters.ullCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        counters.ullInclusive.store(counters.ullInclusive.load(std::memory_order_relaxed) + llInclusive, std::memory_order_relaxed);
+        counters.ullExclusive.store(counters.ullExclusive.load(std::memory_order_relaxed) + llExclusive, std::memory_order_relaxed);
+        if ((ULONGLONG)llInclusive > counters.ullMaxInclusive.load(std::memory_order_relaxed))
+        {
+            counters.ullMaxInclusive.store(llInclusive, std::memory_order_relaxed);
+        }
+    }
+}
+
+const bool FunctionProfiler::AddReturn(const DWORD_PTR dwAddress)
+{
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    auto returnPoint = m_mapReturns.find(dwAddress);
+    if (returnPoint != m_mapReturns.end())
+    {
+        ++returnPoint->second.ulReferences;
+        return true;
+    }
+
+    //A user breakpoint owns the byte and would stop the console on every return
+    if (m_pDebugger->FindBreakpoint(dwAddress) != nullptr)
+    {
+        return false;
+    }
+
+    std::unique_ptr<InterruptBreakpoint> pBreakpoint;
+    if (m_mapEntries.find(dwAddress) == m_mapEntries.end())
+    {
+        pBreakpoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(m_pDebugger->Handle(), dwAddress,
+            m_pDebugger->ProcessPatches()));
+        if (!pBreakpoint->Enable())
+        {
+            return false;
+        }
+    }
+
+    //Built in place; v120 generates no move constructor for ReturnPoint to move one in with
+    ReturnPoint &point = m_mapReturns[dwAddress];
+    point.pBreakpoint = std::move(pBreakpoint);
+    point.ulReferences = 1;
+
+    return true;
+}
+
+void FunctionProfiler::ReleaseReturn(const DWORD_PTR dwAddress)
+{
+    std::lock_guard<std::mutex> lock(m_breakpointMutex);
+    auto returnPoint = m_mapReturns.find(dwAddress);
+    if (returnPoint == m_mapReturns.end() || --returnPoint->second.ulReferences != 0)
+    {
+        return;
+    }
+
+    if (returnPoint->second.pBreakpoint != nullptr)
+    {
+        (void)returnPoint->second.pBreakpoint->Disable();
+    }
+    m_mapReturns.erase(returnPoint);
+}
+
+InterruptBreakpoint * const FunctionProfiler::BreakpointAt(const DWORD_PTR dwAddress) const
+{
+    auto entry = m_mapEntries.find(dwAddress);
+    if (entry != m_mapEntries.end())
+    {
+        return m_functions[entry->second].pBreakpoint.get();
+    }
+
+    auto returnPoint = m_mapReturns.find(dwAddress);
+    if (returnPoint != m_mapReturns.end())
+    {
+        return returnPoint->second.pBreakpoint.get();
+    }
+
+    return nullptr;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "InterruptBreakpoint.h"
+#include "SafeHandle.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Times calls to chosen functions with breakpoints that never stop for the console. A hit on a function's entry
+//records the time, pushes a frame on a per-thread shadow stack and plants a breakpoint on the return address; the
+//hit on that return pops the frame and charges inclusive time to the function and to its caller's children.
+//Common first instructions (push, home-space stores, mov reg,rsp) are emulated so entries resume without a
+//single-step. Counters live in per-thread tables that only the debugger thread writes, so reading them needs no lock.
+class FunctionProfiler final
+{
+public:
+    FunctionProfiler() = delete;
+    FunctionProfiler(Debugger *pDebugger);
+
+    FunctionProfiler(const FunctionProfiler &copy) = delete;
+    FunctionProfiler &operator=(const FunctionProfiler &copy) = delete;
+
+    ~FunctionProfiler() = default;
+
+    const bool AddFunction(const DWORD_PTR dwAddress);
+    const bool RemoveFunction(const DWORD_PTR dwAddress);
+
+    //Called from the exception handler; false means the event belongs to someone else
+    const bool HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+    void PrintStats(const bool bPerThread) const;
+
+    static const size_t ulMaxFunctions = 256;
+    static const size_t ulMaxThreads = 256;
+
+private:
+    enum class eEmulation
+    {
+        eNone,
+        eSkip,
+        ePush,
+        eStoreToStack,
+        eCopyStackPointer
+    };
+
+    struct FunctionEntry
+    {
+        DWORD_PTR dwAddress;
+        std::unique_ptr<InterruptBreakpoint> pBreakpoint;
+        eEmulation emulation;
+        unsigned char cLength;
+        unsigned char cRegister;
+        char cDisplacement;
+    };
+
+    //pBreakpoint is null when the return address is also a profiled entry and shares its breakpoint
+    struct ReturnPoint
+    {
+        std::unique_ptr<InterruptBreakpoint> pBreakpoint;
+        size_t ulReferences;
+    };
+
+    struct ShadowFrame
+    {
+        size_t ulFunction;
+        DWORD_PTR dwReturnAddress;
+        DWORD_PTR dwStack;
+        LONGLONG llEntry;
+        LONGLONG llChildren;
+    };
+
+    struct Counters
+    {
+        std::atomic<ULONGLONG> ullCalls;
+        std::atomic<ULONGLONG> ullInclusive;
+        std::atomic<ULONGLONG> ullExclusive;
+        std::atomic<ULONGLONG> ullMaxInclusive;
+    };
+
+    struct ThreadTable
+    {
+        DWORD dwThreadId;
+        Counters counters[ulMaxFunctions];
+    };
+
+    struct ThreadState
+    {
+        SafeHandle hThread;
+        std::vector<ShadowFrame> vecFrames;
+        DWORD_PTR dwPendingRearm;
+        ThreadTable *pTable;
+    };
+
+    struct Stats
+    {
+        std::atomic<ULONGLONG> ullEntries;
+        std::atomic<ULONGLONG> ullReturns;
+        std::atomic<ULONGLONG> ullEmulated;
+        std::atomic<ULONGLONG> ullSteps;
+        std::atomic<ULONGLONG> ullAbandoned;
+        std::atomic<ULONGLONG> ullHandlerTicks;
+    };
+
+    ThreadState &Thread(const DWORD dwThreadId);
+    static void PlanEmulation(const unsigned char * const pCode, FunctionEntry &function);
+    const bool Emulate(const FunctionEntry &function, CONTEXT &ctx) const;
+    void OnReturn(ThreadState &thread, const DWORD_PTR dwAddress, const DWORD_PTR dwStack, const LONGLONG llNow);
+    const bool AddReturn(const DWORD_PTR dwAddress);
+    void ReleaseReturn(const DWORD_PTR dwAddress);
+    InterruptBreakpoint * const BreakpointAt(const DWORD_PTR dwAddress) const;
+
+    Debugger * const m_pDebugger;
+
+    //Published with release stores so that PrintStats can walk them from another thread without locking
+    std::array<FunctionEntry, ulMaxFunctions> m_functions;
+    std::atomic<size_t> m_ulFunctionCount;
+    std::array<std::unique_ptr<ThreadTable>, ulMaxThreads> m_threadTables;
+    std::atomic<size_t> m_ulThreadCount;
+
+    //Breakpoint bytes are also read by RestoreOriginalBytes on the console thread
+    mutable std::mutex m_breakpointMutex;
+    std::unordered_map<DWORD_PTR, size_t> m_mapEntries;
+    std::unordered_map<DWORD_PTR, ReturnPoint> m_mapReturns;
+
+    std::map<DWORD, ThreadState> m_mapThreads;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include "InstructionTracer.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const DWORD dwTraceMagic = 0x31435254; //"TRC1"
+
+#ifdef _M_IX86
+const size_t ulArchitectureRegisters = 9;
+#elif defined _M_AMD64
+const size_t ulArchitectureRegisters = 17;
+#else
+#error "Unsupported architecture"
+#endif
+
+void ReadRegisters(const CONTEXT &ctx, DWORD64 * const pValues)
+{
+#ifdef _M_IX86
+    const DWORD pRegisters[ulArchitectureRegisters] = { ctx.Eax, ctx.Ecx, ctx.Edx, ctx.Ebx, ctx.Esp, ctx.Ebp, ctx.Esi,
+        ctx.Edi, ctx.EFlags };
+    for (size_t i = 0; i < ulArchitectureRegisters; ++i)
+    {
+        pValues[i] = pRegisters[i];
+    }
+#elif defined _M_AMD64
+    //Rax through R15 are laid out in encoding order
+    const DWORD64 * const pRegisters = &ctx.Rax;
+    for (size_t i = 0; i < 16; ++i)
+    {
+        pValues[i] = pRegisters[i];
+    }
+    pValues[16] = ctx.EFlags;
+#endif
+}
+
+}
+
+InstructionTracer::InstructionTracer(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwModuleStart{ 0 },
+    m_dwModuleEnd{ 0 }, m_ulRegisterCount{ 0 }
+{
+    memset(&m_options, 0, sizeof(TraceOptions));
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+InstructionTracer::~InstructionTracer()
+{
+    (void)Stop();
+}
+
+const bool InstructionTracer::Start(const DWORD dwThreadId, const char * const pPath, const TraceOptions &options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_mapThreads.find(dwThreadId) != m_mapThreads.end())
+    {
+        fprintf(stderr, "Thread %X is already being traced.\n", dwThreadId);
+        return false;
+    }
+
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dwThreadId, GetLastError());
+        return false;
+    }
+
+    const bool bIsFirst = m_mapThreads.empty();
+    if (bIsFirst)
+    {
+        const unsigned char pHeader[] = { sizeof(DWORD_PTR), (unsigned char)(options.bRecordRegisters ? ulArchitectureRegisters : 0) };
+        if (!m_writer.Open(pPath) || !m_writer.WriteValue(dwTraceMagic) || !m_writer.Write(pHeader, sizeof(pHeader)))
+        {
+            (void)m_writer.Close();
+            return false;
+        }
+        m_options = options;
+        m_ulRegisterCount = options.bRecordRegisters ? ulArchitectureRegisters : 0;
+        memset(&m_stats, 0, sizeof(Stats));
+        ModuleRange(InstructionPointer(ctx));
+        m_clock.Start();
+    }
+    else
+    {
+        fprintf(stderr, "Thread %X joins the open trace; its stop conditions apply.\n", dwThreadId);
+    }
+
+    ThreadTrace &thread = m_mapThreads[dwThreadId];
+    thread.hThread = hThread();
+    hThread = INVALID_HANDLE_VALUE;
+    thread.vecRecords.reserve(ulRingRecords);
+    thread.vecValues.reserve(m_ulRegisterCount == 0 ? 0 : ulRingValues);
+    thread.ullInstructions = 0;
+    thread.bHasRegisters = false;
+    thread.dwEncodedInstruction = 0;
+    memset(thread.registers, 0, sizeof(thread.registers));
+    memset(thread.encodedRegisters, 0, sizeof(thread.encodedRegisters));
+
+    //The instruction the thread is stopped on is the first one it will execute
+    (void)Record(dwThreadId, thread, ctx);
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    ctx.EFlags |= 0x100;
+    if (!BOOLIFY(SetThreadContext(thread.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set trap flag on thread %X. Error = %X\n", dwThreadId, GetLastError());
+        (void)FinishThread(m_mapThreads.find(dwThreadId));
+        return false;
+    }
+
+    fprintf(stderr, "Tracing thread %X from %p.\n", dwThreadId, InstructionPointer(ctx));
+    return true;
+}
+
+const bool InstructionTracer::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool bSuccess = true;
+    while (!m_mapThreads.empty())
+    {
+        //A thread that was stepping takes one more trap, which the exception handler passes through
+        bSuccess &= FinishThread(m_mapThreads.begin());
+    }
+
+    return bSuccess;
+}
+
+const bool InstructionTracer::IsTracing() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_mapThreads.empty();
+}
+
+const bool InstructionTracer::HandleSingleStep(const DEBUG_EVENT &dbgEvent, bool &bFinished)
+{
+    bFinished = false;
+    Stopwatch clock;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto thread = m_mapThreads.find(dbgEvent.dwThreadId);
+    if (thread == m_mapThreads.end())
+    {
+        return false;
+    }
+
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | (m_ulRegisterCount != 0 ? CONTEXT_INTEGER : 0);
+    if (!BOOLIFY(GetThreadContext(thread->second.hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        (void)FinishThread(thread);
+        bFinished = true;
+        return true;
+    }
+
+    const DWORD_PTR dwInstruction = InstructionPointer(ctx);
+    bool bSuccess = Record(thread->first, thread->second, ctx);
+
+    const char *pReason = nullptr;
+    if (!bSuccess)
+    {
+        pReason = "trace file could not be written";
+    }
+    else if (dwInstruction == m_options.dwStopAddress)
+    {
+        pReason = "reached stop address";
+    }
+    else if (m_options.ullMaxInstructions != 0 && thread->second.ullInstructions >= m_options.ullMaxInstructions)
+    {
+        pReason = "reached instruction limit";
+    }
+    else if (m_options.bStopOnModuleExit && (dwInstruction < m_dwModuleStart || dwInstruction >= m_dwModuleEnd))
+    {
+        pReason = "left the module";
+    }
+
+    if (pReason != nullptr)
+    {
+        fprintf(stderr, "Trace of thread %X stopped at %p after %I64u instructions: %s.\n", dbgEvent.dwThreadId,
+            dwInstruction, thread->second.ullInstructions, pReason);
+        (void)FinishThread(thread);
+        bFinished = true;
+    }
+    else
+    {
+        ctx.ContextFlags = CONTEXT_CONTROL;
+        ctx.EFlags |= 0x100;
+        if (!BOOLIFY(SetThreadContext(thread->second.hThread(), &ctx)))
+        {
+            fprintf(stderr, "Could not set trap flag on thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+            (void)FinishThread(thread);
+        }
+    }
+
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+    return true;
+}
+
+void InstructionTracer::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto thread = m_mapThreads.find(dwThreadId);
+    if (thread != m_mapThreads.end())
+    {
+        (void)FinishThread(thread);
+    }
+}
+
+void InstructionTracer::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dElapsedMicroseconds = m_mapThreads.empty() ? m_stats.dElapsedMicroseconds : m_clock.ElapsedMicroseconds();
+    const double dInstructions = (double)m_stats.ullInstructions;
+    fprintf(stderr, "Instruction tracer: %I64u instructions in %.2f ms (%.0f per second), %.2f us per step in handler.\n"
+        "%I64u chunks, %I64u register values, %I64u bytes (%.2f bytes per instruction).\n",
+        m_stats.ullInstructions, dElapsedMicroseconds / 1000.0,
+        dElapsedMicroseconds == 0.0 ? 0.0 : dInstructions * 1000000.0 / dElapsedMicroseconds,
+        m_stats.ullInstructions == 0 ? 0.0 : m_stats.dHandlerMicroseconds / dInstructions,
+        m_stats.ullChunks, m_stats.ullRegisterValues, m_writer.BytesWritten(),
+        m_stats.ullInstructions == 0 ? 0.0 : (double)m_writer.BytesWritten() / dInstructions);
+}
+
+const bool InstructionTracer::Record(const DWORD dwThreadId, ThreadTrace &thread, const CONTEXT &ctx)
+{
+    bool bSuccess = true;
+    if (thread.vecRecords.size() == ulRingRecords || thread.vecValues.size() + m_ulRegisterCount > ulRingValues)
+    {
+        bSuccess = Flush(dwThreadId, thread);
+    }
+
+    TraceRecord record = { InstructionPointer(ctx), 0 };
+    if (m_ulRegisterCount != 0)
+    {
+        DWORD64 registers[ulMaxRegisters] = { 0 };
+        ReadRegisters(ctx, registers);
+        for (size_t i = 0; i < m_ulRegisterCount; ++i)
+        {
+            if (!thread.bHasRegisters || registers[i] != thread.registers[i])
+            {
+                record.dwRegisterMask |= (1UL << i);
+                thread.vecValues.push_back(registers[i]);
+                thread.registers[i] = registers[i];
+            }
+        }
+        thread.bHasRegisters = true;
+    }
+    thread.vecRecords.push_back(record);
+    ++thread.ullInstructions;
+    ++m_stats.ullInstructions;
+
+    return bSuccess;
+}
+
+const bool InstructionTracer::Flush(const DWORD dwThreadId, ThreadTrace &thread)
+{
+    if (thread.vecRecords.empty())
+    {
+        return true;
+    }
+
+    bool bSuccess = m_writer.WriteVarint(dwThreadId) && m_writer.WriteVarint(thread.vecRecords.size());
+    size_t ulValue = 0;
+    for (auto record = thread.vecRecords.cbegin(); bSuccess && record != thread.vecRecords.cend(); ++record)
+    {
+        bSuccess = m_writer.WriteSignedVarint((LONGLONG)(record->dwInstruction - thread.dwEncodedInstruction));
+        thread.dwEncodedInstruction = record->dwInstruction;
+        if (m_ulRegisterCount == 0)
+        {
+            continue;
+        }
+
+        bSuccess = bSuccess && m_writer.WriteVarint(record->dwRegisterMask);
+        for (size_t i = 0; bSuccess && i < m_ulRegisterCount; ++i)
+        {
+            if ((record->dwRegisterMask & (1UL << i)) != 0)
+            {
+                const DWORD64 dwValue = thread.vecValues[ulValue++];
+                bSuccess = m_writer.WriteSignedVarint((LONGLONG)(dwValue - thread.encodedRegisters[i]));
+                thread.encodedRegisters[i] = dwValue;
+            }
+        }
+    }
+
+    ++m_stats.ullChunks;
+    m_stats.ullRegisterValues += thread.vecValues.size();
+    thread.vecRecords.clear();
+    thread.vecValues.clear();
+
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not write trace of thread %X.\n", dwThreadId);
+    }
+    return bSuccess;
+}
+
+const bool InstructionTracer::FinishThread(std::map<DWORD, ThreadTrace>::iterator thread)
+{
+    bool bSuccess = Flush(thread->first, thread->second);
+    m_mapThreads.erase(thread);
+    if (m_mapThreads.empty())
+    {
+        bSuccess &= Close();
+    }
+
+    return bSuccess;
+}
+
+const bool InstructionTracer::Close()
+{
+    m_stats.dElapsedMicroseconds = m_clock.ElapsedMicroseconds();
+    if (!m_writer.Close())
+    {
+        return false;
+    }
+
+    fprintf(stderr, "Trace finished: %I64u instructions, %I64u bytes (%.2f bytes per instruction), %.0f instructions per second.\n",
+        m_stats.ullInstructions, m_writer.BytesWritten(),
+        m_stats.ullInstructions == 0 ? 0.0 : (double)m_writer.BytesWritten() / (double)m_stats.ullInstructions,
+        m_stats.dElapsedMicroseconds == 0.0 ? 0.0 : (double)m_stats.ullInstructions * 1000000.0 / m_stats.dElapsedMicroseconds);
+    return true;
+}
+
+void InstructionTracer::ModuleRange(const DWORD_PTR dwAddress)
+{
+    m_dwModuleStart = 0;
+    m_dwModuleEnd = (DWORD_PTR)-1;
+
+    MEMORY_BASIC_INFORMATION memInfo = { 0 };
+    if (VirtualQueryEx(m_pDebugger->Handle(), (LPCVOID)dwAddress, &memInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0)
+    {
+        return;
+    }
+    m_dwModuleStart = (DWORD_PTR)memInfo.AllocationBase;
+    m_dwModuleEnd = (DWORD_PTR)memInfo.BaseAddress + memInfo.RegionSize;
+
+    //Images span several regions, so the headers give the real end
+    IMAGE_DOS_HEADER dosHeader = { 0 };
+    IMAGE_NT_HEADERS ntHeaders = { 0 };
+    SIZE_T ulBytesRead = 0;
+    if (BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)m_dwModuleStart, &dosHeader, sizeof(IMAGE_DOS_HEADER),
+            &ulBytesRead)) && dosHeader.e_magic == IMAGE_DOS_SIGNATURE &&
+        BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)(m_dwModuleStart + dosHeader.e_lfanew), &ntHeaders,
+            sizeof(IMAGE_NT_HEADERS), &ulBytesRead)) && ntHeaders.Signature == IMAGE_NT_SIGNATURE)
+    {
+        m_dwModuleEnd = m_dwModuleStart + ntHeaders.OptionalHeader.SizeOfImage;
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <Windows.h>
+
+#include "BinaryWriter.h"
+#include "SafeHandle.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+struct TraceOptions
+{
+    DWORD_PTR dwStopAddress;
+    ULONGLONG ullMaxInstructions;
+    bool bStopOnModuleExit;
+    bool bRecordRegisters;
+};
+
+//Single-steps threads from inside the debugger thread without going back to the console. Every step appends the
+//instruction pointer, and optionally the registers that changed, to a per-thread ring that is flushed as a chunk
+//once it fills up. The file starts with "TRC1", the pointer size and the register count, and each chunk is
+//[tid][record count] followed by records of [signed pc delta]([changed register mask][signed value delta]...).
+class InstructionTracer final
+{
+public:
+    InstructionTracer() = delete;
+    InstructionTracer(Debugger *pDebugger);
+
+    InstructionTracer(const InstructionTracer &copy) = delete;
+    InstructionTracer &operator=(const InstructionTracer &copy) = delete;
+
+    ~InstructionTracer();
+
+    //The thread has to be stopped; tracing starts when it is continued. Further threads join the open trace file.
+    const bool Start(const DWORD dwThreadId, const char * const pPath, const TraceOptions &options);
+    const bool Stop();
+    const bool IsTracing() const;
+
+    //Called from the exception handler. bFinished is set when the step met a stop condition and the thread should
+    //stop for the console.
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent, bool &bFinished);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void PrintStats() const;
+
+    static const size_t ulRingRecords = 64 * 1024;
+    static const size_t ulRingValues = 4 * ulRingRecords;
+    static const size_t ulMaxRegisters = 17;
+
+private:
+    //Changed register values sit in vecValues in record order, one per bit of the mask
+    struct TraceRecord
+    {
+        DWORD_PTR dwInstruction;
+        DWORD dwRegisterMask;
+    };
+
+    struct ThreadTrace
+    {
+        SafeHandle hThread;
+        std::vector<TraceRecord> vecRecords;
+        std::vector<DWORD64> vecValues;
+        ULONGLONG ullInstructions;
+        DWORD64 registers[ulMaxRegisters];
+        bool bHasRegisters;
+        DWORD_PTR dwEncodedInstruction;
+        DWORD64 encodedRegisters[ulMaxRegisters];
+    };
+
+    struct Stats
+    {
+        unsigned long long ullInstructions;
+        unsigned long long ullChunks;
+        unsigned long long ullRegisterValues;
+        double dHandlerMicroseconds;
+        double dElapsedMicroseconds;
+    };
+
+    const bool Record(const DWORD dwThreadId, ThreadTrace &thread, const CONTEXT &ctx);
+    const bool Flush(const DWORD dwThreadId, ThreadTrace &thread);
+    const bool FinishThread(std::map<DWORD, ThreadTrace>::iterator thread);
+    const bool Close();
+    void ModuleRange(const DWORD_PTR dwAddress);
+
+    Debugger * const m_pDebugger;
+
+    //Guards everything below; steps arrive on the debugger thread while the console starts and stops traces
+    mutable std::mutex m_mutex;
+    std::map<DWORD, ThreadTrace> m_mapThreads;
+    BinaryWriter m_writer;
+    TraceOptions m_options;
+    DWORD_PTR m_dwModuleStart;
+    DWORD_PTR m_dwModuleEnd;
+    size_t m_ulRegisterCount;
+
+    Stopwatch m_clock;
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -2,39 +2,31 @@
 
 #include <cstdio>
 
-#include "Common.h"
+#include "PatchManager.h"
 
 namespace CodeReversing
 {
 
-InterruptBreakpoint::InterruptBreakpoint(const HANDLE hProcess, const DWORD_PTR dwAddress)
+InterruptBreakpoint::InterruptBreakpoint(const HANDLE hProcess, const DWORD_PTR dwAddress, PatchManager *pPatchManager)
     : Breakpoint(hProcess, dwAddress, Breakpoint::eType::eInterrupt),
-    m_originalByte{ 0 }
+    m_originalByte{ 0 }, m_pPatchManager{ pPatchManager }
 {
 }
 
 const bool InterruptBreakpoint::EnableBreakpoint()
 {
-    SIZE_T ulBytes = 0;
-    bool bSuccess = BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)m_dwAddress, &m_originalByte, sizeof(unsigned char), &ulBytes));
-    if (bSuccess && ulBytes == sizeof(unsigned char))
+    if (m_pPatchManager->SwapByte(m_dwAddress, m_breakpointOpcode, &m_originalByte))
     {
-        bSuccess = BOOLIFY(WriteProcessMemory(m_hProcess, (LPVOID)m_dwAddress, &m_breakpointOpcode, sizeof(unsigned char), &ulBytes));
-        return bSuccess && (ulBytes == sizeof(unsigned char));
-    }
-    else
-    {
-        fprintf(stderr, "Could not read from address %p. Error = %X\n", m_dwAddress, GetLastError());
+        return true;
     }
+    fprintf(stderr, "Could not write breakpoint to address %p. Error = %X\n", m_dwAddress, GetLastError());
 
     return false;
 }
 
 const bool InterruptBreakpoint::DisableBreakpoint()
 {
-    SIZE_T ulBytes = 0;
-    const bool bSuccess = BOOLIFY(WriteProcessMemory(m_hProcess, (LPVOID)m_dwAddress, &m_originalByte, sizeof(unsigned char), &ulBytes));
-    if (bSuccess && ulBytes == sizeof(unsigned char))
+    if (m_pPatchManager->SwapByte(m_dwAddress, m_originalByte))
     {
         return true;
     }
@@ -48,4 +40,14 @@ void InterruptBreakpoint::ChangeAddress(const DWORD_PTR dwNewAddress)
     m_dwAddress = dwNewAddress;
 }
 
+const unsigned char InterruptBreakpoint::OriginalByte() const
+{
+    return m_originalByte;
+}
+
+void InterruptBreakpoint::SetOriginalByte(const unsigned char cOriginalByte)
+{
+    m_originalByte = cOriginalByte;
+}
+
 }
\ No newline at end of file
@@ -6,11 +6,14 @@
 namespace CodeReversing
 {
 
+class PatchManager;
+
+//The int 3 byte is swapped in and out through the patch manager so that it never races a patch to the same code
 class InterruptBreakpoint final : public Breakpoint
 {
 public:
     InterruptBreakpoint() = delete;
-    InterruptBreakpoint(const HANDLE hProcess, const DWORD_PTR dwAddress);
+    InterruptBreakpoint(const HANDLE hProcess, const DWORD_PTR dwAddress, PatchManager *pPatchManager);
 
     InterruptBreakpoint(const InterruptBreakpoint &copy) = delete;
     InterruptBreakpoint &operator=(const InterruptBreakpoint &copy) = delete;
@@ -22,9 +25,13 @@ public:
 
     void ChangeAddress(const DWORD_PTR dwNewAddress);
 
+    const unsigned char OriginalByte() const;
+    void SetOriginalByte(const unsigned char cOriginalByte);
+
 private:
     const static unsigned char m_breakpointOpcode = 0xCC;
     unsigned char m_originalByte;
+    PatchManager * const m_pPatchManager;
 
 };
 
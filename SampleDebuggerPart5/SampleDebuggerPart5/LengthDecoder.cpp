@@ -0,0 +1,400 @@
+#include "LengthDecoder.h"
+
+#include <cstring>
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Operand layout flags for each opcode
+const uint8_t MR = 0x01;   //ModRM byte follows
+const uint8_t I8 = 0x02;   //8-bit immediate
+const uint8_t I16 = 0x04;  //16-bit immediate
+const uint8_t IZ = 0x08;   //16-bit or 32-bit immediate depending on operand size
+const uint8_t IV = 0x10;   //16-bit, 32-bit or 64-bit immediate depending on operand size
+const uint8_t AM = 0x20;   //Absolute memory offset, as wide as an address
+const uint8_t NX = 0x40;   //Invalid in 64-bit mode
+
+const uint8_t cOneByteTable[256] =
+{
+    /*        0        1        2        3        4        5        6        7        8        9        A        B        C        D        E        F */
+    /* 0 */   MR,      MR,      MR,      MR,      I8,      IZ,      NX,      NX,      MR,      MR,      MR,      MR,      I8,      IZ,      NX,      0,
+    /* 1 */   MR,      MR,      MR,      MR,      I8,      IZ,      NX,      NX,      MR,      MR,      MR,      MR,      I8,      IZ,      NX,      NX,
+    /* 2 */   MR,      MR,      MR,      MR,      I8,      IZ,      0,       NX,      MR,      MR,      MR,      MR,      I8,      IZ,      0,       NX,
+    /* 3 */   MR,      MR,      MR,      MR,      I8,      IZ,      0,       NX,      MR,      MR,      MR,      MR,      I8,      IZ,      0,       NX,
+    /* 4 */   0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,
+    /* 5 */   0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,
+    /* 6 */   NX,      NX,      MR | NX, MR,      0,       0,       0,       0,       IZ,      MR | IZ, I8,      MR | I8, 0,       0,       0,       0,
+    /* 7 */   I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,
+    /* 8 */   MR | I8, MR | IZ, MR | I8 | NX, MR | I8, MR, MR,   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 9 */   0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       IZ | I16 | NX, 0, 0,     0,       0,       0,
+    /* A */   AM,      AM,      AM,      AM,      0,       0,       0,       0,       I8,      IZ,      0,       0,       0,       0,       0,       0,
+    /* B */   I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      IV,      IV,      IV,      IV,      IV,      IV,      IV,      IV,
+    /* C */   MR | I8, MR | I8, I16,     0,       MR | NX, MR | NX, MR | I8, MR | IZ, I16 | I8, 0,      I16,     0,       0,       I8,      NX,      0,
+    /* D */   MR,      MR,      MR,      MR,      I8 | NX, I8 | NX, NX,      0,       MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* E */   I8,      I8,      I8,      I8,      I8,      I8,      I8,      I8,      IZ,      IZ,      IZ | I16 | NX, I8, 0,     0,       0,       0,
+    /* F */   0,       0,       0,       0,       0,       0,       MR,      MR,      0,       0,       0,       0,       0,       0,       MR,      MR
+};
+
+//0F xx. 0F 38 and 0F 3A are separate maps and are handled before this table is consulted.
+const uint8_t cTwoByteTable[256] =
+{
+    /*        0        1        2        3        4        5        6        7        8        9        A        B        C        D        E        F */
+    /* 0 */   MR,      MR,      MR,      MR,      0,       0,       0,       0,       0,       0,       0,       0,       0,       MR,      0,       MR | I8,
+    /* 1 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 2 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 3 */   0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,       0,
+    /* 4 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 5 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 6 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 7 */   MR | I8, MR | I8, MR | I8, MR | I8, MR,      MR,      MR,      0,       MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* 8 */   IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,      IZ,
+    /* 9 */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* A */   0,       0,       0,       MR,      MR | I8, MR,      MR,      MR,      0,       0,       0,       MR,      MR | I8, MR,      MR,      MR,
+    /* B */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR | I8, MR,      MR,      MR,      MR,      MR,
+    /* C */   MR,      MR,      MR | I8, MR,      MR | I8, MR | I8, MR | I8, MR,      0,       0,       0,       0,       0,       0,       0,       0,
+    /* D */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* E */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,
+    /* F */   MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR,      MR
+};
+
+const bool IsLegacyPrefix(const uint8_t cByte)
+{
+    switch (cByte)
+    {
+    case 0x26:
+    case 0x2E:
+    case 0x36:
+    case 0x3E:
+    case 0x64:
+    case 0x65:
+    case 0x66:
+    case 0x67:
+    case 0xF0:
+    case 0xF2:
+    case 0xF3:
+        return true;
+    }
+
+    return false;
+}
+
+}
+
+const bool LengthDecoder::Decode(const uint8_t * const pBytes, const size_t ulSize, const eMode mode, Result &result)
+{
+    memset(&result, 0, sizeof(Result));
+
+    const bool bIs64Bit = (mode == eMode::e64Bit);
+    const size_t ulLimit = (ulSize < ulMaxInstructionLength) ? ulSize : ulMaxInstructionLength;
+    size_t ulOffset = 0;
+    bool bOperandSize = false;
+    bool bAddressSize = false;
+    bool bRepne = false;
+    bool bRexW = false;
+
+    //A REX prefix only counts when it comes last, right before the opcode
+    while (ulOffset < ulLimit)
+    {
+        const uint8_t cByte = pBytes[ulOffset];
+        if (IsLegacyPrefix(cByte))
+        {
+            bOperandSize |= (cByte == 0x66);
+            bAddressSize |= (cByte == 0x67);
+            bRepne |= (cByte == 0xF2);
+            bRexW = false;
+        }
+        else if (bIs64Bit && (cByte & 0xF0) == 0x40)
+        {
+            bRexW = ((cByte & 0x08) != 0);
+        }
+        else
+        {
+            break;
+        }
+        ++ulOffset;
+    }
+    if (ulOffset >= ulLimit)
+    {
+        return false;
+    }
+
+    const uint8_t cOpcode = pBytes[ulOffset++];
+    bool bHasModRm = false;
+    size_t ulImmediateSize = 0;
+    bool bIsBranchImmediate = false;
+    uint8_t cFlags = 0;
+    uint8_t cSecondOpcode = 0;
+    bool bIsOneByteMap = false;
+    const bool bHasNext = (ulOffset < ulLimit);
+    const uint8_t cNext = bHasNext ? pBytes[ulOffset] : 0;
+
+    //VEX, EVEX and XOP reuse opcodes that are LES, LDS, BOUND and POP outside of 64-bit mode; they are told apart
+    //by a register-form ModRM in 32-bit mode and by the map select field for XOP
+    const bool bIsVex = (cOpcode == 0xC4 || cOpcode == 0xC5) && bHasNext && (bIs64Bit || cNext >= 0xC0);
+    const bool bIsEvex = (cOpcode == 0x62) && bHasNext && (bIs64Bit || cNext >= 0xC0);
+    const bool bIsXop = (cOpcode == 0x8F) && bHasNext && ((cNext & 0x1F) >= 8);
+    if (bIsVex || bIsEvex || bIsXop)
+    {
+        uint8_t cMap = 1;
+        if (cOpcode == 0xC4 || bIsXop)
+        {
+            cMap = cNext & 0x1F;
+            ulOffset += 2;
+        }
+        else if (cOpcode == 0xC5)
+        {
+            ulOffset += 1;
+        }
+        else
+        {
+            cMap = cNext & 0x07;
+            ulOffset += 3;
+        }
+        if (ulOffset >= ulLimit)
+        {
+            return false;
+        }
+
+        cSecondOpcode = pBytes[ulOffset++];
+        bHasModRm = !(bIsVex && cMap == 1 && cSecondOpcode == 0x77);
+        if (bIsXop)
+        {
+            ulImmediateSize = (cMap == 8) ? 1 : ((cMap == 0xA) ? 4 : 0);
+        }
+        else if (cMap == 3)
+        {
+            ulImmediateSize = 1;
+        }
+        else if (cMap == 1)
+        {
+            ulImmediateSize = (cTwoByteTable[cSecondOpcode] & I8) ? 1 : 0;
+        }
+    }
+    else if (cOpcode == 0x0F)
+    {
+        if (ulOffset >= ulLimit)
+        {
+            return false;
+        }
+        cSecondOpcode = pBytes[ulOffset++];
+        if (cSecondOpcode == 0x38 || cSecondOpcode == 0x3A)
+        {
+            if (ulOffset >= ulLimit)
+            {
+                return false;
+            }
+            ++ulOffset;
+            bHasModRm = true;
+            ulImmediateSize = (cSecondOpcode == 0x3A) ? 1 : 0;
+        }
+        else
+        {
+            cFlags = cTwoByteTable[cSecondOpcode];
+            if (cSecondOpcode == 0x78 && (bOperandSize || bRepne))
+            {
+                //SSE4a EXTRQ and INSERTQ take two 8-bit immediates where VMREAD takes none
+                ulImmediateSize = 2;
+            }
+            if (cSecondOpcode >= 0x80 && cSecondOpcode <= 0x8F)
+            {
+                result.branchType = eBranchType::eConditional;
+                bIsBranchImmediate = true;
+            }
+        }
+    }
+    else
+    {
+        bIsOneByteMap = true;
+        cFlags = cOneByteTable[cOpcode];
+        if (bIs64Bit && (cFlags & NX))
+        {
+            return false;
+        }
+
+        switch (cOpcode)
+        {
+        case 0xE8:
+            result.branchType = eBranchType::eCall;
+            bIsBranchImmediate = true;
+            break;
+        case 0xE9:
+        case 0xEB:
+            result.branchType = eBranchType::eJump;
+            bIsBranchImmediate = true;
+            break;
+        case 0xE0:
+        case 0xE1:
+        case 0xE2:
+        case 0xE3:
+            result.branchType = eBranchType::eConditional;
+            bIsBranchImmediate = true;
+            break;
+        case 0x9A:
+            result.branchType = eBranchType::eCall;
+            break;
+        case 0xEA:
+            result.branchType = eBranchType::eJump;
+            break;
+        case 0xC2:
+        case 0xC3:
+        case 0xCA:
+        case 0xCB:
+        case 0xCF:
+            result.branchType = eBranchType::eReturn;
+            break;
+        default:
+            if (cOpcode >= 0x70 && cOpcode <= 0x7F)
+            {
+                result.branchType = eBranchType::eConditional;
+                bIsBranchImmediate = true;
+            }
+            break;
+        }
+    }
+
+    if (cFlags & MR)
+    {
+        bHasModRm = true;
+    }
+    if (cFlags & I8)
+    {
+        ulImmediateSize += 1;
+    }
+    if (cFlags & I16)
+    {
+        ulImmediateSize += 2;
+    }
+    if (cFlags & IZ)
+    {
+        //Near branches ignore the operand size prefix in 64-bit mode
+        ulImmediateSize += ((bOperandSize && !bRexW) && !(bIs64Bit && bIsBranchImmediate)) ? 2 : 4;
+    }
+    if (cFlags & IV)
+    {
+        ulImmediateSize += bRexW ? 8 : (bOperandSize ? 2 : 4);
+    }
+    if (cFlags & AM)
+    {
+        ulImmediateSize += bIs64Bit ? (bAddressSize ? 4 : 8) : (bAddressSize ? 2 : 4);
+    }
+
+    size_t ulDisplacementSize = 0;
+    if (bHasModRm)
+    {
+        if (ulOffset >= ulLimit)
+        {
+            return false;
+        }
+        const uint8_t cModRm = pBytes[ulOffset++];
+        //Moves to and from control, debug and test registers always use the register form
+        const bool bIsRegisterMove = (cOpcode == 0x0F && cSecondOpcode >= 0x20 && cSecondOpcode <= 0x26);
+        const uint8_t cMod = bIsRegisterMove ? 3 : (cModRm >> 6);
+        const uint8_t cReg = (cModRm >> 3) & 7;
+        const uint8_t cRm = cModRm & 7;
+
+        if (cMod != 3)
+        {
+            if (!bIs64Bit && bAddressSize)
+            {
+                ulDisplacementSize = (cMod == 1) ? 1 : ((cMod == 2 || (cMod == 0 && cRm == 6)) ? 2 : 0);
+            }
+            else
+            {
+                if (cRm == 4)
+                {
+                    if (ulOffset >= ulLimit)
+                    {
+                        return false;
+                    }
+                    const uint8_t cSib = pBytes[ulOffset++];
+                    if (cMod == 0 && (cSib & 7) == 5)
+                    {
+                        ulDisplacementSize = 4;
+                    }
+                }
+                if (cMod == 0 && cRm == 5)
+                {
+                    ulDisplacementSize = 4;
+                    result.bIsRipRelative = bIs64Bit;
+                }
+                else if (cMod == 1)
+                {
+                    ulDisplacementSize = 1;
+                }
+                else if (cMod == 2)
+                {
+                    ulDisplacementSize = 4;
+                }
+            }
+        }
+
+        //Group 3 only has an immediate for TEST, and group 5 holds the indirect calls and jumps
+        if (bIsOneByteMap && cOpcode == 0xF6 && cReg < 2)
+        {
+            ulImmediateSize += 1;
+        }
+        else if (bIsOneByteMap && cOpcode == 0xF7 && cReg < 2)
+        {
+            ulImmediateSize += (bOperandSize && !bRexW) ? 2 : 4;
+        }
+        else if (bIsOneByteMap && cOpcode == 0xFF && cReg >= 2 && cReg <= 5)
+        {
+            result.branchType = (cReg <= 3) ? eBranchType::eCall : eBranchType::eJump;
+            result.bIsIndirect = true;
+        }
+        else if (bIsOneByteMap && cOpcode == 0xC7 && cModRm == 0xF8)
+        {
+            //XBEGIN falls through or aborts to its relative target
+            result.branchType = eBranchType::eConditional;
+            bIsBranchImmediate = true;
+        }
+    }
+
+    result.uiDisplacementOffset = (uint8_t)(ulDisplacementSize != 0 ? ulOffset : 0);
+    result.uiDisplacementSize = (uint8_t)ulDisplacementSize;
+    ulOffset += ulDisplacementSize;
+    result.uiImmediateOffset = (uint8_t)(ulImmediateSize != 0 ? ulOffset : 0);
+    result.uiImmediateSize = (uint8_t)ulImmediateSize;
+    ulOffset += ulImmediateSize;
+    if (ulOffset > ulLimit)
+    {
+        return false;
+    }
+    result.uiLength = (uint8_t)ulOffset;
+
+    if (bIsBranchImmediate)
+    {
+        const uint8_t * const pImmediate = &pBytes[result.uiImmediateOffset];
+        result.bIsRelative = true;
+        switch (ulImmediateSize)
+        {
+        case 1:
+            result.llRelative = (int8_t)pImmediate[0];
+            break;
+        case 2:
+            result.llRelative = (int16_t)(pImmediate[0] | (pImmediate[1] << 8));
+            break;
+        default:
+            result.llRelative = (int32_t)((uint32_t)pImmediate[0] | ((uint32_t)pImmediate[1] << 8) |
+                ((uint32_t)pImmediate[2] << 16) | ((uint32_t)pImmediate[3] << 24));
+            break;
+        }
+    }
+
+    return true;
+}
+
+const uint64_t LengthDecoder::BranchTarget(const uint64_t ullAddress, const Result &result)
+{
+    if (!result.bIsRelative)
+    {
+        return 0;
+    }
+
+    return ullAddress + result.uiLength + (uint64_t)result.llRelative;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CodeReversing
+{
+
+enum class eBranchType
+{
+    eNone = 0,
+    eJump = 1,
+    eConditional = 2,
+    eCall = 3,
+    eReturn = 4
+};
+
+//Table-driven x86/x64 instruction length and branch decoder. It only finds instruction boundaries, branch classes
+//and displacement/immediate positions, which is all stepping and code discovery need; it does not depend on
+//Windows so it can be built and checked anywhere.
+class LengthDecoder final
+{
+public:
+    enum class eMode
+    {
+        e32Bit = 1,
+        e64Bit = 2
+    };
+
+    struct Result
+    {
+        uint8_t uiLength;
+        eBranchType branchType;
+        bool bIsIndirect;
+        bool bIsRelative;
+        bool bIsRipRelative;
+        uint8_t uiDisplacementOffset;
+        uint8_t uiDisplacementSize;
+        uint8_t uiImmediateOffset;
+        uint8_t uiImmediateSize;
+        int64_t llRelative;
+    };
+
+    LengthDecoder() = delete;
+
+    static const bool Decode(const uint8_t * const pBytes, const size_t ulSize, const eMode mode, Result &result);
+    static const uint64_t BranchTarget(const uint64_t ullAddress, const Result &result);
+
+    static const size_t ulMaxInstructionLength = 15;
+};
+
+}
\ No newline at end of file
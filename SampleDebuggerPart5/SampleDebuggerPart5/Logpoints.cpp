@@ -0,0 +1,479 @@
+#include "Logpoints.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const std::string Trim(const std::string &strText)
+{
+    const size_t ulStart = strText.find_first_not_of(" \t");
+    if (ulStart == std::string::npos)
+    {
+        return std::string();
+    }
+    const size_t ulEnd = strText.find_last_not_of(" \t");
+    return strText.substr(ulStart, ulEnd - ulStart + 1);
+}
+
+}
+
+Logpoints::Logpoints(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_unwinder{ pDebugger->Handle() },
+    m_vecFrames(ulMaxDepth), m_pRing{ new LogRecord[ulRingSlots] }, m_ulHead{ 0 }, m_ulTail{ 0 }, m_ullDropped{ 0 },
+    m_ullWritten{ 0 }, m_ullReportedDropped{ 0 }, m_bIsRunning{ false }, m_llStart{ Stopwatch::Now() }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+Logpoints::~Logpoints()
+{
+    m_bIsRunning = false;
+    if (m_writer.joinable())
+    {
+        m_writer.join();
+    }
+    (void)m_output.Close();
+}
+
+Logpoints::Logpoint::Logpoint() : dwContextFlags{ 0 }, bOwnsBreakpoint{ false }, ullHits{ 0 }, ullDropped{ 0 },
+    llFirstHit{ 0 }, llLastHit{ 0 }
+{
+}
+
+Logpoints::Logpoint::Logpoint(Logpoint &&other) : strTemplate(std::move(other.strTemplate)),
+    vecParts(std::move(other.vecParts)), vecValues(std::move(other.vecValues)), dwContextFlags{ other.dwContextFlags },
+    bOwnsBreakpoint{ other.bOwnsBreakpoint }, ullHits{ other.ullHits }, ullDropped{ other.ullDropped },
+    llFirstHit{ other.llFirstHit }, llLastHit{ other.llLastHit }
+{
+}
+
+Logpoints::Logpoint &Logpoints::Logpoint::operator=(Logpoint &&other)
+{
+    if (this != &other)
+    {
+        strTemplate = std::move(other.strTemplate);
+        vecParts = std::move(other.vecParts);
+        vecValues = std::move(other.vecValues);
+        dwContextFlags = other.dwContextFlags;
+        bOwnsBreakpoint = other.bOwnsBreakpoint;
+        ullHits = other.ullHits;
+        ullDropped = other.ullDropped;
+        llFirstHit = other.llFirstHit;
+        llLastHit = other.llLastHit;
+    }
+    return *this;
+}
+
+const bool Logpoints::Add(const DWORD_PTR dwAddress, const char * const pTemplate)
+{
+    Logpoint logpoint;
+    if (!Compile(pTemplate, logpoint))
+    {
+        return false;
+    }
+    if (m_pDebugger->FindBreakpoint(dwAddress) == nullptr)
+    {
+        if (!m_pDebugger->AddBreakpoint(dwAddress))
+        {
+            fprintf(stderr, "Could not place logpoint at %p.\n", dwAddress);
+            return false;
+        }
+        logpoint.bOwnsBreakpoint = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto existing = m_mapLogpoints.find(dwAddress);
+        if (existing != m_mapLogpoints.end())
+        {
+            logpoint.bOwnsBreakpoint = logpoint.bOwnsBreakpoint || existing->second.bOwnsBreakpoint;
+        }
+        m_mapLogpoints[dwAddress] = std::move(logpoint);
+    }
+
+    //The writer only runs once there is something to write
+    if (!m_bIsRunning)
+    {
+        m_bIsRunning = true;
+        m_writer = std::thread(&Logpoints::Run, this);
+    }
+
+    return true;
+}
+
+const bool Logpoints::Remove(const DWORD_PTR dwAddress)
+{
+    bool bOwnsBreakpoint = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto logpoint = m_mapLogpoints.find(dwAddress);
+        if (logpoint == m_mapLogpoints.end())
+        {
+            fprintf(stderr, "No logpoint at %p.\n", dwAddress);
+            return false;
+        }
+        bOwnsBreakpoint = logpoint->second.bOwnsBreakpoint;
+        m_mapLogpoints.erase(logpoint);
+    }
+
+    return !bOwnsBreakpoint || m_pDebugger->RemoveBreakpoint(dwAddress);
+}
+
+const bool Logpoints::SetOutput(const char * const pPath)
+{
+    std::lock_guard<std::mutex> lock(m_outputMutex);
+    if (m_output.IsOpen())
+    {
+        (void)m_output.Close();
+    }
+    if (pPath != nullptr && !m_output.Open(pPath))
+    {
+        fprintf(stderr, "Could not open log file %s, logging to stderr.\n", pPath);
+        return false;
+    }
+
+    return true;
+}
+
+const bool Logpoints::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto logpoint = m_mapLogpoints.find(dwAddress);
+    if (logpoint == m_mapLogpoints.end())
+    {
+        return false;
+    }
+    Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(dwAddress);
+    if (pBreakpoint == nullptr || !pBreakpoint->IsEnabled())
+    {
+        return false;
+    }
+
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = logpoint->second.dwContextFlags;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        ++m_stats.ullErrors;
+        return false;
+    }
+
+    Logpoint &current = logpoint->second;
+    const LONGLONG llNow = Stopwatch::Now();
+    if (current.ullHits++ == 0)
+    {
+        current.llFirstHit = llNow;
+    }
+    current.llLastHit = llNow;
+    ++m_stats.ullHits;
+
+    //Only this thread moves the head, so the slot it points at is free once the writer's tail is far enough behind
+    const size_t ulHead = m_ulHead.load(std::memory_order_relaxed);
+    const size_t ulTail = m_ulTail.load(std::memory_order_acquire);
+    if (ulHead - ulTail >= ulRingSlots)
+    {
+        ++m_ullDropped;
+        ++current.ullDropped;
+    }
+    else
+    {
+        LogRecord &record = m_pRing[ulHead & (ulRingSlots - 1)];
+        record.llTime = llNow;
+        record.dwAddress = dwAddress;
+        record.dwThreadId = dbgEvent.dwThreadId;
+        record.uiLength = (unsigned int)Format(current, dbgEvent.dwThreadId, ctx, record.strMessage);
+        m_ulHead.store(ulHead + 1, std::memory_order_release);
+        m_stats.ullPeakQueued = std::max<unsigned long long>(m_stats.ullPeakQueued, ulHead + 1 - ulTail);
+    }
+
+    SetInstructionPointer(ctx, dwAddress);
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    ctx.EFlags |= 0x100;
+    if (!pBreakpoint->Disable())
+    {
+        fprintf(stderr, "Could not remove breakpoint at %p.\n", dwAddress);
+        ++m_stats.ullErrors;
+        return false;
+    }
+    if (!BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not resume thread %X past %p. Error = %X\n", dbgEvent.dwThreadId, dwAddress, GetLastError());
+        (void)pBreakpoint->Enable();
+        ++m_stats.ullErrors;
+        return false;
+    }
+    m_mapRearms[dbgEvent.dwThreadId] = dwAddress;
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+
+    return true;
+}
+
+const bool Logpoints::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dbgEvent.dwThreadId);
+    if (rearm == m_mapRearms.end())
+    {
+        return false;
+    }
+
+    Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(rearm->second);
+    if (pBreakpoint != nullptr && !pBreakpoint->IsEnabled())
+    {
+        (void)pBreakpoint->Enable();
+    }
+    m_mapRearms.erase(rearm);
+
+    return true;
+}
+
+void Logpoints::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dwThreadId);
+    if (rearm != m_mapRearms.end())
+    {
+        Breakpoint * const pBreakpoint = m_pDebugger->FindBreakpoint(rearm->second);
+        if (pBreakpoint != nullptr && !pBreakpoint->IsEnabled())
+        {
+            (void)pBreakpoint->Enable();
+        }
+        m_mapRearms.erase(rearm);
+    }
+}
+
+void Logpoints::RemoveModule(const DWORD_PTR dwModuleBase)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unwinder.RemoveModule(dwModuleBase);
+}
+
+void Logpoints::PrintLogpoints() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &logpoint : m_mapLogpoints)
+    {
+        const Logpoint &current = logpoint.second;
+        const double dSeconds = TicksToSeconds(current.llLastHit - current.llFirstHit);
+        fprintf(stderr, "%p: \"%s\", %I64u hits (%.0f per second), %I64u dropped.\n", logpoint.first,
+            current.strTemplate.c_str(), current.ullHits, (dSeconds > 0.0) ? (double)(current.ullHits - 1) / dSeconds : 0.0,
+            current.ullDropped);
+    }
+}
+
+void Logpoints::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dHits = (m_stats.ullHits != 0) ? (double)m_stats.ullHits : 1.0;
+    fprintf(stderr, "Logpoints: %I64u hits, %I64u written, %I64u dropped, %Iu queued (peak %I64u of %Iu), %I64u errors, "
+        "%.2f us per hit in the handler.\n", m_stats.ullHits, m_ullWritten.load(), m_ullDropped.load(),
+        m_ulHead.load() - m_ulTail.load(), m_stats.ullPeakQueued, ulRingSlots, m_stats.ullErrors,
+        m_stats.dHandlerMicroseconds / dHits);
+}
+
+const bool Logpoints::Compile(const char * const pTemplate, Logpoint &logpoint) const
+{
+    logpoint.strTemplate = pTemplate;
+    logpoint.dwContextFlags = CONTEXT_CONTROL;
+
+    std::string strText;
+    const char *pCurrent = pTemplate;
+    while (*pCurrent != '\0')
+    {
+        //Doubled braces stand for themselves
+        if ((pCurrent[0] == '{' || pCurrent[0] == '}') && pCurrent[1] == pCurrent[0])
+        {
+            strText += *pCurrent;
+            pCurrent += 2;
+            continue;
+        }
+        if (*pCurrent != '{')
+        {
+            strText += *pCurrent++;
+            continue;
+        }
+
+        const char * const pEnd = strchr(pCurrent, '}');
+        if (pEnd == nullptr)
+        {
+            fprintf(stderr, "Template has an unclosed { at column %Iu.\n", (size_t)(pCurrent - pTemplate) + 1);
+            return false;
+        }
+        if (!strText.empty())
+        {
+            logpoint.vecParts.push_back({ eField::eText, 0, strText, nullptr });
+            strText.clear();
+        }
+
+        std::string strField(pCurrent + 1, pEnd);
+        char cFormat = 'x';
+        const size_t ulColon = strField.rfind(':');
+        if (ulColon != std::string::npos)
+        {
+            const std::string strFormat = Trim(strField.substr(ulColon + 1));
+            if (strFormat.size() != 1 || strchr("xdu", strFormat[0]) == nullptr)
+            {
+                fprintf(stderr, "Unknown format \"%s\", expected x, d or u.\n", strFormat.c_str());
+                return false;
+            }
+            cFormat = strFormat[0];
+            strField.resize(ulColon);
+        }
+        strField = Trim(strField);
+
+        TemplatePart part = { eField::eValue, cFormat, std::string(), nullptr };
+        if (_stricmp(strField.c_str(), "tid") == 0)
+        {
+            part.field = eField::eThread;
+        }
+        else if (_stricmp(strField.c_str(), "depth") == 0)
+        {
+            part.field = eField::eDepth;
+            logpoint.dwContextFlags |= CONTEXT_FULL;
+        }
+        else
+        {
+            std::unique_ptr<BreakpointCondition> pValue = BreakpointCondition::Compile(strField.c_str());
+            if (pValue == nullptr)
+            {
+                return false;
+            }
+            logpoint.dwContextFlags |= pValue->ContextFlags();
+            part.pValue = pValue.get();
+            logpoint.vecValues.push_back(std::move(pValue));
+        }
+        logpoint.vecParts.push_back(part);
+        pCurrent = pEnd + 1;
+    }
+    if (!strText.empty())
+    {
+        logpoint.vecParts.push_back({ eField::eText, 0, strText, nullptr });
+    }
+
+    return true;
+}
+
+const size_t Logpoints::Format(const Logpoint &logpoint, const DWORD dwThreadId, const CONTEXT &ctx, char * const pBuffer)
+{
+    size_t ulLength = 0;
+    char strNumber[32] = { 0 };
+    for (auto &part : logpoint.vecParts)
+    {
+        const char *pText = strNumber;
+        size_t ulTextLength = 0;
+        switch (part.field)
+        {
+        case eField::eText:
+            pText = part.strText.c_str();
+            ulTextLength = part.strText.size();
+            break;
+        case eField::eThread:
+            ulTextLength = (size_t)sprintf_s(strNumber, sizeof(strNumber), "%X", dwThreadId);
+            break;
+        case eField::eDepth:
+            ulTextLength = (size_t)sprintf_s(strNumber, sizeof(strNumber), "%Iu",
+                m_unwinder.Capture(ctx, m_vecFrames.data(), ulMaxDepth));
+            break;
+        case eField::eValue:
+        {
+            DWORD64 ullValue = 0;
+            if (!part.pValue->EvaluateValue(m_pDebugger->Handle(), ctx, logpoint.ullHits, ullValue))
+            {
+                pText = "<error>";
+                ulTextLength = strlen(pText);
+                ++m_stats.ullErrors;
+                break;
+            }
+            const char * const pFormat = (part.cFormat == 'd') ? "%I64d" : (part.cFormat == 'u') ? "%I64u" : "%I64X";
+            ulTextLength = (size_t)sprintf_s(strNumber, sizeof(strNumber), pFormat, ullValue);
+            break;
+        }
+        }
+
+        //Long messages are cut at the slot size rather than spilling into another slot
+        ulTextLength = std::min(ulTextLength, ulMaxMessage - ulLength);
+        memcpy(pBuffer + ulLength, pText, ulTextLength);
+        ulLength += ulTextLength;
+    }
+
+    return ulLength;
+}
+
+void Logpoints::Run()
+{
+    while (m_bIsRunning)
+    {
+        if (Drain() == 0)
+        {
+            Sleep(1);
+        }
+    }
+    (void)Drain();
+}
+
+const size_t Logpoints::Drain()
+{
+    std::lock_guard<std::mutex> lock(m_outputMutex);
+    const size_t ulHead = m_ulHead.load(std::memory_order_acquire);
+    size_t ulTail = m_ulTail.load(std::memory_order_relaxed);
+    const size_t ulDrained = ulHead - ulTail;
+
+    char strLine[ulMaxMessage + 64] = { 0 };
+    for (; ulTail != ulHead; ++ulTail)
+    {
+        const LogRecord &record = m_pRing[ulTail & (ulRingSlots - 1)];
+        const int iLength = _snprintf_s(strLine, sizeof(strLine), _TRUNCATE, "[%.6f] %X %p: %.*s\n",
+            TicksToSeconds(record.llTime - m_llStart), record.dwThreadId, record.dwAddress, (int)record.uiLength,
+            record.strMessage);
+        Output(strLine, (iLength < 0) ? strlen(strLine) : (size_t)iLength);
+
+        //Handing each slot back straight away gives the debugger thread room while a long backlog is written
+        m_ulTail.store(ulTail + 1, std::memory_order_release);
+    }
+
+    const ULONGLONG ullDropped = m_ullDropped.load();
+    if (ullDropped != m_ullReportedDropped)
+    {
+        const int iLength = _snprintf_s(strLine, sizeof(strLine), _TRUNCATE, "[%I64u log records dropped, %I64u in total]\n",
+            ullDropped - m_ullReportedDropped, ullDropped);
+        Output(strLine, (iLength < 0) ? strlen(strLine) : (size_t)iLength);
+        m_ullReportedDropped = ullDropped;
+    }
+    if (ulDrained != 0)
+    {
+        m_ullWritten += ulDrained;
+        if (m_output.IsOpen())
+        {
+            (void)m_output.Flush();
+        }
+    }
+
+    return ulDrained;
+}
+
+void Logpoints::Output(const char * const pText, const size_t ulLength)
+{
+    if (m_output.IsOpen())
+    {
+        (void)m_output.Write(pText, ulLength);
+    }
+    else
+    {
+        (void)fwrite(pText, sizeof(char), ulLength, stderr);
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include "BinaryWriter.h"
+#include "BreakpointCondition.h"
+#include "StackUnwinder.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Breakpoints that write a message and resume without stopping. A template such as
+//"rcx={rcx} arg={dword[rdx]:d} depth={depth}" is compiled once: every {} holds a condition expression, or tid or
+//depth, with an optional :x, :d or :u format. Hits are formatted on the debugger thread straight into a
+//single-producer ring and a writer thread drains it to stderr or a file. When the ring is full the message is counted
+//as dropped and the writer reports the count in the output, so nothing goes missing without a trace.
+class Logpoints final
+{
+public:
+    Logpoints() = delete;
+    Logpoints(Debugger *pDebugger);
+
+    Logpoints(const Logpoints &copy) = delete;
+    Logpoints &operator=(const Logpoints &copy) = delete;
+
+    ~Logpoints();
+
+    //Places a breakpoint at the address unless there already is one
+    const bool Add(const DWORD_PTR dwAddress, const char * const pTemplate);
+    const bool Remove(const DWORD_PTR dwAddress);
+
+    //A null path goes back to stderr
+    const bool SetOutput(const char * const pPath);
+
+    //True when the hit was logged and the thread resumed
+    const bool HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+    void RemoveModule(const DWORD_PTR dwModuleBase);
+
+    void PrintLogpoints() const;
+    void PrintStats() const;
+
+    static const size_t ulRingSlots = 16 * 1024;
+    static const size_t ulMaxMessage = 232;
+    static const size_t ulMaxDepth = 256;
+
+private:
+    enum class eField
+    {
+        eText,
+        eValue,
+        eThread,
+        eDepth
+    };
+
+    //A value field points at its compiled expression, which the logpoint owns
+    struct TemplatePart
+    {
+        eField field;
+        char cFormat;
+        std::string strText;
+        const BreakpointCondition *pValue;
+    };
+
+    //Moved by hand since the v120 toolset does not generate move operations, and the owned conditions cannot be copied
+    struct Logpoint
+    {
+        Logpoint();
+        Logpoint(Logpoint &&other);
+        Logpoint &operator=(Logpoint &&other);
+
+        Logpoint(const Logpoint &copy) = delete;
+        Logpoint &operator=(const Logpoint &copy) = delete;
+
+        std::string strTemplate;
+        std::vector<TemplatePart> vecParts;
+        std::vector<std::unique_ptr<BreakpointCondition>> vecValues;
+        DWORD dwContextFlags;
+        bool bOwnsBreakpoint;
+        ULONGLONG ullHits;
+        ULONGLONG ullDropped;
+        LONGLONG llFirstHit;
+        LONGLONG llLastHit;
+    };
+
+    //One slot of the ring; the message is formatted in place so a hit never allocates
+    struct LogRecord
+    {
+        LONGLONG llTime;
+        DWORD_PTR dwAddress;
+        DWORD dwThreadId;
+        unsigned int uiLength;
+        char strMessage[ulMaxMessage];
+    };
+
+    struct Stats
+    {
+        unsigned long long ullHits;
+        unsigned long long ullErrors;
+        unsigned long long ullPeakQueued;
+        double dHandlerMicroseconds;
+    };
+
+    const bool Compile(const char * const pTemplate, Logpoint &logpoint) const;
+    const size_t Format(const Logpoint &logpoint, const DWORD dwThreadId, const CONTEXT &ctx, char * const pBuffer);
+    void Run();
+    const size_t Drain();
+    void Output(const char * const pText, const size_t ulLength);
+
+    Debugger * const m_pDebugger;
+    StackUnwinder m_unwinder;
+    std::vector<StackFrame> m_vecFrames;
+
+    //Guards the logpoints and rearms; the console edits them while hits arrive on the debugger thread
+    mutable std::mutex m_mutex;
+    std::map<DWORD_PTR, Logpoint> m_mapLogpoints;
+    std::map<DWORD, DWORD_PTR> m_mapRearms;
+
+    //The debugger thread only moves the head and the writer only moves the tail
+    std::unique_ptr<LogRecord[]> m_pRing;
+    std::atomic<size_t> m_ulHead;
+    std::atomic<size_t> m_ulTail;
+    std::atomic<ULONGLONG> m_ullDropped;
+    std::atomic<ULONGLONG> m_ullWritten;
+    ULONGLONG m_ullReportedDropped;
+
+    std::thread m_writer;
+    std::atomic<bool> m_bIsRunning;
+
+    //Guards the output, which the console may switch while the writer drains
+    std::mutex m_outputMutex;
+    BinaryWriter m_output;
+    LONGLONG m_llStart;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
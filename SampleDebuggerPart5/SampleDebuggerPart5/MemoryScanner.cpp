@@ -0,0 +1,616 @@
+#include "MemoryScanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "Common.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulChunkSize = 1024 * 1024;
+const size_t ulBlockSize = 64 * 1024;
+
+const bool IsReadable(const DWORD dwProtect)
+{
+    const DWORD dwReadable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY |
+        PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    return BOOLIFY(dwProtect & dwReadable) && !BOOLIFY(dwProtect & PAGE_GUARD);
+}
+
+//Rough rank of how rarely a byte shows up in code and data. Anchoring on rare bytes keeps the candidate rate low.
+const int ByteRarity(const unsigned char cByte)
+{
+    switch (cByte)
+    {
+    case 0x00:
+        return 0;
+    case 0xFF:
+    case 0xCC:
+        return 1;
+    case 0x90:
+    case 0x48:
+    case 0x8B:
+    case 0x89:
+    case 0x01:
+    case 0x20:
+        return 2;
+    default:
+        return ((cByte >= 'a' && cByte <= 'z') || (cByte >= 'A' && cByte <= 'Z')) ? 3 : 4;
+    }
+}
+
+inline const unsigned int LowestSetBit(const unsigned int uiMask)
+{
+    unsigned long ulIndex = 0;
+    (void)_BitScanForward(&ulIndex, uiMask);
+    return (unsigned int)ulIndex;
+}
+
+}
+
+MemoryScanner::MemoryScanner(const HANDLE hProcess) : m_hProcess{ hProcess }, m_engine{ DetectEngine() },
+    m_dwPageSize{ 0x1000 }, m_uiNextPatternId{ 1 }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+}
+
+const unsigned int MemoryScanner::AddBytePattern(const char * const pPattern)
+{
+    std::vector<unsigned char> vecBytes;
+    std::vector<unsigned char> vecMask;
+
+    const char *pCurrent = pPattern;
+    while (*pCurrent != '\0')
+    {
+        if (*pCurrent == ' ')
+        {
+            ++pCurrent;
+        }
+        else if (*pCurrent == '?')
+        {
+            vecBytes.push_back(0);
+            vecMask.push_back(0);
+            pCurrent += (pCurrent[1] == '?') ? 2 : 1;
+        }
+        else
+        {
+            char *pEnd = nullptr;
+            const char strByte[3] = { pCurrent[0], pCurrent[1] == ' ' ? '\0' : pCurrent[1], '\0' };
+            const unsigned long ulByte = strtoul(strByte, &pEnd, 16);
+            if (pEnd == strByte)
+            {
+                fprintf(stderr, "Invalid byte pattern at \"%s\".\n", pCurrent);
+                return 0;
+            }
+            vecBytes.push_back((unsigned char)ulByte);
+            vecMask.push_back(0xFF);
+            pCurrent += (pEnd - strByte);
+        }
+    }
+
+    return AddPattern(std::move(vecBytes), std::move(vecMask), 1);
+}
+
+const unsigned int MemoryScanner::AddStringPattern(const char * const pString, const bool bIsWide)
+{
+    std::vector<unsigned char> vecBytes;
+    for (const char *pCurrent = pString; *pCurrent != '\0'; ++pCurrent)
+    {
+        vecBytes.push_back((unsigned char)*pCurrent);
+        if (bIsWide)
+        {
+            vecBytes.push_back(0);
+        }
+    }
+
+    std::vector<unsigned char> vecMask(vecBytes.size(), 0xFF);
+    return AddPattern(std::move(vecBytes), std::move(vecMask), bIsWide ? sizeof(wchar_t) : 1);
+}
+
+const unsigned int MemoryScanner::AddPointerPattern(const DWORD_PTR dwValue)
+{
+    std::vector<unsigned char> vecBytes((const unsigned char *)&dwValue, (const unsigned char *)&dwValue + sizeof(DWORD_PTR));
+    std::vector<unsigned char> vecMask(vecBytes.size(), 0xFF);
+    return AddPattern(std::move(vecBytes), std::move(vecMask), sizeof(DWORD_PTR));
+}
+
+const unsigned int MemoryScanner::AddPattern(std::vector<unsigned char> &&vecBytes, std::vector<unsigned char> &&vecMask,
+    const size_t ulAlignment)
+{
+    Pattern pattern;
+    pattern.ulFirstAnchor = vecBytes.size();
+    pattern.ulSecondAnchor = vecBytes.size();
+    for (size_t i = 0; i < vecBytes.size(); ++i)
+    {
+        if (vecMask[i] == 0)
+        {
+            continue;
+        }
+        if (pattern.ulFirstAnchor == vecBytes.size() || ByteRarity(vecBytes[i]) > ByteRarity(vecBytes[pattern.ulFirstAnchor]))
+        {
+            pattern.ulFirstAnchor = i;
+        }
+    }
+    if (pattern.ulFirstAnchor == vecBytes.size())
+    {
+        fprintf(stderr, "Pattern must contain at least one non-wildcard byte.\n");
+        return 0;
+    }
+
+    //Prefer a second anchor far away from the first so the two compares are as independent as possible
+    pattern.ulSecondAnchor = pattern.ulFirstAnchor;
+    for (size_t i = 0; i < vecBytes.size(); ++i)
+    {
+        if (vecMask[i] == 0 || i == pattern.ulFirstAnchor)
+        {
+            continue;
+        }
+        const int iRarity = ByteRarity(vecBytes[i]);
+        const int iBestRarity = ByteRarity(vecBytes[pattern.ulSecondAnchor]);
+        if (pattern.ulSecondAnchor == pattern.ulFirstAnchor || iRarity > iBestRarity ||
+            (iRarity == iBestRarity && i > pattern.ulSecondAnchor))
+        {
+            pattern.ulSecondAnchor = i;
+        }
+    }
+
+    pattern.uiId = m_uiNextPatternId++;
+    pattern.vecBytes = std::move(vecBytes);
+    pattern.vecMask = std::move(vecMask);
+    pattern.ulAlignment = ulAlignment;
+    m_vecPatterns.emplace_back(std::move(pattern));
+
+    return m_vecPatterns.back().uiId;
+}
+
+void MemoryScanner::ClearPatterns()
+{
+    m_vecPatterns.clear();
+}
+
+const size_t MemoryScanner::PatternCount() const
+{
+    return m_vecPatterns.size();
+}
+
+const MemoryScanner::eEngine MemoryScanner::Engine() const
+{
+    return m_engine;
+}
+
+void MemoryScanner::SetEngine(const eEngine engine)
+{
+    m_engine = std::min(engine, DetectEngine());
+}
+
+const MemoryScanner::eEngine MemoryScanner::DetectEngine()
+{
+    int iCpuInfo[4] = { 0 };
+    __cpuid(iCpuInfo, 0);
+    const int iMaxLeaf = iCpuInfo[0];
+
+    __cpuid(iCpuInfo, 1);
+    const bool bHasSse2 = BOOLIFY(iCpuInfo[3] & (1 << 26));
+    const bool bHasOsxsave = BOOLIFY(iCpuInfo[2] & (1 << 27));
+    const bool bHasAvx = BOOLIFY(iCpuInfo[2] & (1 << 28));
+
+    bool bHasAvx2 = false;
+    if (iMaxLeaf >= 7 && bHasOsxsave && bHasAvx)
+    {
+        //The OS must also save the upper halves of the YMM registers across context switches
+        const bool bYmmEnabled = ((_xgetbv(0) & 0x6) == 0x6);
+        __cpuidex(iCpuInfo, 7, 0);
+        bHasAvx2 = bYmmEnabled && BOOLIFY(iCpuInfo[1] & (1 << 5));
+    }
+
+    if (bHasAvx2)
+    {
+        return eEngine::eAvx2;
+    }
+
+    return bHasSse2 ? eEngine::eSse2 : eEngine::eScalar;
+}
+
+const std::vector<MemoryRegion> MemoryScanner::EnumerateRegions(const HANDLE hProcess, const bool bWritableOnly /*= false*/)
+{
+    std::vector<MemoryRegion> vecRegions;
+
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+
+    DWORD_PTR dwAddress = (DWORD_PTR)sysInfo.lpMinimumApplicationAddress;
+    const DWORD_PTR dwMaxAddress = (DWORD_PTR)sysInfo.lpMaximumApplicationAddress;
+    while (dwAddress < dwMaxAddress)
+    {
+        MEMORY_BASIC_INFORMATION memInfo = { 0 };
+        if (VirtualQueryEx(hProcess, (LPCVOID)dwAddress, &memInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0)
+        {
+            break;
+        }
+
+        if (memInfo.State == MEM_COMMIT && IsReadable(memInfo.Protect) &&
+            (!bWritableOnly || IsWritable(memInfo.Protect)))
+        {
+            MemoryRegion region = { (DWORD_PTR)memInfo.BaseAddress, memInfo.RegionSize, memInfo.Protect, memInfo.Type };
+            vecRegions.push_back(region);
+        }
+
+        dwAddress = (DWORD_PTR)memInfo.BaseAddress + memInfo.RegionSize;
+    }
+
+    return vecRegions;
+}
+
+const bool MemoryScanner::Matches(const Pattern &pattern, const unsigned char * const pData)
+{
+    const size_t ulLength = pattern.vecBytes.size();
+    for (size_t i = 0; i < ulLength; ++i)
+    {
+        if ((pData[i] & pattern.vecMask[i]) != pattern.vecBytes[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MemoryScanner::ScanBlock(const Pattern &pattern, const unsigned char * const pBuffer, const size_t ulSize,
+    const size_t ulReportLimit, const DWORD_PTR dwBaseAddress, std::vector<ScanResult> &vecResults) const
+{
+    const size_t ulLength = pattern.vecBytes.size();
+    if (ulSize < ulLength || ulReportLimit == 0)
+    {
+        return;
+    }
+
+    //Every candidate position up to and including ulLastStart can be verified without reading past the buffer
+    const size_t ulLastStart = std::min(ulSize - ulLength, ulReportLimit - 1);
+    const size_t ulFirstAnchor = pattern.ulFirstAnchor;
+    const size_t ulSecondAnchor = pattern.ulSecondAnchor;
+    const unsigned char cFirst = pattern.vecBytes[ulFirstAnchor];
+    const unsigned char cSecond = pattern.vecBytes[ulSecondAnchor];
+
+    auto Verify = [&](const size_t ulOffset)
+    {
+        const DWORD_PTR dwAddress = dwBaseAddress + ulOffset;
+        if ((dwAddress % pattern.ulAlignment) == 0 && Matches(pattern, &pBuffer[ulOffset]))
+        {
+            ScanResult result = { dwAddress, pattern.uiId };
+            vecResults.push_back(result);
+        }
+    };
+
+    size_t i = 0;
+    if (m_engine == eEngine::eAvx2)
+    {
+        const __m256i first = _mm256_set1_epi8((char)cFirst);
+        const __m256i second = _mm256_set1_epi8((char)cSecond);
+        for (; i + 31 <= ulLastStart; i += 32)
+        {
+            const __m256i firstBlock = _mm256_loadu_si256((const __m256i *)&pBuffer[i + ulFirstAnchor]);
+            const __m256i secondBlock = _mm256_loadu_si256((const __m256i *)&pBuffer[i + ulSecondAnchor]);
+            unsigned int uiMask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(firstBlock, first), _mm256_cmpeq_epi8(secondBlock, second)));
+            while (uiMask != 0)
+            {
+                Verify(i + LowestSetBit(uiMask));
+                uiMask &= (uiMask - 1);
+            }
+        }
+    }
+    else if (m_engine == eEngine::eSse2)
+    {
+        const __m128i first = _mm_set1_epi8((char)cFirst);
+        const __m128i second = _mm_set1_epi8((char)cSecond);
+        for (; i + 15 <= ulLastStart; i += 16)
+        {
+            const __m128i firstBlock = _mm_loadu_si128((const __m128i *)&pBuffer[i + ulFirstAnchor]);
+            const __m128i secondBlock = _mm_loadu_si128((const __m128i *)&pBuffer[i + ulSecondAnchor]);
+            unsigned int uiMask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(firstBlock, first), _mm_cmpeq_epi8(secondBlock, second)));
+            while (uiMask != 0)
+            {
+                Verify(i + LowestSetBit(uiMask));
+                uiMask &= (uiMask - 1);
+            }
+        }
+    }
+
+    //Scalar fallback, also used for the tail that does not fill a full vector
+    while (i <= ulLastStart)
+    {
+        const unsigned char *pFound = (const unsigned char *)memchr(&pBuffer[i + ulFirstAnchor], cFirst, ulLastStart - i + 1);
+        if (pFound == nullptr)
+        {
+            break;
+        }
+        i = (size_t)(pFound - pBuffer) - ulFirstAnchor;
+        if (pBuffer[i + ulSecondAnchor] == cSecond)
+        {
+            Verify(i);
+        }
+        ++i;
+    }
+}
+
+const size_t MemoryScanner::ScanBuffer(const unsigned char * const pBuffer, const size_t ulSize, const DWORD_PTR dwBaseAddress,
+    const ResultCallback &callback) const
+{
+    std::vector<ScanResult> vecResults;
+    const size_t ulOverlap = MaxPatternLength() - 1;
+
+    //Run every pattern over one cache-sized block before moving on to the next
+    for (size_t ulOffset = 0; ulOffset < ulSize; ulOffset += ulBlockSize)
+    {
+        const size_t ulReportLimit = std::min(ulBlockSize, ulSize - ulOffset);
+        const size_t ulBlockLength = std::min(ulBlockSize + ulOverlap, ulSize - ulOffset);
+        for (auto &pattern : m_vecPatterns)
+        {
+            ScanBlock(pattern, &pBuffer[ulOffset], ulBlockLength, ulReportLimit, dwBaseAddress + ulOffset, vecResults);
+        }
+    }
+
+    if (callback)
+    {
+        for (auto &result : vecResults)
+        {
+            callback(result);
+        }
+    }
+
+    return vecResults.size();
+}
+
+const size_t MemoryScanner::ReadChunk(const Chunk &chunk, unsigned char * const pBuffer,
+    std::vector<std::pair<size_t, size_t>> &vecValidRanges) const
+{
+    vecValidRanges.clear();
+
+    SIZE_T ulBytesRead = 0;
+    if (BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)chunk.dwAddress, pBuffer, chunk.ulReadSize, &ulBytesRead)) &&
+        ulBytesRead == chunk.ulReadSize)
+    {
+        vecValidRanges.push_back(std::make_pair((size_t)0, (size_t)chunk.ulReadSize));
+        return chunk.ulReadSize;
+    }
+
+    //Some page in the chunk went away or became inaccessible. Salvage what can still be read, a page at a time.
+    size_t ulTotalRead = 0;
+    for (size_t ulOffset = 0; ulOffset < chunk.ulReadSize; ulOffset += m_dwPageSize)
+    {
+        const size_t ulPageSize = std::min((size_t)m_dwPageSize, (size_t)(chunk.ulReadSize - ulOffset));
+        if (BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(chunk.dwAddress + ulOffset), &pBuffer[ulOffset], ulPageSize, &ulBytesRead)) &&
+            ulBytesRead == ulPageSize)
+        {
+            if (!vecValidRanges.empty() && vecValidRanges.back().first + vecValidRanges.back().second == ulOffset)
+            {
+                vecValidRanges.back().second += ulPageSize;
+            }
+            else
+            {
+                vecValidRanges.push_back(std::make_pair(ulOffset, ulPageSize));
+            }
+            ulTotalRead += ulPageSize;
+        }
+    }
+
+    return ulTotalRead;
+}
+
+const size_t MemoryScanner::MaxPatternLength() const
+{
+    size_t ulMaxLength = 1;
+    for (auto &pattern : m_vecPatterns)
+    {
+        ulMaxLength = std::max(ulMaxLength, pattern.vecBytes.size());
+    }
+
+    return ulMaxLength;
+}
+
+const size_t MemoryScanner::Scan(const ResultCallback &callback, unsigned int uiThreadCount /*= 0*/)
+{
+    if (m_vecPatterns.empty())
+    {
+        fprintf(stderr, "No scan patterns have been added.\n");
+        return 0;
+    }
+
+    Stopwatch stopwatch;
+
+    //Adjacent regions are merged so that matches can cross region boundaries and reads stay large
+    std::vector<MemoryRegion> vecRegions = EnumerateRegions(m_hProcess);
+    std::vector<std::pair<DWORD_PTR, SIZE_T>> vecRuns;
+    for (auto &region : vecRegions)
+    {
+        if (!vecRuns.empty() && vecRuns.back().first + vecRuns.back().second == region.dwBaseAddress)
+        {
+            vecRuns.back().second += region.ulSize;
+        }
+        else
+        {
+            vecRuns.push_back(std::make_pair(region.dwBaseAddress, region.ulSize));
+        }
+    }
+
+    const size_t ulOverlap = MaxPatternLength() - 1;
+    std::vector<Chunk> vecChunks;
+    for (auto &run : vecRuns)
+    {
+        for (SIZE_T ulOffset = 0; ulOffset < run.second; ulOffset += ulChunkSize)
+        {
+            Chunk chunk = { run.first + ulOffset, std::min((SIZE_T)ulChunkSize, run.second - ulOffset), 0 };
+            chunk.ulReadSize = std::min((SIZE_T)(chunk.ulSize + ulOverlap), run.second - ulOffset);
+            vecChunks.push_back(chunk);
+        }
+    }
+
+    if (uiThreadCount == 0)
+    {
+        uiThreadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    uiThreadCount = (unsigned int)std::max((size_t)1, std::min((size_t)uiThreadCount, vecChunks.size()));
+
+    std::atomic<size_t> ulNextChunk(0);
+    std::atomic<unsigned long long> ullBytesScanned(0);
+    std::mutex resultsMutex;
+    size_t ulResultCount = 0;
+
+    auto Worker = [&]()
+    {
+        std::unique_ptr<unsigned char[]> pBuffer(new unsigned char[ulChunkSize + ulOverlap]);
+        std::vector<std::pair<size_t, size_t>> vecValidRanges;
+        std::vector<ScanResult> vecResults;
+
+        for (size_t ulIndex = ulNextChunk++; ulIndex < vecChunks.size(); ulIndex = ulNextChunk++)
+        {
+            const Chunk &chunk = vecChunks[ulIndex];
+            ullBytesScanned += ReadChunk(chunk, pBuffer.get(), vecValidRanges);
+
+            vecResults.clear();
+            for (auto &range : vecValidRanges)
+            {
+                const size_t ulReportEnd = std::min((size_t)chunk.ulSize, range.first + range.second);
+                for (size_t ulOffset = range.first; ulOffset < ulReportEnd; ulOffset += ulBlockSize)
+                {
+                    const size_t ulReportLimit = std::min(ulBlockSize, ulReportEnd - ulOffset);
+                    const size_t ulBlockLength = std::min(ulBlockSize + ulOverlap, range.first + range.second - ulOffset);
+                    for (auto &pattern : m_vecPatterns)
+                    {
+                        ScanBlock(pattern, &pBuffer[ulOffset], ulBlockLength, ulReportLimit, chunk.dwAddress + ulOffset, vecResults);
+                    }
+                }
+            }
+
+            if (!vecResults.empty())
+            {
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                ulResultCount += vecResults.size();
+                if (callback)
+                {
+                    for (auto &result : vecResults)
+                    {
+                        callback(result);
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> vecWorkers;
+    for (unsigned int i = 1; i < uiThreadCount; ++i)
+    {
+        vecWorkers.emplace_back(std::thread(Worker));
+    }
+    Worker();
+    for (auto &worker : vecWorkers)
+    {
+        worker.join();
+    }
+
+    const double dElapsed = stopwatch.ElapsedSeconds();
+    const double dGigabytes = (double)ullBytesScanned.load() / (1024.0 * 1024.0 * 1024.0);
+    fprintf(stderr, "Scanned %.2f MB in %X regions with %X threads in %.3f s (%.2f GB/s). Matches: %X\n",
+        dGigabytes * 1024.0, (DWORD)vecRegions.size(), uiThreadCount, dElapsed,
+        dElapsed > 0.0 ? dGigabytes / dElapsed : 0.0, (DWORD)ulResultCount);
+
+    return ulResultCount;
+}
+
+void MemoryScanner::Benchmark(const size_t ulTotalBytes, unsigned int uiThreadCount /*= 0*/)
+{
+    //A buffer well past the size of the last level cache, walked repeatedly to stand in for a multi-GB target
+    const size_t ulBufferSize = 256 * 1024 * 1024;
+    const size_t ulPlantInterval = 1024 * 1024;
+    std::unique_ptr<unsigned char[]> pBuffer(new unsigned char[ulBufferSize]);
+
+    unsigned int uiSeed = 0x12345678;
+    for (size_t i = 0; i < ulBufferSize; i += sizeof(unsigned int))
+    {
+        uiSeed ^= uiSeed << 13;
+        uiSeed ^= uiSeed >> 17;
+        uiSeed ^= uiSeed << 5;
+        memcpy(&pBuffer[i], &uiSeed, sizeof(unsigned int));
+    }
+
+    const unsigned char signature[] = { 0x48, 0x8B, 0x05, 0x11, 0x22, 0x33, 0x44, 0x48, 0x85, 0xC0 };
+    const char strMarker[] = "CodeReversing";
+    size_t ulPlanted = 0;
+    for (size_t i = ulPlantInterval; i + 64 < ulBufferSize; i += ulPlantInterval)
+    {
+        memcpy(&pBuffer[i], signature, sizeof(signature));
+        memcpy(&pBuffer[i + 32], strMarker, sizeof(strMarker) - 1);
+        ulPlanted += 2;
+    }
+
+    MemoryScanner scanner(nullptr);
+    (void)scanner.AddBytePattern("48 8B 05 ?? ?? ?? ?? 48 85 C0");
+    (void)scanner.AddStringPattern(strMarker, false);
+    (void)scanner.AddPointerPattern((DWORD_PTR)0xDEADBEEF);
+
+    if (uiThreadCount == 0)
+    {
+        uiThreadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const size_t ulPasses = std::max((size_t)1, ulTotalBytes / ulBufferSize);
+    const char *pEngineNames[] = { "scalar", "SSE2", "AVX2" };
+    for (int iEngine = (int)eEngine::eScalar; iEngine <= (int)DetectEngine(); ++iEngine)
+    {
+        scanner.SetEngine((eEngine)iEngine);
+
+        //Each pass is split into slices so that every thread streams a different part of the buffer
+        const size_t ulSlices = ulPasses * uiThreadCount;
+        const size_t ulSliceSize = (ulBufferSize / uiThreadCount) & ~(ulPlantInterval - 1);
+        std::atomic<size_t> ulNextSlice(0);
+        std::atomic<size_t> ulMatches(0);
+
+        Stopwatch stopwatch;
+        std::vector<std::thread> vecWorkers;
+        for (unsigned int i = 0; i < uiThreadCount; ++i)
+        {
+            vecWorkers.emplace_back(std::thread([&]()
+            {
+                for (size_t ulSlice = ulNextSlice++; ulSlice < ulSlices; ulSlice = ulNextSlice++)
+                {
+                    const size_t ulIndex = ulSlice % uiThreadCount;
+                    const size_t ulOffset = ulIndex * ulSliceSize;
+                    const size_t ulSize = (ulIndex == uiThreadCount - 1) ? ulBufferSize - ulOffset : ulSliceSize;
+                    ulMatches += scanner.ScanBuffer(&pBuffer[ulOffset], ulSize, (DWORD_PTR)ulOffset, nullptr);
+                }
+            }));
+        }
+        for (auto &worker : vecWorkers)
+        {
+            worker.join();
+        }
+
+        const double dElapsed = stopwatch.ElapsedSeconds();
+        const double dGigabytes = (double)(ulPasses * ulBufferSize) / (1024.0 * 1024.0 * 1024.0);
+        fprintf(stderr, "Engine %s: %.2f GB with %X threads in %.3f s (%.2f GB/s). Matches per pass: %X (expected %X)\n",
+            pEngineNames[iEngine], dGigabytes, uiThreadCount, dElapsed, dElapsed > 0.0 ? dGigabytes / dElapsed : 0.0,
+            (DWORD)(ulMatches.load() / ulPasses), (DWORD)ulPlanted);
+    }
+}
+
+}
\ No newline at end of file
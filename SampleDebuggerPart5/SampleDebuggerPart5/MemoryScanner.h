@@ -0,0 +1,98 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+struct MemoryRegion
+{
+    DWORD_PTR dwBaseAddress;
+    SIZE_T ulSize;
+    DWORD dwProtect;
+    DWORD dwType;
+};
+
+struct ScanResult
+{
+    DWORD_PTR dwAddress;
+    unsigned int uiPatternId;
+};
+
+class MemoryScanner final
+{
+public:
+    enum class eEngine
+    {
+        eScalar = 0,
+        eSse2 = 1,
+        eAvx2 = 2
+    };
+
+    typedef std::function<void(const ScanResult &result)> ResultCallback;
+
+    MemoryScanner() = delete;
+    MemoryScanner(const HANDLE hProcess);
+
+    MemoryScanner(const MemoryScanner &copy) = delete;
+    MemoryScanner &operator=(const MemoryScanner &copy) = delete;
+
+    ~MemoryScanner() = default;
+
+    const unsigned int AddBytePattern(const char * const pPattern);
+    const unsigned int AddStringPattern(const char * const pString, const bool bIsWide);
+    const unsigned int AddPointerPattern(const DWORD_PTR dwValue);
+    void ClearPatterns();
+    const size_t PatternCount() const;
+
+    const size_t Scan(const ResultCallback &callback, unsigned int uiThreadCount = 0);
+    const size_t ScanBuffer(const unsigned char * const pBuffer, const size_t ulSize, const DWORD_PTR dwBaseAddress,
+        const ResultCallback &callback) const;
+
+    const eEngine Engine() const;
+    void SetEngine(const eEngine engine);
+
+    static const std::vector<MemoryRegion> EnumerateRegions(const HANDLE hProcess, const bool bWritableOnly = false);
+    static const eEngine DetectEngine();
+
+    static void Benchmark(const size_t ulTotalBytes, unsigned int uiThreadCount = 0);
+
+private:
+    struct Pattern
+    {
+        unsigned int uiId;
+        std::vector<unsigned char> vecBytes;
+        std::vector<unsigned char> vecMask;
+        size_t ulFirstAnchor;
+        size_t ulSecondAnchor;
+        size_t ulAlignment;
+    };
+
+    struct Chunk
+    {
+        DWORD_PTR dwAddress;
+        SIZE_T ulSize;
+        SIZE_T ulReadSize;
+    };
+
+    const unsigned int AddPattern(std::vector<unsigned char> &&vecBytes, std::vector<unsigned char> &&vecMask,
+        const size_t ulAlignment);
+    void ScanBlock(const Pattern &pattern, const unsigned char * const pBuffer, const size_t ulSize,
+        const size_t ulReportLimit, const DWORD_PTR dwBaseAddress, std::vector<ScanResult> &vecResults) const;
+    const size_t ReadChunk(const Chunk &chunk, unsigned char * const pBuffer,
+        std::vector<std::pair<size_t, size_t>> &vecValidRanges) const;
+    const size_t MaxPatternLength() const;
+
+    static const bool Matches(const Pattern &pattern, const unsigned char * const pData);
+
+    HANDLE m_hProcess;
+    eEngine m_engine;
+    DWORD m_dwPageSize;
+    unsigned int m_uiNextPatternId;
+    std::vector<Pattern> m_vecPatterns;
+};
+
+}
\ No newline at end of file
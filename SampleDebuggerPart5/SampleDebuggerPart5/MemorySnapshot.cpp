@@ -0,0 +1,375 @@
+#include "MemorySnapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "BinaryWriter.h"
+#include "Common.h"
+#include "Debugger.h"
+#include "MemoryScanner.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulMaxRunSize = 1024 * 1024;
+const size_t ulMergeGap = 8;
+const DWORD dwDiffMagic = 0x46464944; //"DIFF"
+const DWORD dwDiffVersion = 1;
+
+struct CaptureRun
+{
+    DWORD_PTR dwAddress;
+    size_t ulSize;
+};
+
+const bool WriteRanges(BinaryWriter &writer, const std::vector<MemoryRange> &vecRanges)
+{
+    //Addresses are stored as the distance from the end of the previous range
+    DWORD_PTR dwPreviousEnd = 0;
+    bool bSuccess = writer.WriteVarint(vecRanges.size());
+    for (auto &range : vecRanges)
+    {
+        bSuccess = bSuccess && writer.WriteVarint(range.dwAddress - dwPreviousEnd);
+        bSuccess = bSuccess && writer.WriteVarint(range.dwSize);
+        dwPreviousEnd = range.dwAddress + range.dwSize;
+    }
+
+    return bSuccess;
+}
+
+}
+
+MemorySnapshot::MemorySnapshot(Debugger *pDebugger, const size_t ulContentBudget /*= 256 * 1024 * 1024*/)
+    : m_pDebugger{ pDebugger }, m_dwPageSize{ 0x1000 }, m_ulContentBudget{ ulContentBudget }, m_bHasSnapshot{ false }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+}
+
+const ULONGLONG MemorySnapshot::HashPage(const unsigned char * const pPage, const size_t ulSize)
+{
+    //Four independent lanes over 64-bit words, folded at the end. Pages are always a multiple of 32 bytes.
+    const ULONGLONG ullMultiplier = 0x9E3779B97F4A7C15ULL;
+    ULONGLONG ullLanes[4] = { 0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL };
+    for (size_t ulOffset = 0; ulOffset < ulSize; ulOffset += 4 * sizeof(ULONGLONG))
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            ULONGLONG ullWord = 0;
+            memcpy(&ullWord, &pPage[ulOffset + i * sizeof(ULONGLONG)], sizeof(ULONGLONG));
+            ullLanes[i] = (ullLanes[i] ^ ullWord) * ullMultiplier;
+            ullLanes[i] ^= (ullLanes[i] >> 29);
+        }
+    }
+
+    ULONGLONG ullHash = ulSize;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        ullHash = (ullHash ^ ullLanes[i]) * ullMultiplier;
+        ullHash ^= (ullHash >> 32);
+    }
+
+    return ullHash;
+}
+
+void MemorySnapshot::AppendRange(std::vector<MemoryRange> &vecRanges, const DWORD_PTR dwAddress, const DWORD dwSize)
+{
+    if (!vecRanges.empty() && vecRanges.back().dwAddress + vecRanges.back().dwSize == dwAddress)
+    {
+        vecRanges.back().dwSize += dwSize;
+        return;
+    }
+
+    MemoryRange range = { dwAddress, dwSize };
+    vecRanges.push_back(range);
+}
+
+const bool MemorySnapshot::CapturePages(Capture &capture, const unsigned int uiThreadCount) const
+{
+    std::vector<CaptureRun> vecRuns;
+    for (auto &region : MemoryScanner::EnumerateRegions(m_pDebugger->Handle(), true))
+    {
+        for (SIZE_T ulOffset = 0; ulOffset < region.ulSize; ulOffset += ulMaxRunSize)
+        {
+            CaptureRun run = { region.dwBaseAddress + ulOffset, (size_t)std::min((SIZE_T)ulMaxRunSize, region.ulSize - ulOffset) };
+            vecRuns.push_back(run);
+        }
+    }
+
+    if (vecRuns.empty())
+    {
+        fprintf(stderr, "Could not find any writable memory in the process.\n");
+        return false;
+    }
+
+    std::vector<std::vector<PageRecord>> vecRunPages(vecRuns.size());
+    std::vector<std::unique_ptr<unsigned char[]>> vecRunBuffers(vecRuns.size());
+    std::atomic<size_t> ulNextRun(0);
+    std::atomic<size_t> ulContentUsed(0);
+    auto Worker = [&]()
+    {
+        std::unique_ptr<unsigned char[]> pBuffer;
+        for (size_t ulIndex = ulNextRun++; ulIndex < vecRuns.size(); ulIndex = ulNextRun++)
+        {
+            const CaptureRun &run = vecRuns[ulIndex];
+            if (!pBuffer)
+            {
+                pBuffer.reset(new unsigned char[ulMaxRunSize]);
+            }
+
+            SIZE_T ulBytesRead = 0;
+            const bool bReadAll = BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)run.dwAddress,
+                pBuffer.get(), run.ulSize, &ulBytesRead)) && (ulBytesRead == run.ulSize);
+
+            //Keep the bytes while under budget so that diffs can be narrowed down to the exact bytes that changed
+            const bool bKeepContents = (ulContentUsed.fetch_add(run.ulSize) + run.ulSize <= m_ulContentBudget);
+            std::vector<PageRecord> &vecPages = vecRunPages[ulIndex];
+            for (size_t ulOffset = 0; ulOffset < run.ulSize; ulOffset += m_dwPageSize)
+            {
+                const DWORD_PTR dwPage = run.dwAddress + ulOffset;
+                unsigned char *pPage = &pBuffer[ulOffset];
+                if (!bReadAll && !(BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwPage, pPage,
+                    m_dwPageSize, &ulBytesRead)) && ulBytesRead == m_dwPageSize))
+                {
+                    continue;
+                }
+
+                PageRecord record = { dwPage, HashPage(pPage, m_dwPageSize), bKeepContents ? pPage : nullptr };
+                vecPages.push_back(record);
+            }
+
+            if (bKeepContents && !vecPages.empty())
+            {
+                vecRunBuffers[ulIndex] = std::move(pBuffer);
+            }
+        }
+    };
+
+    std::vector<std::thread> vecWorkers;
+    unsigned int uiThreads = (uiThreadCount == 0) ? std::max(1u, std::thread::hardware_concurrency()) : uiThreadCount;
+    uiThreads = (unsigned int)std::min((size_t)uiThreads, vecRuns.size());
+    for (unsigned int i = 1; i < uiThreads; ++i)
+    {
+        vecWorkers.emplace_back(std::thread(Worker));
+    }
+    Worker();
+    for (auto &worker : vecWorkers)
+    {
+        worker.join();
+    }
+
+    //Regions come back from VirtualQueryEx in ascending order, so concatenating the runs keeps the pages sorted
+    capture.vecPages.clear();
+    capture.vecBuffers.clear();
+    for (size_t i = 0; i < vecRuns.size(); ++i)
+    {
+        capture.vecPages.insert(capture.vecPages.end(), vecRunPages[i].begin(), vecRunPages[i].end());
+        if (vecRunBuffers[i])
+        {
+            capture.vecBuffers.emplace_back(std::move(vecRunBuffers[i]));
+        }
+    }
+
+    return true;
+}
+
+const bool MemorySnapshot::HasSnapshot() const
+{
+    return m_bHasSnapshot;
+}
+
+const bool MemorySnapshot::Take(const unsigned int uiThreadCount /*= 0*/)
+{
+    Stopwatch stopwatch;
+    m_bHasSnapshot = CapturePages(m_capture, uiThreadCount);
+    if (m_bHasSnapshot)
+    {
+        fprintf(stderr, "Snapshot of %Iu pages (%Iu KB kept) taken in %.3f s.\n", m_capture.vecPages.size(),
+            m_capture.vecBuffers.size() * ulMaxRunSize / 1024, stopwatch.ElapsedSeconds());
+    }
+
+    return m_bHasSnapshot;
+}
+
+void MemorySnapshot::DiffPage(const PageRecord &previous, const PageRecord &current, MemoryDiff &diff) const
+{
+    diff.vecChangedPages.push_back(current.dwAddress);
+
+    if (previous.pContents == nullptr || current.pContents == nullptr)
+    {
+        const size_t ulDataOffset = diff.vecData.size();
+        diff.vecData.resize(ulDataOffset + m_dwPageSize);
+        SIZE_T ulBytesRead = 0;
+        if (current.pContents != nullptr)
+        {
+            memcpy(&diff.vecData[ulDataOffset], current.pContents, m_dwPageSize);
+        }
+        else if (!(BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)current.dwAddress, &diff.vecData[ulDataOffset],
+            m_dwPageSize, &ulBytesRead)) && ulBytesRead == m_dwPageSize))
+        {
+            memset(&diff.vecData[ulDataOffset], 0, m_dwPageSize);
+        }
+        AppendRange(diff.vecChangedRanges, current.dwAddress, m_dwPageSize);
+        return;
+    }
+
+    //Walk the page for differing bytes, folding ranges separated by short gaps into one
+    size_t ulOffset = 0;
+    while (ulOffset < m_dwPageSize)
+    {
+        if (previous.pContents[ulOffset] == current.pContents[ulOffset])
+        {
+            ++ulOffset;
+            continue;
+        }
+
+        const size_t ulStart = ulOffset;
+        size_t ulEnd = ulOffset + 1;
+        size_t ulScan = ulEnd;
+        while (ulScan < m_dwPageSize && ulScan - ulEnd < ulMergeGap)
+        {
+            if (previous.pContents[ulScan] != current.pContents[ulScan])
+            {
+                ulEnd = ulScan + 1;
+            }
+            ++ulScan;
+        }
+
+        diff.vecData.insert(diff.vecData.end(), &current.pContents[ulStart], &current.pContents[ulEnd]);
+        AppendRange(diff.vecChangedRanges, current.dwAddress + ulStart, (DWORD)(ulEnd - ulStart));
+        ulOffset = ulEnd;
+    }
+}
+
+const bool MemorySnapshot::Diff(MemoryDiff &diff, const unsigned int uiThreadCount /*= 0*/)
+{
+    if (!m_bHasSnapshot)
+    {
+        fprintf(stderr, "Take a snapshot before diffing.\n");
+        return false;
+    }
+
+    Stopwatch stopwatch;
+    Capture current;
+    if (!CapturePages(current, uiThreadCount))
+    {
+        return false;
+    }
+
+    diff.vecChangedPages.clear();
+    diff.vecChangedRanges.clear();
+    diff.vecAddedRanges.clear();
+    diff.vecRemovedRanges.clear();
+    diff.vecData.clear();
+    diff.ulPagesCompared = 0;
+    diff.dwPageSize = m_dwPageSize;
+
+    //Both page lists are sorted by address, so a single merge walk finds changed, added, and removed pages
+    const std::vector<PageRecord> &vecOld = m_capture.vecPages;
+    const std::vector<PageRecord> &vecNew = current.vecPages;
+    size_t ulOld = 0;
+    size_t ulNew = 0;
+    while (ulOld < vecOld.size() || ulNew < vecNew.size())
+    {
+        if (ulNew == vecNew.size() || (ulOld < vecOld.size() && vecOld[ulOld].dwAddress < vecNew[ulNew].dwAddress))
+        {
+            AppendRange(diff.vecRemovedRanges, vecOld[ulOld++].dwAddress, m_dwPageSize);
+        }
+        else if (ulOld == vecOld.size() || vecNew[ulNew].dwAddress < vecOld[ulOld].dwAddress)
+        {
+            AppendRange(diff.vecAddedRanges, vecNew[ulNew++].dwAddress, m_dwPageSize);
+        }
+        else
+        {
+            ++diff.ulPagesCompared;
+            if (vecOld[ulOld].ullHash != vecNew[ulNew].ullHash)
+            {
+                DiffPage(vecOld[ulOld], vecNew[ulNew], diff);
+            }
+            ++ulOld;
+            ++ulNew;
+        }
+    }
+
+    //The next diff is against this stop. Swapped rather than moved, since v120 generates no move assignment for Capture.
+    m_capture.vecPages.swap(current.vecPages);
+    m_capture.vecBuffers.swap(current.vecBuffers);
+
+    fprintf(stderr, "Compared %Iu pages in %.3f s: %Iu changed pages, %Iu changed ranges, %Iu added ranges, %Iu removed ranges.\n",
+        diff.ulPagesCompared, stopwatch.ElapsedSeconds(), diff.vecChangedPages.size(), diff.vecChangedRanges.size(),
+        diff.vecAddedRanges.size(), diff.vecRemovedRanges.size());
+
+    return true;
+}
+
+const bool MemoryDiff::Save(const char * const pPath) const
+{
+    BinaryWriter writer;
+    if (!writer.Open(pPath))
+    {
+        return false;
+    }
+
+    bool bSuccess = writer.WriteValue(dwDiffMagic);
+    bSuccess = bSuccess && writer.WriteValue(dwDiffVersion);
+    bSuccess = bSuccess && writer.WriteValue(dwPageSize);
+    bSuccess = bSuccess && writer.WriteVarint(ulPagesCompared);
+    bSuccess = bSuccess && WriteRanges(writer, vecChangedRanges);
+    bSuccess = bSuccess && WriteRanges(writer, vecAddedRanges);
+    bSuccess = bSuccess && WriteRanges(writer, vecRemovedRanges);
+    bSuccess = bSuccess && writer.WriteVarint(vecData.size());
+    bSuccess = bSuccess && (vecData.empty() || writer.Write(vecData.data(), vecData.size()));
+    bSuccess = writer.Close() && bSuccess;
+
+    if (bSuccess)
+    {
+        fprintf(stderr, "Wrote %I64u bytes to %s.\n", writer.BytesWritten(), pPath);
+    }
+
+    return bSuccess;
+}
+
+void MemoryDiff::Print(const size_t ulMaxRanges) const
+{
+    size_t ulDataOffset = 0;
+    for (size_t i = 0; i < vecChangedRanges.size(); ++i)
+    {
+        const MemoryRange &range = vecChangedRanges[i];
+        if (i < ulMaxRanges)
+        {
+            fprintf(stderr, "Changed %p (%u bytes):", range.dwAddress, range.dwSize);
+            for (DWORD j = 0; j < range.dwSize && j < 16; ++j)
+            {
+                fprintf(stderr, " %02X", vecData[ulDataOffset + j]);
+            }
+            fprintf(stderr, "%s\n", (range.dwSize > 16) ? " ..." : "");
+        }
+        ulDataOffset += range.dwSize;
+    }
+    if (vecChangedRanges.size() > ulMaxRanges)
+    {
+        fprintf(stderr, "... %Iu more changed ranges.\n", vecChangedRanges.size() - ulMaxRanges);
+    }
+
+    for (auto &range : vecAddedRanges)
+    {
+        fprintf(stderr, "Added %p - %p\n", range.dwAddress, range.dwAddress + range.dwSize);
+    }
+    for (auto &range : vecRemovedRanges)
+    {
+        fprintf(stderr, "Removed %p - %p\n", range.dwAddress, range.dwAddress + range.dwSize);
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+struct MemoryRange
+{
+    DWORD_PTR dwAddress;
+    DWORD dwSize;
+};
+
+//What changed between two stops. Changed ranges are byte-exact when both snapshots kept the page contents,
+//and whole pages otherwise. vecData holds the current bytes of every changed range, back to back.
+struct MemoryDiff
+{
+    std::vector<DWORD_PTR> vecChangedPages;
+    std::vector<MemoryRange> vecChangedRanges;
+    std::vector<MemoryRange> vecAddedRanges;
+    std::vector<MemoryRange> vecRemovedRanges;
+    std::vector<unsigned char> vecData;
+    size_t ulPagesCompared;
+    DWORD dwPageSize;
+
+    const bool Save(const char * const pPath) const;
+    void Print(const size_t ulMaxRanges) const;
+};
+
+class MemorySnapshot final
+{
+public:
+    MemorySnapshot() = delete;
+    MemorySnapshot(Debugger *pDebugger, const size_t ulContentBudget = 256 * 1024 * 1024);
+
+    MemorySnapshot(const MemorySnapshot &copy) = delete;
+    MemorySnapshot &operator=(const MemorySnapshot &copy) = delete;
+
+    ~MemorySnapshot() = default;
+
+    const bool Take(const unsigned int uiThreadCount = 0);
+    const bool Diff(MemoryDiff &diff, const unsigned int uiThreadCount = 0);
+    const bool HasSnapshot() const;
+
+private:
+    struct PageRecord
+    {
+        DWORD_PTR dwAddress;
+        ULONGLONG ullHash;
+        const unsigned char *pContents;
+    };
+
+    struct Capture
+    {
+        std::vector<PageRecord> vecPages;
+        std::vector<std::unique_ptr<unsigned char[]>> vecBuffers;
+    };
+
+    const bool CapturePages(Capture &capture, const unsigned int uiThreadCount) const;
+    void DiffPage(const PageRecord &previous, const PageRecord &current, MemoryDiff &diff) const;
+
+    static const ULONGLONG HashPage(const unsigned char * const pPage, const size_t ulSize);
+    static void AppendRange(std::vector<MemoryRange> &vecRanges, const DWORD_PTR dwAddress, const DWORD dwSize);
+
+    Debugger * const m_pDebugger;
+    DWORD m_dwPageSize;
+    size_t m_ulContentBudget;
+    bool m_bHasSnapshot;
+
+    Capture m_capture;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,515 @@
+#include "ModuleAnalyzer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "Common.h"
+#include "PeParser.h"
+#include "RemoteImage.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Multiple of 64 so that no two workers ever touch the same bitmap word
+const DWORD dwChunkSize = 256 * 1024;
+const unsigned char cUnwindChainInfo = 0x04;
+
+//Resolves a relative branch to an RVA inside the image, or 0 when it leaves the image
+const DWORD RelativeTarget(const DWORD dwFrom, const LengthDecoder::Result &result, const size_t ulImageSize)
+{
+    const long long llTarget = (long long)dwFrom + result.uiLength + result.llRelative;
+    return (llTarget > 0 && llTarget < (long long)ulImageSize) ? (DWORD)llTarget : 0;
+}
+
+}
+
+ModuleAnalyzer::ModuleAnalyzer(const HANDLE hProcess) : m_hProcess{ hProcess }
+{
+}
+
+const bool ModuleAnalyzer::Analyze(const DWORD_PTR dwModuleBase, ModuleIndex &index, const unsigned int uiThreadCount /*= 0*/) const
+{
+    RemoteImage image(m_hProcess, dwModuleBase);
+    if (!image.Read())
+    {
+        return false;
+    }
+
+    return AnalyzeImage(image.Data(), image.Size(), dwModuleBase, index, uiThreadCount);
+}
+
+const bool ModuleAnalyzer::AnalyzeImage(const unsigned char * const pImage, const size_t ulImageSize, const DWORD_PTR dwModuleBase,
+    ModuleIndex &index, const unsigned int uiThreadCount /*= 0*/) const
+{
+    Stopwatch stopwatch;
+
+    //pImage is the image as mapped in memory, so every RVA is directly an offset into it
+    PeParser parser(pImage, ulImageSize, PeParser::eLayout::eImage);
+    if (ulImageSize > 0xFFFFFFFFULL || !parser.Parse())
+    {
+        fprintf(stderr, "Image at %p has invalid PE headers.\n", (void *)dwModuleBase);
+        return false;
+    }
+    const bool bIs64Bit = parser.Is64Bit();
+
+    index.dwModuleBase = dwModuleBase;
+    index.dwImageSize = (DWORD)ulImageSize;
+    index.mode = bIs64Bit ? LengthDecoder::eMode::e64Bit : LengthDecoder::eMode::e32Bit;
+    index.ulCodeBytes = 0;
+    index.ulInstructionCount = 0;
+    index.ulReachableBlocks = 0;
+    index.vecFunctions.clear();
+    index.vecBlocks.clear();
+    index.vecEdges.clear();
+
+    std::vector<CodeRange> vecCode;
+    std::vector<Chunk> vecChunks;
+    for (size_t i = 0; i < parser.SectionCount(); ++i)
+    {
+        const PeParser::Section section = parser.GetSection(i);
+        const DWORD dwSectionSize = (section.uiVirtualSize != 0) ? section.uiVirtualSize : section.uiRawSize;
+        if (!BOOLIFY(section.uiCharacteristics & PeParser::uiSectionExecute) || section.uiVirtualAddress >= ulImageSize ||
+            dwSectionSize == 0)
+        {
+            continue;
+        }
+
+        CodeRange range = { section.uiVirtualAddress, (DWORD)std::min((size_t)section.uiVirtualAddress + dwSectionSize, ulImageSize) };
+        vecCode.push_back(range);
+        index.ulCodeBytes += range.dwEnd - range.dwStart;
+        for (DWORD dwStart = range.dwStart; dwStart < range.dwEnd; dwStart += std::min(dwChunkSize, range.dwEnd - dwStart))
+        {
+            Chunk chunk;
+            chunk.dwStart = dwStart;
+            chunk.dwEnd = std::min(dwStart + dwChunkSize, range.dwEnd);
+            chunk.dwSectionEnd = range.dwEnd;
+            vecChunks.emplace_back(std::move(chunk));
+        }
+    }
+
+    if (vecCode.empty())
+    {
+        fprintf(stderr, "Image at %p has no executable sections.\n", (void *)dwModuleBase);
+        return false;
+    }
+
+    //Sweep every chunk from its first byte. Starts are kept as one bit per image byte.
+    Bitmap starts(ulImageSize);
+    std::atomic<size_t> ulNextChunk(0);
+    auto Worker = [&]()
+    {
+        for (size_t ulIndex = ulNextChunk++; ulIndex < vecChunks.size(); ulIndex = ulNextChunk++)
+        {
+            SweepChunk(pImage, index.mode, vecChunks[ulIndex], starts);
+        }
+    };
+
+    std::vector<std::thread> vecWorkers;
+    unsigned int uiThreads = (uiThreadCount == 0) ? std::max(1u, std::thread::hardware_concurrency()) : uiThreadCount;
+    uiThreads = (unsigned int)std::min((size_t)uiThreads, vecChunks.size());
+    for (unsigned int i = 1; i < uiThreads; ++i)
+    {
+        vecWorkers.emplace_back(std::thread(Worker));
+    }
+    Worker();
+    for (auto &worker : vecWorkers)
+    {
+        worker.join();
+    }
+
+    const double dSweepSeconds = stopwatch.ElapsedSeconds();
+
+    //A chunk that started in the middle of an instruction is re-decoded from where its predecessor really ended
+    //until both decodings agree again. Everything the chunk decoded before that point is replaced.
+    std::vector<BranchRecord> vecRepaired;
+    for (size_t i = 1; i < vecChunks.size(); ++i)
+    {
+        if (vecChunks[i].dwStart == vecChunks[i - 1].dwEnd)
+        {
+            RepairSeam(pImage, index.mode, vecChunks[i], starts, vecRepaired);
+        }
+    }
+
+    //Chunks are in address order and so are the repairs, so the records only need one merge. Records from replaced
+    //decodings lost their start bit; the ones that survived a repair are duplicates.
+    size_t ulRecordCount = vecRepaired.size();
+    for (auto &chunk : vecChunks)
+    {
+        ulRecordCount += chunk.vecRecords.size();
+    }
+    std::vector<BranchRecord> vecRecords;
+    vecRecords.reserve(ulRecordCount);
+    for (auto &chunk : vecChunks)
+    {
+        for (auto &record : chunk.vecRecords)
+        {
+            if (starts.Test(record.dwFrom))
+            {
+                vecRecords.push_back(record);
+            }
+        }
+        std::vector<BranchRecord>().swap(chunk.vecRecords);
+    }
+    if (!vecRepaired.empty())
+    {
+        const size_t ulSwept = vecRecords.size();
+        vecRecords.insert(vecRecords.end(), vecRepaired.begin(), vecRepaired.end());
+        std::inplace_merge(vecRecords.begin(), vecRecords.begin() + ulSwept, vecRecords.end(),
+            [](const BranchRecord &first, const BranchRecord &second)
+        {
+            return first.dwFrom < second.dwFrom;
+        });
+        vecRecords.erase(std::unique(vecRecords.begin(), vecRecords.end(), [](const BranchRecord &first, const BranchRecord &second)
+        {
+            return first.dwFrom == second.dwFrom;
+        }), vecRecords.end());
+    }
+
+    index.ulInstructionCount = starts.Count();
+
+    //Start bits are only ever set inside executable sections
+    auto IsCodeStart = [&](const DWORD dwRva)
+    {
+        return dwRva != 0 && dwRva < ulImageSize && starts.Test(dwRva);
+    };
+
+    //Function starts: the entry point, exports, .pdata on x64 (minus chained fragments) and direct call targets.
+    //Everything but the call targets is also a root for the recursive descent below; chained fragments are too.
+    std::vector<DWORD> vecRoots;
+    const DWORD dwEntryPoint = parser.EntryPoint();
+    if (IsCodeStart(dwEntryPoint))
+    {
+        index.vecFunctions.push_back(dwEntryPoint);
+    }
+
+    std::vector<PeParser::Export> vecExports;
+    if (parser.Exports(vecExports))
+    {
+        for (auto &exportEntry : vecExports)
+        {
+            if (exportEntry.pForwarder == nullptr && IsCodeStart(exportEntry.uiRva))
+            {
+                index.vecFunctions.push_back(exportEntry.uiRva);
+            }
+        }
+    }
+
+    size_t ulRuntimeFunctions = 0;
+    const PeParser::RuntimeFunction * const pRuntimeFunctions = parser.RuntimeFunctions(ulRuntimeFunctions);
+    for (size_t i = 0; i < ulRuntimeFunctions; ++i)
+    {
+        const DWORD dwUnwindInfo = pRuntimeFunctions[i].uiUnwindInfo;
+        const bool bIsChained = BOOLIFY(dwUnwindInfo & 1) ||
+            (dwUnwindInfo < ulImageSize && BOOLIFY((pImage[dwUnwindInfo] >> 3) & cUnwindChainInfo));
+        if (!IsCodeStart(pRuntimeFunctions[i].uiBegin))
+        {
+            continue;
+        }
+        if (!bIsChained)
+        {
+            index.vecFunctions.push_back(pRuntimeFunctions[i].uiBegin);
+        }
+        else
+        {
+            vecRoots.push_back(pRuntimeFunctions[i].uiBegin);
+        }
+    }
+    vecRoots.insert(vecRoots.end(), index.vecFunctions.begin(), index.vecFunctions.end());
+
+    Bitmap leaders(ulImageSize);
+    for (auto &record : vecRecords)
+    {
+        const bool bHasTarget = IsCodeStart(record.dwTo);
+        if (record.branchType == eBranchType::eCall)
+        {
+            if (bHasTarget)
+            {
+                index.vecFunctions.push_back(record.dwTo);
+            }
+            continue;
+        }
+        if (bHasTarget)
+        {
+            leaders.Set(record.dwTo);
+        }
+        const DWORD dwNext = record.dwFrom + record.cLength;
+        if (dwNext < ulImageSize && starts.Test(dwNext))
+        {
+            leaders.Set(dwNext);
+        }
+    }
+    for (auto &range : vecCode)
+    {
+        const DWORD dwFirst = starts.NextSet(range.dwStart, range.dwEnd);
+        if (dwFirst < range.dwEnd)
+        {
+            leaders.Set(dwFirst);
+        }
+    }
+    for (auto &dwFunction : index.vecFunctions)
+    {
+        leaders.Set(dwFunction);
+    }
+    for (auto &dwRoot : vecRoots)
+    {
+        leaders.Set(dwRoot);
+    }
+
+    //Blocks run from one leader to the next. Runs of int3 padding are dropped, and code that resumes after padding
+    //behind an unconditional transfer is taken as a function nobody calls directly. Blocks come out in address order,
+    //so branch edges are emitted by walking the records alongside, which keeps the edges sorted by source and type.
+    auto EmitBranch = [&](const BranchRecord &branch)
+    {
+        if (!IsCodeStart(branch.dwTo))
+        {
+            return;
+        }
+        const eEdgeType type = (branch.branchType == eBranchType::eCall) ? eEdgeType::eCall :
+            (branch.branchType == eBranchType::eConditional) ? eEdgeType::eConditional : eEdgeType::eJump;
+        if (type == eEdgeType::eConditional)
+        {
+            ControlEdge fallthrough = { branch.dwFrom, branch.dwFrom + branch.cLength, eEdgeType::eFallthrough };
+            index.vecEdges.push_back(fallthrough);
+        }
+        ControlEdge edge = { branch.dwFrom, branch.dwTo, type };
+        index.vecEdges.push_back(edge);
+    };
+
+    index.vecEdges.reserve(vecRecords.size() + vecRecords.size() / 2);
+    auto record = vecRecords.begin();
+    for (auto &range : vecCode)
+    {
+        DWORD dwLeader = leaders.NextSet(range.dwStart, range.dwEnd);
+        while (dwLeader < range.dwEnd)
+        {
+            const DWORD dwNextLeader = leaders.NextSet(dwLeader + 1, range.dwEnd);
+
+            DWORD dwStart = dwLeader;
+            while (dwStart < dwNextLeader && pImage[dwStart] == 0xCC && starts.Test(dwStart))
+            {
+                ++dwStart;
+            }
+            dwStart = starts.NextSet(dwStart, dwNextLeader);
+            if (dwStart >= dwNextLeader)
+            {
+                dwLeader = dwNextLeader;
+                continue;
+            }
+            if (dwStart != dwLeader && !index.vecBlocks.empty() && index.vecBlocks.back().terminator != eBranchType::eConditional &&
+                index.vecBlocks.back().terminator != eBranchType::eNone && index.vecBlocks.back().terminator != eBranchType::eCall)
+            {
+                index.vecFunctions.push_back(dwStart);
+            }
+
+            DWORD dwLast = dwNextLeader - 1;
+            while (dwLast > dwStart && !starts.Test(dwLast))
+            {
+                --dwLast;
+            }
+
+            while (record != vecRecords.end() && record->dwFrom < dwLast)
+            {
+                EmitBranch(*record++);
+            }
+            const BranchRecord *pRecord = (record != vecRecords.end() && record->dwFrom == dwLast) ? &*record : nullptr;
+
+            LengthDecoder::Result result = { 0 };
+            DWORD dwLength = (pRecord != nullptr) ? pRecord->cLength : 0;
+            if (pRecord == nullptr && LengthDecoder::Decode(&pImage[dwLast], range.dwEnd - dwLast, index.mode, result))
+            {
+                dwLength = result.uiLength;
+            }
+
+            BasicBlock block = { dwStart, dwLast + std::max(dwLength, 1UL), eBranchType::eNone, false, false };
+            if (pRecord != nullptr)
+            {
+                block.terminator = pRecord->branchType;
+                block.bIsIndirect = pRecord->bIsIndirect;
+            }
+            index.vecBlocks.push_back(block);
+
+            if ((block.terminator == eBranchType::eNone || block.terminator == eBranchType::eCall) && block.dwEnd == dwNextLeader &&
+                dwNextLeader < range.dwEnd && pImage[dwNextLeader] != 0xCC)
+            {
+                ControlEdge edge = { dwLast, dwNextLeader, eEdgeType::eFallthrough };
+                index.vecEdges.push_back(edge);
+            }
+            if (pRecord != nullptr)
+            {
+                EmitBranch(*record++);
+            }
+
+            dwLeader = dwNextLeader;
+        }
+    }
+
+    while (record != vecRecords.end())
+    {
+        EmitBranch(*record++);
+    }
+
+    std::sort(index.vecFunctions.begin(), index.vecFunctions.end());
+    index.vecFunctions.erase(std::unique(index.vecFunctions.begin(), index.vecFunctions.end()), index.vecFunctions.end());
+
+    //Recursive descent over the edges. The sweep also decodes the jump tables and literals that compilers place in
+    //.text, so a leader after a jmp or ret, or after padding, is only trusted once real control flow gets there.
+    //Blocks and edges are both sorted by address, so each step is a binary search.
+    std::vector<size_t> vecPending;
+    auto Reach = [&](const DWORD dwRva)
+    {
+        auto block = std::lower_bound(index.vecBlocks.begin(), index.vecBlocks.end(), dwRva, [](const BasicBlock &block, const DWORD dwValue)
+        {
+            return block.dwStart < dwValue;
+        });
+        if (block != index.vecBlocks.end() && block->dwStart == dwRva && !block->bIsReachable)
+        {
+            block->bIsReachable = true;
+            vecPending.push_back((size_t)(block - index.vecBlocks.begin()));
+        }
+    };
+    for (auto &dwRoot : vecRoots)
+    {
+        Reach(dwRoot);
+    }
+    while (!vecPending.empty())
+    {
+        const BasicBlock block = index.vecBlocks[vecPending.back()];
+        vecPending.pop_back();
+        ++index.ulReachableBlocks;
+
+        auto edge = std::lower_bound(index.vecEdges.begin(), index.vecEdges.end(), block.dwStart, [](const ControlEdge &edge, const DWORD dwValue)
+        {
+            return edge.dwFrom < dwValue;
+        });
+        for (; edge != index.vecEdges.end() && edge->dwFrom < block.dwEnd; ++edge)
+        {
+            Reach(edge->dwTo);
+        }
+    }
+
+    const double dSeconds = stopwatch.ElapsedSeconds();
+    fprintf(stderr, "Analyzed %Iu KB of code at %p in %.3f s (sweep %.1f MB/s, total %.1f MB/s, %u threads).\n",
+        index.ulCodeBytes / 1024, (void *)dwModuleBase, dSeconds,
+        (dSweepSeconds > 0.0) ? (double)index.ulCodeBytes / (1024.0 * 1024.0) / dSweepSeconds : 0.0,
+        (dSeconds > 0.0) ? (double)index.ulCodeBytes / (1024.0 * 1024.0) / dSeconds : 0.0, uiThreads);
+
+    return true;
+}
+
+void ModuleAnalyzer::SweepChunk(const unsigned char * const pImage, const LengthDecoder::eMode mode, Chunk &chunk,
+    Bitmap &starts) const
+{
+    const size_t ulImageSize = starts.Size();
+    DWORD dwOffset = chunk.dwStart;
+    while (dwOffset < chunk.dwEnd)
+    {
+        LengthDecoder::Result result = { 0 };
+        if (!LengthDecoder::Decode(&pImage[dwOffset], chunk.dwSectionEnd - dwOffset, mode, result))
+        {
+            ++dwOffset;
+            continue;
+        }
+
+        starts.Set(dwOffset);
+        if (result.branchType != eBranchType::eNone)
+        {
+            BranchRecord record = { dwOffset, result.bIsRelative ? RelativeTarget(dwOffset, result, ulImageSize) : 0,
+                result.uiLength, result.branchType, result.bIsIndirect };
+            chunk.vecRecords.push_back(record);
+        }
+        dwOffset += result.uiLength;
+    }
+}
+
+void ModuleAnalyzer::RepairSeam(const unsigned char * const pImage, const LengthDecoder::eMode mode, const Chunk &chunk,
+    Bitmap &starts, std::vector<BranchRecord> &vecRecords) const
+{
+    const size_t ulImageSize = starts.Size();
+
+    //Find where the last instruction that starts before this chunk actually ends
+    DWORD dwResume = chunk.dwStart;
+    for (DWORD dwBack = 1; dwBack < LengthDecoder::ulMaxInstructionLength && dwBack <= chunk.dwStart; ++dwBack)
+    {
+        const DWORD dwOffset = chunk.dwStart - dwBack;
+        if (!starts.Test(dwOffset))
+        {
+            continue;
+        }
+        LengthDecoder::Result result = { 0 };
+        if (LengthDecoder::Decode(&pImage[dwOffset], chunk.dwSectionEnd - dwOffset, mode, result))
+        {
+            dwResume = std::max(dwResume, dwOffset + result.uiLength);
+        }
+        break;
+    }
+    if (dwResume == chunk.dwStart || starts.Test(dwResume))
+    {
+        for (DWORD dwOffset = chunk.dwStart; dwOffset < dwResume; ++dwOffset)
+        {
+            starts.Clear(dwOffset);
+        }
+        return;
+    }
+
+    //Decoding is self-synchronizing, so this almost always converges within a few instructions
+    std::vector<DWORD> vecPath;
+    DWORD dwOffset = dwResume;
+    while (dwOffset < chunk.dwSectionEnd && !starts.Test(dwOffset))
+    {
+        LengthDecoder::Result result = { 0 };
+        if (!LengthDecoder::Decode(&pImage[dwOffset], chunk.dwSectionEnd - dwOffset, mode, result))
+        {
+            ++dwOffset;
+            continue;
+        }
+
+        vecPath.push_back(dwOffset);
+        if (result.branchType != eBranchType::eNone)
+        {
+            BranchRecord record = { dwOffset, result.bIsRelative ? RelativeTarget(dwOffset, result, ulImageSize) : 0,
+                result.uiLength, result.branchType, result.bIsIndirect };
+            vecRecords.push_back(record);
+        }
+        dwOffset += result.uiLength;
+    }
+
+    for (DWORD dwClear = chunk.dwStart; dwClear < dwOffset; ++dwClear)
+    {
+        starts.Clear(dwClear);
+    }
+    for (auto &dwStart : vecPath)
+    {
+        starts.Set(dwStart);
+    }
+}
+
+void ModuleAnalyzer::PrintIndex(const ModuleIndex &index, const size_t ulMaxFunctions)
+{
+    size_t ulCalls = 0;
+    for (auto &edge : index.vecEdges)
+    {
+        ulCalls += (edge.type == eEdgeType::eCall) ? 1 : 0;
+    }
+
+    fprintf(stderr, "Module %p (%s): %Iu instructions, %Iu functions, %Iu blocks (%Iu reachable), %Iu edges (%Iu calls).\n",
+        (void *)index.dwModuleBase, (index.mode == LengthDecoder::eMode::e64Bit) ? "x64" : "x86", index.ulInstructionCount,
+        index.vecFunctions.size(), index.vecBlocks.size(), index.ulReachableBlocks, index.vecEdges.size(), ulCalls);
+
+    for (size_t i = 0; i < index.vecFunctions.size() && i < ulMaxFunctions; ++i)
+    {
+        fprintf(stderr, "    Function at %p\n", (void *)(index.dwModuleBase + index.vecFunctions[i]));
+    }
+    if (index.vecFunctions.size() > ulMaxFunctions)
+    {
+        fprintf(stderr, "    ... %Iu more\n", index.vecFunctions.size() - ulMaxFunctions);
+    }
+}
+
+}
\ No newline at end of file
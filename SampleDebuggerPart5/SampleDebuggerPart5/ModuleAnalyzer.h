@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "Bitmap.h"
+#include "LengthDecoder.h"
+
+namespace CodeReversing
+{
+
+enum class eEdgeType
+{
+    eFallthrough = 1,
+    eJump = 2,
+    eConditional = 3,
+    eCall = 4
+};
+
+//Addresses are stored as RVAs to keep the index small. bIsReachable is only set for blocks that recursive descent
+//reaches from the entry point, exports or .pdata; the rest were only seen by the linear sweep and may well be data.
+struct BasicBlock
+{
+    DWORD dwStart;
+    DWORD dwEnd;
+    eBranchType terminator;
+    bool bIsIndirect;
+    bool bIsReachable;
+};
+
+struct ControlEdge
+{
+    DWORD dwFrom;
+    DWORD dwTo;
+    eEdgeType type;
+};
+
+struct ModuleIndex
+{
+    DWORD_PTR dwModuleBase;
+    DWORD dwImageSize;
+    LengthDecoder::eMode mode;
+    size_t ulCodeBytes;
+    size_t ulInstructionCount;
+    size_t ulReachableBlocks;
+    std::vector<DWORD> vecFunctions;
+    std::vector<BasicBlock> vecBlocks;
+    std::vector<ControlEdge> vecEdges;
+};
+
+//Whole-module code discovery. Executable sections are split into chunks that are linearly swept in parallel,
+//the seams between chunks are repaired by re-decoding from where the previous chunk really ended, and the result
+//is turned into function starts, basic blocks and control flow edges. Blocks are then marked by recursive descent
+//from the code the image itself vouches for, which is the only part that is safe to patch.
+class ModuleAnalyzer final
+{
+public:
+    ModuleAnalyzer() = delete;
+    ModuleAnalyzer(const HANDLE hProcess);
+
+    ModuleAnalyzer(const ModuleAnalyzer &copy) = delete;
+    ModuleAnalyzer &operator=(const ModuleAnalyzer &copy) = delete;
+
+    ~ModuleAnalyzer() = default;
+
+    const bool Analyze(const DWORD_PTR dwModuleBase, ModuleIndex &index, const unsigned int uiThreadCount = 0) const;
+    const bool AnalyzeImage(const unsigned char * const pImage, const size_t ulImageSize, const DWORD_PTR dwModuleBase,
+        ModuleIndex &index, const unsigned int uiThreadCount = 0) const;
+
+    static void PrintIndex(const ModuleIndex &index, const size_t ulMaxFunctions);
+
+private:
+    struct BranchRecord
+    {
+        DWORD dwFrom;
+        DWORD dwTo;
+        unsigned char cLength;
+        eBranchType branchType;
+        bool bIsIndirect;
+    };
+
+    struct Chunk
+    {
+        DWORD dwStart;
+        DWORD dwEnd;
+        DWORD dwSectionEnd;
+        std::vector<BranchRecord> vecRecords;
+    };
+
+    struct CodeRange
+    {
+        DWORD dwStart;
+        DWORD dwEnd;
+    };
+
+    void SweepChunk(const unsigned char * const pImage, const LengthDecoder::eMode mode, Chunk &chunk,
+        Bitmap &starts) const;
+    void RepairSeam(const unsigned char * const pImage, const LengthDecoder::eMode mode, const Chunk &chunk,
+        Bitmap &starts, std::vector<BranchRecord> &vecRecords) const;
+
+    HANDLE m_hProcess;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,583 @@
+#include "PatchManager.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "InterruptBreakpoint.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+InterruptBreakpoint *EnabledInterruptBreakpoint(Debugger *pDebugger, const DWORD_PTR dwAddress)
+{
+    Breakpoint *pBreakpoint = pDebugger->FindBreakpoint(dwAddress);
+    if (pBreakpoint != nullptr && pBreakpoint->IsEnabled() && pBreakpoint->Address() == dwAddress &&
+        pBreakpoint->Type() == Breakpoint::eType::eInterrupt)
+    {
+        return static_cast<InterruptBreakpoint *>(pBreakpoint);
+    }
+
+    return nullptr;
+}
+
+const bool IsExecutable(const DWORD dwProtect)
+{
+    const DWORD dwExecutable = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    return BOOLIFY(dwProtect & dwExecutable);
+}
+
+}
+
+PatchManager::PatchManager(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwPageSize{ 0x1000 },
+    m_uiNextTransactionId{ 1 }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+}
+
+const bool PatchManager::WriteBytes(const DWORD_PTR dwAddress, const unsigned char * const pBytes, const size_t ulSize)
+{
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (size_t i = 0; i < ulSize; ++i)
+    {
+        mapBytes[dwAddress + i] = pBytes[i];
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unsigned int uiId = 0;
+    return Commit("write", mapBytes, uiId);
+}
+
+const bool PatchManager::Undo()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_lstUndoLog.empty())
+    {
+        fprintf(stderr, "Undo log is empty.\n");
+        return false;
+    }
+
+    const unsigned int uiId = m_lstUndoLog.back().uiId;
+    if (!Rollback(uiId))
+    {
+        return false;
+    }
+
+    for (auto &patchSet : m_mapPatchSets)
+    {
+        if (patchSet.second.uiTransactionId == uiId)
+        {
+            patchSet.second.uiTransactionId = 0;
+        }
+    }
+
+    return true;
+}
+
+const bool PatchManager::AddPatch(const char * const pSetName, const DWORD_PTR dwAddress, const unsigned char * const pBytes,
+    const size_t ulSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    PatchSet &patchSet = m_mapPatchSets[pSetName];
+    if (patchSet.uiTransactionId != 0)
+    {
+        fprintf(stderr, "Patch set %s is applied. Revert it before adding to it.\n", pSetName);
+        return false;
+    }
+
+    for (size_t i = 0; i < ulSize; ++i)
+    {
+        patchSet.mapBytes[dwAddress + i] = pBytes[i];
+    }
+
+    return true;
+}
+
+const bool PatchManager::ApplyPatchSet(const char * const pSetName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto patchSet = m_mapPatchSets.find(pSetName);
+    if (patchSet == m_mapPatchSets.end())
+    {
+        fprintf(stderr, "Patch set %s does not exist.\n", pSetName);
+        return false;
+    }
+    if (patchSet->second.uiTransactionId != 0)
+    {
+        fprintf(stderr, "Patch set %s is already applied.\n", pSetName);
+        return false;
+    }
+
+    return Commit(pSetName, patchSet->second.mapBytes, patchSet->second.uiTransactionId);
+}
+
+const bool PatchManager::RevertPatchSet(const char * const pSetName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto patchSet = m_mapPatchSets.find(pSetName);
+    if (patchSet == m_mapPatchSets.end() || patchSet->second.uiTransactionId == 0)
+    {
+        fprintf(stderr, "Patch set %s is not applied.\n", pSetName);
+        return false;
+    }
+
+    if (Rollback(patchSet->second.uiTransactionId))
+    {
+        patchSet->second.uiTransactionId = 0;
+        return true;
+    }
+
+    return false;
+}
+
+const bool PatchManager::RemovePatchSet(const char * const pSetName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto patchSet = m_mapPatchSets.find(pSetName);
+    if (patchSet == m_mapPatchSets.end())
+    {
+        return false;
+    }
+    if (patchSet->second.uiTransactionId != 0 && !Rollback(patchSet->second.uiTransactionId))
+    {
+        return false;
+    }
+
+    m_mapPatchSets.erase(patchSet);
+    return true;
+}
+
+const bool PatchManager::IsPatchSetApplied(const char * const pSetName) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto patchSet = m_mapPatchSets.find(pSetName);
+    return (patchSet != m_mapPatchSets.end()) && (patchSet->second.uiTransactionId != 0);
+}
+
+const bool PatchManager::Commit(const char * const pName, const std::map<DWORD_PTR, unsigned char> &mapBytes, unsigned int &uiId)
+{
+    if (mapBytes.empty())
+    {
+        return false;
+    }
+
+    std::map<DWORD_PTR, unsigned char> mapWrites;
+    for (auto &patch : mapBytes)
+    {
+        auto state = m_mapAddressStates.find(patch.first);
+        if (state == m_mapAddressStates.end() || EffectiveByte(state->second) != patch.second)
+        {
+            mapWrites.insert(patch);
+        }
+    }
+
+    std::vector<PatchByte> vecPrevious;
+    if (!Write(mapWrites, &vecPrevious))
+    {
+        return false;
+    }
+
+    Transaction transaction;
+    transaction.uiId = m_uiNextTransactionId++;
+    transaction.strName = pName;
+    transaction.vecBytes.reserve(mapBytes.size());
+
+    auto previous = vecPrevious.begin();
+    for (auto &patch : mapBytes)
+    {
+        auto state = m_mapAddressStates.find(patch.first);
+        if (state == m_mapAddressStates.end())
+        {
+            while (previous != vecPrevious.end() && previous->dwAddress < patch.first)
+            {
+                ++previous;
+            }
+            AddressState newState;
+            newState.cPristine = (previous != vecPrevious.end() && previous->dwAddress == patch.first) ?
+                previous->cOriginal : patch.second;
+            state = m_mapAddressStates.insert(std::make_pair(patch.first, newState)).first;
+        }
+
+        PatchByte patchByte = { patch.first, EffectiveByte(state->second), patch.second };
+        transaction.vecBytes.push_back(patchByte);
+        state->second.vecLayers.push_back(std::make_pair(transaction.uiId, patch.second));
+    }
+
+    uiId = transaction.uiId;
+    m_lstUndoLog.emplace_back(std::move(transaction));
+    TrimUndoLog();
+
+    return true;
+}
+
+const bool PatchManager::Rollback(const unsigned int uiTransactionId)
+{
+    auto transaction = std::find_if(m_lstUndoLog.begin(), m_lstUndoLog.end(), [=](const Transaction &transaction)
+    {
+        return transaction.uiId == uiTransactionId;
+    });
+    if (transaction == m_lstUndoLog.end())
+    {
+        return false;
+    }
+
+    std::map<DWORD_PTR, unsigned char> mapWrites;
+    for (auto &patchByte : transaction->vecBytes)
+    {
+        const AddressState &state = m_mapAddressStates[patchByte.dwAddress];
+        unsigned char cRemaining = state.cPristine;
+        for (auto &layer : state.vecLayers)
+        {
+            if (layer.first != uiTransactionId)
+            {
+                cRemaining = layer.second;
+            }
+        }
+        if (cRemaining != EffectiveByte(state))
+        {
+            mapWrites[patchByte.dwAddress] = cRemaining;
+        }
+    }
+
+    if (!mapWrites.empty() && !Write(mapWrites, nullptr))
+    {
+        return false;
+    }
+
+    for (auto &patchByte : transaction->vecBytes)
+    {
+        auto state = m_mapAddressStates.find(patchByte.dwAddress);
+        auto &vecLayers = state->second.vecLayers;
+        vecLayers.erase(std::remove_if(vecLayers.begin(), vecLayers.end(),
+            [=](const std::pair<unsigned int, unsigned char> &layer) { return layer.first == uiTransactionId; }),
+            vecLayers.end());
+        if (vecLayers.empty())
+        {
+            m_mapAddressStates.erase(state);
+        }
+    }
+
+    m_lstUndoLog.erase(transaction);
+
+    return true;
+}
+
+void PatchManager::TrimUndoLog()
+{
+    auto transaction = m_lstUndoLog.begin();
+    while (m_lstUndoLog.size() > ulMaxUndoTransactions && transaction != m_lstUndoLog.end())
+    {
+        const unsigned int uiId = transaction->uiId;
+        const bool bIsPatchSet = std::any_of(m_mapPatchSets.begin(), m_mapPatchSets.end(),
+            [=](const std::pair<const std::string, PatchSet> &patchSet) { return patchSet.second.uiTransactionId == uiId; });
+        if (bIsPatchSet)
+        {
+            ++transaction;
+            continue;
+        }
+
+        //The layer stays so that reverting what lies under it still exposes it, but it can no longer be undone.
+        //Permanent layers at the bottom fold into the pristine byte and a permanent layer hides the one below it.
+        for (auto &patchByte : transaction->vecBytes)
+        {
+            auto state = m_mapAddressStates.find(patchByte.dwAddress);
+            auto &vecLayers = state->second.vecLayers;
+            for (auto &layer : vecLayers)
+            {
+                if (layer.first == uiId)
+                {
+                    layer.first = 0;
+                }
+            }
+            for (size_t i = vecLayers.size(); i > 1; --i)
+            {
+                if (vecLayers[i - 1].first == 0 && vecLayers[i - 2].first == 0)
+                {
+                    vecLayers.erase(vecLayers.begin() + (i - 2));
+                }
+            }
+            if (!vecLayers.empty() && vecLayers.front().first == 0)
+            {
+                state->second.cPristine = vecLayers.front().second;
+                vecLayers.erase(vecLayers.begin());
+            }
+            if (vecLayers.empty())
+            {
+                m_mapAddressStates.erase(state);
+            }
+        }
+        transaction = m_lstUndoLog.erase(transaction);
+    }
+}
+
+const bool PatchManager::SwapByte(const DWORD_PTR dwAddress, const unsigned char cByte, unsigned char *pPrevious /*= nullptr*/)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const HANDLE hProcess = m_pDebugger->Handle();
+    SIZE_T ulBytes = 0;
+    if (pPrevious != nullptr &&
+        (!BOOLIFY(ReadProcessMemory(hProcess, (LPCVOID)dwAddress, pPrevious, sizeof(unsigned char), &ulBytes)) ||
+        ulBytes != sizeof(unsigned char)))
+    {
+        fprintf(stderr, "Could not read from address %p. Error = %X\n", dwAddress, GetLastError());
+        return false;
+    }
+
+    //The disassembler sees through int 3s with its byte filter, so its cache stays valid
+    bool bSuccess = BOOLIFY(WriteProcessMemory(hProcess, (LPVOID)dwAddress, &cByte, sizeof(unsigned char), &ulBytes));
+    if (!bSuccess)
+    {
+        const DWORD_PTR dwPage = dwAddress & ~((DWORD_PTR)m_dwPageSize - 1);
+        std::vector<ProtectedRange> vecProtected;
+        bSuccess = UnprotectRange(dwPage, dwPage + m_dwPageSize, vecProtected) &&
+            BOOLIFY(WriteProcessMemory(hProcess, (LPVOID)dwAddress, &cByte, sizeof(unsigned char), &ulBytes));
+        RestoreProtection(vecProtected);
+    }
+    if (!bSuccess || ulBytes != sizeof(unsigned char))
+    {
+        return false;
+    }
+    (void)FlushInstructionCache(hProcess, (LPCVOID)dwAddress, sizeof(unsigned char));
+
+    return true;
+}
+
+const bool PatchManager::WriteBatch(const std::map<DWORD_PTR, unsigned char> &mapBytes, std::vector<PatchByte> *pPrevious /*= nullptr*/)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return Write(mapBytes, pPrevious);
+}
+
+const bool PatchManager::Write(const std::map<DWORD_PTR, unsigned char> &mapBytes, std::vector<PatchByte> *pPrevious)
+{
+    struct Span
+    {
+        DWORD_PTR dwFirst;
+        DWORD_PTR dwLast;
+        std::map<DWORD_PTR, unsigned char>::const_iterator begin;
+        std::map<DWORD_PTR, unsigned char>::const_iterator end;
+        std::vector<unsigned char> vecOriginal;
+    };
+
+    //Bytes under an enabled int 3 live in the breakpoint, not in the target
+    std::map<DWORD_PTR, unsigned char> mapMemoryBytes;
+    std::vector<std::pair<InterruptBreakpoint *, unsigned char>> vecBreakpointBytes;
+    for (auto &patch : mapBytes)
+    {
+        InterruptBreakpoint *pBreakpoint = EnabledInterruptBreakpoint(m_pDebugger, patch.first);
+        if (pBreakpoint != nullptr)
+        {
+            vecBreakpointBytes.push_back(std::make_pair(pBreakpoint, patch.second));
+        }
+        else
+        {
+            mapMemoryBytes.insert(patch);
+        }
+    }
+
+    //Group bytes into spans of contiguous pages so that each span costs one protection change, one read and one write
+    const DWORD_PTR dwPageMask = ~((DWORD_PTR)m_dwPageSize - 1);
+    std::vector<Span> vecSpans;
+    for (auto patch = mapMemoryBytes.cbegin(); patch != mapMemoryBytes.cend(); ++patch)
+    {
+        if (vecSpans.empty() || (patch->first & dwPageMask) > ((vecSpans.back().dwLast & dwPageMask) + m_dwPageSize))
+        {
+            Span span;
+            span.dwFirst = patch->first;
+            span.begin = patch;
+            vecSpans.push_back(span);
+        }
+        vecSpans.back().dwLast = patch->first;
+        vecSpans.back().end = std::next(patch);
+    }
+
+    const HANDLE hProcess = m_pDebugger->Handle();
+    std::vector<ProtectedRange> vecProtected;
+    bool bSuccess = true;
+    for (auto &span : vecSpans)
+    {
+        const SIZE_T ulSize = span.dwLast - span.dwFirst + 1;
+        SIZE_T ulBytesRead = 0;
+        span.vecOriginal.resize(ulSize);
+        bSuccess = UnprotectRange(span.dwFirst & dwPageMask, (span.dwLast & dwPageMask) + m_dwPageSize, vecProtected);
+        bSuccess = bSuccess && BOOLIFY(ReadProcessMemory(hProcess, (LPCVOID)span.dwFirst, span.vecOriginal.data(), ulSize, &ulBytesRead));
+        if (!bSuccess || ulBytesRead != ulSize)
+        {
+            fprintf(stderr, "Could not read original bytes at %p. Error = %X\n", span.dwFirst, GetLastError());
+            RestoreProtection(vecProtected);
+            return false;
+        }
+    }
+
+    //Each span is written back whole in one call: the bytes just read with the patches laid over them. The spans that
+    //made it are remembered in case a later one fails.
+    std::vector<const Span *> vecWritten;
+    std::vector<unsigned char> vecBuffer;
+    for (auto spanIter = vecSpans.cbegin(); bSuccess && spanIter != vecSpans.cend(); ++spanIter)
+    {
+        const Span &span = *spanIter;
+        const SIZE_T ulSize = span.dwLast - span.dwFirst + 1;
+        vecBuffer = span.vecOriginal;
+        for (auto patch = span.begin; patch != span.end; ++patch)
+        {
+            vecBuffer[patch->first - span.dwFirst] = patch->second;
+        }
+
+        SIZE_T ulBytesWritten = 0;
+        bSuccess = BOOLIFY(WriteProcessMemory(hProcess, (LPVOID)span.dwFirst, vecBuffer.data(), ulSize, &ulBytesWritten));
+        bSuccess = bSuccess && (ulBytesWritten == ulSize);
+        if (bSuccess)
+        {
+            vecWritten.push_back(&span);
+        }
+        else
+        {
+            fprintf(stderr, "Could not write patch at %p. Error = %X\n", span.dwFirst, GetLastError());
+        }
+    }
+
+    if (!bSuccess)
+    {
+        for (auto &pSpan : vecWritten)
+        {
+            SIZE_T ulBytesWritten = 0;
+            (void)WriteProcessMemory(hProcess, (LPVOID)pSpan->dwFirst, pSpan->vecOriginal.data(),
+                pSpan->dwLast - pSpan->dwFirst + 1, &ulBytesWritten);
+        }
+    }
+
+    Disassembler * const pDisassembler = m_pDebugger->ProcessDisassembler();
+    for (auto &span : vecSpans)
+    {
+        (void)FlushInstructionCache(hProcess, (LPCVOID)span.dwFirst, span.dwLast - span.dwFirst + 1);
+        if (pDisassembler != nullptr)
+        {
+            pDisassembler->Invalidate(span.dwFirst, span.dwLast - span.dwFirst + 1);
+        }
+    }
+    RestoreProtection(vecProtected);
+
+    if (!bSuccess)
+    {
+        return false;
+    }
+
+    if (pPrevious != nullptr)
+    {
+        pPrevious->clear();
+        pPrevious->reserve(mapBytes.size());
+        for (auto &span : vecSpans)
+        {
+            for (auto patch = span.begin; patch != span.end; ++patch)
+            {
+                PatchByte patchByte = { patch->first, span.vecOriginal[patch->first - span.dwFirst], patch->second };
+                pPrevious->push_back(patchByte);
+            }
+        }
+    }
+
+    for (auto &breakpointByte : vecBreakpointBytes)
+    {
+        if (pPrevious != nullptr)
+        {
+            PatchByte patchByte = { breakpointByte.first->Address(), breakpointByte.first->OriginalByte(), breakpointByte.second };
+            pPrevious->push_back(patchByte);
+        }
+        breakpointByte.first->SetOriginalByte(breakpointByte.second);
+        if (pDisassembler != nullptr)
+        {
+            pDisassembler->Invalidate(breakpointByte.first->Address(), sizeof(unsigned char));
+        }
+    }
+
+    if (pPrevious != nullptr)
+    {
+        std::sort(pPrevious->begin(), pPrevious->end(), [](const PatchByte &lhs, const PatchByte &rhs)
+        {
+            return lhs.dwAddress < rhs.dwAddress;
+        });
+    }
+
+    return true;
+}
+
+const unsigned char PatchManager::EffectiveByte(const AddressState &state) const
+{
+    return state.vecLayers.empty() ? state.cPristine : state.vecLayers.back().second;
+}
+
+const bool PatchManager::UnprotectRange(const DWORD_PTR dwStart, const DWORD_PTR dwEnd, std::vector<ProtectedRange> &vecProtected)
+{
+    DWORD_PTR dwAddress = dwStart;
+    while (dwAddress < dwEnd)
+    {
+        MEMORY_BASIC_INFORMATION memInfo = { 0 };
+        if (VirtualQueryEx(m_pDebugger->Handle(), (LPCVOID)dwAddress, &memInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0 ||
+            memInfo.State != MEM_COMMIT)
+        {
+            fprintf(stderr, "Memory at %p is not committed.\n", dwAddress);
+            return false;
+        }
+
+        const DWORD_PTR dwRegionEnd = std::min((DWORD_PTR)memInfo.BaseAddress + memInfo.RegionSize, dwEnd);
+        if (!IsWritable(memInfo.Protect))
+        {
+            ProtectedRange range = { dwAddress, dwRegionEnd - dwAddress, 0 };
+            const DWORD dwNewProtect = IsExecutable(memInfo.Protect) ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE;
+            if (!BOOLIFY(VirtualProtectEx(m_pDebugger->Handle(), (LPVOID)range.dwAddress, range.ulSize, dwNewProtect, &range.dwOldProtect)))
+            {
+                fprintf(stderr, "Could not change memory permissions at address %p. Error = %X\n", dwAddress, GetLastError());
+                return false;
+            }
+            vecProtected.push_back(range);
+        }
+
+        dwAddress = dwRegionEnd;
+    }
+
+    return true;
+}
+
+void PatchManager::RestoreProtection(const std::vector<ProtectedRange> &vecProtected)
+{
+    for (auto &range : vecProtected)
+    {
+        DWORD dwOldProtect = 0;
+        (void)VirtualProtectEx(m_pDebugger->Handle(), (LPVOID)range.dwAddress, range.ulSize, range.dwOldProtect, &dwOldProtect);
+    }
+}
+
+void PatchManager::PrintPatchSets() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &patchSet : m_mapPatchSets)
+    {
+        fprintf(stderr, "Patch set: %s -- Bytes: %X -- %s\n", patchSet.first.c_str(),
+            (DWORD)patchSet.second.mapBytes.size(), patchSet.second.uiTransactionId != 0 ? "applied" : "not applied");
+    }
+}
+
+void PatchManager::PrintUndoLog() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &transaction : m_lstUndoLog)
+    {
+        fprintf(stderr, "Transaction %X: %s -- Bytes: %X\n", transaction.uiId, transaction.strName.c_str(),
+            (DWORD)transaction.vecBytes.size());
+        for (auto &patchByte : transaction.vecBytes)
+        {
+            fprintf(stderr, "    %p: %02X -> %02X\n", patchByte.dwAddress, patchByte.cOriginal, patchByte.cPatched);
+        }
+    }
+}
+
+}
\ No newline at end of file
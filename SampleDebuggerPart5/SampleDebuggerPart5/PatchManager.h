@@ -0,0 +1,109 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+struct PatchByte
+{
+    DWORD_PTR dwAddress;
+    unsigned char cOriginal;
+    unsigned char cPatched;
+};
+
+//Every write into the target goes through here. Each write is a transaction in the undo log, and each patched
+//address keeps a stack of the transactions layered over it so that overlapping patches can be reverted in any order.
+class PatchManager final
+{
+public:
+    PatchManager() = delete;
+    PatchManager(Debugger *pDebugger);
+
+    PatchManager(const PatchManager &copy) = delete;
+    PatchManager &operator=(const PatchManager &copy) = delete;
+
+    ~PatchManager() = default;
+
+    const bool WriteBytes(const DWORD_PTR dwAddress, const unsigned char * const pBytes, const size_t ulSize);
+    const bool Undo();
+
+    const bool AddPatch(const char * const pSetName, const DWORD_PTR dwAddress, const unsigned char * const pBytes,
+        const size_t ulSize);
+    const bool ApplyPatchSet(const char * const pSetName);
+    const bool RevertPatchSet(const char * const pSetName);
+    const bool RemovePatchSet(const char * const pSetName);
+    const bool IsPatchSetApplied(const char * const pSetName) const;
+
+    //Bytes on contiguous pages go out in a single WriteProcessMemory call, with whatever lies between them rewritten as
+    //it was read
+    const bool WriteBatch(const std::map<DWORD_PTR, unsigned char> &mapBytes, std::vector<PatchByte> *pPrevious = nullptr);
+
+    //Int 3 bytes come and go on every hit, so they take the lock but are not transactions. pPrevious receives the byte
+    //that was there before.
+    const bool SwapByte(const DWORD_PTR dwAddress, const unsigned char cByte, unsigned char *pPrevious = nullptr);
+
+    void PrintPatchSets() const;
+    void PrintUndoLog() const;
+
+private:
+    struct PatchSet
+    {
+        std::map<DWORD_PTR, unsigned char> mapBytes;
+        unsigned int uiTransactionId;
+    };
+
+    struct Transaction
+    {
+        unsigned int uiId;
+        std::string strName;
+        std::vector<PatchByte> vecBytes;
+    };
+
+    struct AddressState
+    {
+        unsigned char cPristine;
+        std::vector<std::pair<unsigned int /*uiTransactionId*/, unsigned char>> vecLayers;
+    };
+
+    struct ProtectedRange
+    {
+        DWORD_PTR dwAddress;
+        SIZE_T ulSize;
+        DWORD dwOldProtect;
+    };
+
+    const bool Commit(const char * const pName, const std::map<DWORD_PTR, unsigned char> &mapBytes, unsigned int &uiId);
+    const bool Rollback(const unsigned int uiTransactionId);
+    void TrimUndoLog();
+    const bool Write(const std::map<DWORD_PTR, unsigned char> &mapBytes, std::vector<PatchByte> *pPrevious);
+
+    const unsigned char EffectiveByte(const AddressState &state) const;
+
+    const bool UnprotectRange(const DWORD_PTR dwStart, const DWORD_PTR dwEnd, std::vector<ProtectedRange> &vecProtected);
+    void RestoreProtection(const std::vector<ProtectedRange> &vecProtected);
+
+    //Older writes become permanent once the log is this long, unless an applied patch set still refers to them
+    static const size_t ulMaxUndoTransactions = 4096;
+
+    Debugger * const m_pDebugger;
+    DWORD m_dwPageSize;
+
+    //Guards everything below; tracers patch from the debugger thread while the console writes bytes and toggles groups
+    mutable std::mutex m_mutex;
+    unsigned int m_uiNextTransactionId;
+
+    std::map<std::string, PatchSet> m_mapPatchSets;
+    std::list<Transaction> m_lstUndoLog;
+    std::map<DWORD_PTR, AddressState> m_mapAddressStates;
+};
+
+}
\ No newline at end of file
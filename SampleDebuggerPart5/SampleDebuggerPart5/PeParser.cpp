@@ -0,0 +1,378 @@
+#include "PeParser.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulDosHeaderSize = 0x40;
+const size_t ulFileHeaderSize = 20;
+const size_t ulSectionHeaderSize = 40;
+const size_t ulDirectoryEntrySize = 8;
+const size_t ulExportDirectorySize = 40;
+const size_t ulImportDescriptorSize = 20;
+const uint32_t uiMaxDirectories = 16;
+const uint16_t usMachineAmd64 = 0x8664;
+
+//Headers are not guaranteed to be aligned in a file view, so every field goes through memcpy
+const uint16_t Read16(const uint8_t * const pBytes)
+{
+    uint16_t usValue = 0;
+    memcpy(&usValue, pBytes, sizeof(usValue));
+    return usValue;
+}
+
+const uint32_t Read32(const uint8_t * const pBytes)
+{
+    uint32_t uiValue = 0;
+    memcpy(&uiValue, pBytes, sizeof(uiValue));
+    return uiValue;
+}
+
+const uint64_t Read64(const uint8_t * const pBytes)
+{
+    uint64_t ullValue = 0;
+    memcpy(&ullValue, pBytes, sizeof(ullValue));
+    return ullValue;
+}
+
+}
+
+PeParser::PeParser(const uint8_t * const pView, const size_t ulViewSize, const eLayout layout)
+    : m_pView{ pView }, m_ulViewSize{ ulViewSize }, m_layout{ layout }, m_bIs64Bit{ false }, m_ullImageBase{ 0 },
+    m_uiImageSize{ 0 }, m_uiEntryPoint{ 0 }, m_uiHeadersSize{ 0 }, m_pSections{ nullptr }, m_ulSectionCount{ 0 },
+    m_pDirectories{ nullptr }, m_uiDirectoryCount{ 0 }
+{
+}
+
+const bool PeParser::Parse()
+{
+    if (m_pView == nullptr || m_ulViewSize < ulDosHeaderSize || Read16(m_pView) != 0x5A4D)
+    {
+        return false;
+    }
+
+    const size_t ulNtOffset = Read32(&m_pView[0x3C]);
+    if (ulNtOffset > m_ulViewSize || m_ulViewSize - ulNtOffset < 4 + ulFileHeaderSize + 2 ||
+        Read32(&m_pView[ulNtOffset]) != 0x00004550)
+    {
+        return false;
+    }
+
+    const uint8_t * const pFileHeader = &m_pView[ulNtOffset + 4];
+    const uint16_t usMachine = Read16(pFileHeader);
+    const size_t ulSectionCount = Read16(&pFileHeader[2]);
+    const size_t ulOptionalHeaderSize = Read16(&pFileHeader[16]);
+    const size_t ulOptionalOffset = ulNtOffset + 4 + ulFileHeaderSize;
+    if (m_ulViewSize - ulOptionalOffset < ulOptionalHeaderSize)
+    {
+        return false;
+    }
+
+    //Only the fields before the data directories differ between PE32 and PE32+
+    const uint8_t * const pOptional = &m_pView[ulOptionalOffset];
+    const uint16_t usMagic = (ulOptionalHeaderSize >= 2) ? Read16(pOptional) : 0;
+    size_t ulDirectoriesOffset = 0;
+    if (usMagic == 0x10B && ulOptionalHeaderSize >= 96)
+    {
+        m_bIs64Bit = false;
+        m_ullImageBase = Read32(&pOptional[28]);
+        m_uiDirectoryCount = Read32(&pOptional[92]);
+        ulDirectoriesOffset = 96;
+    }
+    else if (usMagic == 0x20B && ulOptionalHeaderSize >= 112)
+    {
+        m_bIs64Bit = (usMachine == usMachineAmd64);
+        m_ullImageBase = Read64(&pOptional[24]);
+        m_uiDirectoryCount = Read32(&pOptional[108]);
+        ulDirectoriesOffset = 112;
+    }
+    else
+    {
+        return false;
+    }
+    m_uiEntryPoint = Read32(&pOptional[16]);
+    m_uiImageSize = Read32(&pOptional[56]);
+    m_uiHeadersSize = Read32(&pOptional[60]);
+
+    const size_t ulDirectorySpace = (ulOptionalHeaderSize - ulDirectoriesOffset) / ulDirectoryEntrySize;
+    m_uiDirectoryCount = std::min({ m_uiDirectoryCount, uiMaxDirectories, (uint32_t)ulDirectorySpace });
+    m_pDirectories = &pOptional[ulDirectoriesOffset];
+
+    const size_t ulSectionsOffset = ulOptionalOffset + ulOptionalHeaderSize;
+    if (ulSectionCount * ulSectionHeaderSize > m_ulViewSize - ulSectionsOffset)
+    {
+        return false;
+    }
+    m_pSections = &m_pView[ulSectionsOffset];
+    m_ulSectionCount = ulSectionCount;
+
+    return true;
+}
+
+const bool PeParser::Is64Bit() const
+{
+    return m_bIs64Bit;
+}
+
+const uint64_t PeParser::ImageBase() const
+{
+    return m_ullImageBase;
+}
+
+const uint32_t PeParser::ImageSize() const
+{
+    return m_uiImageSize;
+}
+
+const uint32_t PeParser::EntryPoint() const
+{
+    return m_uiEntryPoint;
+}
+
+const size_t PeParser::SectionCount() const
+{
+    return m_ulSectionCount;
+}
+
+const PeParser::Section PeParser::GetSection(const size_t ulIndex) const
+{
+    const uint8_t * const pHeader = &m_pSections[ulIndex * ulSectionHeaderSize];
+    Section section = { 0 };
+    section.pName = (const char *)pHeader;
+    section.uiVirtualSize = Read32(&pHeader[8]);
+    section.uiVirtualAddress = Read32(&pHeader[12]);
+    section.uiRawSize = Read32(&pHeader[16]);
+    section.uiRawOffset = Read32(&pHeader[20]);
+    section.uiCharacteristics = Read32(&pHeader[36]);
+    return section;
+}
+
+const bool PeParser::DataDirectory(const uint32_t uiIndex, uint32_t &uiRva, uint32_t &uiSize) const
+{
+    if (uiIndex >= m_uiDirectoryCount)
+    {
+        return false;
+    }
+    uiRva = Read32(&m_pDirectories[uiIndex * ulDirectoryEntrySize]);
+    uiSize = Read32(&m_pDirectories[uiIndex * ulDirectoryEntrySize + 4]);
+    return uiRva != 0 && uiSize != 0;
+}
+
+const bool PeParser::Exports(std::vector<Export> &vecExports) const
+{
+    vecExports.clear();
+    uint32_t uiDirectoryRva = 0;
+    uint32_t uiDirectorySize = 0;
+    if (!DataDirectory(uiDirectoryExport, uiDirectoryRva, uiDirectorySize))
+    {
+        return true;
+    }
+
+    const uint8_t * const pDirectory = RvaToPointer(uiDirectoryRva, ulExportDirectorySize);
+    if (pDirectory == nullptr)
+    {
+        return false;
+    }
+    const uint32_t uiOrdinalBase = Read32(&pDirectory[16]);
+    const size_t ulFunctionCount = Read32(&pDirectory[20]);
+    const size_t ulNameCount = Read32(&pDirectory[24]);
+    if (ulFunctionCount > m_ulViewSize / 4 || ulNameCount > m_ulViewSize / 4)
+    {
+        return false;
+    }
+
+    const uint8_t * const pFunctions = RvaToPointer(Read32(&pDirectory[28]), ulFunctionCount * 4);
+    const uint8_t * const pNames = RvaToPointer(Read32(&pDirectory[32]), ulNameCount * 4);
+    const uint8_t * const pNameOrdinals = RvaToPointer(Read32(&pDirectory[36]), ulNameCount * 2);
+    if (pFunctions == nullptr || (ulNameCount != 0 && (pNames == nullptr || pNameOrdinals == nullptr)))
+    {
+        return false;
+    }
+
+    vecExports.resize(ulFunctionCount);
+    for (size_t i = 0; i < ulFunctionCount; ++i)
+    {
+        Export &entry = vecExports[i];
+        entry.uiRva = Read32(&pFunctions[i * 4]);
+        entry.uiOrdinal = uiOrdinalBase + (uint32_t)i;
+        entry.pName = nullptr;
+
+        //Addresses that point back into the export directory are forwarder strings rather than code
+        const bool bIsForwarder = (entry.uiRva >= uiDirectoryRva && entry.uiRva - uiDirectoryRva < uiDirectorySize);
+        entry.pForwarder = bIsForwarder ? StringAt(entry.uiRva) : nullptr;
+    }
+
+    for (size_t i = 0; i < ulNameCount; ++i)
+    {
+        const uint16_t usIndex = Read16(&pNameOrdinals[i * 2]);
+        if (usIndex < ulFunctionCount)
+        {
+            vecExports[usIndex].pName = StringAt(Read32(&pNames[i * 4]));
+        }
+    }
+
+    vecExports.erase(std::remove_if(vecExports.begin(), vecExports.end(), [](const Export &entry)
+    {
+        return entry.uiRva == 0;
+    }), vecExports.end());
+
+    return true;
+}
+
+const bool PeParser::Imports(std::vector<Import> &vecImports) const
+{
+    vecImports.clear();
+    uint32_t uiDirectoryRva = 0;
+    uint32_t uiDirectorySize = 0;
+    if (!DataDirectory(uiDirectoryImport, uiDirectoryRva, uiDirectorySize))
+    {
+        return true;
+    }
+
+    const size_t ulThunkSize = m_bIs64Bit ? 8 : 4;
+    const uint64_t ullOrdinalFlag = m_bIs64Bit ? 0x8000000000000000ULL : 0x80000000ULL;
+    for (uint32_t uiDescriptor = uiDirectoryRva; ; uiDescriptor += (uint32_t)ulImportDescriptorSize)
+    {
+        const uint8_t * const pDescriptor = RvaToPointer(uiDescriptor, ulImportDescriptorSize);
+        if (pDescriptor == nullptr)
+        {
+            //A table that runs off the view without a terminator is only an error if nothing could be read
+            return uiDescriptor != uiDirectoryRva;
+        }
+
+        const uint32_t uiLookupRva = Read32(&pDescriptor[0]);
+        const uint32_t uiNameRva = Read32(&pDescriptor[12]);
+        const uint32_t uiAddressRva = Read32(&pDescriptor[16]);
+        if (uiNameRva == 0 && uiAddressRva == 0)
+        {
+            break;
+        }
+
+        //Without a lookup table the names are gone once the loader has overwritten the address table
+        const char * const pModule = StringAt(uiNameRva);
+        const uint32_t uiThunksRva = (uiLookupRva != 0) ? uiLookupRva : uiAddressRva;
+        if (pModule == nullptr || (uiLookupRva == 0 && m_layout == eLayout::eImage))
+        {
+            continue;
+        }
+
+        for (uint32_t i = 0; ; ++i)
+        {
+            const uint8_t * const pThunk = RvaToPointer(uiThunksRva + i * (uint32_t)ulThunkSize, ulThunkSize);
+            const uint64_t ullThunk = (pThunk == nullptr) ? 0 : (m_bIs64Bit ? Read64(pThunk) : Read32(pThunk));
+            if (ullThunk == 0)
+            {
+                break;
+            }
+
+            Import entry = { 0 };
+            entry.pModule = pModule;
+            entry.uiThunkRva = uiAddressRva + i * (uint32_t)ulThunkSize;
+            if ((ullThunk & ullOrdinalFlag) != 0)
+            {
+                entry.uiOrdinal = (uint32_t)(ullThunk & 0xFFFF);
+            }
+            else
+            {
+                //Skip the two byte hint in front of the name
+                entry.pName = StringAt((uint32_t)(ullThunk & 0x7FFFFFFF) + 2);
+                if (entry.pName == nullptr)
+                {
+                    continue;
+                }
+            }
+            vecImports.push_back(entry);
+        }
+    }
+
+    return true;
+}
+
+const PeParser::RuntimeFunction * const PeParser::RuntimeFunctions(size_t &ulCount) const
+{
+    ulCount = 0;
+    uint32_t uiDirectoryRva = 0;
+    uint32_t uiDirectorySize = 0;
+    if (!m_bIs64Bit || !DataDirectory(uiDirectoryException, uiDirectoryRva, uiDirectorySize))
+    {
+        return nullptr;
+    }
+
+    const uint8_t * const pTable = RvaToPointer(uiDirectoryRva, uiDirectorySize);
+    if (pTable == nullptr || ((uintptr_t)pTable % sizeof(uint32_t)) != 0)
+    {
+        return nullptr;
+    }
+
+    ulCount = uiDirectorySize / sizeof(RuntimeFunction);
+    return (const RuntimeFunction *)pTable;
+}
+
+const uint8_t * const PeParser::RvaToPointer(const uint32_t uiRva, const size_t ulSize) const
+{
+    size_t ulAvailable = 0;
+    const uint8_t * const pData = Map(uiRva, ulAvailable);
+    return (pData != nullptr && ulAvailable >= ulSize) ? pData : nullptr;
+}
+
+const char * const PeParser::StringAt(const uint32_t uiRva) const
+{
+    size_t ulAvailable = 0;
+    const uint8_t * const pData = Map(uiRva, ulAvailable);
+    return (pData != nullptr && memchr(pData, 0, ulAvailable) != nullptr) ? (const char *)pData : nullptr;
+}
+
+const uint8_t * const PeParser::Map(const uint32_t uiRva, size_t &ulAvailable) const
+{
+    ulAvailable = 0;
+    if (uiRva == 0)
+    {
+        return nullptr;
+    }
+
+    if (m_layout == eLayout::eImage)
+    {
+        if (uiRva >= m_ulViewSize)
+        {
+            return nullptr;
+        }
+        ulAvailable = m_ulViewSize - uiRva;
+        return &m_pView[uiRva];
+    }
+
+    //On disk the headers come first at the same offsets, then each section's raw data
+    size_t ulOffset = 0;
+    size_t ulLimit = 0;
+    if (uiRva < m_uiHeadersSize)
+    {
+        ulOffset = uiRva;
+        ulLimit = m_uiHeadersSize;
+    }
+    else
+    {
+        for (size_t i = 0; i < m_ulSectionCount && ulLimit == 0; ++i)
+        {
+            const Section section = GetSection(i);
+            if (uiRva >= section.uiVirtualAddress && uiRva - section.uiVirtualAddress < section.uiRawSize)
+            {
+                ulOffset = (size_t)section.uiRawOffset + (uiRva - section.uiVirtualAddress);
+                ulLimit = (size_t)section.uiRawOffset + section.uiRawSize;
+            }
+        }
+    }
+
+    ulLimit = std::min(ulLimit, m_ulViewSize);
+    if (ulOffset >= ulLimit)
+    {
+        return nullptr;
+    }
+    ulAvailable = ulLimit - ulOffset;
+    return &m_pView[ulOffset];
+}
+
+}
\ No newline at end of file
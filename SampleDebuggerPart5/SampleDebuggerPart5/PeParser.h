@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CodeReversing
+{
+
+//Zero-copy PE parser over a view of an image, either as it is mapped in memory (RVAs are offsets into the view) or
+//as it is laid out on disk (RVAs go through the section table). Names handed out point into the view and every
+//read is bounds checked against it. Like LengthDecoder it does not depend on Windows so it can be built and checked
+//anywhere.
+class PeParser final
+{
+public:
+    enum class eLayout
+    {
+        eImage,
+        eFile
+    };
+
+    struct Section
+    {
+        const char *pName;
+        uint32_t uiVirtualAddress;
+        uint32_t uiVirtualSize;
+        uint32_t uiRawOffset;
+        uint32_t uiRawSize;
+        uint32_t uiCharacteristics;
+    };
+
+    //pName is null for exports that are only reachable by ordinal, pForwarder is set for "module.function" forwards
+    struct Export
+    {
+        uint32_t uiRva;
+        uint32_t uiOrdinal;
+        const char *pName;
+        const char *pForwarder;
+    };
+
+    //pName is null for imports by ordinal. uiThunkRva is the import address table slot that the loader fills in.
+    struct Import
+    {
+        const char *pModule;
+        const char *pName;
+        uint32_t uiOrdinal;
+        uint32_t uiThunkRva;
+    };
+
+    //Same layout as an x64 .pdata entry, so the table can be handed out in place
+    struct RuntimeFunction
+    {
+        uint32_t uiBegin;
+        uint32_t uiEnd;
+        uint32_t uiUnwindInfo;
+    };
+
+    static const uint32_t uiDirectoryExport = 0;
+    static const uint32_t uiDirectoryImport = 1;
+    static const uint32_t uiDirectoryException = 3;
+    static const uint32_t uiSectionExecute = 0x20000000;
+
+    PeParser() = delete;
+    PeParser(const uint8_t * const pView, const size_t ulViewSize, const eLayout layout);
+
+    PeParser(const PeParser &copy) = delete;
+    PeParser &operator=(const PeParser &copy) = delete;
+
+    ~PeParser() = default;
+
+    const bool Parse();
+
+    const bool Is64Bit() const;
+    const uint64_t ImageBase() const;
+    const uint32_t ImageSize() const;
+    const uint32_t EntryPoint() const;
+
+    const size_t SectionCount() const;
+    const Section GetSection(const size_t ulIndex) const;
+    const bool DataDirectory(const uint32_t uiIndex, uint32_t &uiRva, uint32_t &uiSize) const;
+
+    const bool Exports(std::vector<Export> &vecExports) const;
+    const bool Imports(std::vector<Import> &vecImports) const;
+    const RuntimeFunction * const RuntimeFunctions(size_t &ulCount) const;
+
+    const uint8_t * const RvaToPointer(const uint32_t uiRva, const size_t ulSize) const;
+    const char * const StringAt(const uint32_t uiRva) const;
+
+private:
+    const uint8_t * const Map(const uint32_t uiRva, size_t &ulAvailable) const;
+
+    const uint8_t *m_pView;
+    size_t m_ulViewSize;
+    eLayout m_layout;
+
+    bool m_bIs64Bit;
+    uint64_t m_ullImageBase;
+    uint32_t m_uiImageSize;
+    uint32_t m_uiEntryPoint;
+    uint32_t m_uiHeadersSize;
+    const uint8_t *m_pSections;
+    size_t m_ulSectionCount;
+    const uint8_t *m_pDirectories;
+    uint32_t m_uiDirectoryCount;
+};
+
+}
\ No newline at end of file
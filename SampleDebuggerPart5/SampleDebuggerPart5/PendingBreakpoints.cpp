@@ -0,0 +1,294 @@
+#include "PendingBreakpoints.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#include "Debugger.h"
+#include "Stopwatch.h"
+#include "Symbols.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const std::string ToLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](const char c) { return (char)tolower((unsigned char)c); });
+    return str;
+}
+
+const bool IsPattern(const std::string &str)
+{
+    return str.find_first_of("*?") != std::string::npos;
+}
+
+}
+
+PendingBreakpoints::PendingBreakpoints(Debugger *pDebugger, Symbols *pSymbols) : m_pDebugger{ pDebugger },
+    m_pSymbols{ pSymbols }, m_uiNextId{ 1 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool PendingBreakpoints::Add(const char * const pSpec, unsigned int &uiId)
+{
+    const std::string strSpec(pSpec);
+    const size_t ulBang = strSpec.find('!');
+    PendingSpec spec;
+    spec.strSpec = strSpec;
+    spec.strModule = (ulBang != std::string::npos) ? ToLower(strSpec.substr(0, ulBang)) : "*";
+    spec.strSymbol = (ulBang != std::string::npos) ? strSpec.substr(ulBang + 1) : strSpec;
+    spec.bIsModulePattern = IsPattern(spec.strModule);
+    spec.bIsSymbolPattern = IsPattern(spec.strSymbol);
+    spec.ullResolved = 0;
+    if (spec.strModule.empty() || spec.strSymbol.empty())
+    {
+        fprintf(stderr, "Expected module!symbol, got %s.\n", pSpec);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uiId = m_uiNextId++;
+    PendingSpec &newSpec = m_mapSpecs[uiId];
+    newSpec = std::move(spec);
+    if (newSpec.bIsModulePattern)
+    {
+        m_vecModulePatterns.push_back(uiId);
+    }
+    else
+    {
+        IndexSpec(uiId, newSpec, m_mapModules[newSpec.strModule]);
+    }
+
+    //Modules that are already loaded never raise another load event
+    SpecIndex index;
+    IndexSpec(uiId, newSpec, index);
+    const std::vector<const SpecIndex *> vecIndexes{ &index };
+    size_t ulPlaced = 0;
+    auto &symbols = m_pSymbols->SymbolList();
+    for (auto module = symbols.begin(); module != symbols.end(); module = symbols.upper_bound(module->first))
+    {
+        if (Symbols::WildcardMatch(newSpec.strModule.c_str(), Symbols::ModuleStem(module->second.strName.data()).c_str()))
+        {
+            ulPlaced += Resolve(module->first, vecIndexes);
+        }
+    }
+    fprintf(stderr, "Pending breakpoint %u on %s, %Iu placed in loaded modules.\n", uiId, pSpec, ulPlaced);
+
+    return true;
+}
+
+const bool PendingBreakpoints::Remove(const unsigned int uiId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto spec = m_mapSpecs.find(uiId);
+    if (spec == m_mapSpecs.end())
+    {
+        fprintf(stderr, "No pending breakpoint %u.\n", uiId);
+        return false;
+    }
+
+    //Breakpoints it already placed are ordinary breakpoints now and stay where they are
+    if (spec->second.bIsModulePattern)
+    {
+        m_vecModulePatterns.erase(std::remove(m_vecModulePatterns.begin(), m_vecModulePatterns.end(), uiId),
+            m_vecModulePatterns.end());
+    }
+    else
+    {
+        auto module = m_mapModules.find(spec->second.strModule);
+        if (module != m_mapModules.end())
+        {
+            SpecIndex &index = module->second;
+            if (spec->second.bIsSymbolPattern)
+            {
+                index.vecPatterns.erase(std::remove(index.vecPatterns.begin(), index.vecPatterns.end(), uiId),
+                    index.vecPatterns.end());
+            }
+            else
+            {
+                auto exact = index.mapExact.find(spec->second.strSymbol);
+                if (exact != index.mapExact.end())
+                {
+                    exact->second.erase(std::remove(exact->second.begin(), exact->second.end(), uiId), exact->second.end());
+                    if (exact->second.empty())
+                    {
+                        index.mapExact.erase(exact);
+                    }
+                }
+            }
+            if (index.mapExact.empty() && index.vecPatterns.empty())
+            {
+                m_mapModules.erase(module);
+            }
+        }
+    }
+    m_mapSpecs.erase(spec);
+
+    return true;
+}
+
+const size_t PendingBreakpoints::ResolveModule(const DWORD_PTR dwModuleBase, const char * const pModulePath)
+{
+    Stopwatch clock;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_stats.ullLoads;
+
+    const std::string strModule = ToLower(Symbols::ModuleStem(pModulePath));
+    std::vector<const SpecIndex *> vecIndexes;
+    auto module = m_mapModules.find(strModule);
+    if (module != m_mapModules.end())
+    {
+        vecIndexes.push_back(&module->second);
+    }
+
+    //Wildcard modules cannot be looked up, but there are few of them and each is one match against the name
+    SpecIndex patternIndex;
+    for (auto uiId : m_vecModulePatterns)
+    {
+        const PendingSpec &spec = m_mapSpecs.find(uiId)->second;
+        if (Symbols::WildcardMatch(spec.strModule.c_str(), strModule.c_str()))
+        {
+            IndexSpec(uiId, spec, patternIndex);
+        }
+    }
+    if (!patternIndex.mapExact.empty() || !patternIndex.vecPatterns.empty())
+    {
+        vecIndexes.push_back(&patternIndex);
+    }
+
+    size_t ulPlaced = 0;
+    if (!vecIndexes.empty())
+    {
+        ++m_stats.ullMatchedLoads;
+        ulPlaced = Resolve(dwModuleBase, vecIndexes);
+        fprintf(stderr, "Resolved %Iu pending breakpoints in %s.\n", ulPlaced, pModulePath);
+    }
+
+    const double dMicroseconds = clock.ElapsedMicroseconds();
+    m_stats.dResolveMicroseconds += dMicroseconds;
+    m_stats.dMaxResolveMicroseconds = (std::max)(m_stats.dMaxResolveMicroseconds, dMicroseconds);
+
+    return ulPlaced;
+}
+
+void PendingBreakpoints::PrintPending() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &spec : m_mapSpecs)
+    {
+        fprintf(stderr, "%u: %s, %I64u symbols resolved.\n", spec.first, spec.second.strSpec.c_str(),
+            spec.second.ullResolved);
+    }
+}
+
+void PendingBreakpoints::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dLoads = (m_stats.ullLoads != 0) ? (double)m_stats.ullLoads : 1.0;
+    fprintf(stderr, "Pending breakpoints: %Iu specs, %Iu indexed modules, %Iu wildcard modules.\n"
+        "%I64u loads, %I64u matched, %I64u symbols scanned, %I64u breakpoints placed, %I64u skipped. "
+        "%.2f us per load on average, %.2f us at most.\n", m_mapSpecs.size(), m_mapModules.size(),
+        m_vecModulePatterns.size(), m_stats.ullLoads, m_stats.ullMatchedLoads, m_stats.ullSymbolsScanned,
+        m_stats.ullPlaced, m_stats.ullSkipped, m_stats.dResolveMicroseconds / dLoads, m_stats.dMaxResolveMicroseconds);
+}
+
+void PendingBreakpoints::IndexSpec(const unsigned int uiId, const PendingSpec &spec, SpecIndex &index) const
+{
+    if (spec.bIsSymbolPattern)
+    {
+        index.vecPatterns.push_back(uiId);
+    }
+    else
+    {
+        index.mapExact[spec.strSymbol].push_back(uiId);
+    }
+}
+
+const size_t PendingBreakpoints::Resolve(const DWORD_PTR dwModuleBase, const std::vector<const SpecIndex *> &vecIndexes)
+{
+    std::vector<PendingSpec *> vecPatterns;
+    for (auto pIndex : vecIndexes)
+    {
+        for (auto uiId : pIndex->vecPatterns)
+        {
+            vecPatterns.push_back(&m_mapSpecs.find(uiId)->second);
+        }
+    }
+
+    //Only the new module's own symbols are walked, each one a hash lookup plus the symbol patterns
+    std::set<DWORD_PTR> setAddresses;
+    std::string strName;
+    auto symbols = m_pSymbols->SymbolList().equal_range(dwModuleBase);
+    for (auto symbol = symbols.first; symbol != symbols.second; ++symbol)
+    {
+        const SymbolInfo &symbolInfo = symbol->second.symbolInfo;
+        const char * const pName = symbolInfo.strName.data();
+        strName.assign(pName);
+        bool bIsMatch = false;
+        for (auto pIndex : vecIndexes)
+        {
+            auto exact = pIndex->mapExact.find(strName);
+            if (exact != pIndex->mapExact.end())
+            {
+                for (auto uiId : exact->second)
+                {
+                    ++m_mapSpecs.find(uiId)->second.ullResolved;
+                }
+                bIsMatch = true;
+            }
+        }
+        for (auto pSpec : vecPatterns)
+        {
+            if (Symbols::WildcardMatch(pSpec->strSymbol.c_str(), pName))
+            {
+                ++pSpec->ullResolved;
+                bIsMatch = true;
+            }
+        }
+        if (bIsMatch)
+        {
+            setAddresses.insert(symbolInfo.dwAddress);
+        }
+        ++m_stats.ullSymbolsScanned;
+    }
+
+    size_t ulPlaced = 0;
+    MEMORY_BASIC_INFORMATION region = { 0 };
+    for (auto dwAddress : setAddresses)
+    {
+        if (!IsCode(dwAddress, region) || m_pDebugger->FindBreakpoint(dwAddress) != nullptr)
+        {
+            ++m_stats.ullSkipped;
+            continue;
+        }
+        if (m_pDebugger->AddBreakpoint(dwAddress))
+        {
+            ++ulPlaced;
+        }
+    }
+    m_stats.ullPlaced += ulPlaced;
+
+    return ulPlaced;
+}
+
+const bool PendingBreakpoints::IsCode(const DWORD_PTR dwAddress, MEMORY_BASIC_INFORMATION &region) const
+{
+    //Patterns also match PDB data symbols, which must never get an int 3 written into them
+    if (dwAddress < (DWORD_PTR)region.BaseAddress || dwAddress - (DWORD_PTR)region.BaseAddress >= region.RegionSize)
+    {
+        if (VirtualQueryEx(m_pDebugger->Handle(), (LPCVOID)dwAddress, &region, sizeof(MEMORY_BASIC_INFORMATION)) == 0)
+        {
+            return false;
+        }
+    }
+
+    return (region.Protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+class Symbols;
+
+//Breakpoints given as "module!symbol" that stay pending until a matching module is loaded. Either side may hold
+//* and ? wildcards; a spec without a module matches every module. Specs are indexed by module name, and exact symbol
+//names by name, so a DLL load only looks at the specs naming that module plus the few with a wildcard module, and
+//walks the symbols of the new module alone, once. Specs stay pending after they resolve so a module that is unloaded
+//and loaded again gets its breakpoints back.
+class PendingBreakpoints final
+{
+public:
+    PendingBreakpoints() = delete;
+    PendingBreakpoints(Debugger *pDebugger, Symbols *pSymbols);
+
+    PendingBreakpoints(const PendingBreakpoints &copy) = delete;
+    PendingBreakpoints &operator=(const PendingBreakpoints &copy) = delete;
+
+    ~PendingBreakpoints() = default;
+
+    //Also resolves the spec against the modules that are already loaded
+    const bool Add(const char * const pSpec, unsigned int &uiId);
+    const bool Remove(const unsigned int uiId);
+
+    //Called from the load handler once the module's symbols are in; returns the number of breakpoints placed
+    const size_t ResolveModule(const DWORD_PTR dwModuleBase, const char * const pModulePath);
+
+    void PrintPending() const;
+    void PrintStats() const;
+
+private:
+    struct PendingSpec
+    {
+        std::string strSpec;
+        std::string strModule;
+        std::string strSymbol;
+        bool bIsModulePattern;
+        bool bIsSymbolPattern;
+        unsigned long long ullResolved;
+    };
+
+    //Exact symbol names are looked up per symbol; patterns are matched against each symbol of the module
+    struct SpecIndex
+    {
+        std::unordered_map<std::string, std::vector<unsigned int>> mapExact;
+        std::vector<unsigned int> vecPatterns;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullLoads;
+        unsigned long long ullMatchedLoads;
+        unsigned long long ullSymbolsScanned;
+        unsigned long long ullPlaced;
+        unsigned long long ullSkipped;
+        double dResolveMicroseconds;
+        double dMaxResolveMicroseconds;
+    };
+
+    void IndexSpec(const unsigned int uiId, const PendingSpec &spec, SpecIndex &index) const;
+    const size_t Resolve(const DWORD_PTR dwModuleBase, const std::vector<const SpecIndex *> &vecIndexes);
+    const bool IsCode(const DWORD_PTR dwAddress, MEMORY_BASIC_INFORMATION &region) const;
+
+    Debugger * const m_pDebugger;
+    Symbols * const m_pSymbols;
+
+    //Guards everything below; the console adds specs while modules load on the debugger thread
+    mutable std::mutex m_mutex;
+    unsigned int m_uiNextId;
+    std::map<unsigned int, PendingSpec> m_mapSpecs;
+    std::unordered_map<std::string /*lower case module*/, SpecIndex> m_mapModules;
+    std::vector<unsigned int> m_vecModulePatterns;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "RangePlan.h"
+
+namespace CodeReversing
+{
+
+RangePlan::RangePlan() : m_ullStart{ 0 }, m_ullEnd{ 0 }, m_ullCallStack{ 0 }
+{
+}
+
+void RangePlan::SetRange(const uint64_t ullStart, const uint64_t ullEnd)
+{
+    m_ullStart = ullStart;
+    m_ullEnd = ullEnd;
+}
+
+const bool RangePlan::Contains(const uint64_t ullAddress) const
+{
+    return ullAddress >= m_ullStart && ullAddress < m_ullEnd;
+}
+
+const RangePlan::Step RangePlan::Next(const uint64_t ullAddress, const InstructionSource &source) const
+{
+    uint8_t uiLength = 0;
+    eBranchType branchType = eBranchType::eNone;
+    if (!source(ullAddress, uiLength, branchType))
+    {
+        return Step{ eAction::eSingleStep, 0 };
+    }
+
+    if (branchType == eBranchType::eCall)
+    {
+        return Step{ eAction::eStepOverCall, ullAddress + uiLength };
+    }
+
+    //Branches are taken with the trap flag; everything up to the next one or the end of the range runs without stopping
+    if (branchType != eBranchType::eNone)
+    {
+        return Step{ eAction::eSingleStep, 0 };
+    }
+    uint64_t ullRunEnd = ullAddress + uiLength;
+    for (size_t i = 0; i < ulMaxScanInstructions && Contains(ullRunEnd); ++i)
+    {
+        if (!source(ullRunEnd, uiLength, branchType) || branchType != eBranchType::eNone)
+        {
+            break;
+        }
+        ullRunEnd += uiLength;
+    }
+
+    return Step{ eAction::eRunTo, ullRunEnd };
+}
+
+void RangePlan::EnterCall(const uint64_t ullStack)
+{
+    m_ullCallStack = ullStack;
+}
+
+const bool RangePlan::IsInCall() const
+{
+    return m_ullCallStack != 0;
+}
+
+const bool RangePlan::IsReturnToCaller(const uint64_t ullStack) const
+{
+    return ullStack >= m_ullCallStack;
+}
+
+void RangePlan::LeaveCall()
+{
+    m_ullCallStack = 0;
+}
+
+}
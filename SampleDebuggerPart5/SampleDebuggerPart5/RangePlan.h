@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "LengthDecoder.h"
+
+namespace CodeReversing
+{
+
+//Returns the length and branch class of the instruction at an address, or false if it cannot be decoded
+typedef std::function<const bool(const uint64_t ullAddress, uint8_t &uiLength, eBranchType &branchType)> InstructionSource;
+
+//The stepping decisions behind RangeStepper: where the thread may run freely, which calls to step over, and whether a
+//hit on a call's return address belongs to the call being stepped over or to a deeper recursion of it. It only looks
+//at addresses and stack pointers, so like LengthDecoder it does not depend on Windows and can be checked anywhere.
+class RangePlan final
+{
+public:
+    enum class eAction
+    {
+        eSingleStep,
+        eRunTo,
+        eStepOverCall
+    };
+
+    struct Step
+    {
+        eAction action;
+        uint64_t ullStopAddress;
+    };
+
+    RangePlan();
+
+    RangePlan(const RangePlan &copy) = delete;
+    RangePlan &operator=(const RangePlan &copy) = delete;
+
+    ~RangePlan() = default;
+
+    void SetRange(const uint64_t ullStart, const uint64_t ullEnd);
+    const bool Contains(const uint64_t ullAddress) const;
+
+    //What to do with the thread sitting at ullAddress, which must be inside the range
+    const Step Next(const uint64_t ullAddress, const InstructionSource &source) const;
+
+    //ullStack is the stack pointer at the call instruction, before the return address is pushed. The call has
+    //returned once the stack is back there; a hit on the return address with anything lower is a recursive call.
+    void EnterCall(const uint64_t ullStack);
+    const bool IsInCall() const;
+    const bool IsReturnToCaller(const uint64_t ullStack) const;
+    void LeaveCall();
+
+    //Straight-line scans stop here so that one run never covers an unbounded amount of code
+    static const size_t ulMaxScanInstructions = 256;
+
+private:
+    uint64_t m_ullStart;
+    uint64_t m_ullEnd;
+    uint64_t m_ullCallStack;
+};
+
+}
@@ -0,0 +1,350 @@
+#include "RangeStepper.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Line numbers the compiler gives to code that belongs to no statement; stepping treats them as part of the current line
+const DWORD dwHiddenLine = 0xFEEFEE;
+const DWORD dwHiddenLineAlternate = 0xF00F00;
+
+void CloseThreadHandle(SafeHandle &hThread)
+{
+    if (hThread() != INVALID_HANDLE_VALUE)
+    {
+        (void)CloseHandle(hThread());
+        hThread = INVALID_HANDLE_VALUE;
+    }
+}
+
+}
+
+RangeStepper::RangeStepper(Debugger *pDebugger, Symbols *pSymbols) : m_pDebugger{ pDebugger }, m_pSymbols{ pSymbols },
+    m_bIsActive{ false }, m_bIsLineStep{ false }, m_dwThreadId{ 0 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool RangeStepper::StartRange(const DWORD dwThreadId, const DWORD_PTR dwStart, const DWORD_PTR dwEnd)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (dwStart >= dwEnd)
+    {
+        fprintf(stderr, "Range %p - %p is empty.\n", dwStart, dwEnd);
+        return false;
+    }
+
+    m_bIsLineStep = false;
+    m_plan.SetRange(dwStart, dwEnd);
+    return Start(dwThreadId);
+}
+
+const bool RangeStepper::StartLine(const DWORD dwThreadId)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_bIsLineStep = true;
+    return Start(dwThreadId);
+}
+
+void RangeStepper::Cancel()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (m_bIsActive)
+    {
+        Finish("cancelled");
+    }
+}
+
+const bool RangeStepper::IsActive() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    return m_bIsActive;
+}
+
+const RangeStepper::eResult RangeStepper::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (!m_bIsActive || m_pStopPoint == nullptr || !m_pStopPoint->IsEnabled() || m_pStopPoint->Address() != dwAddress)
+    {
+        return eResult::eNotOwned;
+    }
+    if (dbgEvent.dwThreadId != m_dwThreadId)
+    {
+        return StepOverForeignHit(dbgEvent, dwAddress);
+    }
+
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", m_dwThreadId, GetLastError());
+        (void)m_pStopPoint->Disable();
+        Finish("lost the thread context");
+        return eResult::eFinished;
+    }
+
+    //A recursive call returning to the same address is still below the caller that is being stepped over
+    if (m_plan.IsInCall() && !m_plan.IsReturnToCaller(StackPointer(ctx)))
+    {
+        return StepOverForeignHit(dbgEvent, dwAddress);
+    }
+
+    (void)m_pStopPoint->Disable();
+    m_plan.LeaveCall();
+    SetInstructionPointer(ctx, dwAddress);
+    const eResult result = Advance(ctx);
+    if (!BOOLIFY(SetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set context of thread %X. Error = %X\n", m_dwThreadId, GetLastError());
+    }
+
+    return result;
+}
+
+const RangeStepper::eResult RangeStepper::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dbgEvent.dwThreadId);
+    if (rearm != m_mapRearms.end())
+    {
+        if (m_bIsActive && m_pStopPoint != nullptr && m_pStopPoint->Address() == rearm->second && !m_pStopPoint->IsEnabled())
+        {
+            (void)m_pStopPoint->Enable();
+        }
+        m_mapRearms.erase(rearm);
+        return eResult::eContinue;
+    }
+    if (!m_bIsActive || dbgEvent.dwThreadId != m_dwThreadId)
+    {
+        return eResult::eNotOwned;
+    }
+
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", m_dwThreadId, GetLastError());
+        Finish("lost the thread context");
+        return eResult::eFinished;
+    }
+
+    const eResult result = Advance(ctx);
+    if (!BOOLIFY(SetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set context of thread %X. Error = %X\n", m_dwThreadId, GetLastError());
+    }
+
+    return result;
+}
+
+void RangeStepper::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    (void)m_mapRearms.erase(dwThreadId);
+    if (m_bIsActive && dwThreadId == m_dwThreadId)
+    {
+        Finish("thread exited");
+    }
+}
+
+void RangeStepper::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (m_pStopPoint != nullptr && m_pStopPoint->IsEnabled() && m_pStopPoint->Address() >= dwAddress &&
+        m_pStopPoint->Address() - dwAddress < ulSize)
+    {
+        pBytes[m_pStopPoint->Address() - dwAddress] = m_pStopPoint->OriginalByte();
+    }
+}
+
+void RangeStepper::PrintStats() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    fprintf(stderr, "Range stepper: %I64u ranges, %I64u single steps, %I64u runs to a branch, %I64u calls stepped over, "
+        "%I64u hits by other threads, %.2f ms stepping.\n", m_stats.ullRanges, m_stats.ullSteps, m_stats.ullRuns,
+        m_stats.ullCallsStepped, m_stats.ullForeignHits, m_stats.dElapsedMicroseconds / 1000.0);
+}
+
+const bool RangeStepper::Start(const DWORD dwThreadId)
+{
+    if (m_bIsActive)
+    {
+        fprintf(stderr, "Thread %X is already range stepping.\n", m_dwThreadId);
+        return false;
+    }
+
+    m_hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dwThreadId, GetLastError());
+        CloseThreadHandle(m_hThread);
+        return false;
+    }
+
+    if (m_bIsLineStep)
+    {
+        if (!m_pSymbols->LineRangeFromAddress(InstructionPointer(ctx), m_line))
+        {
+            fprintf(stderr, "No line information for %p.\n", InstructionPointer(ctx));
+            CloseThreadHandle(m_hThread);
+            return false;
+        }
+        m_plan.SetRange(m_line.dwStart, m_line.dwEnd);
+    }
+
+    //The first instruction is always single-stepped; it may sit on a breakpoint that is waiting for that step to re-arm
+    ctx.EFlags |= 0x100;
+    if (!BOOLIFY(SetThreadContext(m_hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set trap flag on thread %X. Error = %X\n", dwThreadId, GetLastError());
+        CloseThreadHandle(m_hThread);
+        return false;
+    }
+
+    m_dwThreadId = dwThreadId;
+    m_plan.LeaveCall();
+    m_bIsActive = true;
+    ++m_stats.ullRanges;
+    m_clock.Start();
+
+    return true;
+}
+
+const RangeStepper::eResult RangeStepper::Advance(CONTEXT &ctx)
+{
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    ctx.EFlags &= ~0x100;
+
+    const DWORD_PTR dwAddress = InstructionPointer(ctx);
+    if (!m_plan.Contains(dwAddress) && !(m_bIsLineStep && IsSameLine(dwAddress)))
+    {
+        Finish("left the range");
+        return eResult::eFinished;
+    }
+
+    Disassembler * const pDisassembler = m_pDebugger->ProcessDisassembler();
+    const RangePlan::Step step = m_plan.Next(dwAddress, [pDisassembler](const uint64_t ullAddress, uint8_t &uiLength,
+        eBranchType &branchType)
+    {
+        DecodedInstruction instruction = { 0 };
+        if (!pDisassembler->Decode((DWORD_PTR)ullAddress, instruction))
+        {
+            return false;
+        }
+        uiLength = instruction.cLength;
+        branchType = instruction.branchType;
+        return true;
+    });
+
+    if (step.action == RangePlan::eAction::eStepOverCall && PlaceStopPoint((DWORD_PTR)step.ullStopAddress))
+    {
+        m_plan.EnterCall(StackPointer(ctx));
+        ++m_stats.ullCallsStepped;
+        return eResult::eContinue;
+    }
+    if (step.action == RangePlan::eAction::eRunTo && PlaceStopPoint((DWORD_PTR)step.ullStopAddress))
+    {
+        ++m_stats.ullRuns;
+        return eResult::eContinue;
+    }
+
+    ctx.EFlags |= 0x100;
+    ++m_stats.ullSteps;
+    return eResult::eContinue;
+}
+
+const bool RangeStepper::PlaceStopPoint(const DWORD_PTR dwAddress)
+{
+    //A user breakpoint there will stop the thread anyway, and sharing its byte would confuse both
+    if (m_pDebugger->FindBreakpoint(dwAddress) != nullptr)
+    {
+        return false;
+    }
+
+    if (m_pStopPoint == nullptr)
+    {
+        m_pStopPoint = std::unique_ptr<InterruptBreakpoint>(new InterruptBreakpoint(m_pDebugger->Handle(), dwAddress,
+            m_pDebugger->ProcessPatches()));
+    }
+    else
+    {
+        if (m_pStopPoint->IsEnabled())
+        {
+            (void)m_pStopPoint->Disable();
+        }
+        m_pStopPoint->ChangeAddress(dwAddress);
+    }
+
+    return m_pStopPoint->Enable();
+}
+
+const bool RangeStepper::IsSameLine(const DWORD_PTR dwAddress)
+{
+    LineRange line;
+    if (!m_pSymbols->LineRangeFromAddress(dwAddress, line))
+    {
+        return false;
+    }
+
+    const bool bIsHidden = (line.dwLineNumber == dwHiddenLine || line.dwLineNumber == dwHiddenLineAlternate);
+    if (!bIsHidden && (line.dwLineNumber != m_line.dwLineNumber || line.strFileName != m_line.strFileName))
+    {
+        return false;
+    }
+
+    //Loops and inlined code split one line into several ranges; stepping carries on in whichever one was entered
+    m_plan.SetRange(line.dwStart, line.dwEnd);
+    return true;
+}
+
+void RangeStepper::Finish(const char * const pReason)
+{
+    if (m_pStopPoint != nullptr && m_pStopPoint->IsEnabled())
+    {
+        (void)m_pStopPoint->Disable();
+    }
+    m_bIsActive = false;
+    m_plan.LeaveCall();
+    CloseThreadHandle(m_hThread);
+
+    const double dElapsedMicroseconds = m_clock.ElapsedMicroseconds();
+    m_stats.dElapsedMicroseconds += dElapsedMicroseconds;
+    fprintf(stderr, "Range step of thread %X finished after %.2f ms: %s.\n", m_dwThreadId, dElapsedMicroseconds / 1000.0,
+        pReason);
+}
+
+const RangeStepper::eResult RangeStepper::StepOverForeignHit(const DEBUG_EVENT &dbgEvent, const DWORD_PTR dwAddress)
+{
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        return eResult::eContinue;
+    }
+
+    SetInstructionPointer(ctx, dwAddress);
+    ctx.EFlags |= 0x100;
+    if (m_pStopPoint->Disable() && BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        m_mapRearms[dbgEvent.dwThreadId] = dwAddress;
+    }
+    ++m_stats.ullForeignHits;
+
+    return eResult::eContinue;
+}
+
+}
\ No newline at end of file
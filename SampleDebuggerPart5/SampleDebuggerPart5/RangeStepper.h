@@ -0,0 +1,97 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <Windows.h>
+
+#include "InterruptBreakpoint.h"
+#include "RangePlan.h"
+#include "SafeHandle.h"
+#include "Stopwatch.h"
+#include "Symbols.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Steps a thread while its instruction pointer stays inside an address range, or inside the current source line,
+//without going back to the console. Straight-line code up to the next branch runs at full speed under a temporary
+//int 3, branches are taken with the trap flag, and calls are stepped over by breaking on the return address once the
+//stack is back at the caller's level. The console only wakes up once the range has been left.
+class RangeStepper final
+{
+public:
+    enum class eResult
+    {
+        eNotOwned,
+        eContinue,
+        eFinished
+    };
+
+    RangeStepper() = delete;
+    RangeStepper(Debugger *pDebugger, Symbols *pSymbols);
+
+    RangeStepper(const RangeStepper &copy) = delete;
+    RangeStepper &operator=(const RangeStepper &copy) = delete;
+
+    ~RangeStepper() = default;
+
+    //The thread has to be stopped; stepping starts when it is continued
+    const bool StartRange(const DWORD dwThreadId, const DWORD_PTR dwStart, const DWORD_PTR dwEnd);
+    const bool StartLine(const DWORD dwThreadId);
+    void Cancel();
+    const bool IsActive() const;
+
+    const eResult HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const eResult HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+    void PrintStats() const;
+
+private:
+    struct Stats
+    {
+        unsigned long long ullRanges;
+        unsigned long long ullSteps;
+        unsigned long long ullRuns;
+        unsigned long long ullCallsStepped;
+        unsigned long long ullForeignHits;
+        double dElapsedMicroseconds;
+    };
+
+    const bool Start(const DWORD dwThreadId);
+    const eResult Advance(CONTEXT &ctx);
+    const bool PlaceStopPoint(const DWORD_PTR dwAddress);
+    const bool IsSameLine(const DWORD_PTR dwAddress);
+    void Finish(const char * const pReason);
+    const eResult StepOverForeignHit(const DEBUG_EVENT &dbgEvent, const DWORD_PTR dwAddress);
+
+    Debugger * const m_pDebugger;
+    Symbols * const m_pSymbols;
+
+    //Guards everything below; the debugger thread drives the step while the console may cancel it. Recursive because
+    //decoding in Advance reads code through the byte filter, which comes back to RestoreOriginalBytes.
+    mutable std::recursive_mutex m_mutex;
+    bool m_bIsActive;
+    bool m_bIsLineStep;
+    DWORD m_dwThreadId;
+    SafeHandle m_hThread;
+    LineRange m_line;
+    RangePlan m_plan;
+
+    //A single int 3 is either the end of a straight-line run or, while the plan is in a call, the call's return address
+    std::unique_ptr<InterruptBreakpoint> m_pStopPoint;
+
+    //Other threads that ran into the stop point and are single-stepping over it
+    std::map<DWORD, DWORD_PTR> m_mapRearms;
+
+    Stopwatch m_clock;
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
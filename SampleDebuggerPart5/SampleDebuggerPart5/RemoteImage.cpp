@@ -0,0 +1,78 @@
+#include "RemoteImage.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "PeParser.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulPageSize = 0x1000;
+
+}
+
+RemoteImage::RemoteImage(const HANDLE hProcess, const DWORD_PTR dwModuleBase) : m_hProcess{ hProcess },
+    m_dwModuleBase{ dwModuleBase }
+{
+}
+
+const bool RemoteImage::Read()
+{
+    //The headers always fit in the first page
+    unsigned char pHeaders[ulPageSize] = { 0 };
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)m_dwModuleBase, pHeaders, sizeof(pHeaders), &ulBytesRead)))
+    {
+        fprintf(stderr, "Could not read PE headers at %p. Error = %X\n", (void *)m_dwModuleBase, GetLastError());
+        return false;
+    }
+
+    PeParser parser(pHeaders, ulBytesRead, PeParser::eLayout::eImage);
+    if (!parser.Parse() || parser.ImageSize() == 0)
+    {
+        fprintf(stderr, "No PE image at %p.\n", (void *)m_dwModuleBase);
+        return false;
+    }
+
+    const size_t ulImageSize = parser.ImageSize();
+    m_vecImage.resize(ulImageSize);
+    if (!(BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)m_dwModuleBase, m_vecImage.data(), ulImageSize, &ulBytesRead)) &&
+        ulBytesRead == ulImageSize))
+    {
+        //Images can contain reserved or guarded pages; keep whatever is readable
+        for (size_t ulOffset = 0; ulOffset < ulImageSize; ulOffset += ulPageSize)
+        {
+            const size_t ulSize = std::min(ulPageSize, ulImageSize - ulOffset);
+            if (!(BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(m_dwModuleBase + ulOffset), &m_vecImage[ulOffset], ulSize,
+                &ulBytesRead)) && ulBytesRead == ulSize))
+            {
+                memset(&m_vecImage[ulOffset], 0, ulSize);
+            }
+        }
+    }
+
+    return true;
+}
+
+const unsigned char * const RemoteImage::Data() const
+{
+    return m_vecImage.data();
+}
+
+const size_t RemoteImage::Size() const
+{
+    return m_vecImage.size();
+}
+
+const DWORD_PTR RemoteImage::Base() const
+{
+    return m_dwModuleBase;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+//Copy of a module image as it is mapped in the target. Pages that cannot be read are left zeroed so RVAs stay
+//valid offsets into the copy, which can then be handed to PeParser as an image layout view.
+class RemoteImage final
+{
+public:
+    RemoteImage() = delete;
+    RemoteImage(const HANDLE hProcess, const DWORD_PTR dwModuleBase);
+
+    RemoteImage(const RemoteImage &copy) = delete;
+    RemoteImage &operator=(const RemoteImage &copy) = delete;
+
+    ~RemoteImage() = default;
+
+    const bool Read();
+
+    const unsigned char * const Data() const;
+    const size_t Size() const;
+    const DWORD_PTR Base() const;
+
+private:
+    HANDLE m_hProcess;
+    DWORD_PTR m_dwModuleBase;
+    std::vector<unsigned char> m_vecImage;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,401 @@
+#include "SamplingProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <TlHelp32.h>
+
+#include "BinaryWriter.h"
+#include "Common.h"
+#include "Debugger.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//New threads are picked up this often; exited ones drop out as soon as they fail to suspend
+const double dRefreshMicroseconds = 250000.0;
+
+const ULONGLONG HashFrames(const DWORD * const pFrameIds, const size_t ulCount)
+{
+    ULONGLONG ullHash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < ulCount; ++i)
+    {
+        ullHash = (ullHash ^ pFrameIds[i]) * 0x100000001B3ULL;
+    }
+    return ullHash;
+}
+
+//SafeHandle only closes on destruction, so handles that are dropped early are closed here
+void CloseThreadHandle(SafeHandle &hThread)
+{
+    if (hThread() != INVALID_HANDLE_VALUE)
+    {
+        (void)CloseHandle(hThread());
+        hThread = INVALID_HANDLE_VALUE;
+    }
+}
+
+}
+
+SamplingProfiler::SamplingProfiler(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_unwinder{ pDebugger->Handle() },
+    m_bIsRunning{ false }, m_ulMaxFrames{ 0 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+    Stop();
+}
+
+const bool SamplingProfiler::Start(const unsigned int uiFrequency, const size_t ulMaxFrames /*= 128*/)
+{
+    if (m_bIsRunning || uiFrequency == 0 || ulMaxFrames == 0)
+    {
+        return false;
+    }
+
+    m_ulMaxFrames = ulMaxFrames;
+    m_vecCapture.resize(ulMaxFrames);
+    m_vecCaptureIds.reserve(ulMaxFrames);
+    m_bIsRunning = true;
+    m_sampler = std::thread(&SamplingProfiler::Run, this, uiFrequency);
+
+    return true;
+}
+
+void SamplingProfiler::Stop()
+{
+    m_bIsRunning = false;
+    if (m_sampler.joinable())
+    {
+        m_sampler.join();
+    }
+
+    //Thread handles are not worth keeping between runs, the counts are
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &thread : m_mapThreads)
+    {
+        CloseThreadHandle(thread.second.hThread);
+    }
+}
+
+void SamplingProfiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mapThreads.clear();
+    m_mapFrameIds.clear();
+    m_vecFrames.clear();
+    m_vecStackFrames.clear();
+    m_vecStacks.clear();
+    m_mapStackIds.clear();
+    m_mapCounts.clear();
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool SamplingProfiler::IsRunning() const
+{
+    return m_bIsRunning;
+}
+
+void SamplingProfiler::RemoveModule(const DWORD_PTR dwModuleBase)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unwinder.RemoveModule(dwModuleBase);
+}
+
+void SamplingProfiler::Run(const unsigned int uiFrequency)
+{
+    const double dInterval = 1000000.0 / uiFrequency;
+    Stopwatch clock;
+    double dNextTick = 0.0;
+    double dLastRefresh = -dRefreshMicroseconds;
+
+    while (m_bIsRunning)
+    {
+        const double dNow = clock.ElapsedMicroseconds();
+        if (dNow < dNextTick)
+        {
+            //Sleep is only as fine as the system timer, so the achieved rate is reported rather than assumed
+            Sleep((DWORD)((dNextTick - dNow) / 1000.0));
+            continue;
+        }
+
+        //A tick that ran long does not cause a burst of catch-up samples
+        dNextTick = std::max(dNextTick + dInterval, dNow);
+
+        Stopwatch busy;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (dNow - dLastRefresh >= dRefreshMicroseconds)
+        {
+            RefreshThreads();
+            dLastRefresh = dNow;
+        }
+
+        for (auto iter = m_mapThreads.begin(); iter != m_mapThreads.end(); ++iter)
+        {
+            if (iter->second.hThread() != INVALID_HANDLE_VALUE)
+            {
+                SampleThread(iter->first, iter->second);
+            }
+        }
+
+        ++m_stats.ullTicks;
+        m_stats.dSamplerMicroseconds += busy.ElapsedMicroseconds();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.dElapsedMicroseconds += clock.ElapsedMicroseconds();
+}
+
+void SamplingProfiler::RefreshThreads()
+{
+    ++m_stats.ullThreadRefreshes;
+
+    const DWORD dwProcessId = GetProcessId(m_pDebugger->Handle());
+    SafeHandle hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot() == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not enumerate threads. Error = %X\n", GetLastError());
+        return;
+    }
+
+    THREADENTRY32 threadEntry = { 0 };
+    threadEntry.dwSize = sizeof(THREADENTRY32);
+    for (BOOL bHasEntry = Thread32First(hSnapshot(), &threadEntry); bHasEntry; bHasEntry = Thread32Next(hSnapshot(), &threadEntry))
+    {
+        if (threadEntry.th32OwnerProcessID != dwProcessId)
+        {
+            continue;
+        }
+
+        ThreadEntry &thread = m_mapThreads[threadEntry.th32ThreadID];
+        if (thread.hThread() != INVALID_HANDLE_VALUE)
+        {
+            continue;
+        }
+
+        const HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE,
+            threadEntry.th32ThreadID);
+        thread.hThread = (hThread != nullptr) ? hThread : INVALID_HANDLE_VALUE;
+    }
+}
+
+void SamplingProfiler::SampleThread(const DWORD dwThreadId, ThreadEntry &thread)
+{
+    //The thread is only stopped for the context read and the unwind; interning happens after it runs again
+    Stopwatch suspended;
+    if (SuspendThread(thread.hThread()) == (DWORD)-1)
+    {
+        CloseThreadHandle(thread.hThread);
+        return;
+    }
+
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    size_t ulFrames = 0;
+    if (BOOLIFY(GetThreadContext(thread.hThread(), &ctx)))
+    {
+        ulFrames = m_unwinder.Capture(ctx, m_vecCapture.data(), m_ulMaxFrames);
+    }
+    (void)ResumeThread(thread.hThread());
+
+    const double dElapsed = suspended.ElapsedMicroseconds();
+    thread.dSuspendedMicroseconds += dElapsed;
+    m_stats.dSuspendedMicroseconds += dElapsed;
+
+    if (ulFrames == 0)
+    {
+        ++m_stats.ullFailedSamples;
+        return;
+    }
+
+    ++thread.ullSamples;
+    ++m_stats.ullSamples;
+    Record(dwThreadId, m_vecCapture.data(), ulFrames);
+}
+
+void SamplingProfiler::Record(const DWORD dwThreadId, const StackFrame * const pFrames, const size_t ulFrames)
+{
+    m_vecCaptureIds.clear();
+    for (size_t i = 0; i < ulFrames; ++i)
+    {
+        auto iter = m_mapFrameIds.find(pFrames[i].dwInstruction);
+        if (iter == m_mapFrameIds.end())
+        {
+            iter = m_mapFrameIds.insert(std::make_pair(pFrames[i].dwInstruction, (DWORD)m_vecFrames.size())).first;
+            m_vecFrames.push_back(pFrames[i].dwInstruction);
+        }
+        m_vecCaptureIds.push_back(iter->second);
+    }
+
+    //Stacks are found by hash and confirmed by content; a collision moves on to the next hash
+    ULONGLONG ullHash = HashFrames(m_vecCaptureIds.data(), m_vecCaptureIds.size());
+    DWORD dwStackId = 0;
+    for (;;)
+    {
+        auto iter = m_mapStackIds.find(ullHash);
+        if (iter == m_mapStackIds.end())
+        {
+            dwStackId = (DWORD)m_vecStacks.size();
+            m_vecStacks.push_back(StackEntry{ (DWORD)m_vecStackFrames.size(), (DWORD)m_vecCaptureIds.size() });
+            m_vecStackFrames.insert(m_vecStackFrames.end(), m_vecCaptureIds.begin(), m_vecCaptureIds.end());
+            m_mapStackIds.insert(std::make_pair(ullHash, dwStackId));
+            break;
+        }
+
+        const StackEntry &stack = m_vecStacks[iter->second];
+        if (stack.dwFrameCount == m_vecCaptureIds.size() &&
+            memcmp(&m_vecStackFrames[stack.dwFirstFrame], m_vecCaptureIds.data(), m_vecCaptureIds.size() * sizeof(DWORD)) == 0)
+        {
+            dwStackId = iter->second;
+            break;
+        }
+        ++ullHash;
+    }
+
+    ++m_mapCounts[((ULONGLONG)dwThreadId << 32) | dwStackId];
+}
+
+const std::string SamplingProfiler::FrameName(const DWORD dwFrameId) const
+{
+    //Offsets are dropped so that every sample in a function folds into the same frame
+    char strName[512] = { 0 };
+    size_t ulLength = m_pDebugger->ProcessResolver()->Format(m_vecFrames[dwFrameId], strName, sizeof(strName) - 1);
+    if (ulLength == 0)
+    {
+        ulLength = (size_t)sprintf_s(strName, sizeof(strName), "%p", (void *)m_vecFrames[dwFrameId]);
+    }
+    else if (char * const pOffset = strstr(strName, "+0x"))
+    {
+        ulLength = pOffset - strName;
+    }
+
+    std::string strFrame(strName, ulLength);
+    std::replace(strFrame.begin(), strFrame.end(), ';', ':');
+    std::replace(strFrame.begin(), strFrame.end(), ' ', '_');
+    return strFrame;
+}
+
+const bool SamplingProfiler::ExportFolded(const char * const pPath, const bool bPerThread) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<std::string> vecNames(m_vecFrames.size());
+    for (DWORD i = 0; i < (DWORD)m_vecFrames.size(); ++i)
+    {
+        vecNames[i] = FrameName(i);
+    }
+
+    //Different return addresses in one function fold into the same line, so lines are summed before writing
+    std::map<std::string, ULONGLONG> mapLines;
+    std::string strLine;
+    for (auto &count : m_mapCounts)
+    {
+        const DWORD dwThreadId = (DWORD)(count.first >> 32);
+        const StackEntry &stack = m_vecStacks[(size_t)(count.first & 0xFFFFFFFF)];
+
+        strLine.clear();
+        if (bPerThread)
+        {
+            char strThread[32] = { 0 };
+            sprintf_s(strThread, sizeof(strThread), "thread_%X", dwThreadId);
+            strLine = strThread;
+        }
+        for (DWORD i = stack.dwFrameCount; i > 0; --i)
+        {
+            if (!strLine.empty())
+            {
+                strLine += ';';
+            }
+            strLine += vecNames[m_vecStackFrames[stack.dwFirstFrame + i - 1]];
+        }
+        mapLines[strLine] += count.second;
+    }
+
+    BinaryWriter writer;
+    if (!writer.Open(pPath))
+    {
+        return false;
+    }
+    for (auto &line : mapLines)
+    {
+        char strCount[32] = { 0 };
+        const int iLength = sprintf_s(strCount, sizeof(strCount), " %I64u\n", line.second);
+        if (!writer.Write(line.first.data(), line.first.size()) || !writer.Write(strCount, (size_t)iLength))
+        {
+            return false;
+        }
+    }
+    if (!writer.Close())
+    {
+        return false;
+    }
+
+    fprintf(stderr, "Wrote %Iu folded stacks to %s.\n", mapLines.size(), pPath);
+    return true;
+}
+
+void SamplingProfiler::PrintTop(const size_t ulMaxEntries) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //Self samples by leaf function, and samples by thread
+    std::map<std::string, ULONGLONG> mapSelf;
+    for (auto &count : m_mapCounts)
+    {
+        const StackEntry &stack = m_vecStacks[(size_t)(count.first & 0xFFFFFFFF)];
+        mapSelf[FrameName(m_vecStackFrames[stack.dwFirstFrame])] += count.second;
+    }
+
+    std::vector<std::pair<ULONGLONG, std::string>> vecSelf;
+    for (auto &entry : mapSelf)
+    {
+        vecSelf.emplace_back(entry.second, entry.first);
+    }
+    std::sort(vecSelf.begin(), vecSelf.end(), [](const std::pair<ULONGLONG, std::string> &left,
+        const std::pair<ULONGLONG, std::string> &right)
+    {
+        return left.first > right.first;
+    });
+
+    const double dTotal = (m_stats.ullSamples != 0) ? (double)m_stats.ullSamples : 1.0;
+    for (size_t i = 0; i < std::min(ulMaxEntries, vecSelf.size()); ++i)
+    {
+        fprintf(stderr, "%6.2f%% %8I64u  %s\n", (100.0 * vecSelf[i].first) / dTotal, vecSelf[i].first, vecSelf[i].second.c_str());
+    }
+    for (auto &thread : m_mapThreads)
+    {
+        fprintf(stderr, "Thread %X: %I64u samples, %.1f us suspended per sample.\n", thread.first, thread.second.ullSamples,
+            (thread.second.ullSamples != 0) ? thread.second.dSuspendedMicroseconds / thread.second.ullSamples : 0.0);
+    }
+}
+
+void SamplingProfiler::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //Elapsed time is only added when the sampler stops
+    const double dElapsed = m_stats.dElapsedMicroseconds;
+    const unsigned long long ullAttempts = m_stats.ullSamples + m_stats.ullFailedSamples;
+    fprintf(stderr, "Sampling profiler: %s, %I64u ticks, %I64u samples (%I64u failed) from %Iu threads. %Iu frames and "
+        "%Iu distinct stacks interned.\n", m_bIsRunning ? "running" : "stopped", m_stats.ullTicks, m_stats.ullSamples,
+        m_stats.ullFailedSamples, m_mapThreads.size(), m_vecFrames.size(), m_vecStacks.size());
+    fprintf(stderr, "Overhead: %.1f us suspended per sample, sampler busy %.1f us per tick", (ullAttempts != 0) ?
+        m_stats.dSuspendedMicroseconds / ullAttempts : 0.0, (m_stats.ullTicks != 0) ? m_stats.dSamplerMicroseconds / m_stats.ullTicks : 0.0);
+    if (dElapsed > 0.0)
+    {
+        fprintf(stderr, " (%.2f%% of one core), %.1f ticks per second achieved", (100.0 * m_stats.dSamplerMicroseconds) / dElapsed,
+            (1000000.0 * m_stats.ullTicks) / dElapsed);
+    }
+    fprintf(stderr, ".\n");
+    m_unwinder.PrintStats();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "SafeHandle.h"
+#include "StackUnwinder.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Statistical profiler that needs no instrumentation. At a fixed rate every thread of the target is suspended just
+//long enough to read its context and unwind its stack. Frame addresses are interned to ids, each distinct stack is
+//stored once, and samples are counted per thread and stack. Names are only resolved when the results are exported.
+class SamplingProfiler final
+{
+public:
+    SamplingProfiler() = delete;
+    SamplingProfiler(Debugger *pDebugger);
+
+    SamplingProfiler(const SamplingProfiler &copy) = delete;
+    SamplingProfiler &operator=(const SamplingProfiler &copy) = delete;
+
+    ~SamplingProfiler();
+
+    const bool Start(const unsigned int uiFrequency, const size_t ulMaxFrames = 128);
+    void Stop();
+    void Reset();
+    const bool IsRunning() const;
+
+    void RemoveModule(const DWORD_PTR dwModuleBase);
+
+    //Writes one "frame;frame;...;frame count" line per stack, root first, as flamegraph.pl and speedscope read it
+    const bool ExportFolded(const char * const pPath, const bool bPerThread) const;
+    void PrintTop(const size_t ulMaxEntries) const;
+    void PrintStats() const;
+
+private:
+    struct ThreadEntry
+    {
+        SafeHandle hThread;
+        unsigned long long ullSamples;
+        double dSuspendedMicroseconds;
+    };
+
+    struct StackEntry
+    {
+        DWORD dwFirstFrame;
+        DWORD dwFrameCount;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullTicks;
+        unsigned long long ullSamples;
+        unsigned long long ullFailedSamples;
+        unsigned long long ullThreadRefreshes;
+        double dSuspendedMicroseconds;
+        double dSamplerMicroseconds;
+        double dElapsedMicroseconds;
+    };
+
+    void Run(const unsigned int uiFrequency);
+    void RefreshThreads();
+    void SampleThread(const DWORD dwThreadId, ThreadEntry &thread);
+    void Record(const DWORD dwThreadId, const StackFrame * const pFrames, const size_t ulFrames);
+    const std::string FrameName(const DWORD dwFrameId) const;
+
+    Debugger * const m_pDebugger;
+    StackUnwinder m_unwinder;
+
+    std::thread m_sampler;
+    std::atomic<bool> m_bIsRunning;
+    size_t m_ulMaxFrames;
+
+    //Guards everything below; held by the sampler for a whole tick
+    mutable std::mutex m_mutex;
+    std::map<DWORD, ThreadEntry> m_mapThreads;
+
+    std::unordered_map<DWORD_PTR, DWORD> m_mapFrameIds;
+    std::vector<DWORD_PTR> m_vecFrames;
+    std::vector<DWORD> m_vecStackFrames;
+    std::vector<StackEntry> m_vecStacks;
+    std::unordered_map<ULONGLONG, DWORD> m_mapStackIds;
+    std::unordered_map<ULONGLONG, ULONGLONG> m_mapCounts;
+    std::vector<StackFrame> m_vecCapture;
+    std::vector<DWORD> m_vecCaptureIds;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
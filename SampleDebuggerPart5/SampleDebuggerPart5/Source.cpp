@@ -1,6 +1,9 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <vector>
+
 #include <Windows.h>
+#include "BinaryWriter.h"
 #include "Debugger.h"
 #include "Disassembler.h"
 
@@ -104,6 +107,870 @@ const DWORD_PTR PromptBreakpointAddress(CodeReversing::Debugger *dbg)
     return dwAddress;
 }
 
+void PromptPatchCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    char strSetName[64] = { 0 };
+    if (_stricmp(pCommand, "patch-add") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        size_t ulNumBytes = 0;
+        fprintf(stderr, "Enter patch set name: ");
+        fscanf(stdin, "%63s", strSetName);
+        fprintf(stderr, "Enter address to patch at: 0x");
+        fscanf(stdin, "%p", &dwAddress);
+        fprintf(stderr, "Enter number of bytes: ");
+        fscanf(stdin, "%Iu", &ulNumBytes);
+        std::vector<unsigned char> vecBytes(ulNumBytes);
+        fprintf(stderr, "Enter bytes: ");
+        for (auto &cByte : vecBytes)
+        {
+            unsigned int iNewByte = 0;
+            fscanf(stdin, "%X", &iNewByte);
+            cByte = (unsigned char)(iNewByte & 0xFF);
+        }
+        (void)dbg->ProcessPatches()->AddPatch(strSetName, dwAddress, vecBytes.data(), vecBytes.size());
+    }
+    else if (_stricmp(pCommand, "patch-apply") == 0 || _stricmp(pCommand, "patch-revert") == 0 ||
+        _stricmp(pCommand, "patch-remove") == 0)
+    {
+        fprintf(stderr, "Enter patch set name: ");
+        fscanf(stdin, "%63s", strSetName);
+        if (_stricmp(pCommand, "patch-apply") == 0)
+        {
+            (void)dbg->ProcessPatches()->ApplyPatchSet(strSetName);
+        }
+        else if (_stricmp(pCommand, "patch-revert") == 0)
+        {
+            (void)dbg->ProcessPatches()->RevertPatchSet(strSetName);
+        }
+        else
+        {
+            (void)dbg->ProcessPatches()->RemovePatchSet(strSetName);
+        }
+    }
+    else if (_stricmp(pCommand, "patch-undo") == 0)
+    {
+        (void)dbg->ProcessPatches()->Undo();
+    }
+    else if (_stricmp(pCommand, "patch-list") == 0)
+    {
+        dbg->ProcessPatches()->PrintPatchSets();
+        dbg->ProcessPatches()->PrintUndoLog();
+    }
+}
+
+void PromptScanCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::MemoryScanner *pScanner = dbg->ProcessScanner();
+    if (_stricmp(pCommand, "scan-bytes") == 0)
+    {
+        char strPattern[256] = { 0 };
+        fprintf(stderr, "Enter byte pattern (?? for wildcard): ");
+        fscanf(stdin, " %255[^\n]", strPattern);
+        fprintf(stderr, "Added pattern %X.\n", pScanner->AddBytePattern(strPattern));
+    }
+    else if (_stricmp(pCommand, "scan-string") == 0 || _stricmp(pCommand, "scan-wstring") == 0)
+    {
+        char strString[256] = { 0 };
+        fprintf(stderr, "Enter string: ");
+        fscanf(stdin, " %255[^\n]", strString);
+        fprintf(stderr, "Added pattern %X.\n", pScanner->AddStringPattern(strString, _stricmp(pCommand, "scan-wstring") == 0));
+    }
+    else if (_stricmp(pCommand, "scan-pointer") == 0)
+    {
+        DWORD_PTR dwValue = 0;
+        fprintf(stderr, "Enter pointer value: 0x");
+        fscanf(stdin, "%p", &dwValue);
+        fprintf(stderr, "Added pattern %X.\n", pScanner->AddPointerPattern(dwValue));
+    }
+    else if (_stricmp(pCommand, "scan-clear") == 0)
+    {
+        pScanner->ClearPatterns();
+    }
+    else if (_stricmp(pCommand, "scan-run") == 0)
+    {
+        (void)pScanner->Scan([](const CodeReversing::ScanResult &result)
+        {
+            fprintf(stderr, "Pattern %X found at %p\n", result.uiPatternId, result.dwAddress);
+        });
+    }
+    else if (_stricmp(pCommand, "scan-bench") == 0)
+    {
+        size_t ulGigabytes = 0;
+        fprintf(stderr, "Enter number of GB to scan: ");
+        fscanf(stdin, "%Iu", &ulGigabytes);
+        CodeReversing::MemoryScanner::Benchmark(ulGigabytes * 1024 * 1024 * 1024);
+    }
+}
+
+void PromptValueScanCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    typedef CodeReversing::ValueScanner ValueScanner;
+
+    ValueScanner *pScanner = dbg->ProcessValueScanner();
+    static ValueScanner::eValueType valueType = ValueScanner::eValueType::eDword;
+    char strValue[64] = { 0 };
+    CodeReversing::ScanValue value = { 0 };
+
+    if (_stricmp(pCommand, "value-first") == 0)
+    {
+        int iType = 0;
+        int iCompare = 0;
+        fprintf(stderr, "Value type ([1] byte, [2] word, [3] dword, [4] qword, [5] float, [6] double): ");
+        fscanf(stdin, "%i", &iType);
+        fprintf(stderr, "[0] Unknown value or [1] exact value? ");
+        fscanf(stdin, "%i", &iCompare);
+        valueType = (ValueScanner::eValueType)iType;
+        if (iCompare == (int)ValueScanner::eCompare::eEqual)
+        {
+            fprintf(stderr, "Enter value: ");
+            fscanf(stdin, "%63s", strValue);
+            (void)ValueScanner::ParseValue(valueType, strValue, value);
+        }
+        (void)pScanner->FirstScan(valueType, (ValueScanner::eCompare)iCompare, value);
+    }
+    else if (_stricmp(pCommand, "value-next") == 0)
+    {
+        int iCompare = 0;
+        fprintf(stderr, "[1] Equal to, [2] changed, [3] unchanged, [4] increased, [5] decreased? ");
+        fscanf(stdin, "%i", &iCompare);
+        if (iCompare == (int)ValueScanner::eCompare::eEqual)
+        {
+            fprintf(stderr, "Enter value: ");
+            fscanf(stdin, "%63s", strValue);
+            (void)ValueScanner::ParseValue(valueType, strValue, value);
+        }
+        (void)pScanner->NextScan((ValueScanner::eCompare)iCompare, value);
+    }
+    else if (_stricmp(pCommand, "value-list") == 0)
+    {
+        pScanner->PrintCandidates(50);
+    }
+    else if (_stricmp(pCommand, "value-reset") == 0)
+    {
+        pScanner->Reset();
+    }
+}
+
+void PromptSnapshotCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    static CodeReversing::MemoryDiff lastDiff = {};
+
+    CodeReversing::MemorySnapshot *pSnapshot = dbg->ProcessSnapshot();
+    if (_stricmp(pCommand, "snapshot-take") == 0)
+    {
+        (void)pSnapshot->Take();
+    }
+    else if (_stricmp(pCommand, "snapshot-diff") == 0)
+    {
+        if (pSnapshot->Diff(lastDiff))
+        {
+            lastDiff.Print(50);
+        }
+    }
+    else if (_stricmp(pCommand, "snapshot-save") == 0)
+    {
+        char strPath[MAX_PATH] = { 0 };
+        fprintf(stderr, "Enter output path: ");
+        fscanf(stdin, "%259s", strPath);
+        (void)lastDiff.Save(strPath);
+    }
+}
+
+void PromptDumpCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    char strPath[MAX_PATH] = { 0 };
+    fprintf(stderr, "Enter dump path: ");
+    fscanf(stdin, "%259s", strPath);
+
+    if (_stricmp(pCommand, "dump-write") == 0)
+    {
+        int iCompress = 0;
+        int iIncludeImages = 0;
+        fprintf(stderr, "Compress ([0] no, [1] yes)? ");
+        fscanf(stdin, "%i", &iCompress);
+        fprintf(stderr, "Include read-only image pages ([0] no, [1] yes)? ");
+        fscanf(stdin, "%i", &iIncludeImages);
+        (void)dbg->WriteDump(strPath, iCompress != 0, iIncludeImages != 0);
+    }
+    else if (_stricmp(pCommand, "dump-expand") == 0)
+    {
+        char strOutputPath[MAX_PATH] = { 0 };
+        fprintf(stderr, "Enter output path: ");
+        fscanf(stdin, "%259s", strOutputPath);
+        (void)CodeReversing::BinaryWriter::Expand(strPath, strOutputPath);
+    }
+}
+
+void PromptDisassemblerCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    if (_stricmp(pCommand, "disasm-stats") == 0)
+    {
+        dbg->ProcessDisassembler()->PrintCacheStats();
+        dbg->ProcessResolver()->PrintStats();
+    }
+    else if (_stricmp(pCommand, "disasm-bench") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        size_t ulSize = 0;
+        fprintf(stderr, "Enter code address and size: ");
+        fscanf(stdin, "%p %Iu", &dwAddress, &ulSize);
+        (void)dbg->ProcessDisassembler()->Benchmark(dwAddress, ulSize);
+    }
+    else if (_stricmp(pCommand, "disasm-list") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        size_t ulInstructions = 0;
+        fprintf(stderr, "Enter address and number of instructions: ");
+        fscanf(stdin, "%p %Iu", &dwAddress, &ulInstructions);
+        (void)dbg->ProcessDisassembler()->BytesAtAddress(dwAddress, ulInstructions);
+    }
+    else if (_stricmp(pCommand, "disasm-listbench") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        size_t ulInstructions = 0;
+        fprintf(stderr, "Enter address and number of instructions: ");
+        fscanf(stdin, "%p %Iu", &dwAddress, &ulInstructions);
+        (void)dbg->ProcessDisassembler()->BenchmarkListing(dwAddress, ulInstructions);
+        dbg->ProcessResolver()->PrintStats();
+    }
+}
+
+void PromptAnalyzeCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    static CodeReversing::ModuleIndex lastIndex = {};
+
+    if (_stricmp(pCommand, "analyze-module") == 0)
+    {
+        DWORD_PTR dwModuleBase = 0;
+        fprintf(stderr, "Enter module base address: ");
+        fscanf(stdin, "%p", &dwModuleBase);
+        if (dbg->AnalyzeModule(dwModuleBase, lastIndex))
+        {
+            CodeReversing::ModuleAnalyzer::PrintIndex(lastIndex, 20);
+        }
+    }
+    else if (_stricmp(pCommand, "analyze-print") == 0)
+    {
+        CodeReversing::ModuleAnalyzer::PrintIndex(lastIndex, (size_t)-1);
+    }
+}
+
+void PromptFlowGraphCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::ControlFlowGraph *pGraph = dbg->ProcessFlowGraph();
+    if (_stricmp(pCommand, "cfg-stats") == 0)
+    {
+        pGraph->PrintStats();
+        return;
+    }
+
+    DWORD_PTR dwAddress = 0;
+    fprintf(stderr, "Enter address: ");
+    fscanf(stdin, "%p", &dwAddress);
+
+    if (_stricmp(pCommand, "cfg-discover") == 0)
+    {
+        fprintf(stderr, "Decoded %Iu instructions.\n", pGraph->Discover(dwAddress));
+    }
+    else if (_stricmp(pCommand, "cfg-block") == 0)
+    {
+        CodeReversing::FlowBlock block = { 0 };
+        std::vector<CodeReversing::FlowEdge> vecEdges;
+        if (!pGraph->FindBlock(dwAddress, block))
+        {
+            fprintf(stderr, "No block contains %p.\n", dwAddress);
+            return;
+        }
+        fprintf(stderr, "Block %p-%p\n", block.dwStart, block.dwEnd);
+        (void)pGraph->Predecessors(dwAddress, vecEdges);
+        for (auto &edge : vecEdges)
+        {
+            fprintf(stderr, "    from %p (type %i)\n", edge.dwFrom, (int)edge.type);
+        }
+        (void)pGraph->Successors(dwAddress, vecEdges);
+        for (auto &edge : vecEdges)
+        {
+            fprintf(stderr, "    to %p (type %i)\n", edge.dwTo, (int)edge.type);
+        }
+    }
+    else if (_stricmp(pCommand, "cfg-callers") == 0 || _stricmp(pCommand, "cfg-callees") == 0)
+    {
+        std::vector<DWORD_PTR> vecAddresses;
+        const bool bCallers = (_stricmp(pCommand, "cfg-callers") == 0);
+        if (!(bCallers ? pGraph->Callers(dwAddress, vecAddresses) : pGraph->Callees(dwAddress, vecAddresses)))
+        {
+            fprintf(stderr, "No function at %p.\n", dwAddress);
+            return;
+        }
+        for (auto &dwEntry : vecAddresses)
+        {
+            fprintf(stderr, "    %p\n", dwEntry);
+        }
+    }
+    else if (_stricmp(pCommand, "cfg-reach") == 0)
+    {
+        std::vector<DWORD_PTR> vecBlocks;
+        fprintf(stderr, "%Iu blocks reach %p.\n", pGraph->ReachingBlocks(dwAddress, vecBlocks, false), dwAddress);
+    }
+}
+
+void PromptStackCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    const size_t ulMaxFrames = 256;
+    CodeReversing::StackFrame pFrames[ulMaxFrames] = { 0 };
+
+    if (_stricmp(pCommand, "stack-capture") == 0)
+    {
+        const size_t ulFrames = dbg->CaptureStack(pFrames, ulMaxFrames);
+        for (size_t i = 0; i < ulFrames; ++i)
+        {
+            char strName[512] = { 0 };
+            const size_t ulLength = dbg->ProcessResolver()->Format(pFrames[i].dwInstruction, strName, sizeof(strName) - 1);
+            strName[ulLength] = '\0';
+            fprintf(stderr, "#%02Iu %p %p %s\n", i, pFrames[i].dwStack, pFrames[i].dwInstruction, strName);
+        }
+    }
+    else if (_stricmp(pCommand, "stack-bench") == 0)
+    {
+        size_t ulIterations = 0;
+        fprintf(stderr, "Enter number of captures: ");
+        fscanf(stdin, "%Iu", &ulIterations);
+        for (size_t i = 0; i < ulIterations; ++i)
+        {
+            (void)dbg->CaptureStack(pFrames, ulMaxFrames);
+        }
+        dbg->ProcessUnwinder()->PrintStats();
+    }
+    else if (_stricmp(pCommand, "stack-stats") == 0)
+    {
+        dbg->ProcessUnwinder()->PrintStats();
+    }
+}
+
+void PromptProfileCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::SamplingProfiler *pProfiler = dbg->ProcessProfiler();
+    if (_stricmp(pCommand, "profile-start") == 0)
+    {
+        unsigned int uiFrequency = 0;
+        size_t ulMaxFrames = 0;
+        fprintf(stderr, "Enter samples per second and maximum frames: ");
+        fscanf(stdin, "%u %Iu", &uiFrequency, &ulMaxFrames);
+        if (!pProfiler->Start(uiFrequency, ulMaxFrames))
+        {
+            fprintf(stderr, "Could not start profiler.\n");
+        }
+    }
+    else if (_stricmp(pCommand, "profile-stop") == 0)
+    {
+        pProfiler->Stop();
+        pProfiler->PrintStats();
+    }
+    else if (_stricmp(pCommand, "profile-reset") == 0)
+    {
+        pProfiler->Reset();
+    }
+    else if (_stricmp(pCommand, "profile-stats") == 0)
+    {
+        pProfiler->PrintStats();
+    }
+    else if (_stricmp(pCommand, "profile-top") == 0)
+    {
+        pProfiler->PrintTop(20);
+    }
+    else if (_stricmp(pCommand, "profile-export") == 0)
+    {
+        char strPath[MAX_PATH] = { 0 };
+        int iPerThread = 0;
+        fprintf(stderr, "Enter output path and whether to split by thread (0/1): ");
+        fscanf(stdin, "%259s %i", strPath, &iPerThread);
+        (void)pProfiler->ExportFolded(strPath, iPerThread != 0);
+    }
+}
+
+void PromptFunctionProfileCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::FunctionProfiler *pProfiler = dbg->ProcessFunctionProfiler();
+    if (_stricmp(pCommand, "fprof-add") == 0 || _stricmp(pCommand, "fprof-remove") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        fprintf(stderr, "Enter function address: ");
+        fscanf(stdin, "%p", &dwAddress);
+        const bool bAdd = (_stricmp(pCommand, "fprof-add") == 0);
+        if (!(bAdd ? pProfiler->AddFunction(dwAddress) : pProfiler->RemoveFunction(dwAddress)))
+        {
+            fprintf(stderr, "Could not %s function at %p.\n", bAdd ? "profile" : "stop profiling", dwAddress);
+        }
+    }
+    else if (_stricmp(pCommand, "fprof-stats") == 0)
+    {
+        int iPerThread = 0;
+        fprintf(stderr, "Split by thread (0/1): ");
+        fscanf(stdin, "%i", &iPerThread);
+        pProfiler->PrintStats(iPerThread != 0);
+    }
+}
+
+void PromptCoverageCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::CoverageTracer *pCoverage = dbg->ProcessCoverage();
+    if (_stricmp(pCommand, "cov-module") == 0)
+    {
+        DWORD_PTR dwModuleBase = 0;
+        int iBlocks = 0;
+        fprintf(stderr, "Enter module base address and whether to cover blocks instead of functions (0/1): ");
+        fscanf(stdin, "%p %i", &dwModuleBase, &iBlocks);
+        (void)pCoverage->AddModule(dwModuleBase, iBlocks != 0 ? CodeReversing::CoverageTracer::eGranularity::eBlocks :
+            CodeReversing::CoverageTracer::eGranularity::eFunctions);
+    }
+    else if (_stricmp(pCommand, "cov-stop") == 0)
+    {
+        (void)pCoverage->Stop();
+        pCoverage->PrintSummary();
+    }
+    else if (_stricmp(pCommand, "cov-summary") == 0)
+    {
+        pCoverage->PrintSummary();
+    }
+    else if (_stricmp(pCommand, "cov-export") == 0)
+    {
+        char strPath[MAX_PATH] = { 0 };
+        fprintf(stderr, "Enter output path: ");
+        fscanf(stdin, "%259s", strPath);
+        (void)pCoverage->ExportBitmap(strPath);
+    }
+}
+
+void PromptTraceCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::InstructionTracer *pTracer = dbg->ProcessTracer();
+    if (_stricmp(pCommand, "trace-start") == 0)
+    {
+        char strPath[MAX_PATH] = { 0 };
+        CodeReversing::TraceOptions options = { 0 };
+        int iStopOnModuleExit = 0;
+        int iRecordRegisters = 0;
+        fprintf(stderr, "Enter output path, stop address (0 for none), maximum instructions (0 for none), "
+            "whether to stop on leaving the module (0/1) and whether to record registers (0/1): ");
+        fscanf(stdin, "%259s %p %I64u %i %i", strPath, &options.dwStopAddress, &options.ullMaxInstructions,
+            &iStopOnModuleExit, &iRecordRegisters);
+        options.bStopOnModuleExit = (iStopOnModuleExit != 0);
+        options.bRecordRegisters = (iRecordRegisters != 0);
+        if (dbg->TraceExecutingThread(strPath, options))
+        {
+            fprintf(stderr, "Continue to start tracing.\n");
+        }
+    }
+    else if (_stricmp(pCommand, "trace-stop") == 0)
+    {
+        (void)pTracer->Stop();
+        pTracer->PrintStats();
+    }
+    else if (_stricmp(pCommand, "trace-stats") == 0)
+    {
+        pTracer->PrintStats();
+    }
+}
+
+void PromptRangeCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    if (_stricmp(pCommand, "range-step") == 0)
+    {
+        DWORD_PTR dwStart = 0;
+        DWORD_PTR dwEnd = 0;
+        fprintf(stderr, "Enter range start and end address: ");
+        fscanf(stdin, "%p %p", &dwStart, &dwEnd);
+        (void)dbg->StepRange(dwStart, dwEnd);
+    }
+    else if (_stricmp(pCommand, "range-line") == 0)
+    {
+        (void)dbg->StepLine();
+    }
+    else if (_stricmp(pCommand, "range-cancel") == 0)
+    {
+        dbg->ProcessStepper()->Cancel();
+    }
+    else if (_stricmp(pCommand, "range-stats") == 0)
+    {
+        dbg->ProcessStepper()->PrintStats();
+    }
+}
+
+void PromptTemporaryCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::TemporaryBreakpoints *pTemporaries = dbg->ProcessTemporaries();
+    if (_stricmp(pCommand, "temp-out") == 0)
+    {
+        (void)dbg->StepOut();
+    }
+    else if (_stricmp(pCommand, "temp-run") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        fprintf(stderr, "Enter address to run to: ");
+        fscanf(stdin, "%p", &dwAddress);
+        (void)dbg->RunTo(dwAddress);
+    }
+    else if (_stricmp(pCommand, "temp-any") == 0)
+    {
+        size_t ulCount = 0;
+        fprintf(stderr, "Enter number of addresses followed by the addresses: ");
+        fscanf(stdin, "%Iu", &ulCount);
+        std::vector<DWORD_PTR> vecAddresses(ulCount);
+        for (auto &dwAddress : vecAddresses)
+        {
+            fscanf(stdin, "%p", &dwAddress);
+        }
+        (void)dbg->RunToAny(vecAddresses);
+    }
+    else if (_stricmp(pCommand, "temp-remove") == 0)
+    {
+        unsigned int uiId = 0;
+        fprintf(stderr, "Enter set id: ");
+        fscanf(stdin, "%u", &uiId);
+        (void)pTemporaries->Remove(uiId);
+    }
+    else if (_stricmp(pCommand, "temp-cancel") == 0)
+    {
+        pTemporaries->Cancel();
+    }
+    else if (_stricmp(pCommand, "temp-list") == 0)
+    {
+        pTemporaries->PrintSets();
+    }
+    else if (_stricmp(pCommand, "temp-stats") == 0)
+    {
+        pTemporaries->PrintStats();
+    }
+}
+
+void PromptConditionCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::ConditionalBreakpoints *pConditions = dbg->ProcessConditions();
+    DWORD_PTR dwAddress = 0;
+    if (_stricmp(pCommand, "cond-set") == 0)
+    {
+        char strExpression[256] = { 0 };
+        fprintf(stderr, "Enter breakpoint address and condition: ");
+        fscanf(stdin, "%p %255[^\n]", &dwAddress, strExpression);
+        (void)pConditions->SetCondition(dwAddress, strExpression);
+    }
+    else if (_stricmp(pCommand, "cond-ignore") == 0)
+    {
+        ULONGLONG ullIgnoreCount = 0;
+        fprintf(stderr, "Enter breakpoint address and number of hits to ignore: ");
+        fscanf(stdin, "%p %I64u", &dwAddress, &ullIgnoreCount);
+        (void)pConditions->SetIgnoreCount(dwAddress, ullIgnoreCount);
+    }
+    else if (_stricmp(pCommand, "cond-clear") == 0)
+    {
+        fprintf(stderr, "Enter breakpoint address: ");
+        fscanf(stdin, "%p", &dwAddress);
+        (void)pConditions->Clear(dwAddress);
+    }
+    else if (_stricmp(pCommand, "cond-bench") == 0)
+    {
+        size_t ulIterations = 0;
+        fprintf(stderr, "Enter breakpoint address and number of evaluations: ");
+        fscanf(stdin, "%p %Iu", &dwAddress, &ulIterations);
+        (void)pConditions->Benchmark(dwAddress, dbg->GetExecutingContext(), ulIterations);
+    }
+    else if (_stricmp(pCommand, "cond-list") == 0)
+    {
+        pConditions->PrintConditions();
+    }
+    else if (_stricmp(pCommand, "cond-stats") == 0)
+    {
+        pConditions->PrintStats();
+    }
+}
+
+void PromptLogpointCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::Logpoints *pLogpoints = dbg->ProcessLogpoints();
+    DWORD_PTR dwAddress = 0;
+    if (_stricmp(pCommand, "log-add") == 0)
+    {
+        char strTemplate[256] = { 0 };
+        fprintf(stderr, "Enter address and message template: ");
+        fscanf(stdin, "%p %255[^\n]", &dwAddress, strTemplate);
+        (void)pLogpoints->Add(dwAddress, strTemplate);
+    }
+    else if (_stricmp(pCommand, "log-remove") == 0)
+    {
+        fprintf(stderr, "Enter address: ");
+        fscanf(stdin, "%p", &dwAddress);
+        (void)pLogpoints->Remove(dwAddress);
+    }
+    else if (_stricmp(pCommand, "log-file") == 0)
+    {
+        char strPath[MAX_PATH] = { 0 };
+        fprintf(stderr, "Enter log file path: ");
+        fscanf(stdin, "%259s", strPath);
+        (void)pLogpoints->SetOutput(strPath);
+    }
+    else if (_stricmp(pCommand, "log-stderr") == 0)
+    {
+        (void)pLogpoints->SetOutput(nullptr);
+    }
+    else if (_stricmp(pCommand, "log-list") == 0)
+    {
+        pLogpoints->PrintLogpoints();
+    }
+    else if (_stricmp(pCommand, "log-stats") == 0)
+    {
+        pLogpoints->PrintStats();
+    }
+}
+
+void PromptApiTraceCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::ApiTracer *pApiTracer = dbg->ProcessApiTracer();
+    if (_stricmp(pCommand, "api-start") == 0)
+    {
+        char strPattern[256] = { 0 };
+        char strPath[MAX_PATH] = { 0 };
+        size_t ulArguments = 0;
+        fprintf(stderr, "Enter export pattern (module!function), output path and number of arguments: ");
+        fscanf(stdin, "%255s %259s %Iu", strPattern, strPath, &ulArguments);
+        (void)pApiTracer->Start(strPattern, strPath, ulArguments);
+    }
+    else if (_stricmp(pCommand, "api-stop") == 0)
+    {
+        (void)pApiTracer->Stop();
+    }
+    else if (_stricmp(pCommand, "api-top") == 0)
+    {
+        size_t ulMaxEntries = 0;
+        fprintf(stderr, "Enter number of entries: ");
+        fscanf(stdin, "%Iu", &ulMaxEntries);
+        pApiTracer->PrintTop(ulMaxEntries);
+    }
+    else if (_stricmp(pCommand, "api-stats") == 0)
+    {
+        pApiTracer->PrintStats();
+    }
+}
+
+void PromptPendingCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::PendingBreakpoints *pPending = dbg->ProcessPendingBreakpoints();
+    unsigned int uiId = 0;
+    if (_stricmp(pCommand, "pend-add") == 0)
+    {
+        char strSpec[256] = { 0 };
+        fprintf(stderr, "Enter module!symbol (wildcards allowed): ");
+        fscanf(stdin, "%255s", strSpec);
+        (void)pPending->Add(strSpec, uiId);
+    }
+    else if (_stricmp(pCommand, "pend-remove") == 0)
+    {
+        fprintf(stderr, "Enter pending breakpoint id: ");
+        fscanf(stdin, "%u", &uiId);
+        (void)pPending->Remove(uiId);
+    }
+    else if (_stricmp(pCommand, "pend-list") == 0)
+    {
+        pPending->PrintPending();
+    }
+    else if (_stricmp(pCommand, "pend-stats") == 0)
+    {
+        pPending->PrintStats();
+    }
+}
+
+void PromptGroupCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::BreakpointGroups *pGroups = dbg->ProcessBreakpointGroups();
+    char strGroup[128] = { 0 };
+    char strPath[MAX_PATH] = { 0 };
+    if (_stricmp(pCommand, "group-add") == 0)
+    {
+        size_t ulCount = 0;
+        fprintf(stderr, "Enter group name, number of addresses and the addresses: ");
+        fscanf(stdin, "%127s %Iu", strGroup, &ulCount);
+        std::vector<DWORD_PTR> vecAddresses(ulCount);
+        for (auto &dwAddress : vecAddresses)
+        {
+            fscanf(stdin, "%p", &dwAddress);
+        }
+        (void)pGroups->Add(strGroup, vecAddresses);
+    }
+    else if (_stricmp(pCommand, "group-enable") == 0)
+    {
+        fprintf(stderr, "Enter group name: ");
+        fscanf(stdin, "%127s", strGroup);
+        (void)pGroups->Enable(strGroup);
+    }
+    else if (_stricmp(pCommand, "group-disable") == 0)
+    {
+        fprintf(stderr, "Enter group name: ");
+        fscanf(stdin, "%127s", strGroup);
+        (void)pGroups->Disable(strGroup);
+    }
+    else if (_stricmp(pCommand, "group-remove") == 0)
+    {
+        fprintf(stderr, "Enter group name: ");
+        fscanf(stdin, "%127s", strGroup);
+        (void)pGroups->Remove(strGroup);
+    }
+    else if (_stricmp(pCommand, "group-save") == 0)
+    {
+        fprintf(stderr, "Enter session file path: ");
+        fscanf(stdin, "%259s", strPath);
+        (void)pGroups->SaveSession(strPath);
+    }
+    else if (_stricmp(pCommand, "group-load") == 0)
+    {
+        fprintf(stderr, "Enter session file path: ");
+        fscanf(stdin, "%259s", strPath);
+        (void)pGroups->LoadSession(strPath);
+    }
+    else if (_stricmp(pCommand, "group-list") == 0)
+    {
+        pGroups->PrintGroups();
+    }
+    else if (_stricmp(pCommand, "group-stats") == 0)
+    {
+        pGroups->PrintStats();
+    }
+}
+
+void PromptWatchCommand(CodeReversing::Debugger *dbg, const char * const pCommand)
+{
+    CodeReversing::Watchpoints *pWatchpoints = dbg->ProcessWatchpoints();
+    unsigned int uiId = 0;
+    if (_stricmp(pCommand, "watch-add") == 0 || _stricmp(pCommand, "watch-hw") == 0)
+    {
+        DWORD_PTR dwAddress = 0;
+        size_t ulSize = 0;
+        char strAccess[8] = { 0 };
+        fprintf(stderr, "Enter address, size and access (w or rw): ");
+        fscanf(stdin, "%p %Iu %7s", &dwAddress, &ulSize, strAccess);
+        const CodeReversing::Watchpoints::eAccess access = (_stricmp(strAccess, "rw") == 0) ?
+            CodeReversing::Watchpoints::eAccess::eReadWrite : CodeReversing::Watchpoints::eAccess::eWrite;
+        (void)pWatchpoints->Add(dwAddress, ulSize, access, _stricmp(pCommand, "watch-hw") == 0, uiId);
+    }
+    else if (_stricmp(pCommand, "watch-remove") == 0)
+    {
+        fprintf(stderr, "Enter watchpoint id: ");
+        fscanf(stdin, "%u", &uiId);
+        (void)pWatchpoints->Remove(uiId);
+    }
+    else if (_stricmp(pCommand, "watch-adaptive") == 0)
+    {
+        int iIsAdaptive = 0;
+        double dRate = 0.0;
+        fprintf(stderr, "Enter 1 to enable or 0 to disable, and false hits per second before moving to debug registers: ");
+        fscanf(stdin, "%d %lf", &iIsAdaptive, &dRate);
+        pWatchpoints->SetAdaptive(iIsAdaptive != 0, dRate);
+    }
+    else if (_stricmp(pCommand, "watch-list") == 0)
+    {
+        pWatchpoints->PrintWatches();
+    }
+    else if (_stricmp(pCommand, "watch-stats") == 0)
+    {
+        pWatchpoints->PrintStats();
+    }
+}
+
+void PromptExtendedCommand(CodeReversing::Debugger *dbg)
+{
+    char strCommand[32] = { 0 };
+    fprintf(stderr, "Enter command: ");
+    fscanf(stdin, "%31s", strCommand);
+
+    if (_strnicmp(strCommand, "patch-", 6) == 0)
+    {
+        PromptPatchCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "scan-", 5) == 0)
+    {
+        PromptScanCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "value-", 6) == 0)
+    {
+        PromptValueScanCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "snapshot-", 9) == 0)
+    {
+        PromptSnapshotCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "dump-", 5) == 0)
+    {
+        PromptDumpCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "disasm-", 7) == 0)
+    {
+        PromptDisassemblerCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "analyze-", 8) == 0)
+    {
+        PromptAnalyzeCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "cfg-", 4) == 0)
+    {
+        PromptFlowGraphCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "stack-", 6) == 0)
+    {
+        PromptStackCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "profile-", 8) == 0)
+    {
+        PromptProfileCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "fprof-", 6) == 0)
+    {
+        PromptFunctionProfileCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "cov-", 4) == 0)
+    {
+        PromptCoverageCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "trace-", 6) == 0)
+    {
+        PromptTraceCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "range-", 6) == 0)
+    {
+        PromptRangeCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "temp-", 5) == 0)
+    {
+        PromptTemporaryCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "cond-", 5) == 0)
+    {
+        PromptConditionCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "log-", 4) == 0)
+    {
+        PromptLogpointCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "api-", 4) == 0)
+    {
+        PromptApiTraceCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "pend-", 5) == 0)
+    {
+        PromptPendingCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "group-", 6) == 0)
+    {
+        PromptGroupCommand(dbg, strCommand);
+    }
+    else if (_strnicmp(strCommand, "watch-", 6) == 0)
+    {
+        PromptWatchCommand(dbg, strCommand);
+    }
+    else
+    {
+        fprintf(stderr, "Unknown command %s.\n", strCommand);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     DWORD dwPid = 0;
@@ -127,6 +994,7 @@ int main(int argc, char *argv[])
         "[D]isassemble at address.\n"
         "Modify at m[e]mory.\n"
         "Pr[i]nt at memory.\n"
+        "E[x]tended command.\n"
         "[Q]uit.\n");
 
     char cInput = 0;
@@ -218,6 +1086,10 @@ int main(int argc, char *argv[])
             (void)dbg.ChangeByteAt(dwTargetAddress, (unsigned char)(iNewChar & 0xFF));
         }
             break;
+        case 'X':
+        case 'x':
+            PromptExtendedCommand(&dbg);
+            break;
         }
 
     } while (cInput != 'Q' || cInput != 'q');
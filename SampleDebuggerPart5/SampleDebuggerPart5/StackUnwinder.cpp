@@ -0,0 +1,594 @@
+#include "StackUnwinder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "PeParser.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//UNWIND_CODE operations, see the x64 exception handling documentation
+const unsigned char cPushNonvolatile = 0;
+const unsigned char cAllocLarge = 1;
+const unsigned char cAllocSmall = 2;
+const unsigned char cSetFramePointer = 3;
+const unsigned char cSaveNonvolatile = 4;
+const unsigned char cSaveNonvolatileFar = 5;
+const unsigned char cEpilog = 6;
+const unsigned char cSaveXmm128 = 8;
+const unsigned char cSaveXmm128Far = 9;
+const unsigned char cPushMachineFrame = 10;
+
+const unsigned char cFlagChainInfo = 0x04;
+const size_t ulMaxChainDepth = 32;
+const size_t ulMaxCodeSlots = 256;
+const size_t ulRegisterRsp = 4;
+
+const size_t ulWindowSize = 16 * 1024;
+const size_t ulPageSize = 0x1000;
+
+//Number of UNWIND_CODE slots taken up by each operation
+const size_t CodeSlots(const unsigned char cOperation, const unsigned char cInfo)
+{
+    switch (cOperation)
+    {
+    case cAllocLarge:
+        return (cInfo == 0) ? 2 : 3;
+    case cSaveNonvolatile:
+    case cSaveXmm128:
+    case cEpilog:
+        return 2;
+    case cSaveNonvolatileFar:
+    case cSaveXmm128Far:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+}
+
+StackUnwinder::StackUnwinder(const HANDLE hProcess) : m_hProcess{ hProcess }, m_dwWindowStart{ 0 }, m_ulWindowValid{ 0 },
+    m_vecWindow(ulWindowSize)
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const size_t StackUnwinder::Capture(const CONTEXT &ctx, StackFrame * const pFrames, const size_t ulMaxFrames)
+{
+    Stopwatch stopwatch;
+
+    //The stack has moved on since the last capture
+    m_ulWindowValid = 0;
+    size_t ulFrames = 0;
+
+#ifdef _M_IX86
+    DWORD_PTR dwInstruction = ctx.Eip;
+    DWORD_PTR dwStack = ctx.Esp;
+    DWORD_PTR dwFrame = ctx.Ebp;
+    while (ulFrames < ulMaxFrames && dwInstruction != 0)
+    {
+        pFrames[ulFrames].dwInstruction = dwInstruction;
+        pFrames[ulFrames].dwStack = dwStack;
+        ++ulFrames;
+
+        DWORD_PTR dwNextFrame = 0;
+        if (dwFrame < dwStack || !ReadStack(dwFrame, dwNextFrame) ||
+            !ReadStack(dwFrame + sizeof(DWORD_PTR), dwInstruction) || dwNextFrame <= dwFrame)
+        {
+            break;
+        }
+        dwStack = dwFrame + 2 * sizeof(DWORD_PTR);
+        dwFrame = dwNextFrame;
+    }
+#elif defined _M_AMD64
+    DWORD64 pRegisters[16] = { ctx.Rax, ctx.Rcx, ctx.Rdx, ctx.Rbx, ctx.Rsp, ctx.Rbp, ctx.Rsi, ctx.Rdi,
+        ctx.R8, ctx.R9, ctx.R10, ctx.R11, ctx.R12, ctx.R13, ctx.R14, ctx.R15 };
+    DWORD64 dwInstruction = ctx.Rip;
+    while (ulFrames < ulMaxFrames && dwInstruction != 0)
+    {
+        pFrames[ulFrames].dwInstruction = (DWORD_PTR)dwInstruction;
+        pFrames[ulFrames].dwStack = (DWORD_PTR)pRegisters[ulRegisterRsp];
+        ++ulFrames;
+
+        //Every unwound frame pops at least a return address, so a stack pointer that does not move up means garbage
+        const DWORD64 dwPreviousStack = pRegisters[ulRegisterRsp];
+        if (!UnwindFrame(pRegisters, dwInstruction, ulFrames == 1) || pRegisters[ulRegisterRsp] <= dwPreviousStack)
+        {
+            break;
+        }
+    }
+#else
+#error "Unsupported architecture"
+#endif
+
+    ++m_stats.ullCaptures;
+    m_stats.ullFrames += ulFrames;
+    m_stats.dMicroseconds += stopwatch.ElapsedMicroseconds();
+
+    return ulFrames;
+}
+
+void StackUnwinder::RemoveModule(const DWORD_PTR dwModuleBase)
+{
+    (void)m_mapModules.erase(dwModuleBase);
+}
+
+void StackUnwinder::PrintStats() const
+{
+    size_t ulFunctions = 0;
+    for (auto &module : m_mapModules)
+    {
+        ulFunctions += module.second.vecFunctions.size();
+    }
+
+    const unsigned long long ullCaptures = m_stats.ullCaptures;
+    fprintf(stderr, "Stack unwinder: %Iu modules, %Iu functions cached, %I64u decoded. %I64u captures, %.2f us and "
+        "%.1f frames per capture, %I64u stack reads.\n", m_mapModules.size(), ulFunctions, m_stats.ullDecodedFunctions,
+        ullCaptures, (ullCaptures != 0) ? m_stats.dMicroseconds / ullCaptures : 0.0,
+        (ullCaptures != 0) ? (double)m_stats.ullFrames / ullCaptures : 0.0, m_stats.ullStackReads);
+}
+
+StackUnwinder::ModuleEntry * const StackUnwinder::FindModule(const DWORD_PTR dwAddress)
+{
+    auto iter = m_mapModules.upper_bound(dwAddress);
+    if (iter != m_mapModules.begin())
+    {
+        --iter;
+        if (dwAddress - iter->second.dwBase < iter->second.dwSize)
+        {
+            return &iter->second;
+        }
+    }
+
+    MEMORY_BASIC_INFORMATION memoryInfo = { 0 };
+    if (VirtualQueryEx(m_hProcess, (LPCVOID)dwAddress, &memoryInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0 ||
+        memoryInfo.Type != MEM_IMAGE)
+    {
+        return nullptr;
+    }
+
+    const DWORD_PTR dwBase = (DWORD_PTR)memoryInfo.AllocationBase;
+    unsigned char pHeaders[ulPageSize] = { 0 };
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwBase, pHeaders, sizeof(pHeaders), &ulBytesRead)))
+    {
+        fprintf(stderr, "Could not read PE headers at %p. Error = %X\n", (void *)dwBase, GetLastError());
+        return nullptr;
+    }
+
+    PeParser parser(pHeaders, ulBytesRead, PeParser::eLayout::eImage);
+    if (!parser.Parse() || parser.ImageSize() == 0)
+    {
+        return nullptr;
+    }
+
+    ModuleEntry &module = m_mapModules[dwBase];
+    module.dwBase = dwBase;
+    module.dwSize = parser.ImageSize();
+
+    //Only the runtime function table itself is read; UNWIND_INFO is fetched per function when it is first needed
+    uint32_t uiTableRva = 0;
+    uint32_t uiTableSize = 0;
+    if (parser.Is64Bit() && parser.DataDirectory(PeParser::uiDirectoryException, uiTableRva, uiTableSize))
+    {
+        std::vector<PeParser::RuntimeFunction> vecTable(uiTableSize / sizeof(PeParser::RuntimeFunction));
+        const size_t ulTableBytes = vecTable.size() * sizeof(PeParser::RuntimeFunction);
+        if (BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(dwBase + uiTableRva), vecTable.data(), ulTableBytes,
+            &ulBytesRead)) && ulBytesRead == ulTableBytes)
+        {
+            module.vecFunctions.reserve(vecTable.size());
+            for (auto &entry : vecTable)
+            {
+                FunctionEntry function = { 0 };
+                function.dwBegin = entry.uiBegin;
+                function.dwEnd = entry.uiEnd;
+                function.dwUnwindInfo = entry.uiUnwindInfo;
+                module.vecFunctions.push_back(function);
+            }
+            std::sort(module.vecFunctions.begin(), module.vecFunctions.end(), [](const FunctionEntry &left, const FunctionEntry &right)
+            {
+                return left.dwBegin < right.dwBegin;
+            });
+        }
+        else
+        {
+            fprintf(stderr, "Could not read runtime functions of module at %p. Error = %X\n", (void *)dwBase, GetLastError());
+        }
+    }
+
+    return &module;
+}
+
+StackUnwinder::FunctionEntry * const StackUnwinder::FindFunction(ModuleEntry &module, const DWORD_PTR dwAddress)
+{
+    const DWORD dwRva = (DWORD)(dwAddress - module.dwBase);
+    auto iter = std::upper_bound(module.vecFunctions.begin(), module.vecFunctions.end(), dwRva, [](const DWORD dwValue, const FunctionEntry &function)
+    {
+        return dwValue < function.dwBegin;
+    });
+    if (iter == module.vecFunctions.begin())
+    {
+        return nullptr;
+    }
+    --iter;
+    return (dwRva < iter->dwEnd) ? &(*iter) : nullptr;
+}
+
+const bool StackUnwinder::Decode(ModuleEntry &module, FunctionEntry &function)
+{
+    function.bIsDecoded = true;
+    function.bIsValid = false;
+    function.dwFirstCode = (DWORD)module.vecCodes.size();
+    function.usCodeCount = 0;
+
+    DWORD dwUnwindInfo = function.dwUnwindInfo;
+    bool bIsChained = false;
+    SIZE_T ulBytesRead = 0;
+    for (size_t ulDepth = 0; ulDepth < ulMaxChainDepth; ++ulDepth)
+    {
+        //An odd address points at another runtime function that shares its unwind data
+        if (BOOLIFY(dwUnwindInfo & 1))
+        {
+            PeParser::RuntimeFunction entry = { 0 };
+            if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(module.dwBase + (dwUnwindInfo & ~1UL)), &entry, sizeof(entry),
+                &ulBytesRead)))
+            {
+                return false;
+            }
+            dwUnwindInfo = entry.uiUnwindInfo;
+            continue;
+        }
+
+        unsigned char pHeader[4] = { 0 };
+        if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(module.dwBase + dwUnwindInfo), pHeader, sizeof(pHeader),
+            &ulBytesRead)))
+        {
+            return false;
+        }
+
+        const unsigned char cVersion = pHeader[0] & 0x07;
+        const unsigned char cFlags = pHeader[0] >> 3;
+        const size_t ulSlots = pHeader[2];
+        if (cVersion != 1 && cVersion != 2)
+        {
+            return false;
+        }
+        if (!bIsChained)
+        {
+            function.cPrologSize = pHeader[1];
+            function.cFrameRegister = pHeader[3] & 0x0F;
+            function.cFrameOffset = pHeader[3] >> 4;
+        }
+
+        //Slots are padded to an even count, and a chained runtime function follows them
+        unsigned short pSlots[ulMaxCodeSlots + 1 + 6] = { 0 };
+        const size_t ulSlotBytes = ((ulSlots + 1) & ~(size_t)1) * sizeof(unsigned short);
+        const size_t ulReadBytes = ulSlotBytes + (BOOLIFY(cFlags & cFlagChainInfo) ? sizeof(PeParser::RuntimeFunction) : 0);
+        if (ulReadBytes != 0 && !BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)(module.dwBase + dwUnwindInfo + sizeof(pHeader)),
+            pSlots, ulReadBytes, &ulBytesRead)))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < ulSlots;)
+        {
+            const unsigned short usSlot = pSlots[i];
+            const unsigned char cOperation = (usSlot >> 8) & 0x0F;
+            const unsigned char cInfo = (unsigned char)(usSlot >> 12);
+            const size_t ulSize = CodeSlots(cOperation, cInfo);
+            if (i + ulSize > ulSlots)
+            {
+                return false;
+            }
+
+            UnwindCode code = { 0 };
+            code.cOperation = cOperation;
+            code.cRegister = cInfo;
+            code.cCodeOffset = (unsigned char)(usSlot & 0xFF);
+            code.bIsChained = bIsChained;
+            bool bKeep = true;
+            switch (cOperation)
+            {
+            case cAllocLarge:
+                code.dwValue = (cInfo == 0) ? pSlots[i + 1] * 8UL : (pSlots[i + 1] | ((DWORD)pSlots[i + 2] << 16));
+                break;
+            case cAllocSmall:
+                code.dwValue = cInfo * 8UL + 8;
+                break;
+            case cSetFramePointer:
+                code.cRegister = pHeader[3] & 0x0F;
+                code.dwValue = (pHeader[3] >> 4) * 16UL;
+                break;
+            case cSaveNonvolatile:
+                code.dwValue = pSlots[i + 1] * 8UL;
+                break;
+            case cSaveNonvolatileFar:
+                code.dwValue = pSlots[i + 1] | ((DWORD)pSlots[i + 2] << 16);
+                break;
+            case cPushMachineFrame:
+                code.dwValue = cInfo;
+                break;
+            case cPushNonvolatile:
+                break;
+            default:
+                //XMM saves and epilog descriptors do not affect the integer registers
+                bKeep = false;
+                break;
+            }
+            if (bKeep)
+            {
+                module.vecCodes.push_back(code);
+                ++function.usCodeCount;
+            }
+            i += ulSize;
+        }
+
+        if (!BOOLIFY(cFlags & cFlagChainInfo))
+        {
+            function.bIsValid = true;
+            ++m_stats.ullDecodedFunctions;
+            return true;
+        }
+
+        PeParser::RuntimeFunction chained = { 0 };
+        memcpy(&chained, &pSlots[ulSlotBytes / sizeof(unsigned short)], sizeof(chained));
+        dwUnwindInfo = chained.uiUnwindInfo;
+        bIsChained = true;
+    }
+
+    return false;
+}
+
+const bool StackUnwinder::UnwindFrame(DWORD64 * const pRegisters, DWORD64 &dwInstruction, const bool bIsTopFrame)
+{
+    //Return addresses can sit just past a call at the very end of a function, so look those up by the call itself
+    const DWORD_PTR dwLookup = (DWORD_PTR)(bIsTopFrame ? dwInstruction : dwInstruction - 1);
+    ModuleEntry * const pModule = FindModule(dwLookup);
+    FunctionEntry * const pFunction = (pModule != nullptr) ? FindFunction(*pModule, dwLookup) : nullptr;
+
+    DWORD_PTR dwValue = 0;
+    if (pFunction == nullptr)
+    {
+        //Leaf functions have no unwind data and leave the return address on top of the stack
+        if (!ReadStack((DWORD_PTR)pRegisters[ulRegisterRsp], dwValue))
+        {
+            return false;
+        }
+        dwInstruction = dwValue;
+        pRegisters[ulRegisterRsp] += sizeof(DWORD64);
+        return true;
+    }
+
+    if (!pFunction->bIsDecoded)
+    {
+        (void)Decode(*pModule, *pFunction);
+    }
+    if (!pFunction->bIsValid)
+    {
+        return false;
+    }
+
+    const DWORD dwOffset = (DWORD)(dwInstruction - pModule->dwBase) - pFunction->dwBegin;
+    if (bIsTopFrame && dwOffset >= pFunction->cPrologSize && UnwindEpilog(pRegisters, dwInstruction, *pFunction))
+    {
+        return true;
+    }
+
+    //Codes are stored in reverse prolog order, so replaying them front to back undoes the prolog
+    const UnwindCode * const pCodes = &pModule->vecCodes[pFunction->dwFirstCode];
+    for (unsigned short i = 0; i < pFunction->usCodeCount; ++i)
+    {
+        const UnwindCode &code = pCodes[i];
+        if (!code.bIsChained && dwOffset < pFunction->cPrologSize && code.cCodeOffset > dwOffset)
+        {
+            continue;
+        }
+
+        DWORD64 &dwStack = pRegisters[ulRegisterRsp];
+        switch (code.cOperation)
+        {
+        case cPushNonvolatile:
+            if (!ReadStack((DWORD_PTR)dwStack, dwValue))
+            {
+                return false;
+            }
+            pRegisters[code.cRegister] = dwValue;
+            dwStack += sizeof(DWORD64);
+            break;
+        case cAllocLarge:
+        case cAllocSmall:
+            dwStack += code.dwValue;
+            break;
+        case cSetFramePointer:
+            dwStack = pRegisters[code.cRegister] - code.dwValue;
+            break;
+        case cSaveNonvolatile:
+        case cSaveNonvolatileFar:
+            if (!ReadStack((DWORD_PTR)(dwStack + code.dwValue), dwValue))
+            {
+                return false;
+            }
+            pRegisters[code.cRegister] = dwValue;
+            break;
+        case cPushMachineFrame:
+        {
+            //Interrupt and exception frames: optional error code, then RIP, CS, EFLAGS, old RSP and SS
+            const DWORD64 dwFrame = dwStack + code.dwValue * sizeof(DWORD64);
+            DWORD_PTR dwStackValue = 0;
+            if (!ReadStack((DWORD_PTR)dwFrame, dwValue) || !ReadStack((DWORD_PTR)(dwFrame + 3 * sizeof(DWORD64)), dwStackValue))
+            {
+                return false;
+            }
+            dwInstruction = dwValue;
+            dwStack = dwStackValue;
+            return true;
+        }
+        }
+    }
+
+    if (!ReadStack((DWORD_PTR)pRegisters[ulRegisterRsp], dwValue))
+    {
+        return false;
+    }
+    dwInstruction = dwValue;
+    pRegisters[ulRegisterRsp] += sizeof(DWORD64);
+
+    return true;
+}
+
+const bool StackUnwinder::UnwindEpilog(DWORD64 * const pRegisters, DWORD64 &dwInstruction, const FunctionEntry &function)
+{
+    //Epilogs are not described by unwind codes, so recognize one by its instructions: an optional add rsp or
+    //lea rsp, a run of pops and then ret or a tail jump
+    //A few bytes of zero padding let the terminator checks look past the end of what was read
+    const size_t ulCodeSize = 32;
+    unsigned char pCode[ulCodeSize + 3] = { 0 };
+    const size_t ulToPageEnd = ulPageSize - (size_t)(dwInstruction & (ulPageSize - 1));
+    SIZE_T ulBytesRead = 0;
+    if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwInstruction, pCode, std::min(ulCodeSize, ulToPageEnd), &ulBytesRead)))
+    {
+        return false;
+    }
+
+    DWORD64 dwStack = pRegisters[ulRegisterRsp];
+    size_t i = 0;
+    bool bHasStackChange = false;
+    if (pCode[0] == 0x48 && pCode[1] == 0x83 && pCode[2] == 0xC4)
+    {
+        dwStack += (signed char)pCode[3];
+        i = 4;
+        bHasStackChange = true;
+    }
+    else if (pCode[0] == 0x48 && pCode[1] == 0x81 && pCode[2] == 0xC4)
+    {
+        int iDisplacement = 0;
+        memcpy(&iDisplacement, &pCode[3], sizeof(iDisplacement));
+        dwStack += iDisplacement;
+        i = 7;
+        bHasStackChange = true;
+    }
+    else if ((pCode[0] & 0xFE) == 0x48 && pCode[1] == 0x8D && ((pCode[2] >> 3) & 0x07) == ulRegisterRsp &&
+        (pCode[2] & 0x07) != 4 && (pCode[2] >> 6) != 0 && (pCode[2] >> 6) != 3)
+    {
+        //lea rsp, [frame register + displacement]
+        const size_t ulBase = (pCode[2] & 0x07) + ((pCode[0] & 0x01) ? 8 : 0);
+        int iDisplacement = 0;
+        if ((pCode[2] >> 6) == 1)
+        {
+            iDisplacement = (signed char)pCode[3];
+            i = 4;
+        }
+        else
+        {
+            memcpy(&iDisplacement, &pCode[3], sizeof(iDisplacement));
+            i = 7;
+        }
+        if (ulBase != function.cFrameRegister || function.cFrameRegister == 0)
+        {
+            return false;
+        }
+        dwStack = pRegisters[ulBase] + iDisplacement;
+        bHasStackChange = true;
+    }
+
+    size_t pPopped[16] = { 0 };
+    size_t ulPopCount = 0;
+    while (i + 2 <= ulCodeSize && ulPopCount < 16)
+    {
+        if (pCode[i] >= 0x58 && pCode[i] <= 0x5F)
+        {
+            pPopped[ulPopCount++] = pCode[i] - 0x58;
+            i += 1;
+        }
+        else if (pCode[i] == 0x41 && pCode[i + 1] >= 0x58 && pCode[i + 1] <= 0x5F)
+        {
+            pPopped[ulPopCount++] = 8 + pCode[i + 1] - 0x58;
+            i += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    //A bare jmp is ordinary control flow, it only ends an epilog when something was torn down before it
+    const bool bIsReturn = (pCode[i] == 0xC3 || pCode[i] == 0xC2 || (pCode[i] == 0xF3 && pCode[i + 1] == 0xC3));
+    const bool bIsTailJump = (pCode[i] == 0xE9 || (pCode[i] == 0xFF && pCode[i + 1] == 0x25) ||
+        (pCode[i] == 0x48 && pCode[i + 1] == 0xFF && pCode[i + 2] == 0x25));
+    if (i >= ulBytesRead || !(bIsReturn || (bIsTailJump && (bHasStackChange || ulPopCount != 0))))
+    {
+        return false;
+    }
+
+    DWORD_PTR dwValue = 0;
+    DWORD64 pRestored[16] = { 0 };
+    for (size_t ulPop = 0; ulPop < ulPopCount; ++ulPop)
+    {
+        if (!ReadStack((DWORD_PTR)dwStack, dwValue))
+        {
+            return false;
+        }
+        pRestored[ulPop] = dwValue;
+        dwStack += sizeof(DWORD64);
+    }
+    if (!ReadStack((DWORD_PTR)dwStack, dwValue))
+    {
+        return false;
+    }
+
+    for (size_t ulPop = 0; ulPop < ulPopCount; ++ulPop)
+    {
+        pRegisters[pPopped[ulPop]] = pRestored[ulPop];
+    }
+    dwInstruction = dwValue;
+    pRegisters[ulRegisterRsp] = dwStack + sizeof(DWORD64);
+
+    return true;
+}
+
+const bool StackUnwinder::ReadStack(const DWORD_PTR dwAddress, DWORD_PTR &dwValue)
+{
+    if (dwAddress >= m_dwWindowStart && dwAddress - m_dwWindowStart + sizeof(DWORD_PTR) <= m_ulWindowValid)
+    {
+        memcpy(&dwValue, &m_vecWindow[dwAddress - m_dwWindowStart], sizeof(DWORD_PTR));
+        return true;
+    }
+
+    //Stacks are walked upwards, so fetch a whole window above the address but never past the end of its region
+    ++m_stats.ullStackReads;
+    m_dwWindowStart = dwAddress;
+    m_ulWindowValid = 0;
+    SIZE_T ulBytesRead = 0;
+    size_t ulSize = m_vecWindow.size();
+    if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, m_vecWindow.data(), ulSize, &ulBytesRead)))
+    {
+        MEMORY_BASIC_INFORMATION memoryInfo = { 0 };
+        if (VirtualQueryEx(m_hProcess, (LPCVOID)dwAddress, &memoryInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0)
+        {
+            return false;
+        }
+        ulSize = std::min(ulSize, (size_t)((DWORD_PTR)memoryInfo.BaseAddress + memoryInfo.RegionSize - dwAddress));
+        if (!BOOLIFY(ReadProcessMemory(m_hProcess, (LPCVOID)dwAddress, m_vecWindow.data(), ulSize, &ulBytesRead)))
+        {
+            return false;
+        }
+    }
+    m_ulWindowValid = ulBytesRead;
+
+    if (m_ulWindowValid < sizeof(DWORD_PTR))
+    {
+        return false;
+    }
+    memcpy(&dwValue, m_vecWindow.data(), sizeof(DWORD_PTR));
+    return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+struct StackFrame
+{
+    DWORD_PTR dwInstruction;
+    DWORD_PTR dwStack;
+};
+
+//Native stack capture for sampling. On x64 each module's .pdata is cached as a sorted array the first time a frame
+//lands in it and UNWIND_INFO is decoded once per function into a flat list of operations. Stack memory is read
+//in large windows instead of one value at a time. 32-bit targets walk the EBP chain.
+class StackUnwinder final
+{
+public:
+    StackUnwinder() = delete;
+    StackUnwinder(const HANDLE hProcess);
+
+    StackUnwinder(const StackUnwinder &copy) = delete;
+    StackUnwinder &operator=(const StackUnwinder &copy) = delete;
+
+    ~StackUnwinder() = default;
+
+    const size_t Capture(const CONTEXT &ctx, StackFrame * const pFrames, const size_t ulMaxFrames);
+    void RemoveModule(const DWORD_PTR dwModuleBase);
+
+    void PrintStats() const;
+
+private:
+    struct UnwindCode
+    {
+        unsigned char cOperation;
+        unsigned char cRegister;
+        unsigned char cCodeOffset;
+        bool bIsChained;
+        DWORD dwValue;
+    };
+
+    struct FunctionEntry
+    {
+        DWORD dwBegin;
+        DWORD dwEnd;
+        DWORD dwUnwindInfo;
+        DWORD dwFirstCode;
+        unsigned short usCodeCount;
+        unsigned char cPrologSize;
+        unsigned char cFrameRegister;
+        unsigned char cFrameOffset;
+        bool bIsDecoded;
+        bool bIsValid;
+    };
+
+    struct ModuleEntry
+    {
+        DWORD_PTR dwBase;
+        DWORD_PTR dwSize;
+        std::vector<FunctionEntry> vecFunctions;
+        std::vector<UnwindCode> vecCodes;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullCaptures;
+        unsigned long long ullFrames;
+        unsigned long long ullStackReads;
+        unsigned long long ullDecodedFunctions;
+        double dMicroseconds;
+    };
+
+    ModuleEntry * const FindModule(const DWORD_PTR dwAddress);
+    FunctionEntry * const FindFunction(ModuleEntry &module, const DWORD_PTR dwAddress);
+    const bool Decode(ModuleEntry &module, FunctionEntry &function);
+    const bool UnwindFrame(DWORD64 * const pRegisters, DWORD64 &dwInstruction, const bool bIsTopFrame);
+    const bool UnwindEpilog(DWORD64 * const pRegisters, DWORD64 &dwInstruction, const FunctionEntry &function);
+    const bool ReadStack(const DWORD_PTR dwAddress, DWORD_PTR &dwValue);
+
+    HANDLE m_hProcess;
+
+    //Keyed by base; modules with no unwind data are kept as well so they are not looked up again
+    std::map<DWORD_PTR, ModuleEntry> m_mapModules;
+
+    DWORD_PTR m_dwWindowStart;
+    size_t m_ulWindowValid;
+    std::vector<unsigned char> m_vecWindow;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+    //Thin wrapper around the performance counter for timing debugger operations
+    class Stopwatch
+    {
+    public:
+        Stopwatch() : m_llStart{ 0 }
+        {
+            Start();
+        }
+
+        void Start()
+        {
+            m_llStart = Now();
+        }
+
+        const double ElapsedSeconds() const
+        {
+            return (double)(Now() - m_llStart) / (double)Frequency();
+        }
+
+        const double ElapsedMicroseconds() const
+        {
+            return ElapsedSeconds() * 1000000.0;
+        }
+
+        static const LONGLONG Now()
+        {
+            LARGE_INTEGER counter = { 0 };
+            (void)QueryPerformanceCounter(&counter);
+            return counter.QuadPart;
+        }
+
+        static const LONGLONG Frequency()
+        {
+            static LONGLONG llFrequency = 0;
+            if (llFrequency == 0)
+            {
+                LARGE_INTEGER frequency = { 0 };
+                (void)QueryPerformanceFrequency(&frequency);
+                llFrequency = frequency.QuadPart;
+            }
+            return llFrequency;
+        }
+
+    private:
+        LONGLONG m_llStart;
+    };
+}
\ No newline at end of file
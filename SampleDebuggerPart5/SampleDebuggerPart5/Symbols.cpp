@@ -2,9 +2,13 @@
 
 #include "Symbols.h"
 
+#include <cctype>
 #include <cstdio>
+#include <set>
 
 #include "Common.h"
+#include "PeParser.h"
+#include "RemoteImage.h"
 
 namespace CodeReversing
 {
@@ -95,9 +99,10 @@ const bool Symbols::EnumerateModuleSymbols(const char * const pModulePath, const
     {
         fprintf(stderr, "Could not load modules for %s. Error = %X.\n",
             pModulePath, GetLastError());
-        return false;
+        return EnumerateModuleExports(pModulePath, dwBaseAddress);
     }
 
+    const size_t ulSymbolsBefore = m_mapSymbols.size();
     UserContext userContext = { this, pModulePath };
     const bool bSuccess = 
        BOOLIFY(SymEnumSymbols(m_hProcess, dwBaseOfDll, "*!*", SymEnumCallback, &userContext));
@@ -107,9 +112,120 @@ const bool Symbols::EnumerateModuleSymbols(const char * const pModulePath, const
             pModulePath, GetLastError());
     }
 
+    //Modules without a PDB still have their export table
+    if (m_mapSymbols.size() == ulSymbolsBefore)
+    {
+        return EnumerateModuleExports(pModulePath, dwBaseAddress);
+    }
+
     return bSuccess;
 }
 
+const bool Symbols::EnumerateModuleExports(const char * const pModulePath, const DWORD64 dwBaseAddress)
+{
+    RemoteImage image(m_hProcess, (DWORD_PTR)dwBaseAddress);
+    if (!image.Read())
+    {
+        return false;
+    }
+
+    PeParser parser(image.Data(), image.Size(), PeParser::eLayout::eImage);
+    std::vector<PeParser::Export> vecExports;
+    if (!parser.Parse() || !parser.Exports(vecExports))
+    {
+        fprintf(stderr, "Could not parse the export table of %s.\n", pModulePath);
+        return false;
+    }
+
+    for (auto &exportEntry : vecExports)
+    {
+        //Forwarded exports have no code in this module
+        if (exportEntry.pForwarder != nullptr)
+        {
+            continue;
+        }
+
+        char strOrdinal[32] = { 0 };
+        const char *pName = exportEntry.pName;
+        if (pName == nullptr)
+        {
+            sprintf_s(strOrdinal, sizeof(strOrdinal), "Ordinal%u", exportEntry.uiOrdinal);
+            pName = strOrdinal;
+        }
+
+        SymbolInfo symbolInfo;
+        symbolInfo.dwAddress = (DWORD_PTR)dwBaseAddress + exportEntry.uiRva;
+        symbolInfo.strName = std::vector<char>(pName, pName + strlen(pName) + 1);
+
+        ModuleSymbolInfo moduleSymbol;
+        moduleSymbol.dwModuleBaseAddress = (DWORD_PTR)dwBaseAddress;
+        moduleSymbol.strName = std::vector<char>(pModulePath, pModulePath + strlen(pModulePath) + 1);
+        moduleSymbol.symbolInfo = std::move(symbolInfo);
+
+        m_mapSymbols.insert(std::make_pair((DWORD_PTR)dwBaseAddress, std::move(moduleSymbol)));
+    }
+
+    fprintf(stderr, "Loaded %Iu exports for %s.\n", vecExports.size(), pModulePath);
+
+    return true;
+}
+
+const bool Symbols::FindExports(const char * const pPattern, std::vector<ExportedFunction> &vecExports) const
+{
+    const std::string strPattern(pPattern);
+    const size_t ulBang = strPattern.find('!');
+    const std::string strModulePattern = strPattern.substr(0, ulBang);
+    const std::string strFunctionPattern = (ulBang != std::string::npos) ? strPattern.substr(ulBang + 1) : "*";
+
+    //The export table is read again rather than trusting the symbol list, which also holds PDB-only functions
+    for (auto module = m_mapSymbols.begin(); module != m_mapSymbols.end(); module = m_mapSymbols.upper_bound(module->first))
+    {
+        if (!WildcardMatch(strModulePattern.c_str(), ModuleStem(module->second.strName.data()).c_str()))
+        {
+            continue;
+        }
+
+        RemoteImage image(m_hProcess, module->first);
+        if (!image.Read())
+        {
+            continue;
+        }
+        PeParser parser(image.Data(), image.Size(), PeParser::eLayout::eImage);
+        std::vector<PeParser::Export> vecModuleExports;
+        if (!parser.Parse() || !parser.Exports(vecModuleExports))
+        {
+            fprintf(stderr, "Could not parse the export table of %s.\n", module->second.strName.data());
+            continue;
+        }
+
+        std::set<uint32_t> setSeen;
+        for (auto &exportEntry : vecModuleExports)
+        {
+            if (exportEntry.pForwarder != nullptr || exportEntry.pName == nullptr ||
+                !WildcardMatch(strFunctionPattern.c_str(), exportEntry.pName) || !setSeen.insert(exportEntry.uiRva).second)
+            {
+                continue;
+            }
+
+            //Exported variables must never get an int 3 written into them
+            bool bIsCode = false;
+            for (size_t i = 0; i < parser.SectionCount() && !bIsCode; ++i)
+            {
+                const PeParser::Section section = parser.GetSection(i);
+                bIsCode = (section.uiCharacteristics & PeParser::uiSectionExecute) != 0 &&
+                    exportEntry.uiRva >= section.uiVirtualAddress &&
+                    exportEntry.uiRva - section.uiVirtualAddress < section.uiVirtualSize;
+            }
+            if (bIsCode)
+            {
+                vecExports.push_back({ module->first + exportEntry.uiRva, exportEntry.pName });
+            }
+        }
+    }
+
+    return !vecExports.empty();
+}
+
 const bool Symbols::SymbolFromAddress(const DWORD64 dwAddress, const SymbolInfo **pFullSymbolInfo)
 {
     char pBuffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(char)] = { 0 };
@@ -178,6 +294,27 @@ const bool Symbols::SymbolLineFromAddress(const DWORD64 dwAddress)
     return bSuccess;
 }
 
+const bool Symbols::LineRangeFromAddress(const DWORD64 dwAddress, LineRange &range)
+{
+    DWORD dwDisplacement = 0;
+    bool bSuccess = false;
+    IMAGEHLP_LINE64 lineInfo = GetSymbolLineInfo(dwAddress, dwDisplacement, bSuccess);
+    if (!bSuccess)
+    {
+        return false;
+    }
+
+    range.dwStart = lineInfo.Address;
+    range.dwLineNumber = lineInfo.LineNumber;
+    range.strFileName = lineInfo.FileName;
+
+    //The last entry of a file has no successor, so its extent is unknown and only the address itself is covered
+    IMAGEHLP_LINE64 nextInfo = lineInfo;
+    range.dwEnd = (BOOLIFY(SymGetLineNext64(m_hProcess, &nextInfo)) && nextInfo.Address > dwAddress) ? nextInfo.Address : dwAddress + 1;
+
+    return true;
+}
+
 const bool Symbols::SymbolAddressFromLine(const char * const pName, const char * const pFileName,
     const DWORD dwLineNumber)
 {
@@ -283,6 +420,58 @@ const bool Symbols::SymbolModuleExists(const DWORD_PTR dwAddress) const
     return false;
 }
 
+const bool Symbols::WildcardMatch(const char *pPattern, const char *pText)
+{
+    const char *pStarPattern = nullptr;
+    const char *pStarText = nullptr;
+    while (*pText != '\0')
+    {
+        if (*pPattern == '*')
+        {
+            pStarPattern = ++pPattern;
+            pStarText = pText;
+        }
+        else if (*pPattern == '?' || tolower((unsigned char)*pPattern) == tolower((unsigned char)*pText))
+        {
+            ++pPattern;
+            ++pText;
+        }
+        else if (pStarPattern != nullptr)
+        {
+            pPattern = pStarPattern;
+            pText = ++pStarText;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (*pPattern == '*')
+    {
+        ++pPattern;
+    }
+
+    return *pPattern == '\0';
+}
+
+//C:\Windows\System32\ws2_32.dll is matched as ws2_32
+const std::string Symbols::ModuleStem(const char * const pModulePath)
+{
+    std::string strStem(pModulePath);
+    const size_t ulSlash = strStem.find_last_of("\\/");
+    if (ulSlash != std::string::npos)
+    {
+        strStem.erase(0, ulSlash + 1);
+    }
+    const size_t ulDot = strStem.rfind('.');
+    if (ulDot != std::string::npos)
+    {
+        strStem.resize(ulDot);
+    }
+
+    return strStem;
+}
+
 const std::multimap<DWORD_PTR, ModuleSymbolInfo> &Symbols::SymbolList() const
 {
     return m_mapSymbols;
@@ -3,6 +3,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <Windows.h>
@@ -76,6 +77,22 @@ struct ModuleSymbolInfo
     SymbolInfo symbolInfo;
 };
 
+//One entry of a module's line table; dwEnd is where the next entry in the same file starts
+struct LineRange
+{
+    DWORD64 dwStart;
+    DWORD64 dwEnd;
+    DWORD dwLineNumber;
+    std::string strFileName;
+};
+
+//A code export picked out by FindExports; data exports and forwarders are left out
+struct ExportedFunction
+{
+    DWORD_PTR dwAddress;
+    std::string strName;
+};
+
 class Symbols final
 {
 public:
@@ -89,14 +106,19 @@ public:
 
     const bool EnumerateAllModulesWithSymbols();
     const bool EnumerateModuleSymbols(const char * const pModulePath, const DWORD64 dwBaseAddress);
+    const bool EnumerateModuleExports(const char * const pModulePath, const DWORD64 dwBaseAddress);
 
     const bool SymbolFromAddress(const DWORD64 dwAddress, const SymbolInfo **pFullSymbolInfo);
     const bool SymbolFromName(const char * const pName, const SymbolInfo **pFullSymbolInfo);
 
     const bool SymbolLineFromAddress(const DWORD64 dwAddress);
+    const bool LineRangeFromAddress(const DWORD64 dwAddress, LineRange &range);
     const bool SymbolAddressFromLine(const char * const pName, const char * const pFileName,
         const DWORD dwLineNumber);
 
+    //The pattern is "module!function" with * and ? wildcards on both sides, matched without case
+    const bool FindExports(const char * const pPattern, std::vector<ExportedFunction> &vecExports) const;
+
     const bool ListSourceFiles();
     const bool DumpSourceFileInfo(const DWORD64 dwBaseAddress, const char * const pFilePath);
 
@@ -107,6 +129,10 @@ public:
     void PrintSymbolsForModule(const char * const pModuleName) const;
     void PrintSymbol(const SymbolInfo * const pSymbol) const;
 
+    //Case-insensitive match with * and ? wildcards
+    static const bool WildcardMatch(const char *pPattern, const char *pText);
+    static const std::string ModuleStem(const char * const pModulePath);
+
 private:
 
     struct UserContext
@@ -0,0 +1,330 @@
+#include "TemporaryBreakpoints.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+#include "Debugger.h"
+
+namespace CodeReversing
+{
+
+TemporaryBreakpoints::TemporaryBreakpoints(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_uiNextId{ 1 }
+{
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool TemporaryBreakpoints::Add(const DWORD dwThreadId, const DWORD_PTR dwStackAbove,
+    const std::vector<DWORD_PTR> &vecAddresses, unsigned int &uiId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TemporarySet set = { 0 };
+    set.dwThreadId = dwThreadId;
+    set.dwStackAbove = dwStackAbove;
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto dwAddress : vecAddresses)
+    {
+        //A user breakpoint there stops every thread anyway, and sharing its byte would confuse both
+        if (m_pDebugger->FindBreakpoint(dwAddress) != nullptr)
+        {
+            fprintf(stderr, "Skipping %p, a breakpoint is already set there.\n", dwAddress);
+            continue;
+        }
+        if (std::find(set.vecAddresses.begin(), set.vecAddresses.end(), dwAddress) != set.vecAddresses.end())
+        {
+            continue;
+        }
+        set.vecAddresses.push_back(dwAddress);
+        if (m_mapBytes.find(dwAddress) == m_mapBytes.end())
+        {
+            mapBytes[dwAddress] = cBreakpointOpcode;
+        }
+    }
+    if (set.vecAddresses.empty())
+    {
+        fprintf(stderr, "No addresses left to place temporary breakpoints on.\n");
+        return false;
+    }
+
+    Stopwatch clock;
+    std::vector<PatchByte> vecPrevious;
+    if (!mapBytes.empty() && !m_pDebugger->ProcessPatches()->WriteBatch(mapBytes, &vecPrevious))
+    {
+        fprintf(stderr, "Could not place temporary breakpoints.\n");
+        return false;
+    }
+    m_stats.dArmMicroseconds += clock.ElapsedMicroseconds();
+
+    for (auto &previous : vecPrevious)
+    {
+        //An int 3 that was already there belongs to another component; backing a thread over it would loop forever
+        TemporaryByte &byte = m_mapBytes[previous.dwAddress];
+        byte.cOriginal = previous.cOriginal;
+        byte.bIsArmed = (previous.cOriginal != cBreakpointOpcode);
+    }
+
+    uiId = m_uiNextId++;
+    for (auto dwAddress : set.vecAddresses)
+    {
+        m_mapBytes[dwAddress].vecSets.push_back(uiId);
+    }
+    set.llArmedAt = Stopwatch::Now();
+    ++m_stats.ullSets;
+    m_stats.ullAddresses += set.vecAddresses.size();
+    m_mapSets[uiId] = std::move(set);
+
+    return true;
+}
+
+const bool TemporaryBreakpoints::Remove(const unsigned int uiId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto set = m_mapSets.find(uiId);
+    if (set == m_mapSets.end())
+    {
+        fprintf(stderr, "No temporary breakpoint set %u.\n", uiId);
+        return false;
+    }
+
+    return RemoveSet(set);
+}
+
+void TemporaryBreakpoints::Cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto &byte : m_mapBytes)
+    {
+        if (byte.second.bIsArmed)
+        {
+            mapBytes[byte.first] = byte.second.cOriginal;
+        }
+    }
+
+    Stopwatch clock;
+    if (!mapBytes.empty() && !m_pDebugger->ProcessPatches()->WriteBatch(mapBytes))
+    {
+        fprintf(stderr, "Could not remove temporary breakpoints.\n");
+    }
+    m_stats.dDisarmMicroseconds += clock.ElapsedMicroseconds();
+
+    fprintf(stderr, "Cancelled %Iu temporary breakpoint sets.\n", m_mapSets.size());
+    m_mapSets.clear();
+    m_mapBytes.clear();
+}
+
+const TemporaryBreakpoints::eResult TemporaryBreakpoints::HandleBreakpoint(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const DWORD_PTR dwAddress = (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto byte = m_mapBytes.find(dwAddress);
+    if (byte == m_mapBytes.end() || !byte->second.bIsArmed)
+    {
+        return eResult::eNotOwned;
+    }
+
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        return eResult::eContinue;
+    }
+    ++m_stats.ullEvents;
+    SetInstructionPointer(ctx, dwAddress);
+
+    auto set = m_mapSets.end();
+    for (auto uiId : byte->second.vecSets)
+    {
+        auto candidate = m_mapSets.find(uiId);
+        if (candidate == m_mapSets.end())
+        {
+            continue;
+        }
+        ++candidate->second.ullEvents;
+        if (set == m_mapSets.end() && Matches(candidate->second, dbgEvent.dwThreadId, ctx))
+        {
+            set = candidate;
+        }
+    }
+
+    if (set == m_mapSets.end())
+    {
+        //Not this thread's stop, or a deeper recursion: run the original instruction once and plant the byte again
+        ctx.EFlags |= 0x100;
+        if (WriteByte(dwAddress, byte->second.cOriginal) && BOOLIFY(SetThreadContext(hThread(), &ctx)))
+        {
+            byte->second.bIsArmed = false;
+            m_mapRearms[dbgEvent.dwThreadId] = dwAddress;
+        }
+        ++m_stats.ullForeignHits;
+        m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+        return eResult::eContinue;
+    }
+
+    ctx.EFlags &= ~0x100;
+    if (!BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not set context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+    }
+
+    const unsigned int uiId = set->first;
+    const double dRoundTripMicroseconds = TicksToMicroseconds(Stopwatch::Now() - set->second.llArmedAt);
+    const unsigned long long ullEvents = set->second.ullEvents;
+    (void)RemoveSet(set);
+    ++m_stats.ullFired;
+    m_stats.dRoundTripMicroseconds += dRoundTripMicroseconds;
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+    fprintf(stderr, "Temporary breakpoint set %u hit at %p by thread %X after %.2f ms and %I64u debug events.\n", uiId,
+        dwAddress, dbgEvent.dwThreadId, dRoundTripMicroseconds / 1000.0, ullEvents);
+
+    return eResult::eFinished;
+}
+
+const bool TemporaryBreakpoints::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dbgEvent.dwThreadId);
+    if (rearm == m_mapRearms.end())
+    {
+        return false;
+    }
+
+    //The set may have fired for another thread while this one was stepping, in which case the byte is gone for good
+    auto byte = m_mapBytes.find(rearm->second);
+    if (byte != m_mapBytes.end() && !byte->second.bIsArmed && WriteByte(byte->first, cBreakpointOpcode))
+    {
+        byte->second.bIsArmed = true;
+    }
+    m_mapRearms.erase(rearm);
+    ++m_stats.ullEvents;
+
+    return true;
+}
+
+void TemporaryBreakpoints::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto rearm = m_mapRearms.find(dwThreadId);
+    if (rearm != m_mapRearms.end())
+    {
+        auto byte = m_mapBytes.find(rearm->second);
+        if (byte != m_mapBytes.end() && !byte->second.bIsArmed && WriteByte(byte->first, cBreakpointOpcode))
+        {
+            byte->second.bIsArmed = true;
+        }
+        m_mapRearms.erase(rearm);
+    }
+
+    //Sets tied to the thread can never fire now
+    for (auto set = m_mapSets.begin(); set != m_mapSets.end();)
+    {
+        auto current = set++;
+        if (current->second.dwThreadId == dwThreadId)
+        {
+            (void)RemoveSet(current);
+        }
+    }
+}
+
+void TemporaryBreakpoints::RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes,
+    const size_t ulSize) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto byte = m_mapBytes.lower_bound(dwAddress); byte != m_mapBytes.end() && byte->first - dwAddress < ulSize; ++byte)
+    {
+        if (byte->second.bIsArmed)
+        {
+            pBytes[byte->first - dwAddress] = byte->second.cOriginal;
+        }
+    }
+}
+
+void TemporaryBreakpoints::PrintSets() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &set : m_mapSets)
+    {
+        fprintf(stderr, "Set %u: %Iu addresses, thread %X, stack above %p, armed %.2f ms ago.\n", set.first,
+            set.second.vecAddresses.size(), set.second.dwThreadId, set.second.dwStackAbove,
+            TicksToMicroseconds(Stopwatch::Now() - set.second.llArmedAt) / 1000.0);
+    }
+}
+
+void TemporaryBreakpoints::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dEvents = (m_stats.ullEvents != 0) ? (double)m_stats.ullEvents : 1.0;
+    const double dFired = (m_stats.ullFired != 0) ? (double)m_stats.ullFired : 1.0;
+    fprintf(stderr, "Temporary breakpoints: %I64u sets over %I64u addresses, %I64u fired, %I64u hits by other threads.\n"
+        "%.2f ms arming, %.2f ms disarming, %I64u debug events at %.2f us each in the handler, %.2f ms from arming "
+        "to hit on average.\n", m_stats.ullSets, m_stats.ullAddresses, m_stats.ullFired, m_stats.ullForeignHits,
+        m_stats.dArmMicroseconds / 1000.0, m_stats.dDisarmMicroseconds / 1000.0, m_stats.ullEvents,
+        m_stats.dHandlerMicroseconds / dEvents, m_stats.dRoundTripMicroseconds / dFired / 1000.0);
+}
+
+const bool TemporaryBreakpoints::Matches(const TemporarySet &set, const DWORD dwThreadId, const CONTEXT &ctx) const
+{
+    if (set.dwThreadId != 0 && set.dwThreadId != dwThreadId)
+    {
+        return false;
+    }
+
+    return set.dwStackAbove == 0 || StackPointer(ctx) > set.dwStackAbove;
+}
+
+const bool TemporaryBreakpoints::RemoveSet(std::map<unsigned int, TemporarySet>::iterator set)
+{
+    std::map<DWORD_PTR, unsigned char> mapBytes;
+    for (auto dwAddress : set->second.vecAddresses)
+    {
+        auto byte = m_mapBytes.find(dwAddress);
+        if (byte == m_mapBytes.end())
+        {
+            continue;
+        }
+
+        auto &vecSets = byte->second.vecSets;
+        vecSets.erase(std::remove(vecSets.begin(), vecSets.end(), set->first), vecSets.end());
+        if (vecSets.empty())
+        {
+            if (byte->second.bIsArmed)
+            {
+                mapBytes[dwAddress] = byte->second.cOriginal;
+            }
+            m_mapBytes.erase(byte);
+        }
+    }
+    m_mapSets.erase(set);
+
+    Stopwatch clock;
+    const bool bSuccess = mapBytes.empty() || m_pDebugger->ProcessPatches()->WriteBatch(mapBytes);
+    m_stats.dDisarmMicroseconds += clock.ElapsedMicroseconds();
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not remove temporary breakpoints.\n");
+    }
+
+    return bSuccess;
+}
+
+const bool TemporaryBreakpoints::WriteByte(const DWORD_PTR dwAddress, const unsigned char cByte) const
+{
+    SIZE_T ulBytesWritten = 0;
+    if (!BOOLIFY(WriteProcessMemory(m_pDebugger->Handle(), (LPVOID)dwAddress, &cByte, sizeof(unsigned char),
+        &ulBytesWritten)))
+    {
+        fprintf(stderr, "Could not write temporary breakpoint byte at %p. Error = %X\n", dwAddress, GetLastError());
+        return false;
+    }
+    (void)FlushInstructionCache(m_pDebugger->Handle(), (LPCVOID)dwAddress, sizeof(unsigned char));
+
+    return true;
+}
+
+}
\ No newline at end of file
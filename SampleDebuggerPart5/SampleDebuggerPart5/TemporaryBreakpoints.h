@@ -0,0 +1,102 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//One-shot int 3 sets for step-out, run-to-cursor and "stop at any of these" requests. Every set is planted with a
+//single batched write and, on the first hit that matches its thread and stack condition, every address of that set
+//is taken back out in another batched write. Sets may share addresses; the byte stays planted while any set needs it.
+//Threads a set does not belong to step over the int 3 with the trap flag and it is put back behind them.
+class TemporaryBreakpoints final
+{
+public:
+    enum class eResult
+    {
+        eNotOwned,
+        eContinue,
+        eFinished
+    };
+
+    TemporaryBreakpoints() = delete;
+    TemporaryBreakpoints(Debugger *pDebugger);
+
+    TemporaryBreakpoints(const TemporaryBreakpoints &copy) = delete;
+    TemporaryBreakpoints &operator=(const TemporaryBreakpoints &copy) = delete;
+
+    ~TemporaryBreakpoints() = default;
+
+    //A thread id of 0 lets any thread fire the set. A non-zero dwStackAbove only fires once the stack pointer has
+    //risen above it, which keeps recursive calls from ending a step-out early.
+    const bool Add(const DWORD dwThreadId, const DWORD_PTR dwStackAbove, const std::vector<DWORD_PTR> &vecAddresses,
+        unsigned int &uiId);
+    const bool Remove(const unsigned int uiId);
+    void Cancel();
+
+    const eResult HandleBreakpoint(const DEBUG_EVENT &dbgEvent);
+    const bool HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void RestoreOriginalBytes(const DWORD_PTR dwAddress, unsigned char * const pBytes, const size_t ulSize) const;
+    void PrintSets() const;
+    void PrintStats() const;
+
+private:
+    struct TemporarySet
+    {
+        DWORD dwThreadId;
+        DWORD_PTR dwStackAbove;
+        std::vector<DWORD_PTR> vecAddresses;
+        LONGLONG llArmedAt;
+        unsigned long long ullEvents;
+    };
+
+    //bIsArmed is false while a thread is stepping over the byte, or when another component's int 3 was already there
+    struct TemporaryByte
+    {
+        unsigned char cOriginal;
+        bool bIsArmed;
+        std::vector<unsigned int> vecSets;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullSets;
+        unsigned long long ullAddresses;
+        unsigned long long ullFired;
+        unsigned long long ullForeignHits;
+        unsigned long long ullEvents;
+        double dArmMicroseconds;
+        double dDisarmMicroseconds;
+        double dHandlerMicroseconds;
+        double dRoundTripMicroseconds;
+    };
+
+    const bool Matches(const TemporarySet &set, const DWORD dwThreadId, const CONTEXT &ctx) const;
+    const bool RemoveSet(std::map<unsigned int, TemporarySet>::iterator set);
+    const bool WriteByte(const DWORD_PTR dwAddress, const unsigned char cByte) const;
+
+    Debugger * const m_pDebugger;
+
+    //Guards everything below; sets are added from the console while hits arrive on the debugger thread
+    mutable std::mutex m_mutex;
+    unsigned int m_uiNextId;
+    std::map<unsigned int, TemporarySet> m_mapSets;
+    std::map<DWORD_PTR, TemporaryByte> m_mapBytes;
+
+    //Threads stepping over a byte that did not fire for them
+    std::map<DWORD, DWORD_PTR> m_mapRearms;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
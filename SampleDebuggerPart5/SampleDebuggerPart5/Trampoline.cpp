@@ -0,0 +1,189 @@
+#include "Trampoline.h"
+
+#include <cstring>
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const uint32_t uiCarryFlag = 0x1;
+const uint32_t uiParityFlag = 0x4;
+const uint32_t uiZeroFlag = 0x40;
+const uint32_t uiSignFlag = 0x80;
+const uint32_t uiOverflowFlag = 0x800;
+
+const bool FitsInt32(const int64_t llValue)
+{
+    return llValue >= INT32_MIN && llValue <= INT32_MAX;
+}
+
+}
+
+Trampoline::Trampoline() : m_kind{ eKind::eStep }, m_ullAddress{ 0 }, m_mode{ LengthDecoder::eMode::e32Bit },
+    m_result{}, m_uiCondition{ 0 }
+{
+    memset(m_pCode, 0, sizeof(m_pCode));
+}
+
+const bool Trampoline::Plan(const uint64_t ullAddress, const uint8_t * const pCode, const size_t ulSize,
+    const LengthDecoder::eMode mode)
+{
+    m_kind = eKind::eStep;
+    m_ullAddress = ullAddress;
+    m_mode = mode;
+    m_result = LengthDecoder::Result{};
+    if (!LengthDecoder::Decode(pCode, ulSize, mode, m_result))
+    {
+        return false;
+    }
+    memcpy(m_pCode, pCode, m_result.uiLength);
+
+    //An int 3 under the breakpoint would only trap again in the slot
+    if (m_result.uiLength == 1 && pCode[0] == 0xCC)
+    {
+        return false;
+    }
+
+    switch (m_result.branchType)
+    {
+    case eBranchType::eNone:
+        if (m_result.bIsRipRelative && m_result.uiDisplacementSize != sizeof(int32_t))
+        {
+            return false;
+        }
+        m_kind = eKind::eDisplaced;
+        return true;
+
+    //A 16-bit operand size would also truncate the instruction pointer, which the emulation does not do
+    case eBranchType::eJump:
+    case eBranchType::eCall:
+        if (m_result.bIsIndirect || !m_result.bIsRelative || m_result.uiImmediateSize == sizeof(int16_t))
+        {
+            return false;
+        }
+        m_kind = (m_result.branchType == eBranchType::eJump) ? eKind::eJump : eKind::eCall;
+        return true;
+
+    //Only jcc reads nothing but the flags; loop and jecxz also need the counter, and xbegin cannot be emulated
+    case eBranchType::eConditional:
+    {
+        if (!m_result.bIsRelative || m_result.uiImmediateSize == sizeof(int16_t) || m_result.uiImmediateOffset == 0)
+        {
+            return false;
+        }
+        const uint8_t uiOpcode = m_pCode[m_result.uiImmediateOffset - 1];
+        const bool bIsShort = (uiOpcode & 0xF0) == 0x70;
+        const bool bIsNear = (uiOpcode & 0xF0) == 0x80 && m_result.uiImmediateOffset >= 2 &&
+            m_pCode[m_result.uiImmediateOffset - 2] == 0x0F;
+        if (!bIsShort && !bIsNear)
+        {
+            return false;
+        }
+        m_uiCondition = uiOpcode & 0x0F;
+        m_kind = eKind::eConditional;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+const bool Trampoline::Matches(const uint64_t ullAddress, const uint8_t * const pCode, const size_t ulSize) const
+{
+    return m_ullAddress == ullAddress && m_result.uiLength != 0 && ulSize >= m_result.uiLength &&
+        memcmp(m_pCode, pCode, m_result.uiLength) == 0;
+}
+
+const bool Trampoline::Relocate(const uint64_t ullSlot, uint8_t * const pSlot) const
+{
+    if (m_kind != eKind::eDisplaced)
+    {
+        return false;
+    }
+
+    const size_t ulLength = m_result.uiLength;
+    memset(pSlot, 0xCC, ulSlotSize);
+    memcpy(pSlot, m_pCode, ulLength);
+
+    if (m_result.bIsRipRelative)
+    {
+        int32_t iDisplacement = 0;
+        memcpy(&iDisplacement, &m_pCode[m_result.uiDisplacementOffset], sizeof(int32_t));
+        const uint64_t ullTarget = ReturnAddress() + (int64_t)iDisplacement;
+        const int64_t llMoved = (int64_t)(ullTarget - (ullSlot + ulLength));
+        if (!FitsInt32(llMoved))
+        {
+            return false;
+        }
+        iDisplacement = (int32_t)llMoved;
+        memcpy(&pSlot[m_result.uiDisplacementOffset], &iDisplacement, sizeof(int32_t));
+    }
+
+    //jmp [rip+0] with the address after it on x64, since the slot may be anywhere; jmp rel32 on x86
+    uint8_t * const pJump = &pSlot[ulLength];
+    const uint64_t ullBack = ReturnAddress();
+    if (m_mode == LengthDecoder::eMode::e64Bit)
+    {
+        const uint8_t pIndirect[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+        memcpy(pJump, pIndirect, sizeof(pIndirect));
+        memcpy(&pJump[sizeof(pIndirect)], &ullBack, sizeof(uint64_t));
+    }
+    else
+    {
+        const uint32_t uiRelative = (uint32_t)(ullBack - (ullSlot + ulLength + 5));
+        pJump[0] = 0xE9;
+        memcpy(&pJump[1], &uiRelative, sizeof(uint32_t));
+    }
+
+    return true;
+}
+
+const uint64_t Trampoline::Continuation(const uint32_t uiFlags) const
+{
+    const uint64_t ullTarget = LengthDecoder::BranchTarget(m_ullAddress, m_result);
+    const uint64_t ullNext = (m_kind == eKind::eConditional && !IsTaken(m_uiCondition, uiFlags)) ? ReturnAddress() : ullTarget;
+    return (m_mode == LengthDecoder::eMode::e64Bit) ? ullNext : (uint32_t)ullNext;
+}
+
+const Trampoline::eKind Trampoline::Kind() const
+{
+    return m_kind;
+}
+
+const uint64_t Trampoline::Address() const
+{
+    return m_ullAddress;
+}
+
+const uint64_t Trampoline::ReturnAddress() const
+{
+    const uint64_t ullNext = m_ullAddress + m_result.uiLength;
+    return (m_mode == LengthDecoder::eMode::e64Bit) ? ullNext : (uint32_t)ullNext;
+}
+
+const bool Trampoline::IsTaken(const uint8_t uiCondition, const uint32_t uiFlags)
+{
+    const bool bCarry = (uiFlags & uiCarryFlag) != 0;
+    const bool bZero = (uiFlags & uiZeroFlag) != 0;
+    const bool bSignOverflow = ((uiFlags & uiSignFlag) != 0) != ((uiFlags & uiOverflowFlag) != 0);
+
+    //Odd condition codes are the negation of the even one below them
+    bool bIsTaken = false;
+    switch (uiCondition >> 1)
+    {
+    case 0: bIsTaken = (uiFlags & uiOverflowFlag) != 0; break;
+    case 1: bIsTaken = bCarry; break;
+    case 2: bIsTaken = bZero; break;
+    case 3: bIsTaken = bCarry || bZero; break;
+    case 4: bIsTaken = (uiFlags & uiSignFlag) != 0; break;
+    case 5: bIsTaken = (uiFlags & uiParityFlag) != 0; break;
+    case 6: bIsTaken = bSignOverflow; break;
+    default: bIsTaken = bZero || bSignOverflow; break;
+    }
+    return ((uiCondition & 1) != 0) ? !bIsTaken : bIsTaken;
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "LengthDecoder.h"
+
+namespace CodeReversing
+{
+
+//How a thread stopped on an int 3 gets past the instruction underneath while the int 3 stays in place. Most
+//instructions are copied into an out-of-line slot followed by a jump back, with RIP-relative operands re-aimed from
+//the slot. Relative jumps, calls and conditional branches are emulated from the registers instead, since a copy would
+//branch relative to the slot. Indirect branches, returns, loop/jecxz and operands the slot cannot reach get no plan
+//and have to be stepped with the trap flag. Like LengthDecoder it does not depend on Windows and can be checked
+//anywhere.
+class Trampoline final
+{
+public:
+    enum class eKind
+    {
+        eStep,
+        eDisplaced,
+        eJump,
+        eCall,
+        eConditional
+    };
+
+    //The longest instruction plus the longest jump back
+    static const size_t ulSlotSize = 32;
+
+    Trampoline();
+
+    Trampoline(const Trampoline &copy) = delete;
+    Trampoline &operator=(const Trampoline &copy) = delete;
+
+    ~Trampoline() = default;
+
+    //pCode holds the original bytes at ullAddress with any int 3 already taken off. False leaves the plan at eStep.
+    const bool Plan(const uint64_t ullAddress, const uint8_t * const pCode, const size_t ulSize,
+        const LengthDecoder::eMode mode);
+
+    //True when the plan was made from these bytes, so an instruction patched since is noticed before it is reused
+    const bool Matches(const uint64_t ullAddress, const uint8_t * const pCode, const size_t ulSize) const;
+
+    //Fills pSlot, ulSlotSize bytes, with the displaced copy for a slot that will live at ullSlot. False when a
+    //RIP-relative operand is out of reach of the slot.
+    const bool Relocate(const uint64_t ullSlot, uint8_t * const pSlot) const;
+
+    //Where an emulated branch continues, given the flags register
+    const uint64_t Continuation(const uint32_t uiFlags) const;
+
+    const eKind Kind() const;
+    const uint64_t Address() const;
+    const uint64_t ReturnAddress() const;
+
+    static const bool IsTaken(const uint8_t uiCondition, const uint32_t uiFlags);
+
+private:
+    eKind m_kind;
+    uint64_t m_ullAddress;
+    LengthDecoder::eMode m_mode;
+    LengthDecoder::Result m_result;
+    uint8_t m_uiCondition;
+    uint8_t m_pCode[LengthDecoder::ulMaxInstructionLength];
+};
+
+}
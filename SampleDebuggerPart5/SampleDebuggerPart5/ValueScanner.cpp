@@ -0,0 +1,493 @@
+#include "ValueScanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <thread>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "MemoryScanner.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+const size_t ulMaxRunSize = 1024 * 1024;
+
+template <typename T>
+const T TargetValue(const ScanValue &value)
+{
+    return (T)value.llInteger;
+}
+
+template <>
+const float TargetValue<float>(const ScanValue &value)
+{
+    return (float)value.dFloat;
+}
+
+template <>
+const double TargetValue<double>(const ScanValue &value)
+{
+    return value.dFloat;
+}
+
+}
+
+ValueScanner::ValueScanner(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwPageSize{ 0x1000 },
+    m_valueType{ eValueType::eDword }, m_ulAlignment{ 4 }, m_bHasScanned{ false }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+}
+
+const size_t ValueScanner::ValueSize(const eValueType valueType)
+{
+    switch (valueType)
+    {
+    case eValueType::eByte:
+        return sizeof(unsigned char);
+    case eValueType::eWord:
+        return sizeof(unsigned short);
+    case eValueType::eDword:
+        return sizeof(unsigned int);
+    case eValueType::eQword:
+        return sizeof(unsigned long long);
+    case eValueType::eFloat:
+        return sizeof(float);
+    case eValueType::eDouble:
+        return sizeof(double);
+    }
+
+    return 0;
+}
+
+const bool ValueScanner::ParseValue(const eValueType valueType, const char * const pString, ScanValue &value)
+{
+    char *pEnd = nullptr;
+    if (valueType == eValueType::eFloat || valueType == eValueType::eDouble)
+    {
+        value.dFloat = strtod(pString, &pEnd);
+    }
+    else
+    {
+        value.llInteger = _strtoi64(pString, &pEnd, 0);
+    }
+
+    return (pEnd != pString);
+}
+
+void ValueScanner::Reset()
+{
+    m_vecPages.clear();
+    m_vecPages.shrink_to_fit();
+    m_bHasScanned = false;
+}
+
+const unsigned int ValueScanner::DefaultThreadCount(const unsigned int uiThreadCount, const size_t ulWorkItems)
+{
+    unsigned int uiCount = (uiThreadCount == 0) ? std::max(1u, std::thread::hardware_concurrency()) : uiThreadCount;
+    return (unsigned int)std::max((size_t)1, std::min((size_t)uiCount, ulWorkItems));
+}
+
+void ValueScanner::EncodePage(CandidatePage &page, const std::vector<unsigned short> &vecOffsets) const
+{
+    const size_t ulSlots = m_dwPageSize / m_ulAlignment;
+    const size_t ulBitmapWords = (ulSlots + 31) / 32;
+
+    page.uiCount = (unsigned int)vecOffsets.size();
+    page.vecOffsets.clear();
+    page.vecBitmap.clear();
+
+    if (vecOffsets.size() * sizeof(unsigned short) < ulBitmapWords * sizeof(unsigned int))
+    {
+        page.vecOffsets.assign(vecOffsets.begin(), vecOffsets.end());
+    }
+    else
+    {
+        page.vecBitmap.assign(ulBitmapWords, 0);
+        for (auto usOffset : vecOffsets)
+        {
+            const size_t ulSlot = usOffset / m_ulAlignment;
+            page.vecBitmap[ulSlot / 32] |= (1u << (ulSlot % 32));
+        }
+    }
+}
+
+template <typename T>
+void ValueScanner::ScanPage(const unsigned char * const pPage, const CandidatePage * const pPrevious, const eCompare compare,
+    const ScanValue &value, CandidatePage &page, std::vector<unsigned short> &vecScratch) const
+{
+    const T target = TargetValue<T>(value);
+    vecScratch.clear();
+    page.vecValues.clear();
+
+    auto Test = [&](const unsigned short usOffset, const unsigned char * const pOld)
+    {
+        T current;
+        memcpy(&current, &pPage[usOffset], sizeof(T));
+
+        T previous = current;
+        if (pOld != nullptr)
+        {
+            memcpy(&previous, pOld, sizeof(T));
+        }
+
+        bool bKeep = false;
+        switch (compare)
+        {
+        case eCompare::eUnknown:
+            bKeep = true;
+            break;
+        case eCompare::eEqual:
+            bKeep = (current == target);
+            break;
+        case eCompare::eChanged:
+            bKeep = (current != previous);
+            break;
+        case eCompare::eUnchanged:
+            bKeep = (current == previous);
+            break;
+        case eCompare::eIncreased:
+            bKeep = (current > previous);
+            break;
+        case eCompare::eDecreased:
+            bKeep = (current < previous);
+            break;
+        }
+
+        if (bKeep)
+        {
+            vecScratch.push_back(usOffset);
+            page.vecValues.insert(page.vecValues.end(), &pPage[usOffset], &pPage[usOffset] + sizeof(T));
+        }
+    };
+
+    if (pPrevious == nullptr)
+    {
+        for (size_t ulOffset = 0; ulOffset + sizeof(T) <= m_dwPageSize; ulOffset += m_ulAlignment)
+        {
+            Test((unsigned short)ulOffset, nullptr);
+        }
+    }
+    else if (!pPrevious->vecOffsets.empty())
+    {
+        for (size_t i = 0; i < pPrevious->vecOffsets.size(); ++i)
+        {
+            Test(pPrevious->vecOffsets[i], &pPrevious->vecValues[i * sizeof(T)]);
+        }
+    }
+    else
+    {
+        size_t ulIndex = 0;
+        for (size_t ulWord = 0; ulWord < pPrevious->vecBitmap.size(); ++ulWord)
+        {
+            unsigned int uiBits = pPrevious->vecBitmap[ulWord];
+            while (uiBits != 0)
+            {
+                unsigned long ulBit = 0;
+                (void)_BitScanForward(&ulBit, uiBits);
+                uiBits &= (uiBits - 1);
+                Test((unsigned short)((ulWord * 32 + ulBit) * m_ulAlignment), &pPrevious->vecValues[ulIndex++ * sizeof(T)]);
+            }
+        }
+    }
+
+    EncodePage(page, vecScratch);
+}
+
+void ValueScanner::ScanPageDispatch(const unsigned char * const pPage, const CandidatePage * const pPrevious, const eCompare compare,
+    const ScanValue &value, CandidatePage &page, std::vector<unsigned short> &vecScratch) const
+{
+    switch (m_valueType)
+    {
+    case eValueType::eByte:
+        ScanPage<unsigned char>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    case eValueType::eWord:
+        ScanPage<unsigned short>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    case eValueType::eDword:
+        ScanPage<unsigned int>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    case eValueType::eQword:
+        ScanPage<unsigned long long>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    case eValueType::eFloat:
+        ScanPage<float>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    case eValueType::eDouble:
+        ScanPage<double>(pPage, pPrevious, compare, value, page, vecScratch);
+        break;
+    }
+}
+
+const size_t ValueScanner::FirstScan(const eValueType valueType, const eCompare compare, const ScanValue &value,
+    unsigned int uiThreadCount /*= 0*/)
+{
+    if (compare != eCompare::eUnknown && compare != eCompare::eEqual)
+    {
+        fprintf(stderr, "A first scan can only look for an exact or an unknown value.\n");
+        return 0;
+    }
+
+    Stopwatch stopwatch;
+    Reset();
+    m_valueType = valueType;
+    m_ulAlignment = std::min(ValueSize(valueType), (size_t)4);
+
+    std::vector<ReadRun> vecRuns;
+    for (auto &region : MemoryScanner::EnumerateRegions(m_pDebugger->Handle(), true))
+    {
+        for (SIZE_T ulOffset = 0; ulOffset < region.ulSize; ulOffset += ulMaxRunSize)
+        {
+            const SIZE_T ulRunSize = std::min((SIZE_T)ulMaxRunSize, region.ulSize - ulOffset);
+            ReadRun run = { region.dwBaseAddress + ulOffset, 0, (size_t)(ulRunSize / m_dwPageSize) };
+            vecRuns.push_back(run);
+        }
+    }
+
+    std::vector<std::vector<CandidatePage>> vecRunPages(vecRuns.size());
+    std::atomic<size_t> ulNextRun(0);
+    auto Worker = [&]()
+    {
+        std::unique_ptr<unsigned char[]> pBuffer(new unsigned char[ulMaxRunSize]);
+        std::vector<unsigned short> vecScratch;
+        for (size_t ulIndex = ulNextRun++; ulIndex < vecRuns.size(); ulIndex = ulNextRun++)
+        {
+            const ReadRun &run = vecRuns[ulIndex];
+            const size_t ulRunSize = run.ulPageCount * m_dwPageSize;
+            SIZE_T ulBytesRead = 0;
+            const bool bReadAll = BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)run.dwAddress,
+                pBuffer.get(), ulRunSize, &ulBytesRead)) && (ulBytesRead == ulRunSize);
+
+            for (size_t i = 0; i < run.ulPageCount; ++i)
+            {
+                const DWORD_PTR dwPage = run.dwAddress + i * m_dwPageSize;
+                unsigned char *pPage = &pBuffer[i * m_dwPageSize];
+                if (!bReadAll && !(BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)dwPage, pPage,
+                    m_dwPageSize, &ulBytesRead)) && ulBytesRead == m_dwPageSize))
+                {
+                    continue;
+                }
+
+                CandidatePage page;
+                page.dwAddress = dwPage;
+                ScanPageDispatch(pPage, nullptr, compare, value, page, vecScratch);
+                if (page.uiCount != 0)
+                {
+                    vecRunPages[ulIndex].emplace_back(std::move(page));
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> vecWorkers;
+    const unsigned int uiThreads = DefaultThreadCount(uiThreadCount, vecRuns.size());
+    for (unsigned int i = 1; i < uiThreads; ++i)
+    {
+        vecWorkers.emplace_back(std::thread(Worker));
+    }
+    Worker();
+    for (auto &worker : vecWorkers)
+    {
+        worker.join();
+    }
+
+    for (auto &vecPages : vecRunPages)
+    {
+        std::move(vecPages.begin(), vecPages.end(), std::back_inserter(m_vecPages));
+    }
+    m_bHasScanned = true;
+
+    const size_t ulCount = CandidateCount();
+    fprintf(stderr, "First scan found %Iu candidates on %Iu pages in %.3f s. Candidate memory: %Iu KB\n",
+        ulCount, m_vecPages.size(), stopwatch.ElapsedSeconds(), MemoryUsage() / 1024);
+
+    return ulCount;
+}
+
+const size_t ValueScanner::NextScan(const eCompare compare, const ScanValue &value, unsigned int uiThreadCount /*= 0*/)
+{
+    if (!m_bHasScanned)
+    {
+        fprintf(stderr, "Run a first scan before narrowing.\n");
+        return 0;
+    }
+
+    Stopwatch stopwatch;
+
+    //Only pages that still hold candidates are read, and neighbouring ones are read together
+    std::vector<ReadRun> vecRuns;
+    const size_t ulMaxRunPages = ulMaxRunSize / m_dwPageSize;
+    for (size_t i = 0; i < m_vecPages.size(); ++i)
+    {
+        if (!vecRuns.empty() && vecRuns.back().ulPageCount < ulMaxRunPages &&
+            vecRuns.back().dwAddress + vecRuns.back().ulPageCount * m_dwPageSize == m_vecPages[i].dwAddress)
+        {
+            ++vecRuns.back().ulPageCount;
+        }
+        else
+        {
+            ReadRun run = { m_vecPages[i].dwAddress, i, 1 };
+            vecRuns.push_back(run);
+        }
+    }
+
+    std::vector<CandidatePage> vecNewPages(m_vecPages.size());
+    std::atomic<size_t> ulNextRun(0);
+    auto Worker = [&]()
+    {
+        std::unique_ptr<unsigned char[]> pBuffer(new unsigned char[ulMaxRunSize]);
+        std::vector<unsigned short> vecScratch;
+        for (size_t ulIndex = ulNextRun++; ulIndex < vecRuns.size(); ulIndex = ulNextRun++)
+        {
+            const ReadRun &run = vecRuns[ulIndex];
+            const size_t ulRunSize = run.ulPageCount * m_dwPageSize;
+            SIZE_T ulBytesRead = 0;
+            const bool bReadAll = BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)run.dwAddress,
+                pBuffer.get(), ulRunSize, &ulBytesRead)) && (ulBytesRead == ulRunSize);
+
+            for (size_t i = 0; i < run.ulPageCount; ++i)
+            {
+                const CandidatePage &previous = m_vecPages[run.ulFirstPage + i];
+                unsigned char *pPage = &pBuffer[i * m_dwPageSize];
+                if (!bReadAll && !(BOOLIFY(ReadProcessMemory(m_pDebugger->Handle(), (LPCVOID)previous.dwAddress, pPage,
+                    m_dwPageSize, &ulBytesRead)) && ulBytesRead == m_dwPageSize))
+                {
+                    //The page is gone, and so are its candidates
+                    continue;
+                }
+
+                CandidatePage &page = vecNewPages[run.ulFirstPage + i];
+                page.dwAddress = previous.dwAddress;
+                ScanPageDispatch(pPage, &previous, compare, value, page, vecScratch);
+            }
+        }
+    };
+
+    std::vector<std::thread> vecWorkers;
+    const unsigned int uiThreads = DefaultThreadCount(uiThreadCount, vecRuns.size());
+    for (unsigned int i = 1; i < uiThreads; ++i)
+    {
+        vecWorkers.emplace_back(std::thread(Worker));
+    }
+    Worker();
+    for (auto &worker : vecWorkers)
+    {
+        worker.join();
+    }
+
+    const size_t ulPagesRead = m_vecPages.size();
+    vecNewPages.erase(std::remove_if(vecNewPages.begin(), vecNewPages.end(), [](const CandidatePage &page)
+    {
+        return page.uiCount == 0;
+    }), vecNewPages.end());
+    m_vecPages = std::move(vecNewPages);
+
+    const size_t ulCount = CandidateCount();
+    fprintf(stderr, "Next scan kept %Iu candidates on %Iu pages (%Iu pages read) in %.3f s. Candidate memory: %Iu KB\n",
+        ulCount, m_vecPages.size(), ulPagesRead, stopwatch.ElapsedSeconds(), MemoryUsage() / 1024);
+
+    return ulCount;
+}
+
+const size_t ValueScanner::CandidateCount() const
+{
+    size_t ulCount = 0;
+    for (auto &page : m_vecPages)
+    {
+        ulCount += page.uiCount;
+    }
+
+    return ulCount;
+}
+
+const size_t ValueScanner::MemoryUsage() const
+{
+    size_t ulBytes = m_vecPages.capacity() * sizeof(CandidatePage);
+    for (auto &page : m_vecPages)
+    {
+        ulBytes += page.vecOffsets.capacity() * sizeof(unsigned short);
+        ulBytes += page.vecBitmap.capacity() * sizeof(unsigned int);
+        ulBytes += page.vecValues.capacity();
+    }
+
+    return ulBytes;
+}
+
+void ValueScanner::ForEachCandidate(const std::function<void(const DWORD_PTR dwAddress, const unsigned char * const pValue)> &callback) const
+{
+    const size_t ulValueSize = ValueSize(m_valueType);
+    for (auto &page : m_vecPages)
+    {
+        if (!page.vecOffsets.empty())
+        {
+            for (size_t i = 0; i < page.vecOffsets.size(); ++i)
+            {
+                callback(page.dwAddress + page.vecOffsets[i], &page.vecValues[i * ulValueSize]);
+            }
+            continue;
+        }
+
+        size_t ulIndex = 0;
+        for (size_t ulWord = 0; ulWord < page.vecBitmap.size(); ++ulWord)
+        {
+            unsigned int uiBits = page.vecBitmap[ulWord];
+            while (uiBits != 0)
+            {
+                unsigned long ulBit = 0;
+                (void)_BitScanForward(&ulBit, uiBits);
+                uiBits &= (uiBits - 1);
+                callback(page.dwAddress + (ulWord * 32 + ulBit) * m_ulAlignment, &page.vecValues[ulIndex++ * ulValueSize]);
+            }
+        }
+    }
+}
+
+void ValueScanner::PrintCandidates(const size_t ulMaxCandidates) const
+{
+    size_t ulPrinted = 0;
+    const eValueType valueType = m_valueType;
+    ForEachCandidate([&](const DWORD_PTR dwAddress, const unsigned char * const pValue)
+    {
+        if (ulPrinted++ >= ulMaxCandidates)
+        {
+            return;
+        }
+
+        unsigned long long ullValue = 0;
+        switch (valueType)
+        {
+        case eValueType::eFloat:
+            fprintf(stderr, "%p: %f\n", dwAddress, *(const float *)pValue);
+            break;
+        case eValueType::eDouble:
+            fprintf(stderr, "%p: %f\n", dwAddress, *(const double *)pValue);
+            break;
+        default:
+            memcpy(&ullValue, pValue, ValueSize(valueType));
+            fprintf(stderr, "%p: %I64u (0x%I64X)\n", dwAddress, ullValue, ullValue);
+            break;
+        }
+    });
+
+    if (ulPrinted > ulMaxCandidates)
+    {
+        fprintf(stderr, "... %Iu more.\n", ulPrinted - ulMaxCandidates);
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+union ScanValue
+{
+    LONGLONG llInteger;
+    double dFloat;
+};
+
+//First scan / next scan workflow for finding the variables behind a value. Candidates are kept per page, either
+//as a bitmap of aligned slots or as sorted 16-bit page offsets when sparse, next to the value last seen at each one.
+class ValueScanner final
+{
+public:
+    enum class eValueType
+    {
+        eByte = 1,
+        eWord = 2,
+        eDword = 3,
+        eQword = 4,
+        eFloat = 5,
+        eDouble = 6
+    };
+
+    enum class eCompare
+    {
+        eUnknown = 0,
+        eEqual = 1,
+        eChanged = 2,
+        eUnchanged = 3,
+        eIncreased = 4,
+        eDecreased = 5
+    };
+
+    ValueScanner() = delete;
+    ValueScanner(Debugger *pDebugger);
+
+    ValueScanner(const ValueScanner &copy) = delete;
+    ValueScanner &operator=(const ValueScanner &copy) = delete;
+
+    ~ValueScanner() = default;
+
+    const size_t FirstScan(const eValueType valueType, const eCompare compare, const ScanValue &value,
+        unsigned int uiThreadCount = 0);
+    const size_t NextScan(const eCompare compare, const ScanValue &value, unsigned int uiThreadCount = 0);
+    void Reset();
+
+    const size_t CandidateCount() const;
+    const size_t MemoryUsage() const;
+    void ForEachCandidate(const std::function<void(const DWORD_PTR dwAddress, const unsigned char * const pValue)> &callback) const;
+    void PrintCandidates(const size_t ulMaxCandidates) const;
+
+    static const bool ParseValue(const eValueType valueType, const char * const pString, ScanValue &value);
+    static const size_t ValueSize(const eValueType valueType);
+
+private:
+    struct CandidatePage
+    {
+        DWORD_PTR dwAddress;
+        unsigned int uiCount;
+        std::vector<unsigned short> vecOffsets;
+        std::vector<unsigned int> vecBitmap;
+        std::vector<unsigned char> vecValues;
+    };
+
+    struct ReadRun
+    {
+        DWORD_PTR dwAddress;
+        size_t ulFirstPage;
+        size_t ulPageCount;
+    };
+
+    template <typename T>
+    void ScanPage(const unsigned char * const pPage, const CandidatePage * const pPrevious, const eCompare compare,
+        const ScanValue &value, CandidatePage &page, std::vector<unsigned short> &vecScratch) const;
+
+    void EncodePage(CandidatePage &page, const std::vector<unsigned short> &vecOffsets) const;
+    void ScanPageDispatch(const unsigned char * const pPage, const CandidatePage * const pPrevious, const eCompare compare,
+        const ScanValue &value, CandidatePage &page, std::vector<unsigned short> &vecScratch) const;
+
+    static const unsigned int DefaultThreadCount(const unsigned int uiThreadCount, const size_t ulWorkItems);
+
+    Debugger * const m_pDebugger;
+    DWORD m_dwPageSize;
+    eValueType m_valueType;
+    size_t m_ulAlignment;
+    bool m_bHasScanned;
+
+    std::vector<CandidatePage> m_vecPages;
+};
+
+}
\ No newline at end of file
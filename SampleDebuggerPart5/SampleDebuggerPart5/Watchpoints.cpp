@@ -0,0 +1,597 @@
+#include "Watchpoints.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <TlHelp32.h>
+
+#include "Common.h"
+#include "Debugger.h"
+#include "SafeHandle.h"
+#include "Stopwatch.h"
+
+namespace CodeReversing
+{
+
+namespace
+{
+
+//Keeps the execute and caching bits and drops only the write access
+const DWORD WithoutWrite(const DWORD dwProtect)
+{
+    const DWORD dwModifiers = dwProtect & ~(DWORD)0xFF;
+    switch (dwProtect & 0xFF)
+    {
+    case PAGE_READWRITE:
+    case PAGE_WRITECOPY:
+        return PAGE_READONLY | dwModifiers;
+    case PAGE_EXECUTE_READWRITE:
+    case PAGE_EXECUTE_WRITECOPY:
+        return PAGE_EXECUTE_READ | dwModifiers;
+    default:
+        return dwProtect;
+    }
+}
+
+const bool FitsDebugRegister(const DWORD_PTR dwAddress, const size_t ulSize)
+{
+#ifdef _M_IX86
+    const bool bIsValidSize = (ulSize == 1 || ulSize == 2 || ulSize == 4);
+#elif defined _M_AMD64
+    const bool bIsValidSize = (ulSize == 1 || ulSize == 2 || ulSize == 4 || ulSize == 8);
+#endif
+    return bIsValidSize && (dwAddress % ulSize) == 0;
+}
+
+//LEN field of DR7; eight bytes is 10b, four is 11b
+const DWORD_PTR LengthBits(const size_t ulSize)
+{
+    switch (ulSize)
+    {
+    case 2:
+        return 1;
+    case 4:
+        return 3;
+    case 8:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+}
+
+Watchpoints::Watchpoints(Debugger *pDebugger) : m_pDebugger{ pDebugger }, m_dwPageSize{ 0x1000 }, m_uiNextId{ 1 },
+    m_bIsAdaptive{ false }, m_dPromoteRate{ 1000.0 }
+{
+    SYSTEM_INFO sysInfo = { 0 };
+    GetSystemInfo(&sysInfo);
+    if (sysInfo.dwPageSize != 0)
+    {
+        m_dwPageSize = sysInfo.dwPageSize;
+    }
+    m_arrSlots.fill(0);
+    memset(&m_stats, 0, sizeof(Stats));
+}
+
+const bool Watchpoints::Add(const DWORD_PTR dwAddress, const size_t ulSize, const eAccess access, const bool bUseHardware,
+    unsigned int &uiId)
+{
+    if (ulSize == 0)
+    {
+        fprintf(stderr, "A watchpoint needs at least one byte.\n");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const unsigned int uiNewId = m_uiNextId;
+    Watch &watch = m_mapWatches[uiNewId];
+    watch = { dwAddress, ulSize, access, -1, 0 };
+    const bool bSuccess = bUseHardware ? (AssignSlot(uiNewId, watch) && ApplyDebugRegistersToAll()) :
+        AttachPages(uiNewId, watch);
+    if (!bSuccess)
+    {
+        if (watch.iSlot >= 0)
+        {
+            m_arrSlots[watch.iSlot] = 0;
+        }
+        else if (bUseHardware)
+        {
+            fprintf(stderr, "No free debug register for %Iu bytes at %p; it takes 1, 2, 4 or 8 aligned bytes.\n", ulSize,
+                dwAddress);
+        }
+        m_mapWatches.erase(uiNewId);
+        return false;
+    }
+
+    uiId = m_uiNextId++;
+    fprintf(stderr, "Watchpoint %u on %Iu bytes at %p, %s, %s.\n", uiId, ulSize, dwAddress,
+        (access == eAccess::eWrite) ? "writes" : "reads and writes", bUseHardware ? "debug register" : "page protection");
+
+    return true;
+}
+
+const bool Watchpoints::Remove(const unsigned int uiId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto watch = m_mapWatches.find(uiId);
+    if (watch == m_mapWatches.end())
+    {
+        fprintf(stderr, "No watchpoint %u.\n", uiId);
+        return false;
+    }
+
+    bool bSuccess = true;
+    if (watch->second.iSlot >= 0)
+    {
+        m_arrSlots[watch->second.iSlot] = 0;
+        m_mapWatches.erase(watch);
+        bSuccess = ApplyDebugRegistersToAll();
+    }
+    else
+    {
+        DetachPages(uiId, watch->second);
+        m_mapWatches.erase(watch);
+    }
+
+    return bSuccess;
+}
+
+void Watchpoints::SetAdaptive(const bool bIsAdaptive, const double dFalseHitsPerSecond)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bIsAdaptive = bIsAdaptive;
+    m_dPromoteRate = dFalseHitsPerSecond;
+}
+
+const Watchpoints::eResult Watchpoints::HandleFault(const DEBUG_EVENT &dbgEvent)
+{
+    Stopwatch clock;
+    const LONGLONG llNow = Stopwatch::Now();
+    auto &exceptionRecord = dbgEvent.u.Exception.ExceptionRecord;
+    if (exceptionRecord.NumberParameters < 2)
+    {
+        return eResult::eNotOwned;
+    }
+    const bool bIsGuard = (exceptionRecord.ExceptionCode == EXCEPTION_GUARD_PAGE);
+    const bool bIsWrite = (exceptionRecord.ExceptionInformation[0] == 1);
+    const DWORD_PTR dwFault = (DWORD_PTR)exceptionRecord.ExceptionInformation[1];
+    const DWORD_PTR dwPage = dwFault & ~(m_dwPageSize - 1);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto page = m_mapPages.find(dwPage);
+    if (page == m_mapPages.end())
+    {
+        return eResult::eNotOwned;
+    }
+
+    //Only writes into a page that was writable before it was watched are ours; anything else is the target's own fault
+    WatchedPage &watchedPage = page->second;
+    if (!bIsGuard && (!bIsWrite || WithoutWrite(watchedPage.dwOriginalProtect) == watchedPage.dwOriginalProtect))
+    {
+        return eResult::eNotOwned;
+    }
+
+    unsigned int uiHit = 0;
+    for (auto uiId : watchedPage.vecWatches)
+    {
+        const Watch &watch = m_mapWatches.find(uiId)->second;
+        if (dwFault - watch.dwAddress < watch.ulSize && (bIsWrite || watch.access == eAccess::eReadWrite))
+        {
+            uiHit = uiId;
+            break;
+        }
+    }
+    ++watchedPage.ullFaults;
+    ++m_stats.ullFaults;
+
+    //The guard is already gone by the time the fault is reported; a write-protected page has to be opened
+    if (!bIsGuard && watchedPage.ulSteppingThreads == 0 && !RestorePage(dwPage, watchedPage))
+    {
+        ++m_stats.ullErrors;
+        return eResult::eNotOwned;
+    }
+
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not get context of thread %X. Error = %X\n", dbgEvent.dwThreadId, GetLastError());
+        ++m_stats.ullErrors;
+    }
+    ctx.EFlags |= 0x100;
+    if (!BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        fprintf(stderr, "Could not step thread %X past %p. Error = %X\n", dbgEvent.dwThreadId, dwFault, GetLastError());
+        ++m_stats.ullErrors;
+    }
+    ++watchedPage.ulSteppingThreads;
+    m_mapSteps[dbgEvent.dwThreadId] = { dwPage, llNow, uiHit == 0 };
+
+    eResult result = eResult::eContinue;
+    if (uiHit != 0)
+    {
+        ++m_mapWatches.find(uiHit)->second.ullHits;
+        ++m_stats.ullHits;
+        fprintf(stderr, "Watchpoint %u: %s of %p by thread %X at %p.\n", uiHit, bIsWrite ? "write" : "read", dwFault,
+            dbgEvent.dwThreadId, InstructionPointer(ctx));
+        result = eResult::eStop;
+    }
+    else
+    {
+        if (watchedPage.ullFalseHits++ == 0)
+        {
+            watchedPage.llFirstFalseHit = llNow;
+        }
+        ++m_stats.ullFalseHits;
+    }
+    m_stats.dHandlerMicroseconds += clock.ElapsedMicroseconds();
+
+    return result;
+}
+
+const Watchpoints::eResult Watchpoints::HandleSingleStep(const DEBUG_EVENT &dbgEvent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    eResult result = eResult::eNotOwned;
+    auto step = m_mapSteps.find(dbgEvent.dwThreadId);
+    if (step != m_mapSteps.end())
+    {
+        const PendingStep pendingStep = step->second;
+        m_mapSteps.erase(step);
+        FinishStep(pendingStep);
+        result = eResult::eContinue;
+    }
+
+    //The context is only read for debug registers when one of them is in use
+    const bool bHasHardware = std::any_of(m_arrSlots.begin(), m_arrSlots.end(), [](const unsigned int uiId) { return uiId != 0; });
+    if (bHasHardware && CheckDebugRegisters(dbgEvent) == eResult::eStop)
+    {
+        result = eResult::eStop;
+    }
+
+    return result;
+}
+
+void Watchpoints::AddThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (std::any_of(m_arrSlots.begin(), m_arrSlots.end(), [](const unsigned int uiId) { return uiId != 0; }))
+    {
+        (void)ApplyDebugRegisters(dwThreadId);
+    }
+}
+
+void Watchpoints::RemoveThread(const DWORD dwThreadId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto step = m_mapSteps.find(dwThreadId);
+    if (step != m_mapSteps.end())
+    {
+        PendingStep pendingStep = step->second;
+        pendingStep.bIsFalseHit = false;
+        m_mapSteps.erase(step);
+        FinishStep(pendingStep);
+    }
+}
+
+void Watchpoints::PrintWatches() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &watch : m_mapWatches)
+    {
+        char strWhere[32] = { 0 };
+        if (watch.second.iSlot >= 0)
+        {
+            sprintf_s(strWhere, sizeof(strWhere), "debug register %d", watch.second.iSlot);
+        }
+        else
+        {
+            sprintf_s(strWhere, sizeof(strWhere), "page protection");
+        }
+        fprintf(stderr, "%u: %Iu bytes at %p, %s, %s, %I64u hits.\n", watch.first, watch.second.ulSize,
+            watch.second.dwAddress, (watch.second.access == eAccess::eWrite) ? "writes" : "reads and writes", strWhere,
+            watch.second.ullHits);
+    }
+
+    const LONGLONG llNow = Stopwatch::Now();
+    for (auto &page : m_mapPages)
+    {
+        const WatchedPage &watchedPage = page.second;
+        const double dSeconds = TicksToMicroseconds(llNow - watchedPage.llFirstFalseHit) / 1000000.0;
+        const double dFalseHits = (watchedPage.ullFalseHits != 0) ? (double)watchedPage.ullFalseHits : 1.0;
+        fprintf(stderr, "Page %p: %Iu watches, %I64u faults, %I64u false hits (%.0f per second), %.2f us per false hit.\n",
+            page.first, watchedPage.vecWatches.size(), watchedPage.ullFaults, watchedPage.ullFalseHits,
+            (watchedPage.ullFalseHits != 0 && dSeconds > 0.0) ? (double)watchedPage.ullFalseHits / dSeconds : 0.0,
+            watchedPage.dFalseHitMicroseconds / dFalseHits);
+    }
+}
+
+void Watchpoints::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double dFaults = (m_stats.ullFaults != 0) ? (double)m_stats.ullFaults : 1.0;
+    const double dFalseHits = (m_stats.ullFalseHits != 0) ? (double)m_stats.ullFalseHits : 1.0;
+    fprintf(stderr, "Watchpoints: %Iu watches on %Iu pages, %I64u faults, %I64u hits (%I64u by debug register), "
+        "%I64u false hits, %I64u moved to debug registers, %I64u errors.\n%.2f us per fault in the handler, %.2f us per "
+        "false hit from fault to re-protection. Adaptive mode %s at %.0f false hits per second.\n", m_mapWatches.size(),
+        m_mapPages.size(), m_stats.ullFaults, m_stats.ullHits, m_stats.ullHardwareHits, m_stats.ullFalseHits,
+        m_stats.ullPromotions, m_stats.ullErrors, m_stats.dHandlerMicroseconds / dFaults,
+        m_stats.dFalseHitMicroseconds / dFalseHits, m_bIsAdaptive ? "on" : "off", m_dPromoteRate);
+}
+
+const bool Watchpoints::AttachPages(const unsigned int uiId, const Watch &watch)
+{
+    const DWORD_PTR dwFirst = watch.dwAddress & ~(m_dwPageSize - 1);
+    const DWORD_PTR dwLast = (watch.dwAddress + watch.ulSize - 1) & ~(m_dwPageSize - 1);
+    for (DWORD_PTR dwPage = dwFirst; dwPage <= dwLast; dwPage += m_dwPageSize)
+    {
+        auto page = m_mapPages.find(dwPage);
+        if (page == m_mapPages.end())
+        {
+            //Pages that are already guard pages, such as the end of a stack, belong to the system
+            MEMORY_BASIC_INFORMATION memoryInfo = { 0 };
+            if (VirtualQueryEx(m_pDebugger->Handle(), (LPCVOID)dwPage, &memoryInfo, sizeof(MEMORY_BASIC_INFORMATION)) == 0 ||
+                memoryInfo.State != MEM_COMMIT || (memoryInfo.Protect & (PAGE_GUARD | PAGE_NOACCESS)) != 0)
+            {
+                fprintf(stderr, "Cannot watch page %p.\n", dwPage);
+                DetachPages(uiId, watch);
+                return false;
+            }
+            WatchedPage newPage = { memoryInfo.Protect, std::vector<unsigned int>(), 0, 0, 0, 0, 0.0 };
+            page = m_mapPages.insert(std::make_pair(dwPage, std::move(newPage))).first;
+        }
+
+        page->second.vecWatches.push_back(uiId);
+        if (page->second.ulSteppingThreads == 0 && !ProtectPage(dwPage, page->second))
+        {
+            DetachPages(uiId, watch);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Watchpoints::DetachPages(const unsigned int uiId, const Watch &watch)
+{
+    const DWORD_PTR dwFirst = watch.dwAddress & ~(m_dwPageSize - 1);
+    const DWORD_PTR dwLast = (watch.dwAddress + watch.ulSize - 1) & ~(m_dwPageSize - 1);
+    for (DWORD_PTR dwPage = dwFirst; dwPage <= dwLast; dwPage += m_dwPageSize)
+    {
+        auto page = m_mapPages.find(dwPage);
+        if (page == m_mapPages.end())
+        {
+            continue;
+        }
+
+        auto &vecWatches = page->second.vecWatches;
+        vecWatches.erase(std::remove(vecWatches.begin(), vecWatches.end(), uiId), vecWatches.end());
+        if (vecWatches.empty())
+        {
+            (void)RestorePage(dwPage, page->second);
+            m_mapPages.erase(page);
+        }
+        else if (page->second.ulSteppingThreads == 0)
+        {
+            (void)ProtectPage(dwPage, page->second);
+        }
+    }
+}
+
+const bool Watchpoints::ProtectPage(const DWORD_PTR dwPage, const WatchedPage &page)
+{
+    const bool bNeedsGuard = std::any_of(page.vecWatches.begin(), page.vecWatches.end(), [&](const unsigned int uiId)
+    {
+        return m_mapWatches.find(uiId)->second.access == eAccess::eReadWrite;
+    });
+    const DWORD dwProtect = bNeedsGuard ? (page.dwOriginalProtect | PAGE_GUARD) : WithoutWrite(page.dwOriginalProtect);
+
+    DWORD dwOldProtect = 0;
+    if (!BOOLIFY(VirtualProtectEx(m_pDebugger->Handle(), (LPVOID)dwPage, m_dwPageSize, dwProtect, &dwOldProtect)))
+    {
+        fprintf(stderr, "Could not protect page %p. Error = %X\n", dwPage, GetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+const bool Watchpoints::RestorePage(const DWORD_PTR dwPage, const WatchedPage &page)
+{
+    DWORD dwOldProtect = 0;
+    if (!BOOLIFY(VirtualProtectEx(m_pDebugger->Handle(), (LPVOID)dwPage, m_dwPageSize, page.dwOriginalProtect, &dwOldProtect)))
+    {
+        fprintf(stderr, "Could not restore protection of page %p. Error = %X\n", dwPage, GetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+void Watchpoints::FinishStep(const PendingStep &step)
+{
+    //The page may have lost its last watch while the thread was stepping
+    auto page = m_mapPages.find(step.dwPage);
+    if (page == m_mapPages.end())
+    {
+        return;
+    }
+
+    WatchedPage &watchedPage = page->second;
+    if (watchedPage.ulSteppingThreads != 0 && --watchedPage.ulSteppingThreads == 0)
+    {
+        (void)ProtectPage(step.dwPage, watchedPage);
+    }
+    if (step.bIsFalseHit)
+    {
+        const double dMicroseconds = TicksToMicroseconds(Stopwatch::Now() - step.llFault);
+        watchedPage.dFalseHitMicroseconds += dMicroseconds;
+        m_stats.dFalseHitMicroseconds += dMicroseconds;
+        if (m_bIsAdaptive)
+        {
+            Promote(step.dwPage, watchedPage);
+        }
+    }
+}
+
+void Watchpoints::Promote(const DWORD_PTR dwPage, WatchedPage &page)
+{
+    const double dSeconds = TicksToMicroseconds(Stopwatch::Now() - page.llFirstFalseHit) / 1000000.0;
+    const double dRate = (dSeconds > 0.0) ? (double)page.ullFalseHits / dSeconds : 0.0;
+    if (page.ullFalseHits < ullMinFalseHits || dRate < m_dPromoteRate)
+    {
+        return;
+    }
+
+    //Detaching the last watch erases the page, so nothing of it is touched after the loop starts
+    const unsigned long long ullFalseHits = page.ullFalseHits;
+    const std::vector<unsigned int> vecWatches = page.vecWatches;
+    bool bIsChanged = false;
+    for (auto uiId : vecWatches)
+    {
+        Watch &watch = m_mapWatches.find(uiId)->second;
+        if (!AssignSlot(uiId, watch))
+        {
+            continue;
+        }
+        DetachPages(uiId, watch);
+        fprintf(stderr, "Watchpoint %u moved to debug register %d after %I64u false hits on page %p (%.0f per second).\n",
+            uiId, watch.iSlot, ullFalseHits, dwPage, dRate);
+        ++m_stats.ullPromotions;
+        bIsChanged = true;
+    }
+    if (bIsChanged)
+    {
+        (void)ApplyDebugRegistersToAll();
+    }
+}
+
+const bool Watchpoints::AssignSlot(const unsigned int uiId, Watch &watch)
+{
+    if (!FitsDebugRegister(watch.dwAddress, watch.ulSize))
+    {
+        return false;
+    }
+
+    auto slot = std::find(m_arrSlots.begin(), m_arrSlots.end(), 0u);
+    if (slot == m_arrSlots.end())
+    {
+        return false;
+    }
+    *slot = uiId;
+    watch.iSlot = (int)(slot - m_arrSlots.begin());
+
+    return true;
+}
+
+const bool Watchpoints::ApplyDebugRegisters(const DWORD dwThreadId) const
+{
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT | THREAD_SUSPEND_RESUME, FALSE, dwThreadId);
+    if (hThread() == nullptr)
+    {
+        return false;
+    }
+
+    //Only the local enable, type and length bits of the four slots are touched
+    const bool bIsSuspended = (SuspendThread(hThread()) != (DWORD)-1);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+    bool bSuccess = BOOLIFY(GetThreadContext(hThread(), &ctx));
+    if (bSuccess)
+    {
+        decltype(ctx.Dr0) * const pAddresses[ulHardwareSlots] = { &ctx.Dr0, &ctx.Dr1, &ctx.Dr2, &ctx.Dr3 };
+        for (size_t i = 0; i < ulHardwareSlots; ++i)
+        {
+            ctx.Dr7 &= ~(((DWORD_PTR)0x3 << (i * 2)) | ((DWORD_PTR)0xF << (16 + i * 4)));
+            if (m_arrSlots[i] == 0)
+            {
+                continue;
+            }
+            const Watch &watch = m_mapWatches.find(m_arrSlots[i])->second;
+            const DWORD_PTR dwType = (watch.access == eAccess::eWrite) ? 1 : 3;
+            *pAddresses[i] = watch.dwAddress;
+            ctx.Dr7 |= ((DWORD_PTR)1 << (i * 2)) | ((dwType | (LengthBits(watch.ulSize) << 2)) << (16 + i * 4));
+        }
+        bSuccess = BOOLIFY(SetThreadContext(hThread(), &ctx));
+    }
+    if (bIsSuspended)
+    {
+        (void)ResumeThread(hThread());
+    }
+    if (!bSuccess)
+    {
+        fprintf(stderr, "Could not set debug registers of thread %X. Error = %X\n", dwThreadId, GetLastError());
+    }
+
+    return bSuccess;
+}
+
+const bool Watchpoints::ApplyDebugRegistersToAll() const
+{
+    const DWORD dwProcessId = GetProcessId(m_pDebugger->Handle());
+    SafeHandle hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot() == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Could not enumerate threads. Error = %X\n", GetLastError());
+        return false;
+    }
+
+    bool bSuccess = true;
+    THREADENTRY32 threadEntry = { 0 };
+    threadEntry.dwSize = sizeof(THREADENTRY32);
+    for (BOOL bHasEntry = Thread32First(hSnapshot(), &threadEntry); bHasEntry; bHasEntry = Thread32Next(hSnapshot(), &threadEntry))
+    {
+        if (threadEntry.th32OwnerProcessID == dwProcessId)
+        {
+            bSuccess = ApplyDebugRegisters(threadEntry.th32ThreadID) && bSuccess;
+        }
+    }
+
+    return bSuccess;
+}
+
+const Watchpoints::eResult Watchpoints::CheckDebugRegisters(const DEBUG_EVENT &dbgEvent)
+{
+    SafeHandle hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, dbgEvent.dwThreadId);
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+    if (!BOOLIFY(GetThreadContext(hThread(), &ctx)))
+    {
+        ++m_stats.ullErrors;
+        return eResult::eNotOwned;
+    }
+    if ((ctx.Dr6 & 0xF) == 0)
+    {
+        return eResult::eNotOwned;
+    }
+
+    //Data breakpoints trap after the access, so the reported address is the next instruction
+    eResult result = eResult::eNotOwned;
+    for (size_t i = 0; i < ulHardwareSlots; ++i)
+    {
+        if ((ctx.Dr6 & ((DWORD_PTR)1 << i)) == 0 || m_arrSlots[i] == 0)
+        {
+            continue;
+        }
+        Watch &watch = m_mapWatches.find(m_arrSlots[i])->second;
+        ++watch.ullHits;
+        ++m_stats.ullHits;
+        ++m_stats.ullHardwareHits;
+        fprintf(stderr, "Watchpoint %u: access to %p by thread %X, stopped after it at %p.\n", m_arrSlots[i],
+            watch.dwAddress, dbgEvent.dwThreadId, (DWORD_PTR)dbgEvent.u.Exception.ExceptionRecord.ExceptionAddress);
+        result = eResult::eStop;
+    }
+
+    ctx.Dr6 = 0;
+    if (!BOOLIFY(SetThreadContext(hThread(), &ctx)))
+    {
+        ++m_stats.ullErrors;
+    }
+
+    return result;
+}
+
+}
\ No newline at end of file
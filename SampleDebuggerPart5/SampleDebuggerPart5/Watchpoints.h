@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+namespace CodeReversing
+{
+
+class Debugger;
+
+//Data breakpoints on any number of ranges. Pages under a read/write watch get PAGE_GUARD and pages under write
+//watches alone lose their write access, so reads run at full speed. A fault is matched against its page with one hash
+//lookup and a scan of that page's few ranges; the page is then opened for the faulting thread, which single-steps the
+//access and has the page protected again behind it. While the step is pending other threads on that page go unseen.
+//Faults outside every range are false hits and their round trip is timed per page. In adaptive mode a hot page hands
+//its watches to the four debug registers wherever size and alignment allow, and hardware hits arrive as steps.
+class Watchpoints final
+{
+public:
+    enum class eAccess
+    {
+        eWrite,
+        eReadWrite
+    };
+
+    enum class eResult
+    {
+        eNotOwned,
+        eContinue,
+        eStop
+    };
+
+    Watchpoints() = delete;
+    Watchpoints(Debugger *pDebugger);
+
+    Watchpoints(const Watchpoints &copy) = delete;
+    Watchpoints &operator=(const Watchpoints &copy) = delete;
+
+    ~Watchpoints() = default;
+
+    const bool Add(const DWORD_PTR dwAddress, const size_t ulSize, const eAccess access, const bool bUseHardware,
+        unsigned int &uiId);
+    const bool Remove(const unsigned int uiId);
+
+    //A page moves its watches to debug registers once it sees this many false hits per second
+    void SetAdaptive(const bool bIsAdaptive, const double dFalseHitsPerSecond);
+
+    //Guard page and access violation events
+    const eResult HandleFault(const DEBUG_EVENT &dbgEvent);
+    const eResult HandleSingleStep(const DEBUG_EVENT &dbgEvent);
+    void AddThread(const DWORD dwThreadId);
+    void RemoveThread(const DWORD dwThreadId);
+
+    void PrintWatches() const;
+    void PrintStats() const;
+
+    static const size_t ulHardwareSlots = 4;
+    static const unsigned long long ullMinFalseHits = 64;
+
+private:
+    struct Watch
+    {
+        DWORD_PTR dwAddress;
+        size_t ulSize;
+        eAccess access;
+        int iSlot;
+        unsigned long long ullHits;
+    };
+
+    struct WatchedPage
+    {
+        DWORD dwOriginalProtect;
+        std::vector<unsigned int> vecWatches;
+        size_t ulSteppingThreads;
+        unsigned long long ullFaults;
+        unsigned long long ullFalseHits;
+        LONGLONG llFirstFalseHit;
+        double dFalseHitMicroseconds;
+    };
+
+    struct PendingStep
+    {
+        DWORD_PTR dwPage;
+        LONGLONG llFault;
+        bool bIsFalseHit;
+    };
+
+    struct Stats
+    {
+        unsigned long long ullFaults;
+        unsigned long long ullHits;
+        unsigned long long ullFalseHits;
+        unsigned long long ullHardwareHits;
+        unsigned long long ullPromotions;
+        unsigned long long ullErrors;
+        double dHandlerMicroseconds;
+        double dFalseHitMicroseconds;
+    };
+
+    const bool AttachPages(const unsigned int uiId, const Watch &watch);
+    void DetachPages(const unsigned int uiId, const Watch &watch);
+    const bool ProtectPage(const DWORD_PTR dwPage, const WatchedPage &page);
+    const bool RestorePage(const DWORD_PTR dwPage, const WatchedPage &page);
+    void FinishStep(const PendingStep &step);
+    void Promote(const DWORD_PTR dwPage, WatchedPage &page);
+
+    const bool AssignSlot(const unsigned int uiId, Watch &watch);
+    const bool ApplyDebugRegisters(const DWORD dwThreadId) const;
+    const bool ApplyDebugRegistersToAll() const;
+    const eResult CheckDebugRegisters(const DEBUG_EVENT &dbgEvent);
+
+    Debugger * const m_pDebugger;
+    DWORD_PTR m_dwPageSize;
+
+    //Guards everything below; faults arrive on the debugger thread while the console adds and removes watches
+    mutable std::mutex m_mutex;
+    unsigned int m_uiNextId;
+    std::map<unsigned int, Watch> m_mapWatches;
+    std::unordered_map<DWORD_PTR /*page*/, WatchedPage> m_mapPages;
+    std::map<DWORD /*thread*/, PendingStep> m_mapSteps;
+    std::array<unsigned int, ulHardwareSlots> m_arrSlots;
+
+    bool m_bIsAdaptive;
+    double m_dPromoteRate;
+
+    Stats m_stats;
+};
+
+}
\ No newline at end of file
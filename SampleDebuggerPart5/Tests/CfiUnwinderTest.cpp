@@ -0,0 +1,132 @@
+#include "CfiUnwinder.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace CodeReversing;
+
+namespace
+{
+
+const int iDepth = 200;
+const int iMaxBacktrace = 1024;
+
+//The child's own view of its stack, from glibc's unwinder, then a breakpoint so the stop lands in code built with
+//frame pointers
+__attribute__((noinline)) void Leaf(const int iPipe)
+{
+    void *pAddresses[iMaxBacktrace];
+    const int iCount = backtrace(pAddresses, iMaxBacktrace);
+    (void)write(iPipe, &iCount, sizeof(int));
+    (void)write(iPipe, pAddresses, iCount * sizeof(void *));
+    __asm__ volatile("int3");
+}
+
+__attribute__((noinline)) int Recurse(const int iLevel, const int iPipe)
+{
+    if (iLevel == 0)
+    {
+        Leaf(iPipe);
+        return 0;
+    }
+    const int iResult = Recurse(iLevel - 1, iPipe);
+    __asm__ volatile("" : : "r"(iResult));
+    return iResult + 1;
+}
+
+const bool Check(const bool bCondition, const char * const pMessage)
+{
+    if (!bCondition)
+    {
+        fprintf(stderr, "FAILED: %s\n", pMessage);
+    }
+    return bCondition;
+}
+
+const bool ReadAll(const int iPipe, void * const pBuffer, const size_t ulSize)
+{
+    size_t ulRead = 0;
+    while (ulRead < ulSize)
+    {
+        const ssize_t lResult = read(iPipe, (char *)pBuffer + ulRead, ulSize - ulRead);
+        if (lResult <= 0)
+        {
+            return false;
+        }
+        ulRead += (size_t)lResult;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t ulIterations = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 2000;
+
+    int iPipe[2] = { 0 };
+    if (pipe(iPipe) != 0)
+    {
+        return 1;
+    }
+    const pid_t iChild = fork();
+    if (iChild == 0)
+    {
+        close(iPipe[0]);
+        (void)ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        (void)Recurse(iDepth, iPipe[1]);
+        _exit(0);
+    }
+    close(iPipe[1]);
+
+    int iCount = 0;
+    std::vector<void *> vecExpected(iMaxBacktrace);
+    int iStatus = 0;
+    if (!Check(ReadAll(iPipe[0], &iCount, sizeof(int)) && iCount > 0 && iCount <= iMaxBacktrace &&
+        ReadAll(iPipe[0], vecExpected.data(), iCount * sizeof(void *)), "no backtrace from the target") ||
+        !Check(waitpid(iChild, &iStatus, 0) == iChild && WIFSTOPPED(iStatus) && WSTOPSIG(iStatus) == SIGTRAP,
+        "target did not stop at its breakpoint"))
+    {
+        kill(iChild, SIGKILL);
+        return 1;
+    }
+    vecExpected.resize(iCount);
+
+    CfiUnwinder unwinder;
+    bool bSuccess = Check(unwinder.LoadProcessModules(iChild), "could not load the target's modules");
+
+    //Past the leaf, every frame is a return address and has to match what glibc found, all the way out of main
+    std::vector<CfiFrame> vecFrames(4096);
+    const size_t ulCfiFrames = unwinder.CaptureThread(iChild, vecFrames.data(), vecFrames.size(), CfiUnwinder::eMode::eCfi);
+    size_t ulMatching = 0;
+    while (ulMatching + 1 < ulCfiFrames && ulMatching + 1 < vecExpected.size() &&
+        vecFrames[ulMatching + 1].ullInstruction == (uint64_t)vecExpected[ulMatching + 1])
+    {
+        ++ulMatching;
+    }
+    fprintf(stderr, "CFI: %zu frames, %zu of %zu glibc frames matched.\n", ulCfiFrames, ulMatching, vecExpected.size() - 1);
+    bSuccess = Check(ulCfiFrames > (size_t)iDepth, "CFI capture is shallower than the recursion") && bSuccess;
+    bSuccess = Check(ulMatching + 1 >= vecExpected.size() - 1, "CFI frames differ from glibc's backtrace") && bSuccess;
+
+    //This file is built with frame pointers, so the chain holds at least up to main
+    const size_t ulChainFrames = unwinder.CaptureThread(iChild, vecFrames.data(), vecFrames.size(),
+        CfiUnwinder::eMode::eFramePointer);
+    fprintf(stderr, "Frame pointer: %zu frames.\n", ulChainFrames);
+    bSuccess = Check(ulChainFrames > (size_t)iDepth, "frame pointer capture is shallower than the recursion") && bSuccess;
+
+    unwinder.Benchmark(iChild, ulIterations);
+    unwinder.PrintStats();
+
+    kill(iChild, SIGKILL);
+    (void)waitpid(iChild, nullptr, 0);
+
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+#include "ElfCoreWriter.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/procfs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace CodeReversing;
+
+namespace
+{
+
+const size_t ulPatternSize = 256 * 1024;
+unsigned char g_pattern[ulPatternSize];
+
+void *SleepingThread(void *)
+{
+    for (;;)
+    {
+        pause();
+    }
+    return nullptr;
+}
+
+//Runs in the child: fills a buffer the parent knows the address of, starts a second thread and waits to be dumped
+void RunTarget(const int iReadyPipe)
+{
+    for (size_t i = 0; i < ulPatternSize; ++i)
+    {
+        g_pattern[i] = (unsigned char)(i * 7 + (i >> 12));
+    }
+    pthread_t thread;
+    (void)pthread_create(&thread, nullptr, SleepingThread, nullptr);
+    const char cReady = 1;
+    (void)write(iReadyPipe, &cReady, 1);
+    for (;;)
+    {
+        pause();
+    }
+}
+
+const bool Check(const bool bCondition, const char * const pMessage)
+{
+    if (!bCondition)
+    {
+        fprintf(stderr, "FAILED: %s\n", pMessage);
+    }
+    return bCondition;
+}
+
+const std::vector<unsigned char> ReadFile(const char * const pPath)
+{
+    std::vector<unsigned char> vecData;
+    FILE *pFile = fopen(pPath, "rb");
+    if (pFile == nullptr)
+    {
+        return vecData;
+    }
+    unsigned char buffer[65536];
+    size_t ulRead = 0;
+    while ((ulRead = fread(buffer, 1, sizeof(buffer), pFile)) != 0)
+    {
+        vecData.insert(vecData.end(), buffer, buffer + ulRead);
+    }
+    fclose(pFile);
+    return vecData;
+}
+
+const bool CheckCore(const std::vector<unsigned char> &vecCore, const int iProcessId)
+{
+    if (!Check(vecCore.size() >= sizeof(Elf64_Ehdr), "core is smaller than an ELF header"))
+    {
+        return false;
+    }
+    const Elf64_Ehdr &header = *(const Elf64_Ehdr *)vecCore.data();
+    bool bSuccess = Check(memcmp(header.e_ident, ELFMAG, SELFMAG) == 0, "bad ELF magic");
+    bSuccess = Check(header.e_type == ET_CORE && header.e_machine == EM_X86_64, "not an x64 core") && bSuccess;
+    if (!Check(header.e_phoff + header.e_phnum * sizeof(Elf64_Phdr) <= vecCore.size(), "program headers out of bounds"))
+    {
+        return false;
+    }
+
+    const Elf64_Phdr * const pHeaders = (const Elf64_Phdr *)&vecCore[header.e_phoff];
+    size_t ulThreads = 0;
+    bool bFoundMainThread = false;
+    bool bFoundFiles = false;
+    uint64_t ullPatternBytes = 0;
+    bool bFoundTrimmedFile = false;
+    for (size_t i = 0; i < header.e_phnum; ++i)
+    {
+        const Elf64_Phdr &segment = pHeaders[i];
+        if (!Check(segment.p_offset + segment.p_filesz <= vecCore.size(), "segment data out of bounds"))
+        {
+            return false;
+        }
+
+        if (segment.p_type == PT_NOTE)
+        {
+            for (uint64_t ullNote = segment.p_offset; ullNote + sizeof(Elf64_Nhdr) <= segment.p_offset + segment.p_filesz;)
+            {
+                const Elf64_Nhdr &note = *(const Elf64_Nhdr *)&vecCore[ullNote];
+                const uint64_t ullDesc = ullNote + sizeof(Elf64_Nhdr) + ((note.n_namesz + 3) & ~3u);
+                if (note.n_type == NT_PRSTATUS)
+                {
+                    int iThreadId = 0;
+                    memcpy(&iThreadId, &vecCore[ullDesc + offsetof(elf_prstatus, pr_pid)], sizeof(int));
+                    bFoundMainThread = bFoundMainThread || (ulThreads == 0 && iThreadId == iProcessId);
+                    ++ulThreads;
+                }
+                bFoundFiles = bFoundFiles || (note.n_type == NT_FILE);
+                ullNote = ullDesc + ((note.n_descsz + 3) & ~3u);
+            }
+        }
+        else if (segment.p_type == PT_LOAD)
+        {
+            //The buffer may straddle the end of the data section and the anonymous bss behind it
+            const uint64_t ullPattern = (uint64_t)&g_pattern[0];
+            const uint64_t ullBegin = std::max<uint64_t>(ullPattern, segment.p_vaddr);
+            const uint64_t ullEnd = std::min<uint64_t>(ullPattern + ulPatternSize, segment.p_vaddr + segment.p_filesz);
+            if (ullBegin < ullEnd)
+            {
+                const bool bMatches = memcmp(&vecCore[segment.p_offset + (ullBegin - segment.p_vaddr)],
+                    &g_pattern[ullBegin - ullPattern], (size_t)(ullEnd - ullBegin)) == 0;
+                ullPatternBytes += bMatches ? (ullEnd - ullBegin) : 0;
+            }
+            bFoundTrimmedFile = bFoundTrimmedFile || ((segment.p_flags & PF_X) && segment.p_filesz < segment.p_memsz);
+        }
+    }
+
+    bSuccess = Check(ulThreads == 2, "expected one NT_PRSTATUS per thread") && bSuccess;
+    bSuccess = Check(bFoundMainThread, "the first NT_PRSTATUS is not the main thread") && bSuccess;
+    bSuccess = Check(bFoundFiles, "no NT_FILE note") && bSuccess;
+    bSuccess = Check(ullPatternBytes == ulPatternSize, "the pattern buffer does not match the process memory") && bSuccess;
+    bSuccess = Check(bFoundTrimmedFile, "read-only code was dumped instead of left to its file") && bSuccess;
+
+    return bSuccess;
+}
+
+const bool IsRunning(const int iProcessId)
+{
+    char strPath[64] = { 0 };
+    snprintf(strPath, sizeof(strPath), "/proc/%i/stat", iProcessId);
+    FILE *pFile = fopen(strPath, "r");
+    if (pFile == nullptr)
+    {
+        return false;
+    }
+    char strStat[512] = { 0 };
+    const bool bRead = fgets(strStat, sizeof(strStat), pFile) != nullptr;
+    fclose(pFile);
+    const char * const pClose = strrchr(strStat, ')');
+    return bRead && pClose != nullptr && pClose[1] == ' ' && (pClose[2] == 'S' || pClose[2] == 'R');
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    //Fills in the pattern in this process too so the parent knows what the child holds
+    for (size_t i = 0; i < ulPatternSize; ++i)
+    {
+        g_pattern[i] = (unsigned char)(i * 7 + (i >> 12));
+    }
+
+    int iPipe[2] = { 0 };
+    if (pipe(iPipe) != 0)
+    {
+        return 1;
+    }
+    const pid_t iChild = fork();
+    if (iChild == 0)
+    {
+        close(iPipe[0]);
+        RunTarget(iPipe[1]);
+        _exit(0);
+    }
+    close(iPipe[1]);
+    char cReady = 0;
+    if (read(iPipe[0], &cReady, 1) != 1)
+    {
+        fprintf(stderr, "FAILED: target did not start\n");
+        return 1;
+    }
+    usleep(50 * 1000);
+
+    const std::string strPath = std::string((argc > 1) ? argv[1] : "/tmp") + "/ElfCoreWriterTest." +
+        std::to_string(iChild) + ".core";
+    ElfCoreWriter writer(iChild);
+    bool bSuccess = Check(writer.Write(strPath.c_str()), "Write failed");
+    if (bSuccess)
+    {
+        bSuccess = CheckCore(ReadFile(strPath.c_str()), iChild);
+        usleep(50 * 1000);
+        bSuccess = Check(IsRunning(iChild), "target was left stopped") && bSuccess;
+    }
+
+    kill(iChild, SIGKILL);
+    (void)waitpid(iChild, nullptr, 0);
+    (void)unlink(strPath.c_str());
+
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}
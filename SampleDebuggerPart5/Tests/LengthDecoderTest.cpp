@@ -0,0 +1,297 @@
+#include "LengthDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace CodeReversing;
+
+namespace
+{
+
+//ctest treats this as skipped rather than failed
+const int iSkipped = 77;
+
+//Prefixes, escapes and the opcodes with unusual immediates come up far more often than uniform bytes would give them
+const uint8_t cHotBytes[] = { 0x0F, 0x66, 0x67, 0xF2, 0xF3, 0x48, 0x4C, 0xC4, 0xC5, 0x62, 0x8F, 0x38, 0x3A, 0xFF, 0xF6,
+    0xF7, 0xE8, 0xE9, 0xA0, 0xA1, 0xB8, 0xC8, 0x9A, 0xEA };
+
+const std::vector<uint8_t> RandomCode(std::mt19937 &random, const size_t ulSize)
+{
+    std::vector<uint8_t> vecCode(ulSize);
+    for (auto &cByte : vecCode)
+    {
+        cByte = ((random() % 10) < 3) ? cHotBytes[random() % sizeof(cHotBytes)] : (uint8_t)random();
+    }
+    return vecCode;
+}
+
+const char * const ModeName(const LengthDecoder::eMode mode)
+{
+    return (mode == LengthDecoder::eMode::e64Bit) ? "x64" : "x86";
+}
+
+//Every decoded field has to stay inside the instruction and the instruction inside the input
+const bool CheckInvariants(std::mt19937 &random, const size_t ulIterations)
+{
+    size_t ulDecoded = 0;
+    for (size_t i = 0; i < ulIterations; ++i)
+    {
+        const std::vector<uint8_t> vecCode = RandomCode(random, random() % (LengthDecoder::ulMaxInstructionLength + 2));
+        for (auto mode : { LengthDecoder::eMode::e32Bit, LengthDecoder::eMode::e64Bit })
+        {
+            LengthDecoder::Result result;
+            if (!LengthDecoder::Decode(vecCode.data(), vecCode.size(), mode, result))
+            {
+                continue;
+            }
+            ++ulDecoded;
+            const bool bIsValid = result.uiLength != 0 && result.uiLength <= vecCode.size() &&
+                result.uiLength <= LengthDecoder::ulMaxInstructionLength &&
+                result.uiImmediateOffset + result.uiImmediateSize <= result.uiLength &&
+                result.uiDisplacementOffset + result.uiDisplacementSize <= result.uiLength &&
+                (!result.bIsRelative || result.branchType != eBranchType::eNone) &&
+                (!result.bIsRipRelative || mode == LengthDecoder::eMode::e64Bit);
+            if (!bIsValid)
+            {
+                fprintf(stderr, "FAILED: %s invariants broken for", ModeName(mode));
+                for (auto cByte : vecCode)
+                {
+                    fprintf(stderr, " %02x", cByte);
+                }
+                fprintf(stderr, " (length %u)\n", result.uiLength);
+                return false;
+            }
+        }
+    }
+    fprintf(stderr, "Invariants: %zu random inputs, %zu decoded.\n", ulIterations, ulDecoded);
+    return true;
+}
+
+const bool IsPrefix(const unsigned long ulByte, const LengthDecoder::eMode mode)
+{
+    switch (ulByte)
+    {
+    case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65: case 0x66: case 0x67: case 0xF0: case 0xF2: case 0xF3:
+        return true;
+    default:
+        return (mode == LengthDecoder::eMode::e64Bit) && ((ulByte & 0xF0) == 0x40);
+    }
+}
+
+const char ClassOf(const eBranchType branchType)
+{
+    switch (branchType)
+    {
+    case eBranchType::eJump: return 'j';
+    case eBranchType::eConditional: return 'c';
+    case eBranchType::eCall: return 'k';
+    case eBranchType::eReturn: return 'r';
+    default: return 'n';
+    }
+}
+
+//Strips the prefixes objdump prints as separate words and classifies what is left the way eBranchType does.
+//Returns false for lines that are not a comparable instruction.
+const bool ParseObjdumpLine(char * const pLine, const LengthDecoder::eMode mode, size_t &ulOffset, size_t &ulLength,
+    char &cClass)
+{
+    char *pBytes = strchr(pLine, ':');
+    if (pBytes == nullptr || pBytes[1] != '\t')
+    {
+        return false;
+    }
+    ulOffset = strtoull(pLine, nullptr, 16);
+    pBytes += 2;
+    char * const pText = strchr(pBytes, '\t');
+    if (pText == nullptr)
+    {
+        return false;
+    }
+    *pText = '\0';
+    //The byte column is padded with spaces, so count the hex pairs rather than the separators. The first byte after
+    //the legacy and REX prefixes is kept to spot fwait.
+    ulLength = 0;
+    unsigned long ulOpcode = 0;
+    bool bInPrefixes = true;
+    for (char *pByte = pBytes; *pByte != '\0';)
+    {
+        char *pEnd = nullptr;
+        const unsigned long ulByte = strtoul(pByte, &pEnd, 16);
+        if (pEnd == pByte)
+        {
+            break;
+        }
+        pByte = pEnd;
+        ++ulLength;
+        if (bInPrefixes && !IsPrefix(ulByte, mode))
+        {
+            ulOpcode = ulByte;
+            bInPrefixes = false;
+        }
+    }
+
+    static const char * const pPrefixes[] = { "lock", "rep", "repz", "repnz", "repe", "repne", "bnd", "notrack", "data16",
+        "addr32", "cs", "ds", "es", "ss", "fs", "gs", "xacquire", "xrelease", "{vex}", "{evex}", "{vex3}" };
+    char *pContext = nullptr;
+    const char *pMnemonic = strtok_r(pText + 1, " \t\n", &pContext);
+    while (pMnemonic != nullptr && (strncmp(pMnemonic, "rex", 3) == 0 ||
+        std::any_of(std::begin(pPrefixes), std::end(pPrefixes), [&](const char * const pPrefix) { return strcmp(pPrefix, pMnemonic) == 0; })))
+    {
+        pMnemonic = strtok_r(nullptr, " \t\n", &pContext);
+    }
+
+    //Undecodable bytes, lone prefixes, fwait (which objdump folds into the next x87 opcode), far and 16-bit forms
+    //are left out; they are either not instructions or objdump groups them differently
+    if (pMnemonic == nullptr || strstr(pMnemonic, "(bad)") != nullptr || pMnemonic[0] == '.' || ulLength == 0 ||
+        ulLength > LengthDecoder::ulMaxInstructionLength || ulOpcode == 0x9B ||
+        strncmp(pMnemonic, "addr16", 6) == 0 || pMnemonic[0] == 'l' || strcmp(pMnemonic, "fwait") == 0)
+    {
+        return false;
+    }
+    if (strstr(pContext, "(bad)") != nullptr)
+    {
+        return false;
+    }
+
+    cClass = 'n';
+    if (strncmp(pMnemonic, "jmp", 3) == 0)
+    {
+        cClass = 'j';
+    }
+    else if (pMnemonic[0] == 'j' || strncmp(pMnemonic, "loop", 4) == 0 || strncmp(pMnemonic, "xbegin", 6) == 0)
+    {
+        cClass = 'c';
+    }
+    else if (strncmp(pMnemonic, "call", 4) == 0)
+    {
+        cClass = 'k';
+    }
+    else if (strncmp(pMnemonic, "ret", 3) == 0 || strncmp(pMnemonic, "iret", 4) == 0)
+    {
+        cClass = 'r';
+    }
+
+    return true;
+}
+
+//Sweeps random code with objdump and decodes every instruction it reports at the same offset. Returns -1 when
+//objdump is not available.
+const int CompareWithObjdump(std::mt19937 &random, const LengthDecoder::eMode mode, const size_t ulSize)
+{
+    char strPath[] = "/tmp/LengthDecoderTestXXXXXX";
+    const int iFile = mkstemp(strPath);
+    if (iFile == -1)
+    {
+        return -1;
+    }
+    const std::vector<uint8_t> vecCode = RandomCode(random, ulSize);
+    const bool bWritten = write(iFile, vecCode.data(), vecCode.size()) == (ssize_t)vecCode.size();
+    close(iFile);
+
+    //Intel64 rules, like the decoder: an operand size prefix does not shorten near branches in 64-bit mode
+    const std::string strCommand = std::string("objdump -D -b binary -m ") +
+        ((mode == LengthDecoder::eMode::e64Bit) ? "i386:x86-64 -M intel64" : "i386") + " --insn-width=16 -w " + strPath +
+        " 2>/dev/null";
+    FILE *pOutput = bWritten ? popen(strCommand.c_str(), "r") : nullptr;
+    if (pOutput == nullptr)
+    {
+        unlink(strPath);
+        return -1;
+    }
+
+    size_t ulCompared = 0;
+    size_t ulMismatches = 0;
+    char strLine[512] = { 0 };
+    while (fgets(strLine, sizeof(strLine), pOutput) != nullptr)
+    {
+        size_t ulOffset = 0;
+        size_t ulLength = 0;
+        char cClass = 'n';
+        if (!ParseObjdumpLine(strLine, mode, ulOffset, ulLength, cClass) || ulOffset >= vecCode.size())
+        {
+            continue;
+        }
+
+        ++ulCompared;
+        LengthDecoder::Result result;
+        const bool bDecoded = LengthDecoder::Decode(&vecCode[ulOffset], vecCode.size() - ulOffset, mode, result);
+        if (!bDecoded || result.uiLength != ulLength || ClassOf(result.branchType) != cClass)
+        {
+            if (ulMismatches++ < 10)
+            {
+                fprintf(stderr, "%s mismatch at %zx:", ModeName(mode), ulOffset);
+                for (size_t i = 0; i < ulLength; ++i)
+                {
+                    fprintf(stderr, " %02x", vecCode[ulOffset + i]);
+                }
+                fprintf(stderr, " objdump %zu %c, decoder %u %c\n", ulLength, cClass, bDecoded ? result.uiLength : 0,
+                    bDecoded ? ClassOf(result.branchType) : '-');
+            }
+        }
+    }
+    const int iStatus = pclose(pOutput);
+    unlink(strPath);
+    if (iStatus != 0 || ulCompared == 0)
+    {
+        return -1;
+    }
+
+    fprintf(stderr, "Objdump %s: %zu instructions compared, %zu mismatches.\n", ModeName(mode), ulCompared, ulMismatches);
+    return (int)(ulMismatches != 0 ? 1 : 0);
+}
+
+void Benchmark(std::mt19937 &random)
+{
+    const size_t ulSize = 16 * 1024 * 1024;
+    const std::vector<uint8_t> vecCode = RandomCode(random, ulSize + LengthDecoder::ulMaxInstructionLength);
+    for (auto mode : { LengthDecoder::eMode::e32Bit, LengthDecoder::eMode::e64Bit })
+    {
+        const auto start = std::chrono::steady_clock::now();
+        size_t ulInstructions = 0;
+        for (size_t ulOffset = 0; ulOffset < ulSize; ++ulInstructions)
+        {
+            LengthDecoder::Result result;
+            ulOffset += LengthDecoder::Decode(&vecCode[ulOffset], vecCode.size() - ulOffset, mode, result) ? result.uiLength : 1;
+        }
+        const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "Benchmark %s: %zu instructions, %.0f instructions/s.\n", ModeName(mode), ulInstructions,
+            (dSeconds > 0.0) ? ulInstructions / dSeconds : 0.0);
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned int uiSeed = (argc > 1) ? (unsigned int)strtoul(argv[1], nullptr, 0) : 7;
+    std::mt19937 random(uiSeed);
+    fprintf(stderr, "Seed %u.\n", uiSeed);
+
+    bool bSuccess = CheckInvariants(random, 2000000);
+
+    bool bHasObjdump = true;
+    for (auto mode : { LengthDecoder::eMode::e32Bit, LengthDecoder::eMode::e64Bit })
+    {
+        const int iResult = CompareWithObjdump(random, mode, 400000);
+        bHasObjdump = bHasObjdump && (iResult != -1);
+        bSuccess = (iResult != 1) && bSuccess;
+    }
+
+    Benchmark(random);
+
+    if (bSuccess && !bHasObjdump)
+    {
+        fprintf(stderr, "SKIPPED: objdump is not available for the differential check\n");
+        return iSkipped;
+    }
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}
@@ -0,0 +1,306 @@
+#include "PeParser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace CodeReversing;
+
+namespace
+{
+
+const bool Check(const bool bCondition, const char * const pMessage, const char * const pContext = "")
+{
+    if (!bCondition)
+    {
+        fprintf(stderr, "FAILED: %s %s\n", pMessage, pContext);
+    }
+    return bCondition;
+}
+
+const std::vector<uint8_t> ReadFile(const std::string &strPath)
+{
+    std::vector<uint8_t> vecData;
+    FILE *pFile = fopen(strPath.c_str(), "rb");
+    if (pFile == nullptr)
+    {
+        return vecData;
+    }
+    uint8_t buffer[65536];
+    size_t ulRead = 0;
+    while ((ulRead = fread(buffer, 1, sizeof(buffer), pFile)) != 0)
+    {
+        vecData.insert(vecData.end(), buffer, buffer + ulRead);
+    }
+    fclose(pFile);
+    return vecData;
+}
+
+//Everything the parser hands out has to point into the view, and strings have to end inside it
+struct View
+{
+    const uint8_t *pBegin;
+    size_t ulSize;
+
+    const bool Contains(const void * const p, const size_t ulLength) const
+    {
+        const uint8_t * const pByte = (const uint8_t *)p;
+        return pByte >= pBegin && pByte <= pBegin + ulSize && ulLength <= (size_t)(pBegin + ulSize - pByte);
+    }
+
+    const bool IsString(const char * const pString) const
+    {
+        return pString == nullptr ||
+            (Contains(pString, 1) && memchr(pString, '\0', (size_t)(pBegin + ulSize - (const uint8_t *)pString)) != nullptr);
+    }
+};
+
+struct Summary
+{
+    bool bParsed;
+    size_t ulExports;
+    size_t ulImports;
+    size_t ulRuntimeFunctions;
+    bool bIsSafe;
+};
+
+//Walks everything the parser exposes. Used on good and damaged images alike; only bIsSafe has to hold for both.
+const Summary Walk(const uint8_t * const pData, const size_t ulSize, const PeParser::eLayout layout,
+    std::vector<std::string> *pExportNames = nullptr)
+{
+    Summary summary = { false, 0, 0, 0, true };
+    const View view = { pData, ulSize };
+    PeParser parser(pData, ulSize, layout);
+    summary.bParsed = parser.Parse();
+    if (!summary.bParsed)
+    {
+        return summary;
+    }
+
+    for (size_t i = 0; i < parser.SectionCount(); ++i)
+    {
+        const PeParser::Section section = parser.GetSection(i);
+        summary.bIsSafe = summary.bIsSafe && view.Contains(section.pName, 8);
+    }
+
+    std::vector<PeParser::Export> vecExports;
+    if (parser.Exports(vecExports))
+    {
+        summary.ulExports = vecExports.size();
+        for (auto &exported : vecExports)
+        {
+            summary.bIsSafe = summary.bIsSafe && view.IsString(exported.pName) && view.IsString(exported.pForwarder);
+            if (pExportNames != nullptr && exported.pName != nullptr)
+            {
+                pExportNames->push_back(exported.pName);
+            }
+        }
+    }
+
+    std::vector<PeParser::Import> vecImports;
+    if (parser.Imports(vecImports))
+    {
+        summary.ulImports = vecImports.size();
+        for (auto &imported : vecImports)
+        {
+            summary.bIsSafe = summary.bIsSafe && view.IsString(imported.pModule) && view.IsString(imported.pName);
+        }
+    }
+
+    size_t ulCount = 0;
+    const PeParser::RuntimeFunction * const pFunctions = parser.RuntimeFunctions(ulCount);
+    if (pFunctions != nullptr)
+    {
+        summary.ulRuntimeFunctions = ulCount;
+        summary.bIsSafe = summary.bIsSafe && view.Contains(pFunctions, ulCount * sizeof(PeParser::RuntimeFunction));
+    }
+
+    return summary;
+}
+
+//Lays the sections out at their RVAs the way the loader would, to check the image layout against the file layout
+const std::vector<uint8_t> MapImage(const std::vector<uint8_t> &vecFile)
+{
+    PeParser parser(vecFile.data(), vecFile.size(), PeParser::eLayout::eFile);
+    if (!parser.Parse())
+    {
+        return std::vector<uint8_t>();
+    }
+    std::vector<uint8_t> vecImage(parser.ImageSize(), 0);
+    memcpy(vecImage.data(), vecFile.data(), std::min<size_t>(vecFile.size(), 0x1000));
+    for (size_t i = 0; i < parser.SectionCount(); ++i)
+    {
+        const PeParser::Section section = parser.GetSection(i);
+        const size_t ulSize = std::min<size_t>(section.uiRawSize, section.uiVirtualSize);
+        if (section.uiRawOffset + ulSize <= vecFile.size() && section.uiVirtualAddress + ulSize <= vecImage.size())
+        {
+            memcpy(&vecImage[section.uiVirtualAddress], &vecFile[section.uiRawOffset], ulSize);
+        }
+    }
+    return vecImage;
+}
+
+//Offsets of the header fields the targeted corruptions aim at, found the same way the loader finds them
+struct Layout
+{
+    size_t ulNtOffset;
+    size_t ulSectionCount;
+    size_t ulOptionalSize;
+    size_t ulExportDirectory;
+    size_t ulImportDirectory;
+    size_t ulExceptionDirectory;
+    size_t ulExportTable;
+};
+
+const Layout FindLayout(const std::vector<uint8_t> &vecFile)
+{
+    Layout layout = { 0 };
+    memcpy(&layout.ulNtOffset, &vecFile[0x3C], sizeof(uint32_t));
+    layout.ulSectionCount = layout.ulNtOffset + 4 + 2;
+    layout.ulOptionalSize = layout.ulNtOffset + 4 + 16;
+    const size_t ulOptional = layout.ulNtOffset + 4 + 20;
+    const size_t ulDirectories = ulOptional + ((vecFile[ulOptional] == 0x0B && vecFile[ulOptional + 1] == 0x02) ? 112 : 96);
+    layout.ulExportDirectory = ulDirectories + PeParser::uiDirectoryExport * 8;
+    layout.ulImportDirectory = ulDirectories + PeParser::uiDirectoryImport * 8;
+    layout.ulExceptionDirectory = ulDirectories + PeParser::uiDirectoryException * 8;
+
+    PeParser parser(vecFile.data(), vecFile.size(), PeParser::eLayout::eFile);
+    uint32_t uiRva = 0;
+    uint32_t uiSize = 0;
+    if (parser.Parse() && parser.DataDirectory(PeParser::uiDirectoryExport, uiRva, uiSize))
+    {
+        const uint8_t * const pTable = parser.RvaToPointer(uiRva, 40);
+        layout.ulExportTable = (pTable != nullptr) ? (size_t)(pTable - vecFile.data()) : 0;
+    }
+    return layout;
+}
+
+void Write32(std::vector<uint8_t> &vecFile, const size_t ulOffset, const uint32_t uiValue)
+{
+    memcpy(&vecFile[ulOffset], &uiValue, sizeof(uint32_t));
+}
+
+const bool CheckModule(const std::string &strPath, const bool bIs64Bit, const char * const pExport)
+{
+    const std::vector<uint8_t> vecFile = ReadFile(strPath);
+    if (!Check(!vecFile.empty(), "could not read", strPath.c_str()))
+    {
+        return false;
+    }
+
+    std::vector<std::string> vecNames;
+    const Summary file = Walk(vecFile.data(), vecFile.size(), PeParser::eLayout::eFile, &vecNames);
+    bool bSuccess = Check(file.bParsed && file.bIsSafe, "could not parse", strPath.c_str());
+    PeParser parser(vecFile.data(), vecFile.size(), PeParser::eLayout::eFile);
+    bSuccess = Check(parser.Parse() && parser.Is64Bit() == bIs64Bit, "wrong machine", strPath.c_str()) && bSuccess;
+    bSuccess = Check(std::find(vecNames.begin(), vecNames.end(), pExport) != vecNames.end(), "missing export", pExport) && bSuccess;
+    bSuccess = Check(std::is_sorted(vecNames.begin(), vecNames.end()), "export names are not sorted", strPath.c_str()) && bSuccess;
+    bSuccess = Check(file.ulImports != 0, "no imports", strPath.c_str()) && bSuccess;
+    bSuccess = Check((file.ulRuntimeFunctions != 0) == bIs64Bit, "unexpected .pdata", strPath.c_str()) && bSuccess;
+
+    size_t ulCount = 0;
+    const PeParser::RuntimeFunction * const pFunctions = parser.RuntimeFunctions(ulCount);
+    for (size_t i = 0; pFunctions != nullptr && i < ulCount; ++i)
+    {
+        bSuccess = Check(pFunctions[i].uiBegin < pFunctions[i].uiEnd && (i == 0 || pFunctions[i - 1].uiEnd <= pFunctions[i].uiBegin),
+            ".pdata is not sorted and disjoint", strPath.c_str()) && bSuccess;
+    }
+
+    //The same module mapped the way the loader maps it has to give the same answers
+    const std::vector<uint8_t> vecImage = MapImage(vecFile);
+    std::vector<std::string> vecImageNames;
+    const Summary image = Walk(vecImage.data(), vecImage.size(), PeParser::eLayout::eImage, &vecImageNames);
+    bSuccess = Check(image.bParsed && image.bIsSafe && vecImageNames == vecNames && image.ulImports == file.ulImports &&
+        image.ulRuntimeFunctions == file.ulRuntimeFunctions, "image layout disagrees with file layout", strPath.c_str()) && bSuccess;
+
+    fprintf(stderr, "%s: %zu exports, %zu imports, %zu runtime functions.\n", strPath.c_str(), file.ulExports, file.ulImports,
+        file.ulRuntimeFunctions);
+    return bSuccess;
+}
+
+//Truncated, patched and randomly damaged copies may fail to parse, but nothing handed out may leave the view
+const bool CheckDamaged(const std::string &strPath, std::mt19937 &random)
+{
+    const std::vector<uint8_t> vecFile = ReadFile(strPath);
+    if (vecFile.empty())
+    {
+        return false;
+    }
+    bool bSuccess = true;
+
+    //Every cut through the headers, then a stride through the rest. Each copy gets its own allocation so reads past
+    //the end land outside it.
+    size_t ulTruncations = 0;
+    for (size_t ulLength = 0; ulLength < vecFile.size(); ulLength += (ulLength < 0x2000) ? 1 : 509, ++ulTruncations)
+    {
+        const std::vector<uint8_t> vecCopy(vecFile.begin(), vecFile.begin() + ulLength);
+        bSuccess = Check(Walk(vecCopy.data(), vecCopy.size(), PeParser::eLayout::eFile).bIsSafe, "unsafe truncation",
+            strPath.c_str()) && bSuccess;
+    }
+
+    const Layout layout = FindLayout(vecFile);
+    const uint32_t uiBadValues[] = { 0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFF0, 0xFFFFFFFF, (uint32_t)vecFile.size(),
+        (uint32_t)vecFile.size() - 4 };
+    const size_t ulTargets[] = { 0x3C, layout.ulSectionCount, layout.ulOptionalSize, layout.ulExportDirectory,
+        layout.ulExportDirectory + 4, layout.ulImportDirectory, layout.ulImportDirectory + 4, layout.ulExceptionDirectory,
+        layout.ulExceptionDirectory + 4, layout.ulExportTable + 12, layout.ulExportTable + 20, layout.ulExportTable + 24,
+        layout.ulExportTable + 28, layout.ulExportTable + 32, layout.ulExportTable + 36 };
+    size_t ulPatches = 0;
+    for (auto ulTarget : ulTargets)
+    {
+        if (ulTarget == 0 || ulTarget + 4 > vecFile.size())
+        {
+            continue;
+        }
+        for (auto uiValue : uiBadValues)
+        {
+            std::vector<uint8_t> vecCopy(vecFile);
+            Write32(vecCopy, ulTarget, uiValue);
+            bSuccess = Check(Walk(vecCopy.data(), vecCopy.size(), PeParser::eLayout::eFile).bIsSafe, "unsafe patch",
+                strPath.c_str()) && bSuccess;
+            ++ulPatches;
+        }
+    }
+
+    //Random damage goes where the parser looks: the headers and the export table
+    const size_t ulFlips = 20000;
+    for (size_t i = 0; i < ulFlips; ++i)
+    {
+        std::vector<uint8_t> vecCopy(vecFile);
+        const size_t ulDamage = 1 + random() % 8;
+        for (size_t j = 0; j < ulDamage; ++j)
+        {
+            const size_t ulOffset = ((random() % 2) == 0 || layout.ulExportTable == 0) ? random() % 0x400 :
+                layout.ulExportTable + random() % 0x100;
+            if (ulOffset < vecCopy.size())
+            {
+                vecCopy[ulOffset] = (uint8_t)random();
+            }
+        }
+        bSuccess = Check(Walk(vecCopy.data(), vecCopy.size(), PeParser::eLayout::eFile).bIsSafe, "unsafe random damage",
+            strPath.c_str()) && bSuccess;
+    }
+
+    fprintf(stderr, "%s: %zu truncations, %zu patched fields, %zu randomly damaged copies.\n", strPath.c_str(), ulTruncations,
+        ulPatches, ulFlips);
+    return bSuccess;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const std::string strDirectory = (argc > 1) ? argv[1] : "dlls";
+    std::mt19937 random(7);
+
+    bool bSuccess = CheckModule(strDirectory + "/BeaEngine_x86.dll", false, "_Disasm@4");
+    bSuccess = CheckModule(strDirectory + "/BeaEngine_x64.dll", true, "Disasm") && bSuccess;
+    bSuccess = CheckDamaged(strDirectory + "/BeaEngine_x86.dll", random) && bSuccess;
+    bSuccess = CheckDamaged(strDirectory + "/BeaEngine_x64.dll", random) && bSuccess;
+
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "RangePlan.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace CodeReversing;
+
+namespace
+{
+
+//Just enough of a 32-bit CPU to run the test programs: nop, dec ecx, jz, jnz, jmp short, call, ret and hlt
+struct Cpu
+{
+    uint32_t uiEip;
+    uint32_t uiEsp;
+    uint32_t uiEcx;
+    bool bZero;
+    std::vector<uint8_t> vecMemory;
+};
+
+const bool Execute(Cpu &cpu)
+{
+    const uint8_t * const pCode = &cpu.vecMemory[cpu.uiEip];
+    int32_t iRelative = 0;
+    switch (pCode[0])
+    {
+    case 0x90:
+        cpu.uiEip += 1;
+        return true;
+    case 0x49:
+        cpu.bZero = (--cpu.uiEcx == 0);
+        cpu.uiEip += 1;
+        return true;
+    case 0x74:
+    case 0x75:
+        cpu.uiEip += 2 + (((pCode[0] == 0x74) == cpu.bZero) ? (int8_t)pCode[1] : 0);
+        return true;
+    case 0xEB:
+        cpu.uiEip += 2 + (int8_t)pCode[1];
+        return true;
+    case 0xE8:
+        memcpy(&iRelative, &pCode[1], sizeof(int32_t));
+        cpu.uiEsp -= 4;
+        *(uint32_t *)&cpu.vecMemory[cpu.uiEsp] = cpu.uiEip + 5;
+        cpu.uiEip += 5 + iRelative;
+        return true;
+    case 0xC3:
+        cpu.uiEip = *(const uint32_t *)&cpu.vecMemory[cpu.uiEsp];
+        cpu.uiEsp += 4;
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct Outcome
+{
+    bool bFinished;
+    size_t ulSteps;
+    size_t ulRuns;
+    size_t ulCallsStepped;
+    size_t ulRecursiveHits;
+};
+
+//Drives the plan the way RangeStepper does: the first instruction is single-stepped, runs and calls go to a stop
+//point, and a hit on a call's return address below the caller's stack is stepped over and re-armed
+const Outcome StepRange(Cpu &cpu, const uint32_t uiStart, const uint32_t uiEnd)
+{
+    Outcome outcome = { false, 0, 0, 0, 0 };
+    const InstructionSource source = [&cpu](const uint64_t ullAddress, uint8_t &uiLength, eBranchType &branchType)
+    {
+        LengthDecoder::Result result;
+        if (ullAddress >= cpu.vecMemory.size() || !LengthDecoder::Decode(&cpu.vecMemory[(size_t)ullAddress],
+            cpu.vecMemory.size() - (size_t)ullAddress, LengthDecoder::eMode::e32Bit, result))
+        {
+            return false;
+        }
+        uiLength = result.uiLength;
+        branchType = result.branchType;
+        return true;
+    };
+
+    RangePlan plan;
+    plan.SetRange(uiStart, uiEnd);
+    bool bTrap = true;
+    uint64_t ullStopPoint = 0;
+    for (size_t ulEvents = 0; ulEvents < 1000; ++ulEvents)
+    {
+        if (bTrap)
+        {
+            if (!Execute(cpu))
+            {
+                return outcome;
+            }
+            bTrap = false;
+        }
+        else
+        {
+            size_t ulExecuted = 0;
+            while (cpu.uiEip != ullStopPoint)
+            {
+                if (++ulExecuted > 10000 || !Execute(cpu))
+                {
+                    fprintf(stderr, "Ran past the stop point at %llx to %x.\n", (unsigned long long)ullStopPoint, cpu.uiEip);
+                    return outcome;
+                }
+            }
+            if (plan.IsInCall() && !plan.IsReturnToCaller(cpu.uiEsp))
+            {
+                ++outcome.ulRecursiveHits;
+                if (!Execute(cpu))
+                {
+                    return outcome;
+                }
+                continue;
+            }
+            ullStopPoint = 0;
+            plan.LeaveCall();
+        }
+
+        if (!plan.Contains(cpu.uiEip))
+        {
+            outcome.bFinished = true;
+            return outcome;
+        }
+        const RangePlan::Step step = plan.Next(cpu.uiEip, source);
+        switch (step.action)
+        {
+        case RangePlan::eAction::eStepOverCall:
+            plan.EnterCall(cpu.uiEsp);
+            ullStopPoint = step.ullStopAddress;
+            ++outcome.ulCallsStepped;
+            break;
+        case RangePlan::eAction::eRunTo:
+            ullStopPoint = step.ullStopAddress;
+            ++outcome.ulRuns;
+            break;
+        default:
+            bTrap = true;
+            ++outcome.ulSteps;
+            break;
+        }
+    }
+
+    return outcome;
+}
+
+const bool Check(const bool bCondition, const char * const pMessage)
+{
+    if (!bCondition)
+    {
+        fprintf(stderr, "FAILED: %s\n", pMessage);
+    }
+    return bCondition;
+}
+
+Cpu MakeCpu(const uint32_t uiAddress, const std::vector<uint8_t> &vecCode)
+{
+    Cpu cpu = { uiAddress, 0x8000, 0, false, std::vector<uint8_t>(0x10000, 0xF4) };
+    memcpy(&cpu.vecMemory[uiAddress], vecCode.data(), vecCode.size());
+    return cpu;
+}
+
+void Place(Cpu &cpu, const uint32_t uiAddress, const std::vector<uint8_t> &vecCode)
+{
+    memcpy(&cpu.vecMemory[uiAddress], vecCode.data(), vecCode.size());
+}
+
+//nop; call 1020; nop; nop | nop, with 1020: nop; nop; ret
+const bool PlainCall()
+{
+    Cpu cpu = MakeCpu(0x1000, { 0x90, 0xE8, 0x1A, 0x00, 0x00, 0x00, 0x90, 0x90, 0x90 });
+    Place(cpu, 0x1020, { 0x90, 0x90, 0xC3 });
+    const Outcome outcome = StepRange(cpu, 0x1000, 0x1008);
+
+    bool bSuccess = Check(outcome.bFinished, "plain call: the range never completed");
+    bSuccess = Check(cpu.uiEip == 0x1008 && cpu.uiEsp == 0x8000, "plain call: finished in the wrong place") && bSuccess;
+    bSuccess = Check(outcome.ulCallsStepped == 1 && outcome.ulRecursiveHits == 0,
+        "plain call: the return was taken for a recursive hit") && bSuccess;
+    bSuccess = Check(outcome.ulRuns == 1, "plain call: the nops after the call were not run to") && bSuccess;
+    return bSuccess;
+}
+
+//1040: dec ecx; jz 1048; call 1040; 1048: ret. Stepping starts on the jz three levels from the bottom, so the first
+//single step falls through to the recursive call.
+const bool RecursiveCall()
+{
+    Cpu cpu = MakeCpu(0x1040, { 0x49, 0x74, 0x05, 0xE8, 0xF8, 0xFF, 0xFF, 0xFF, 0xC3 });
+    Place(cpu, 0x1000, { 0xE8, 0x3B, 0x00, 0x00, 0x00, 0x90 });
+    cpu.uiEip = 0x1041;
+    cpu.uiEsp = 0x7FFC;
+    *(uint32_t *)&cpu.vecMemory[cpu.uiEsp] = 0x1005;
+    cpu.uiEcx = 3;
+    const Outcome outcome = StepRange(cpu, 0x1040, 0x1049);
+
+    bool bSuccess = Check(outcome.bFinished, "recursive call: the range never completed");
+    bSuccess = Check(cpu.uiEip == 0x1005 && cpu.uiEsp == 0x8000 && cpu.uiEcx == 0,
+        "recursive call: finished in the wrong place") && bSuccess;
+    bSuccess = Check(outcome.ulCallsStepped == 1 && outcome.ulRecursiveHits == 3,
+        "recursive call: deeper returns were not told apart from the caller's") && bSuccess;
+    return bSuccess;
+}
+
+//1060: nop; dec ecx; jnz 1060 | nop
+const bool Loop()
+{
+    Cpu cpu = MakeCpu(0x1060, { 0x90, 0x49, 0x75, 0xFC, 0x90 });
+    cpu.uiEcx = 5;
+    const Outcome outcome = StepRange(cpu, 0x1060, 0x1064);
+
+    bool bSuccess = Check(outcome.bFinished && cpu.uiEip == 0x1064 && cpu.uiEcx == 0, "loop: finished in the wrong place");
+    bSuccess = Check(outcome.ulSteps == 5 && outcome.ulRuns == 5, "loop: branches were not single-stepped") && bSuccess;
+    return bSuccess;
+}
+
+}
+
+int main()
+{
+    bool bSuccess = PlainCall();
+    bSuccess = RecursiveCall() && bSuccess;
+    bSuccess = Loop() && bSuccess;
+
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}
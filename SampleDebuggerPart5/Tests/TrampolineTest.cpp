@@ -0,0 +1,195 @@
+#include "Trampoline.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+using namespace CodeReversing;
+
+namespace
+{
+
+const bool Check(const bool bCondition, const char * const pMessage)
+{
+    if (!bCondition)
+    {
+        fprintf(stderr, "FAILED: %s\n", pMessage);
+    }
+    return bCondition;
+}
+
+const Trampoline::eKind KindOf(const std::vector<uint8_t> &vecCode, const LengthDecoder::eMode mode)
+{
+    Trampoline trampoline;
+    (void)trampoline.Plan(0x401000, vecCode.data(), vecCode.size(), mode);
+    return trampoline.Kind();
+}
+
+//What gets moved, what gets emulated and what is left to the trap flag
+const bool Classification()
+{
+    const LengthDecoder::eMode x64 = LengthDecoder::eMode::e64Bit;
+    const LengthDecoder::eMode x86 = LengthDecoder::eMode::e32Bit;
+    bool bSuccess = Check(KindOf({ 0x48, 0x89, 0xF8 }, x64) == Trampoline::eKind::eDisplaced, "mov rax, rdi is not displaced");
+    bSuccess = Check(KindOf({ 0x48, 0x8D, 0x05, 0x00, 0x01, 0x00, 0x00 }, x64) == Trampoline::eKind::eDisplaced,
+        "lea rax, [rip] is not displaced") && bSuccess;
+    bSuccess = Check(KindOf({ 0xEB, 0x10 }, x64) == Trampoline::eKind::eJump, "jmp short is not emulated") && bSuccess;
+    bSuccess = Check(KindOf({ 0xE8, 0x00, 0x10, 0x00, 0x00 }, x86) == Trampoline::eKind::eCall, "call is not emulated") && bSuccess;
+    bSuccess = Check(KindOf({ 0x0F, 0x85, 0x00, 0x10, 0x00, 0x00 }, x64) == Trampoline::eKind::eConditional,
+        "jnz near is not emulated") && bSuccess;
+    bSuccess = Check(KindOf({ 0x66, 0xE9, 0x00, 0x10 }, x86) == Trampoline::eKind::eStep, "16-bit jmp is emulated") && bSuccess;
+    bSuccess = Check(KindOf({ 0xFF, 0xE0 }, x64) == Trampoline::eKind::eStep, "jmp rax is not stepped") && bSuccess;
+    bSuccess = Check(KindOf({ 0xC3 }, x64) == Trampoline::eKind::eStep, "ret is not stepped") && bSuccess;
+    bSuccess = Check(KindOf({ 0xE2, 0xFE }, x64) == Trampoline::eKind::eStep, "loop is not stepped") && bSuccess;
+    bSuccess = Check(KindOf({ 0xE3, 0xFE }, x86) == Trampoline::eKind::eStep, "jecxz is not stepped") && bSuccess;
+    bSuccess = Check(KindOf({ 0xCC }, x64) == Trampoline::eKind::eStep, "int 3 is displaced") && bSuccess;
+
+    //A different instruction at the same address needs a new plan
+    const uint8_t pCode[] = { 0x48, 0x89, 0xF8 };
+    const uint8_t pPatched[] = { 0x48, 0x89, 0xF0 };
+    Trampoline trampoline;
+    (void)trampoline.Plan(0x401000, pCode, sizeof(pCode), x64);
+    bSuccess = Check(trampoline.Matches(0x401000, pCode, sizeof(pCode)) && !trampoline.Matches(0x401000, pPatched,
+        sizeof(pPatched)) && !trampoline.Matches(0x402000, pCode, sizeof(pCode)), "patched code still matches") && bSuccess;
+    return bSuccess;
+}
+
+const bool Relocation()
+{
+    //x86 jumps back with a rel32 from the end of the copy
+    const uint8_t pPush[] = { 0x55 };
+    Trampoline trampoline;
+    (void)trampoline.Plan(0x401000, pPush, sizeof(pPush), LengthDecoder::eMode::e32Bit);
+    uint8_t pSlot[Trampoline::ulSlotSize] = { 0 };
+    bool bSuccess = Check(trampoline.Relocate(0x10000, pSlot), "x86 slot was not built");
+    int32_t iRelative = 0;
+    memcpy(&iRelative, &pSlot[2], sizeof(int32_t));
+    bSuccess = Check(pSlot[0] == 0x55 && pSlot[1] == 0xE9 && 0x10000 + 6 + iRelative == 0x401001,
+        "x86 slot does not jump back after the instruction") && bSuccess;
+
+    //A RIP-relative operand is re-aimed from the slot and refused once the slot is out of its reach
+    const uint8_t pLea[] = { 0x48, 0x8D, 0x05, 0x00, 0x01, 0x00, 0x00 };
+    (void)trampoline.Plan(0x140001000, pLea, sizeof(pLea), LengthDecoder::eMode::e64Bit);
+    bSuccess = Check(trampoline.Relocate(0x140001000 - 0x7FFF0000, pSlot), "near x64 slot was not built") && bSuccess;
+    memcpy(&iRelative, &pSlot[3], sizeof(int32_t));
+    bSuccess = Check(0x140001000 - 0x7FFF0000 + 7 + (int64_t)iRelative == 0x140001107, "RIP-relative operand moved") &&
+        bSuccess;
+    bSuccess = Check(!trampoline.Relocate(0x140001000 - 0x90000000ULL, pSlot), "out-of-reach slot was built") && bSuccess;
+    return bSuccess;
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+
+uint8_t *MapCode(void * const pHint)
+{
+    void * const pPage = mmap(pHint, 0x1000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (pPage == MAP_FAILED) ? nullptr : (uint8_t *)pPage;
+}
+
+//Each jcc runs on the processor under every combination of the flags it can read and has to agree with IsTaken
+const bool ConditionsAgainstCpu()
+{
+    uint8_t * const pCode = MapCode(nullptr);
+    if (!Check(pCode != nullptr, "could not map code"))
+    {
+        return false;
+    }
+
+    //push rdi; popfq; jcc +3; xor eax, eax; ret; mov eax, 1; ret
+    const uint8_t pTemplate[] = { 0x57, 0x9D, 0x70, 0x03, 0x31, 0xC0, 0xC3, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+    const uint32_t pFlags[] = { 0x1, 0x4, 0x40, 0x80, 0x800 };
+    bool bSuccess = true;
+    for (uint8_t uiCondition = 0; uiCondition < 16; ++uiCondition)
+    {
+        memcpy(pCode, pTemplate, sizeof(pTemplate));
+        pCode[2] = (uint8_t)(0x70 | uiCondition);
+        int (* const pJcc)(uint64_t) = (int (*)(uint64_t))pCode;
+        for (uint32_t uiMask = 0; uiMask < 32; ++uiMask)
+        {
+            uint32_t uiFlags = 0x202;
+            for (size_t i = 0; i < sizeof(pFlags) / sizeof(pFlags[0]); ++i)
+            {
+                uiFlags |= ((uiMask >> i) & 1) ? pFlags[i] : 0;
+            }
+            if ((pJcc(uiFlags) != 0) != Trampoline::IsTaken(uiCondition, uiFlags))
+            {
+                fprintf(stderr, "FAILED: condition %X with flags %X.\n", uiCondition, uiFlags);
+                bSuccess = false;
+            }
+        }
+    }
+
+    munmap(pCode, 0x1000);
+    return bSuccess;
+}
+
+//Runs each instruction both in place and from a slot on another page; the slot jumps back to the ret after the
+//original, so both calls return the same thing
+const bool DisplacedAgainstCpu()
+{
+    uint8_t * const pCode = MapCode(nullptr);
+    uint8_t * const pSlots = (pCode != nullptr) ? MapCode(pCode + 0x10000000) : nullptr;
+    if (!Check(pCode != nullptr && pSlots != nullptr, "could not map code"))
+    {
+        return false;
+    }
+
+    const std::vector<std::vector<uint8_t>> vecInstructions = {
+        { 0x48, 0x89, 0xF8 },                                       //mov rax, rdi
+        { 0x48, 0x8D, 0x05, 0x00, 0x08, 0x00, 0x00 },               //lea rax, [rip+800]
+        { 0x48, 0x8B, 0x05, 0xF0, 0x07, 0x00, 0x00 },               //mov rax, [rip+7F0]
+        { 0x48, 0x8D, 0x44, 0x3F, 0x05 }                            //lea rax, [rdi+rdi+5]
+    };
+    const uint64_t ullData = 0x1122334455667788ULL;
+    bool bSuccess = true;
+    for (size_t i = 0; i < vecInstructions.size(); ++i)
+    {
+        const std::vector<uint8_t> &vecInstruction = vecInstructions[i];
+        memset(pCode, 0xCC, 0x1000);
+        memcpy(pCode, vecInstruction.data(), vecInstruction.size());
+        pCode[vecInstruction.size()] = 0xC3;
+        memcpy(&pCode[0x7F7], &ullData, sizeof(ullData));
+
+        Trampoline trampoline;
+        if (!trampoline.Plan((uint64_t)pCode, pCode, 16, LengthDecoder::eMode::e64Bit) ||
+            !trampoline.Relocate((uint64_t)pSlots, pSlots))
+        {
+            fprintf(stderr, "FAILED: instruction %zu was not displaced.\n", i);
+            bSuccess = false;
+            continue;
+        }
+        const uint64_t ullInPlace = ((uint64_t (*)(uint64_t))pCode)(0x1234);
+        const uint64_t ullDisplaced = ((uint64_t (*)(uint64_t))pSlots)(0x1234);
+        if (ullInPlace != ullDisplaced)
+        {
+            fprintf(stderr, "FAILED: instruction %zu gave %llx in place and %llx displaced.\n", i,
+                (unsigned long long)ullInPlace, (unsigned long long)ullDisplaced);
+            bSuccess = false;
+        }
+    }
+
+    munmap(pSlots, 0x1000);
+    munmap(pCode, 0x1000);
+    return bSuccess;
+}
+
+#endif
+
+}
+
+int main()
+{
+    bool bSuccess = Classification();
+    bSuccess = Relocation() && bSuccess;
+#if defined(__linux__) && defined(__x86_64__)
+    bSuccess = ConditionsAgainstCpu() && bSuccess;
+    bSuccess = DisplacedAgainstCpu() && bSuccess;
+#endif
+
+    fprintf(stderr, "%s\n", bSuccess ? "PASSED" : "FAILED");
+    return bSuccess ? 0 : 1;
+}